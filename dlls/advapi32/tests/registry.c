@@ -2307,6 +2307,70 @@ static void test_rw_order(void)
     ok(!RegDeleteKeyA(HKEY_CURRENT_USER, keyname), "Failed to delete key\n");
 }
 
+static void test_many_subkeys(void)
+{
+    HKEY key, subkey;
+    char name[16], buffer[16];
+    DWORD count, len;
+    LONG ret;
+    int i;
+
+    ret = RegCreateKeyA( hkey_main, "many_subkeys", &key );
+    ok( !ret, "RegCreateKeyA failed: %d\n", ret );
+
+    /* enough subkeys to switch to indexed lookups, created out of order */
+    for (i = 199; i >= 0; i--)
+    {
+        sprintf( name, "key%03d", i );
+        ret = RegCreateKeyA( key, name, &subkey );
+        ok( !ret, "RegCreateKeyA %s failed: %d\n", name, ret );
+        RegCloseKey( subkey );
+    }
+    ret = RegOpenKeyA( key, "KEY150", &subkey );
+    ok( !ret, "RegOpenKeyA failed: %d\n", ret );
+    RegCloseKey( subkey );
+
+    ret = RegQueryInfoKeyA( key, NULL, NULL, NULL, &count, NULL, NULL, NULL, NULL, NULL, NULL, NULL );
+    ok( !ret, "RegQueryInfoKeyA failed: %d\n", ret );
+    ok( count == 200, "got %u subkeys\n", count );
+
+    for (i = 0; i < 200; i++)
+    {
+        len = sizeof(buffer);
+        ret = RegEnumKeyExA( key, i, buffer, &len, NULL, NULL, NULL, NULL );
+        ok( !ret, "RegEnumKeyExA %d failed: %d\n", i, ret );
+        sprintf( name, "key%03d", i );
+        ok( !strcmp( buffer, name ), "%d: got %s\n", i, buffer );
+    }
+
+    for (i = 1; i < 200; i += 2)
+    {
+        sprintf( name, "key%03d", i );
+        ret = RegDeleteKeyA( key, name );
+        ok( !ret, "RegDeleteKeyA %s failed: %d\n", name, ret );
+    }
+    ret = RegOpenKeyA( key, "key151", &subkey );
+    ok( ret == ERROR_FILE_NOT_FOUND, "RegOpenKeyA returned %d\n", ret );
+    ret = RegOpenKeyA( key, "key150", &subkey );
+    ok( !ret, "RegOpenKeyA failed: %d\n", ret );
+    RegCloseKey( subkey );
+
+    for (i = 0; i < 100; i++)
+    {
+        len = sizeof(buffer);
+        ret = RegEnumKeyExA( key, i, buffer, &len, NULL, NULL, NULL, NULL );
+        ok( !ret, "RegEnumKeyExA %d failed: %d\n", i, ret );
+        sprintf( name, "key%03d", 2 * i );
+        ok( !strcmp( buffer, name ), "%d: got %s\n", i, buffer );
+    }
+    len = sizeof(buffer);
+    ret = RegEnumKeyExA( key, 100, buffer, &len, NULL, NULL, NULL, NULL );
+    ok( ret == ERROR_NO_MORE_ITEMS, "RegEnumKeyExA returned %d\n", ret );
+
+    delete_key( key );
+    RegCloseKey( key );
+}
+
 static void test_symlinks(void)
 {
     static const WCHAR targetW[] = {'\\','S','o','f','t','w','a','r','e','\\','W','i','n','e',
@@ -4162,6 +4226,7 @@ START_TEST(registry)
     test_reg_copy_tree();
     test_reg_delete_tree();
     test_rw_order();
+    test_many_subkeys();
     test_deleted_key();
     test_delete_value();
     test_delete_key_value();
@@ -39,6 +39,7 @@
 #define HEAP_VALIDATE_PARAMS  0x40000000
 
 static BOOL (WINAPI *pHeapQueryInformation)(HANDLE, HEAP_INFORMATION_CLASS, PVOID, SIZE_T, PSIZE_T);
+static BOOL (WINAPI *pHeapSetInformation)(HANDLE, HEAP_INFORMATION_CLASS, PVOID, SIZE_T);
 static BOOL (WINAPI *pGetPhysicallyInstalledSystemMemory)(ULONGLONG *);
 static ULONG (WINAPI *pRtlGetNtGlobalFlags)(void);
 
@@ -892,6 +893,132 @@ static void test_HeapQueryInformation(void)
     ok(info == 0 || info == 1 || info == 2, "expected 0, 1 or 2, got %u\n", info);
 }
 
+static BOOL check_block( const BYTE *ptr, SIZE_T size, BYTE value )
+{
+    SIZE_T i;
+
+    for (i = 0; i < size; i++) if (ptr[i] != value) return FALSE;
+    return TRUE;
+}
+
+static DWORD WINAPI lfh_thread( void *arg )
+{
+    HANDLE heap = arg;
+    BYTE *ptr[64];
+    unsigned int i, j;
+
+    memset( ptr, 0, sizeof(ptr) );
+    for (i = 0; i < 20000; i++)
+    {
+        j = (i * 7) % ARRAY_SIZE(ptr);
+        if (ptr[j])
+        {
+            ok( check_block( ptr[j], j * 9, j ), "block %p corrupted\n", ptr[j] );
+            ok( HeapFree( heap, 0, ptr[j] ), "HeapFree failed\n" );
+            ptr[j] = NULL;
+        }
+        else
+        {
+            ptr[j] = HeapAlloc( heap, 0, j * 9 );
+            ok( ptr[j] != NULL, "HeapAlloc failed\n" );
+            memset( ptr[j], j, j * 9 );
+        }
+    }
+    for (j = 0; j < ARRAY_SIZE(ptr); j++) HeapFree( heap, 0, ptr[j] );
+    return 0;
+}
+
+static void test_HeapSetInformation(void)
+{
+    PROCESS_HEAP_ENTRY entry;
+    HANDLE heap, threads[4];
+    BYTE *ptr[300], *p;
+    unsigned int i, count;
+    SIZE_T size;
+    ULONG info;
+    BOOL ret;
+
+    pHeapSetInformation = (void *)GetProcAddress(GetModuleHandleA("kernel32.dll"), "HeapSetInformation");
+    if (!pHeapSetInformation || !pHeapQueryInformation)
+    {
+        win_skip("HeapSetInformation is not available\n");
+        return;
+    }
+
+    heap = HeapCreate( HEAP_NO_SERIALIZE, 0, 0 );
+    ok( heap != NULL, "HeapCreate failed\n" );
+    info = 2;
+    ret = pHeapSetInformation( heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    ok( !ret, "HeapSetInformation succeeded\n" );
+    HeapDestroy( heap );
+
+    heap = HeapCreate( 0, 0x10000, 0x10000 );
+    ok( heap != NULL, "HeapCreate failed\n" );
+    info = 2;
+    ret = pHeapSetInformation( heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    ok( !ret, "HeapSetInformation succeeded on a fixed size heap\n" );
+    HeapDestroy( heap );
+
+    heap = HeapCreate( 0, 0, 0 );
+    ok( heap != NULL, "HeapCreate failed\n" );
+    info = 2;
+    ret = pHeapSetInformation( heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    ok( ret, "HeapSetInformation error %u\n", GetLastError() );
+    info = 0xdeadbeef;
+    ret = pHeapQueryInformation( heap, HeapCompatibilityInformation, &info, sizeof(info), NULL );
+    ok( ret, "HeapQueryInformation error %u\n", GetLastError() );
+    ok( info == 2, "expected 2, got %u\n", info );
+
+    for (i = 0; i < ARRAY_SIZE(ptr); i++)
+    {
+        size = i * 15;
+        ptr[i] = HeapAlloc( heap, HEAP_ZERO_MEMORY, size );
+        ok( ptr[i] != NULL, "%u: HeapAlloc failed\n", i );
+        ok( check_block( ptr[i], size, 0 ), "%u: block not zeroed\n", i );
+        ok( HeapSize( heap, 0, ptr[i] ) == size, "%u: wrong size %lu\n", i, HeapSize( heap, 0, ptr[i] ));
+        ok( HeapValidate( heap, 0, ptr[i] ), "%u: HeapValidate failed\n", i );
+        memset( ptr[i], i, size );
+    }
+    ok( HeapValidate( heap, 0, NULL ), "HeapValidate failed\n" );
+
+    for (i = 0; i < ARRAY_SIZE(ptr); i += 2)
+        ok( HeapFree( heap, 0, ptr[i] ), "%u: HeapFree failed\n", i );
+    for (i = 1; i < ARRAY_SIZE(ptr); i += 2)
+    {
+        p = HeapReAlloc( heap, HEAP_REALLOC_IN_PLACE_ONLY, ptr[i], i * 15 - 1 );
+        ok( p == ptr[i], "%u: HeapReAlloc failed\n", i );
+        ok( HeapSize( heap, 0, p ) == i * 15 - 1, "%u: wrong size %lu\n", i, HeapSize( heap, 0, p ));
+
+        p = HeapReAlloc( heap, HEAP_ZERO_MEMORY, ptr[i], i * 30 );
+        ok( p != NULL, "%u: HeapReAlloc failed\n", i );
+        ok( check_block( p, i * 15 - 1, i ), "%u: contents not preserved\n", i );
+        ok( check_block( p + i * 15 - 1, i * 15 + 1, 0 ), "%u: block not zeroed\n", i );
+        ok( HeapSize( heap, 0, p ) == i * 30, "%u: wrong size %lu\n", i, HeapSize( heap, 0, p ));
+        ptr[i] = p;
+    }
+    ok( HeapValidate( heap, 0, NULL ), "HeapValidate failed\n" );
+
+    memset( &entry, 0, sizeof(entry) );
+    count = 0;
+    while (HeapWalk( heap, &entry )) count++;
+    ok( GetLastError() == ERROR_NO_MORE_ITEMS, "HeapWalk failed with error %u\n", GetLastError() );
+    ok( count > 0, "no heap entries\n" );
+
+    for (i = 1; i < ARRAY_SIZE(ptr); i += 2)
+        ok( HeapFree( heap, 0, ptr[i] ), "%u: HeapFree failed\n", i );
+
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+        threads[i] = CreateThread( NULL, 0, lfh_thread, heap, 0, NULL );
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        ok( !WaitForSingleObject( threads[i], 30000 ), "thread didn't exit\n" );
+        CloseHandle( threads[i] );
+    }
+    ok( HeapValidate( heap, 0, NULL ), "HeapValidate failed\n" );
+
+    HeapDestroy( heap );
+}
+
 static void test_heap_checks( DWORD flags )
 {
     BYTE old, *p, *p2;
@@ -1245,6 +1372,7 @@ START_TEST(heap)
     test_sized_HeapReAlloc((1 << 20), 1);
 
     test_HeapQueryInformation();
+    test_HeapSetInformation();
     test_GetPhysicallyInstalledSystemMemory();
 
     if (pRtlGetNtGlobalFlags)
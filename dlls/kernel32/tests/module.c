@@ -684,6 +684,27 @@ static void test_LoadLibraryEx_search_flags(void)
         for (k = 0; tests[j].add_dirs[k]; k++) pRemoveDllDirectory( cookies[k] );
     }
 
+    /* a dll created after a failed search has to be found */
+    pSetDllDirectoryA( NULL );
+    sprintf( p, "\\6" );
+    MultiByteToWideChar( CP_ACP, 0, buf, -1, bufW, MAX_PATH );
+    cookies[0] = pAddDllDirectory( bufW );
+    ok( cookies[0] != NULL, "failed to add %s\n", buf );
+
+    SetLastError( 0xdeadbeef );
+    mod = LoadLibraryExA( "winetestdll.dll", 0, LOAD_LIBRARY_SEARCH_USER_DIRS );
+    ok( !mod, "LoadLibrary succeeded\n" );
+    ok( GetLastError() == ERROR_MOD_NOT_FOUND || broken(GetLastError() == ERROR_NOT_ENOUGH_MEMORY),
+        "wrong error %u\n", GetLastError() );
+
+    sprintf( p, "\\6\\winetestdll.dll" );
+    create_test_dll( buf );
+    SetLastError( 0xdeadbeef );
+    mod = LoadLibraryExA( "winetestdll.dll", 0, LOAD_LIBRARY_SEARCH_USER_DIRS );
+    ok( mod != NULL, "LoadLibrary failed err %u\n", GetLastError() );
+    FreeLibrary( mod );
+    pRemoveDllDirectory( cookies[0] );
+
 done:
     for (i = 1; i <= 6; i++)
     {
@@ -867,8 +867,13 @@ int CDECL MSVCRT_strncpy_s(char *dest, MSVCRT_size_t numberOfElements,
 
 BOOL msvcrt_init_heap(void)
 {
+    ULONG lfh = 2;
+
     heap = HeapCreate(0, 0, 0);
-    return heap != NULL;
+    if (!heap) return FALSE;
+    /* like on Windows, use the low-fragmentation heap when possible */
+    HeapSetInformation(heap, HeapCompatibilityInformation, &lfh, sizeof(lfh));
+    return TRUE;
 }
 
 void msvcrt_destroy_heap(void)
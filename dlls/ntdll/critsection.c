@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #ifdef HAVE_SYS_SYSCALL_H
 #include <sys/syscall.h>
@@ -61,6 +62,29 @@ static inline void small_pause(void)
 
 static void *no_debug_info_marker = (void *)(ULONG_PTR)-1;
 
+/* the low bits of SpinCount hold the count, the high ones the RTL_CRITICAL_SECTION_FLAG_ flags */
+#define CRIT_SPIN_MASK          0x00ffffff
+/* maximum number of spins of critical sections with a dynamic spin count */
+#define CRIT_MAX_ADAPTIVE_SPIN  1000
+
+static BOOL adaptive_spin;  /* critical sections without a spin count use a dynamic one */
+
+/* contention statistics of a critical section; these are kept out of the
+ * critical section so that they can be reported once it has been deleted */
+struct crit_stats
+{
+    RTL_CRITICAL_SECTION *crit;       /* critical section, or deleted_crit */
+    ULONG                 entries;    /* number of entries that found the section busy */
+    ULONG                 waits;      /* number of entries that had to wait */
+    ULONGLONG             wait_time;  /* total time spent waiting */
+    char                  name[64];   /* name of the section */
+};
+
+#define CRIT_STATS_SIZE 4096  /* must be a power of 2 */
+
+static struct crit_stats *crit_stats;  /* statistics table, NULL if disabled */
+static RTL_CRITICAL_SECTION * const deleted_crit = (RTL_CRITICAL_SECTION *)1;
+
 static BOOL crit_section_has_debuginfo(const RTL_CRITICAL_SECTION *crit)
 {
     return crit->DebugInfo != NULL && crit->DebugInfo != no_debug_info_marker;
@@ -247,6 +271,125 @@ static inline NTSTATUS wait_semaphore( RTL_CRITICAL_SECTION *crit, int timeout )
     return ret;
 }
 
+/* find the statistics entry of a critical section, creating it if needed */
+static struct crit_stats *get_crit_stats( RTL_CRITICAL_SECTION *crit, BOOL create )
+{
+    unsigned int i, hash = ((ULONG_PTR)crit >> 4) * 2654435761u;
+
+    for (i = 0; i < CRIT_STATS_SIZE; i++)
+    {
+        struct crit_stats *stats = &crit_stats[(hash + i) & (CRIT_STATS_SIZE - 1)];
+        RTL_CRITICAL_SECTION *prev = stats->crit;
+
+        if (prev == crit) return stats;
+        if (prev) continue;
+        if (!create) return NULL;
+        if (!(prev = interlocked_cmpxchg_ptr( (void **)&stats->crit, crit, NULL )))
+        {
+            const char *name = NULL;
+            if (crit_section_has_debuginfo( crit )) name = (const char *)crit->DebugInfo->Spare[0];
+            if (name) snprintf( stats->name, sizeof(stats->name), "%s", name );
+            return stats;
+        }
+        if (prev == crit) return stats;
+    }
+    return NULL;  /* table is full */
+}
+
+/* record a contended entry into a critical section, called once it has been acquired */
+static void record_contention( RTL_CRITICAL_SECTION *crit, BOOL waited, ULONGLONG wait_time )
+{
+    struct crit_stats *stats;
+
+    if (crit_section_has_debuginfo( crit )) crit->DebugInfo->EntryCount++;
+    if (!crit_stats || !(stats = get_crit_stats( crit, TRUE ))) return;
+    stats->entries++;
+    if (!waited) return;
+    stats->waits++;
+    stats->wait_time += wait_time;
+}
+
+/* spin on a busy critical section with a dynamic spin count, adjusting it to how
+ * long the section is usually held; returns TRUE if the section has been acquired */
+static BOOL spin_adaptive( RTL_CRITICAL_SECTION *crit, ULONG_PTR spincount )
+{
+    LONG spin = spincount & CRIT_SPIN_MASK;
+    LONG count, max = min( spin * 2 + 10, CRIT_MAX_ADAPTIVE_SPIN );
+    BOOL ret = FALSE;
+
+    for (count = 0; count < max; count++)
+    {
+        if (crit->LockCount > 0) break;  /* more than one waiter, don't bother spinning */
+        if (crit->LockCount == -1 && interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1)
+        {
+            ret = TRUE;
+            break;
+        }
+        small_pause();
+    }
+
+    /* if spinning didn't help, the owner is most likely waiting or not running,
+     * so spin less next time; otherwise get closer to the observed hold time */
+    if (!ret) count = 0;
+    spin += (count - spin) / 8;
+    crit->SpinCount = spin | (spincount & ~CRIT_SPIN_MASK) | RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN;
+    return ret;
+}
+
+static int crit_stats_compare( const void *a, const void *b )
+{
+    const struct crit_stats *stats1 = a, *stats2 = b;
+
+    if (stats1->wait_time != stats2->wait_time) return stats1->wait_time < stats2->wait_time ? 1 : -1;
+    if (stats1->entries != stats2->entries) return stats1->entries < stats2->entries ? 1 : -1;
+    return 0;
+}
+
+/***********************************************************************
+ *           critsection_init
+ */
+void critsection_init(void)
+{
+    const char *env;
+    SIZE_T size = CRIT_STATS_SIZE * sizeof(*crit_stats);
+    void *ptr = NULL;
+
+    if ((env = getenv( "WINECRITSPIN" )) && atoi( env ) && NtCurrentTeb()->Peb->NumberOfProcessors > 1)
+        adaptive_spin = TRUE;
+
+    if (!(env = getenv( "WINECRITSTATS" )) || !atoi( env )) return;
+    if (!NtAllocateVirtualMemory( NtCurrentProcess(), &ptr, 0, &size, MEM_COMMIT, PAGE_READWRITE ))
+        crit_stats = ptr;
+}
+
+/***********************************************************************
+ *           critsection_dump_stats
+ *
+ * Print the contention statistics of the critical sections, most waited for first.
+ */
+void critsection_dump_stats(void)
+{
+    struct crit_stats *stats = crit_stats;
+    unsigned int i, count;
+
+    if (!stats) return;
+    crit_stats = NULL;
+
+    for (i = count = 0; i < CRIT_STATS_SIZE; i++)
+        if (stats[i].crit) stats[count++] = stats[i];
+    if (!count) return;
+    qsort( stats, count, sizeof(*stats), crit_stats_compare );
+
+    MESSAGE( "wine: critical section contention in process %04x:\n", GetCurrentProcessId() );
+    MESSAGE( "  %-*s %-48s %10s %10s %12s\n", (int)sizeof(void *) * 2, "section", "name",
+             "entries", "waits", "wait (ms)" );
+    for (i = 0; i < count; i++)
+        MESSAGE( "  %p %-48s %10u %10u %12u\n",
+                 stats[i].crit == deleted_crit ? NULL : stats[i].crit,
+                 stats[i].name[0] ? stats[i].name : "?", stats[i].entries, stats[i].waits,
+                 (ULONG)(stats[i].wait_time / 10000) );
+}
+
 /***********************************************************************
  *           RtlInitializeCriticalSection   (NTDLL.@)
  *
@@ -318,7 +461,7 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionAndSpinCount( RTL_CRITICAL_SECTION *
  */
 NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULONG spincount, ULONG flags )
 {
-    if (flags & (RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN|RTL_CRITICAL_SECTION_FLAG_STATIC_INIT))
+    if (flags & RTL_CRITICAL_SECTION_FLAG_STATIC_INIT)
         FIXME("(%p,%u,0x%08x) semi-stub\n", crit, spincount, flags);
 
     /* FIXME: if RTL_CRITICAL_SECTION_FLAG_STATIC_INIT is given, we should use
@@ -348,8 +491,12 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULON
     crit->RecursionCount = 0;
     crit->OwningThread   = 0;
     crit->LockSemaphore  = 0;
-    if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) spincount = 0;
-    crit->SpinCount = spincount & ~0x80000000;
+    if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) crit->SpinCount = 0;
+    else if (flags & RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN)
+        crit->SpinCount = min( spincount & CRIT_SPIN_MASK, CRIT_MAX_ADAPTIVE_SPIN ) |
+                          RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN;
+    else
+        crit->SpinCount = spincount & ~0x80000000;
     return STATUS_SUCCESS;
 }
 
@@ -377,6 +524,7 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULON
 ULONG WINAPI RtlSetCriticalSectionSpinCount( RTL_CRITICAL_SECTION *crit, ULONG spincount )
 {
     ULONG oldspincount = crit->SpinCount;
+    if (oldspincount & RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN) oldspincount &= CRIT_SPIN_MASK;
     if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) spincount = 0;
     crit->SpinCount = spincount;
     return oldspincount;
@@ -401,6 +549,9 @@ ULONG WINAPI RtlSetCriticalSectionSpinCount( RTL_CRITICAL_SECTION *crit, ULONG s
  */
 NTSTATUS WINAPI RtlDeleteCriticalSection( RTL_CRITICAL_SECTION *crit )
 {
+    struct crit_stats *stats;
+
+    if (crit_stats && (stats = get_crit_stats( crit, FALSE ))) stats->crit = deleted_crit;
     crit->LockCount      = -1;
     crit->RecursionCount = 0;
     crit->OwningThread   = 0;
@@ -555,12 +706,22 @@ NTSTATUS WINAPI RtlpUnWaitCriticalSection( RTL_CRITICAL_SECTION *crit )
  */
 NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
 {
-    if (crit->SpinCount)
+    ULONG_PTR spincount = crit->SpinCount;
+    LARGE_INTEGER start, end;
+    BOOL contended = FALSE;
+
+    if (!spincount && adaptive_spin) spincount = RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN;
+    if (spincount)
     {
         ULONG count;
 
         if (RtlTryEnterCriticalSection( crit )) return STATUS_SUCCESS;
-        for (count = crit->SpinCount; count > 0; count--)
+        contended = TRUE;
+        if (spincount & RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN)
+        {
+            if (spin_adaptive( crit, spincount )) goto done;
+        }
+        else for (count = spincount; count > 0; count--)
         {
             if (crit->LockCount > 0) break;  /* more than one waiter, don't bother spinning */
             if (crit->LockCount == -1)       /* try again */
@@ -580,11 +741,19 @@ NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
         }
 
         /* Now wait for it */
+        start.QuadPart = end.QuadPart = 0;
+        if (crit_stats) RtlQueryPerformanceCounter( &start );
         RtlpWaitForCriticalSection( crit );
+        if (start.QuadPart) RtlQueryPerformanceCounter( &end );
+        crit->OwningThread   = ULongToHandle(GetCurrentThreadId());
+        crit->RecursionCount = 1;
+        record_contention( crit, TRUE, end.QuadPart - start.QuadPart );
+        return STATUS_SUCCESS;
     }
 done:
     crit->OwningThread   = ULongToHandle(GetCurrentThreadId());
     crit->RecursionCount = 1;
+    if (contended) record_contention( crit, FALSE, 0 );
     return STATUS_SUCCESS;
 }
 
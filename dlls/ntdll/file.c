@@ -584,6 +584,22 @@ static NTSTATUS FILE_AsyncReadService( void *user, IO_STATUS_BLOCK *iosb, NTSTAT
     return status;
 }
 
+/***********************************************************************
+ *           drop_pipe_socket
+ *
+ * The server shuts down the socket of a pipe end when its connection is over.
+ * Remove such a socket from the fd cache, so that the caller can get the
+ * current fd of the pipe end. Returns FALSE if the socket wasn't cached.
+ */
+static BOOL drop_pipe_socket( HANDLE handle, int needs_close )
+{
+    int fd;
+
+    if (needs_close || (fd = server_remove_fd_from_cache( handle )) == -1) return FALSE;
+    close( fd );
+    return TRUE;
+}
+
 /* do a read call through the server */
 static NTSTATUS server_read_file( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_context,
                                   IO_STATUS_BLOCK *io, void *buffer, ULONG size,
@@ -780,6 +796,7 @@ static NTSTATUS get_io_avail_mode( HANDLE handle, enum server_fd_type type, BOOL
         break;
     case FD_TYPE_MAILSLOT:
     case FD_TYPE_SOCKET:
+    case FD_TYPE_PIPE:
     case FD_TYPE_CHAR:
         *avail_mode = TRUE;
         break;
@@ -855,13 +872,14 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
     ULONG total = 0;
     enum server_fd_type type;
     ULONG_PTR cvalue = apc ? 0 : (ULONG_PTR)apc_user;
-    BOOL send_completion = FALSE, async_read, timeout_init_done = FALSE;
+    BOOL send_completion = FALSE, async_read, timeout_init_done = FALSE, retried = FALSE;
 
     TRACE("(%p,%p,%p,%p,%p,%p,0x%08x,%p,%p)\n",
           hFile,hEvent,apc,apc_user,io_status,buffer,length,offset,key);
 
     if (!io_status) return STATUS_ACCESS_VIOLATION;
 
+retry:
     status = server_get_unix_fd( hFile, FILE_READ_DATA, &unix_handle,
                                  &needs_close, &type, &options );
     if (status && status != STATUS_BAD_DEVICE_TYPE) return status;
@@ -883,6 +901,14 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
 
         if (offset && offset->QuadPart != FILE_USE_FILE_POINTER_POSITION)
         {
+            if (async_read && !apc && length && (hEvent || cvalue) &&
+                uring_submit_rw( hFile, unix_handle, FALSE, hEvent, cvalue, io_status,
+                                 buffer, length, offset->QuadPart ) == STATUS_PENDING)
+            {
+                if (needs_close) close( unix_handle );
+                return STATUS_PENDING;
+            }
+
             /* async I/O doesn't make sense on regular files */
             while ((result = virtual_locked_pread( unix_handle, buffer, length, offset->QuadPart )) == -1)
             {
@@ -950,12 +976,31 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
                         goto done;
                     }
                     break;
+                case FD_TYPE_PIPE:
+                    if (!length)
+                    {
+                        status = STATUS_SUCCESS;
+                        goto done;
+                    }
+                    /* the connection may be over, try again with the current fd of the pipe */
+                    if (!retried && drop_pipe_socket( hFile, needs_close ))
+                    {
+                        retried = TRUE;
+                        goto retry;
+                    }
+                    status = STATUS_PIPE_BROKEN;
+                    goto err;
                 default:
                     status = STATUS_PIPE_BROKEN;
                     goto err;
                 }
             }
             else if (type == FD_TYPE_FILE) continue;  /* no async I/O on regular files */
+            else if (type == FD_TYPE_PIPE)  /* byte mode pipes return the data available so far */
+            {
+                status = STATUS_SUCCESS;
+                goto done;
+            }
         }
         else if (errno != EAGAIN)
         {
@@ -1151,6 +1196,7 @@ static NTSTATUS FILE_AsyncWriteService( void *user, IO_STATUS_BLOCK *iosb, NTSTA
         if (result < 0)
         {
             if (errno == EAGAIN || errno == EINTR) status = STATUS_PENDING;
+            else if (errno == EPIPE && type == FD_TYPE_PIPE) status = STATUS_PIPE_CLOSING;
             else status = FILE_GetNtStatus();
         }
         else
@@ -1224,6 +1270,7 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
     enum server_fd_type type;
     ULONG_PTR cvalue = apc ? 0 : (ULONG_PTR)apc_user;
     BOOL send_completion = FALSE, async_write, append_write = FALSE, timeout_init_done = FALSE;
+    BOOL retried = FALSE;
     LARGE_INTEGER offset_eof;
 
     TRACE("(%p,%p,%p,%p,%p,%p,0x%08x,%p,%p)\n",
@@ -1231,6 +1278,7 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
 
     if (!io_status) return STATUS_ACCESS_VIOLATION;
 
+retry:
     status = server_get_unix_fd( hFile, FILE_WRITE_DATA, &unix_handle,
                                  &needs_close, &type, &options );
     if (status == STATUS_ACCESS_DENIED)
@@ -1288,6 +1336,14 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
                 goto done;
             }
 
+            if (async_write && !apc && length && (hEvent || cvalue) &&
+                uring_submit_rw( hFile, unix_handle, TRUE, hEvent, cvalue, io_status,
+                                 (void *)buffer, length, off ) == STATUS_PENDING)
+            {
+                if (needs_close) close( unix_handle );
+                return STATUS_PENDING;
+            }
+
             /* async I/O doesn't make sense on regular files */
             while ((result = pwrite( unix_handle, buffer, length, off )) == -1)
             {
@@ -1341,7 +1397,16 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
             if (errno == EINTR) continue;
             if (!total)
             {
+                if (errno == EPIPE && type == FD_TYPE_PIPE && !retried &&
+                    drop_pipe_socket( hFile, needs_close ))
+                {
+                    /* the connection may be over, try again with the current fd of the pipe */
+                    retried = TRUE;
+                    goto retry;
+                }
                 if (errno == EFAULT) status = STATUS_INVALID_USER_BUFFER;
+                /* the other end closed the socket without disconnecting the pipe */
+                else if (errno == EPIPE && type == FD_TYPE_PIPE) status = STATUS_PIPE_CLOSING;
                 else status = FILE_GetNtStatus();
             }
             goto err;
@@ -2447,6 +2512,7 @@ NTSTATUS WINAPI NtQueryInformationFile( HANDLE hFile, PIO_STATUS_BLOCK io,
     int fd, needs_close = FALSE;
     ULONG attr;
     unsigned int options;
+    enum server_fd_type type;
 
     TRACE("(%p,%p,%p,0x%08x,0x%08x)\n", hFile, io, ptr, len, class);
 
@@ -2459,11 +2525,16 @@ NTSTATUS WINAPI NtQueryInformationFile( HANDLE hFile, PIO_STATUS_BLOCK io,
     if (len < info_sizes[class])
         return io->u.Status = STATUS_INFO_LENGTH_MISMATCH;
 
-    if ((io->u.Status = server_get_unix_fd( hFile, 0, &fd, &needs_close, NULL, &options )))
+    if ((io->u.Status = server_get_unix_fd( hFile, 0, &fd, &needs_close, &type, &options )))
     {
         if (io->u.Status != STATUS_BAD_DEVICE_TYPE) return io->u.Status;
         return server_get_file_info( hFile, io, ptr, len, class );
     }
+    if (type == FD_TYPE_PIPE)  /* the pipe state is kept in the server */
+    {
+        if (needs_close) close( fd );
+        return server_get_file_info( hFile, io, ptr, len, class );
+    }
 
     switch (class)
     {
@@ -3268,8 +3339,14 @@ NTSTATUS WINAPI NtQueryVolumeInformationFile( HANDLE handle, PIO_STATUS_BLOCK io
 {
     int fd, needs_close;
     struct stat st;
+    enum server_fd_type type;
 
-    io->u.Status = server_get_unix_fd( handle, 0, &fd, &needs_close, NULL, NULL );
+    io->u.Status = server_get_unix_fd( handle, 0, &fd, &needs_close, &type, NULL );
+    if (!io->u.Status && type == FD_TYPE_PIPE)  /* pipe volumes are handled by the server */
+    {
+        if (needs_close) close( fd );
+        io->u.Status = STATUS_BAD_DEVICE_TYPE;
+    }
     if (io->u.Status == STATUS_BAD_DEVICE_TYPE)
     {
         SERVER_START_REQ( get_volume_info )
@@ -3719,6 +3796,19 @@ NTSTATUS WINAPI NtUnlockFile( HANDLE hFile, PIO_STATUS_BLOCK io_status,
     return status;
 }
 
+/* check if the pipes created by this process should use sockets for their connections */
+static BOOL use_pipe_sockets(void)
+{
+    static int enabled = -1;
+
+    if (enabled == -1)
+    {
+        const char *env = getenv( "WINEPIPESOCKETS" );
+        enabled = env && atoi( env );
+    }
+    return enabled;
+}
+
 /******************************************************************
  *		NtCreateNamedPipeFile    (NTDLL.@)
  *
@@ -3757,7 +3847,8 @@ NTSTATUS WINAPI NtCreateNamedPipeFile( PHANDLE handle, ULONG access,
         req->flags = 
             (pipe_type ? NAMED_PIPE_MESSAGE_STREAM_WRITE   : 0) |
             (read_mode ? NAMED_PIPE_MESSAGE_STREAM_READ    : 0) |
-            (completion_mode ? NAMED_PIPE_NONBLOCKING_MODE : 0);
+            (completion_mode ? NAMED_PIPE_NONBLOCKING_MODE : 0) |
+            (use_pipe_sockets() ? NAMED_PIPE_USE_SOCKETS : 0);
         req->maxinstances = max_inst;
         req->outsize = outbound_quota;
         req->insize  = inbound_quota;
@@ -75,6 +75,13 @@ typedef struct
     DWORD                 magic;      /* these must remain at the end of the structure */
 } ARENA_LARGE;
 
+typedef struct
+{
+    DWORD  offset;                  /* Offset from the start of the group; must be the first field */
+    DWORD  magic : 24;              /* Magic number */
+    DWORD  unused_bytes : 8;        /* Number of bytes in the block not used by user data */
+} ARENA_LFH;
+
 #define ARENA_FLAG_FREE        0x00000001  /* flags OR'ed with arena size */
 #define ARENA_FLAG_PREV_FREE   0x00000002
 #define ARENA_SIZE_MASK        (~3)
@@ -85,6 +92,8 @@ typedef struct
 #define ARENA_PENDING_MAGIC    0xbedead
 #define ARENA_FREE_MAGIC       0x45455246
 #define ARENA_LARGE_MAGIC      0x6752614c
+#define ARENA_LFH_MAGIC        0x48464c
+#define ARENA_LFH_FREE_MAGIC   0x46464c
 
 #define ARENA_INUSE_FILLER     0x55
 #define ARENA_TAIL_FILLER      0xab
@@ -96,6 +105,7 @@ typedef struct
 #define ARENA_OFFSET           (ALIGNMENT - sizeof(ARENA_INUSE))
 
 C_ASSERT( sizeof(ARENA_LARGE) % LARGE_ALIGNMENT == 0 );
+C_ASSERT( sizeof(ARENA_LFH) == sizeof(ARENA_INUSE) );
 
 #define ROUND_SIZE(size)       ((((size) + ALIGNMENT - 1) & ~(ALIGNMENT-1)) + ARENA_OFFSET)
 
@@ -133,6 +143,7 @@ typedef union
 } FREE_LIST_ENTRY;
 
 struct tagHEAP;
+struct lfh;
 
 typedef struct tagSUBHEAP
 {
@@ -164,6 +175,7 @@ typedef struct tagHEAP
     ARENA_INUSE    **pending_free;  /* Ring buffer for pending free requests */
     RTL_CRITICAL_SECTION critSection; /* Critical section for serialization */
     FREE_LIST_ENTRY *freeList;      /* Free lists */
+    struct lfh      *lfh;           /* Low-fragmentation heap, if enabled */
 } HEAP;
 
 #define HEAP_MAGIC       ((DWORD)('H' | ('E'<<8) | ('A'<<16) | ('P'<<24)))
@@ -178,9 +190,88 @@ typedef struct tagHEAP
 #define HEAP_VALIDATE_ALL     0x20000000
 #define HEAP_VALIDATE_PARAMS  0x40000000
 
+/*
+ * Low-fragmentation heap
+ *
+ * Once enabled with RtlSetHeapInformation, small blocks are allocated from
+ * groups of blocks of the same size class. Each size class (bin) keeps a
+ * group per thread slot, which the allocating thread takes ownership of with
+ * an atomic exchange, so that allocations and frees usually don't need the
+ * heap lock. The heap lock is only taken to get a new group, or to put a
+ * group back in the bin list.
+ *
+ * The groups are allocated in fixed size slots of a region reserved for the
+ * LFH, so that the blocks can be told apart from standard ones without taking
+ * the heap lock, and the header of a group is found from the address of any
+ * of its blocks. The region is never moved, and the first page of a slot
+ * stays committed once it has been used.
+ *
+ * The free blocks of a group are tracked in a bitmap that other threads can
+ * only set bits in. A full group isn't referenced anywhere, it's marked as
+ * detached and the first thread freeing a block in it takes it back, either
+ * in its own thread slot if it's free, or in the bin list. Empty groups in
+ * the bin list are periodically decommitted and their slots reused, except
+ * for one of them. When the region is full, blocks come from the standard heap.
+ */
+
+#define LFH_MAX_SIZE          0x1000      /* largest block size handled by the LFH */
+#define LFH_NB_BINS           (0x100 / ALIGNMENT + 0x300 / 0x40 + 0xc00 / 0x80)
+#define LFH_AFFINITY_SLOTS    32          /* number of thread slots in each bin */
+#define LFH_GROUP_SIZE        0x4000      /* target size of a group of blocks */
+#define LFH_MIN_GROUP_BLOCKS  4
+#define LFH_MAX_GROUP_BLOCKS  31
+#define LFH_GROUP_DETACHED    0x80000000  /* free_bits flag for full groups */
+#define LFH_SLOT_SIZE         0x5000      /* space reserved for each group */
+#ifdef _WIN64
+#define LFH_REGION_SIZE       0x10000000  /* space reserved for the groups of a heap */
+#else
+#define LFH_REGION_SIZE       0x1000000
+#endif
+
+struct lfh_group
+{
+    struct list      entry;        /* entry in the bin list */
+    struct tagHEAP  *heap;         /* heap owning the group */
+    LONG             free_bits;    /* bitmap of the free blocks */
+    DWORD            bin;          /* index of the bin of the group */
+    DWORD            magic;        /* magic number */
+};
+
+#define LFH_GROUP_MAGIC       ((DWORD)('L' | ('F'<<8) | ('H'<<16) | ('G'<<24)))
+#define LFH_GROUP_HEADER_SIZE ROUND_SIZE( sizeof(struct lfh_group) )
+
+C_ASSERT( LFH_GROUP_HEADER_SIZE + LFH_MIN_GROUP_BLOCKS * (sizeof(ARENA_LFH) + ROUND_SIZE( LFH_MAX_SIZE )) <= LFH_SLOT_SIZE );
+C_ASSERT( LFH_GROUP_HEADER_SIZE + LFH_GROUP_SIZE <= LFH_SLOT_SIZE );
+
+struct lfh_bin
+{
+    struct list       groups;      /* groups with free blocks not owned by any thread */
+    unsigned int      nb_groups;   /* number of groups in the list */
+    LONG              nb_empty;    /* number of groups that became empty since the last cleanup */
+    struct lfh_group *affinity[LFH_AFFINITY_SLOTS];  /* groups owned by each thread slot */
+};
+
+struct lfh
+{
+    char             *base;        /* region reserved for the groups */
+    SIZE_T            used;        /* size of the slots used so far in the region */
+    struct list       free_slots;  /* slots of the groups that have been released */
+    struct lfh_bin    bins[LFH_NB_BINS];
+};
+
 static HEAP *processHeap;  /* main process heap */
 
 static BOOL HEAP_IsRealArena( HEAP *heapPtr, DWORD flags, LPCVOID block, BOOL quiet );
+static struct lfh_group *lfh_get_block_group( const HEAP *heap, const ARENA_LFH *arena,
+                                              unsigned int *index );
+
+/* check whether a pointer belongs to the LFH; the region doesn't move, so this doesn't need the heap lock */
+static inline BOOL is_lfh_block( const HEAP *heap, const void *ptr )
+{
+    const struct lfh *lfh = heap->lfh;
+
+    return lfh && (const char *)ptr > lfh->base && (const char *)ptr < lfh->base + lfh->used;
+}
 
 /* mark a block of memory as free for debugging purposes */
 static inline void mark_block_free( void *ptr, SIZE_T size, DWORD flags )
@@ -924,6 +1015,7 @@ static SUBHEAP *HEAP_CreateSubHeap( HEAP *heap, LPVOID address, DWORD flags,
         heap->flags         = flags;
         heap->magic         = HEAP_MAGIC;
         heap->grow_size     = max( HEAP_DEF_SIZE, totalSize );
+        heap->lfh           = NULL;
         list_init( &heap->subheap_list );
         list_init( &heap->large_list );
 
@@ -1344,8 +1436,13 @@ static BOOL HEAP_IsRealArena( HEAP *heapPtr,   /* [in] ptr to the heap */
     {
         const ARENA_INUSE *arena = (const ARENA_INUSE *)block - 1;
 
-        if (!(subheap = HEAP_FindSubHeap( heapPtr, arena )) ||
-            ((const char *)arena < (char *)subheap->base + subheap->headerSize))
+        if (is_lfh_block( heapPtr, block ))
+        {
+            unsigned int index;
+            ret = lfh_get_block_group( heapPtr, (const ARENA_LFH *)arena, &index ) != NULL;
+        }
+        else if (!(subheap = HEAP_FindSubHeap( heapPtr, arena )) ||
+                 ((const char *)arena < (char *)subheap->base + subheap->headerSize))
         {
             if (!(large_arena = find_large_block( heapPtr, block )))
             {
@@ -1437,6 +1534,390 @@ static BOOL validate_block_pointer( HEAP *heap, SUBHEAP **ret_subheap, const ARE
 }
 
 
+/***********************************************************************
+ *           allocate_block
+ *
+ * Allocate a block from the free lists. The heap must be locked.
+ */
+static ARENA_INUSE *allocate_block( HEAP *heap, SIZE_T rounded_size, SIZE_T size )
+{
+    ARENA_FREE *pArena;
+    ARENA_INUSE *pInUse;
+    SUBHEAP *subheap;
+
+    /* Locate a suitable free block */
+
+    if (!(pArena = HEAP_FindFreeBlock( heap, rounded_size, &subheap ))) return NULL;
+
+    /* Remove the arena from the free list */
+
+    list_remove( &pArena->entry );
+
+    /* Build the in-use arena */
+
+    pInUse = (ARENA_INUSE *)pArena;
+
+    /* in-use arena is smaller than free arena,
+     * so we have to add the difference to the size */
+    pInUse->size  = (pInUse->size & ~ARENA_FLAG_FREE) + sizeof(ARENA_FREE) - sizeof(ARENA_INUSE);
+    pInUse->magic = ARENA_INUSE_MAGIC;
+
+    /* Shrink the block */
+
+    HEAP_ShrinkBlock( subheap, pInUse, rounded_size );
+    pInUse->unused_bytes = (pInUse->size & ARENA_SIZE_MASK) - size;
+    return pInUse;
+}
+
+
+/* get the LFH bin index for a block size */
+static inline unsigned int lfh_get_bin( SIZE_T size )
+{
+    if (size <= 0x100) return size ? (size - 1) / ALIGNMENT : 0;
+    if (size <= 0x400) return 0x100 / ALIGNMENT + (size - 0x101) / 0x40;
+    return 0x100 / ALIGNMENT + 0x300 / 0x40 + (size - 0x401) / 0x80;
+}
+
+/* get the largest block size of an LFH bin */
+static inline SIZE_T lfh_get_bin_size( unsigned int bin )
+{
+    if (bin < 0x100 / ALIGNMENT) return (bin + 1) * ALIGNMENT;
+    bin -= 0x100 / ALIGNMENT;
+    if (bin < 0x300 / 0x40) return 0x100 + (bin + 1) * 0x40;
+    bin -= 0x300 / 0x40;
+    return 0x400 + (bin + 1) * 0x80;
+}
+
+/* get the distance between two consecutive blocks of an LFH bin */
+static inline SIZE_T lfh_get_block_stride( unsigned int bin )
+{
+    return sizeof(ARENA_LFH) + ROUND_SIZE( lfh_get_bin_size( bin ));
+}
+
+/* get the number of blocks in the groups of an LFH bin */
+static inline unsigned int lfh_get_group_blocks( unsigned int bin )
+{
+    SIZE_T count = LFH_GROUP_SIZE / lfh_get_block_stride( bin );
+
+    if (count < LFH_MIN_GROUP_BLOCKS) return LFH_MIN_GROUP_BLOCKS;
+    if (count > LFH_MAX_GROUP_BLOCKS) return LFH_MAX_GROUP_BLOCKS;
+    return count;
+}
+
+/* get the free_bits value of an empty group */
+static inline LONG lfh_get_group_mask( unsigned int bin )
+{
+    return ((ULONG)1 << lfh_get_group_blocks( bin )) - 1;
+}
+
+/* get the thread slot of the current thread */
+static inline unsigned int lfh_get_affinity(void)
+{
+    return (HandleToULong( NtCurrentTeb()->ClientId.UniqueThread ) >> 2) % LFH_AFFINITY_SLOTS;
+}
+
+/* atomically set or clear bits in the free bitmap of a group, and return the previous value */
+static inline LONG lfh_update_bits( struct lfh_group *group, LONG set, LONG clear )
+{
+    LONG old, bits = group->free_bits;
+
+    while ((old = interlocked_cmpxchg( (int *)&group->free_bits, (bits | set) & ~clear, bits )) != bits)
+        bits = old;
+    return old;
+}
+
+/* validate a pointer in the LFH region and retrieve its group and block index */
+static struct lfh_group *lfh_get_block_group( const HEAP *heap, const ARENA_LFH *arena,
+                                              unsigned int *index )
+{
+    SIZE_T pos = (const char *)arena - heap->lfh->base;
+    struct lfh_group *group = (struct lfh_group *)(heap->lfh->base + pos - pos % LFH_SLOT_SIZE);
+    SIZE_T offset = pos % LFH_SLOT_SIZE, stride;
+
+    /* the group header is always committed, the blocks only while the group is in use */
+    if (group->magic != LFH_GROUP_MAGIC || group->heap != heap || group->bin >= LFH_NB_BINS)
+    {
+        WARN( "Heap %p: invalid group %p for LFH arena %p\n", heap, group, arena );
+        return NULL;
+    }
+    stride = lfh_get_block_stride( group->bin );
+    *index = (offset - LFH_GROUP_HEADER_SIZE) / stride;
+    if (offset < LFH_GROUP_HEADER_SIZE || (offset - LFH_GROUP_HEADER_SIZE) % stride ||
+        *index >= lfh_get_group_blocks( group->bin ))
+    {
+        WARN( "Heap %p: invalid LFH arena %p in group %p\n", heap, arena, group );
+        return NULL;
+    }
+    if (arena->magic != ARENA_LFH_MAGIC || arena->offset != offset)
+    {
+        WARN( "Heap %p: invalid magic %06x or offset %08x for LFH arena %p\n", heap, arena->magic, arena->offset, arena );
+        return NULL;
+    }
+    if (group->free_bits & (1 << *index))
+    {
+        WARN( "Heap %p: LFH block %p used after free\n", heap, arena + 1 );
+        return NULL;
+    }
+    return group;
+}
+
+/* take a group with free blocks from a bin, allocating a new one if needed; heap must be locked */
+static struct lfh_group *lfh_get_group( HEAP *heap, unsigned int index )
+{
+    struct lfh *lfh = heap->lfh;
+    struct lfh_bin *bin = &lfh->bins[index];
+    struct lfh_group *group;
+    struct list *ptr;
+    SIZE_T size;
+    void *addr;
+
+    if ((ptr = list_head( &bin->groups )))
+    {
+        list_remove( ptr );
+        bin->nb_groups--;
+        return LIST_ENTRY( ptr, struct lfh_group, entry );
+    }
+
+    if ((ptr = list_head( &lfh->free_slots ))) group = LIST_ENTRY( ptr, struct lfh_group, entry );
+    else if (lfh->used < LFH_REGION_SIZE) group = (struct lfh_group *)(lfh->base + lfh->used);
+    else return NULL;
+
+    addr = group;
+    size = LFH_GROUP_HEADER_SIZE + lfh_get_group_blocks( index ) * lfh_get_block_stride( index );
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size, MEM_COMMIT, PAGE_READWRITE ))
+        return NULL;
+    if (ptr) list_remove( ptr );
+    else lfh->used += LFH_SLOT_SIZE;
+
+    group->heap      = heap;
+    group->free_bits = lfh_get_group_mask( index );
+    group->bin       = index;
+    group->magic     = LFH_GROUP_MAGIC;
+    TRACE( "heap %p: allocated group %p for bin %u\n", heap, group, index );
+    return group;
+}
+
+/* add a group to its bin list; heap must be locked */
+static void lfh_add_group( HEAP *heap, struct lfh_group *group )
+{
+    struct lfh_bin *bin = &heap->lfh->bins[group->bin];
+
+    list_add_head( &bin->groups, &group->entry );
+    bin->nb_groups++;
+}
+
+/* decommit the empty groups of a bin and free their slots, except for one; heap must be locked */
+static void lfh_release_groups( HEAP *heap, unsigned int index )
+{
+    struct lfh_bin *bin = &heap->lfh->bins[index];
+    struct lfh_group *group, *next;
+    LONG mask = lfh_get_group_mask( index );
+    BOOL keep = TRUE;
+    SIZE_T size;
+    void *addr;
+
+    /* groups in the list can't be allocated from, so an empty one stays empty */
+    LIST_FOR_EACH_ENTRY_SAFE( group, next, &bin->groups, struct lfh_group, entry )
+    {
+        if (group->free_bits != mask) continue;
+        if (keep)
+        {
+            keep = FALSE;
+            continue;
+        }
+        list_remove( &group->entry );
+        bin->nb_groups--;
+        group->magic = 0;
+        list_add_head( &heap->lfh->free_slots, &group->entry );
+        if (LFH_SLOT_SIZE % page_size) continue;  /* slots share pages */
+        addr = (char *)group + page_size;
+        size = LFH_SLOT_SIZE - page_size;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_DECOMMIT );
+    }
+    bin->nb_empty = 0;
+}
+
+/* give the ownership of a group back to the current thread slot */
+static void lfh_put_group( HEAP *heap, unsigned int affinity, struct lfh_group *group )
+{
+    struct lfh_bin *bin = &heap->lfh->bins[group->bin];
+
+    /* another thread of the same slot may have put its own group there meanwhile */
+    if (!(group = interlocked_xchg_ptr( (void **)&bin->affinity[affinity], group ))) return;
+
+    RtlEnterCriticalSection( &heap->critSection );
+    lfh_add_group( heap, group );
+    RtlLeaveCriticalSection( &heap->critSection );
+}
+
+/***********************************************************************
+ *           lfh_allocate
+ */
+static void *lfh_allocate( HEAP *heap, DWORD flags, SIZE_T size )
+{
+    unsigned int index = lfh_get_bin( size ), affinity = lfh_get_affinity();
+    struct lfh_bin *bin = &heap->lfh->bins[index];
+    struct lfh_group *group;
+    ARENA_LFH *arena;
+    LONG bits;
+    unsigned int i;
+
+    if (!(group = interlocked_xchg_ptr( (void **)&bin->affinity[affinity], NULL )))
+    {
+        RtlEnterCriticalSection( &heap->critSection );
+        group = lfh_get_group( heap, index );
+        RtlLeaveCriticalSection( &heap->critSection );
+        if (!group) return NULL;
+    }
+
+    /* the group is ours now, other threads can only free blocks in it */
+    i = RtlFindLeastSignificantBit( group->free_bits );
+    bits = lfh_update_bits( group, 0, 1 << i ) & ~(1 << i);
+
+    /* if the group is full, detach it until one of its blocks gets freed */
+    if (bits || interlocked_cmpxchg( (int *)&group->free_bits, (LONG)LFH_GROUP_DETACHED, 0 ))
+        lfh_put_group( heap, affinity, group );
+
+    arena = (ARENA_LFH *)((char *)group + LFH_GROUP_HEADER_SIZE + i * lfh_get_block_stride( index ));
+    arena->offset       = (char *)arena - (char *)group;
+    arena->magic        = ARENA_LFH_MAGIC;
+    arena->unused_bytes = ROUND_SIZE( lfh_get_bin_size( index )) - size;
+
+    notify_alloc( arena + 1, size, flags & HEAP_ZERO_MEMORY );
+    initialize_block( arena + 1, size, arena->unused_bytes, flags );
+    return arena + 1;
+}
+
+/***********************************************************************
+ *           lfh_free
+ */
+static BOOL lfh_free( HEAP *heap, void *ptr )
+{
+    ARENA_LFH *arena = (ARENA_LFH *)ptr - 1;
+    struct lfh_group *group;
+    struct lfh_bin *bin;
+    unsigned int bin_index, index;
+    LONG old;
+
+    if (!(group = lfh_get_block_group( heap, arena, &index ))) return FALSE;
+    bin_index = group->bin;
+    bin = &heap->lfh->bins[bin_index];
+
+    /* once the bit is set, the group may be reused or released at any time */
+    arena->magic = ARENA_LFH_FREE_MAGIC;
+    old = lfh_update_bits( group, 1 << index, 0 );
+
+    if (old == (LONG)LFH_GROUP_DETACHED)  /* first block freed in a full group, we own it now */
+    {
+        lfh_update_bits( group, 0, (LONG)LFH_GROUP_DETACHED );
+        if (interlocked_cmpxchg_ptr( (void **)&bin->affinity[lfh_get_affinity()], group, NULL ))
+        {
+            RtlEnterCriticalSection( &heap->critSection );
+            lfh_add_group( heap, group );
+            RtlLeaveCriticalSection( &heap->critSection );
+        }
+    }
+    else if ((old | (1 << index)) == lfh_get_group_mask( bin_index ) &&
+             interlocked_xchg_add( (int *)&bin->nb_empty, 1 ) >= (int)(bin->nb_groups / 4))
+    {
+        RtlEnterCriticalSection( &heap->critSection );
+        lfh_release_groups( heap, bin_index );
+        RtlLeaveCriticalSection( &heap->critSection );
+    }
+    return TRUE;
+}
+
+/***********************************************************************
+ *           lfh_realloc
+ */
+static void *lfh_realloc( HEAP *heap, DWORD flags, void *ptr, SIZE_T size )
+{
+    ARENA_LFH *arena = (ARENA_LFH *)ptr - 1;
+    struct lfh_group *group;
+    SIZE_T block_size, old_size;
+    unsigned int index;
+    void *ret;
+
+    if (!(group = lfh_get_block_group( heap, arena, &index )))
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+        return NULL;
+    }
+    block_size = ROUND_SIZE( lfh_get_bin_size( group->bin ));
+    old_size = block_size - arena->unused_bytes;
+
+    /* keep the block if the new size still fits and doesn't waste too much */
+    if (size <= lfh_get_bin_size( group->bin ) && block_size - size <= 0xff)
+    {
+        notify_realloc( ptr, old_size, size );
+        arena->unused_bytes = block_size - size;
+        if (size > old_size)
+            initialize_block( (char *)ptr + old_size, size - old_size, arena->unused_bytes, flags );
+        else
+            mark_block_tail( (char *)ptr + size, arena->unused_bytes, flags );
+        return ptr;
+    }
+
+    if (flags & HEAP_REALLOC_IN_PLACE_ONLY)
+    {
+        if (flags & HEAP_GENERATE_EXCEPTIONS) RtlRaiseStatus( STATUS_NO_MEMORY );
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_NO_MEMORY );
+        return NULL;
+    }
+    if (!(ret = RtlAllocateHeap( heap, flags & (HEAP_GENERATE_EXCEPTIONS | HEAP_ZERO_MEMORY), size )))
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_NO_MEMORY );
+        return NULL;
+    }
+    memcpy( ret, ptr, min( size, old_size ));
+    notify_free( ptr );
+    lfh_free( heap, ptr );
+    return ret;
+}
+
+/***********************************************************************
+ *           enable_lfh
+ */
+static NTSTATUS enable_lfh( HEAP *heap )
+{
+    struct lfh *lfh = NULL;
+    SIZE_T size = sizeof(*lfh);
+    unsigned int i;
+
+    /* the LFH takes its groups from the heap as it grows, so the heap must be growable */
+    if (!(heap->flags & HEAP_GROWABLE)) return STATUS_INVALID_PARAMETER;
+    if (heap->flags & (HEAP_NO_SERIALIZE | HEAP_SHARED)) return STATUS_UNSUCCESSFUL;
+
+    /* the debugging features need all the blocks to go through the standard heap */
+    if ((heap->flags & (HEAP_TAIL_CHECKING_ENABLED | HEAP_FREE_CHECKING_ENABLED |
+                        HEAP_VALIDATE | HEAP_PAGE_ALLOCS)) || heap->pending_free)
+        return STATUS_UNSUCCESSFUL;
+
+    if (heap->lfh) return STATUS_SUCCESS;
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), (void **)&lfh, 0, &size, MEM_COMMIT, PAGE_READWRITE ))
+        return STATUS_NO_MEMORY;
+    size = LFH_REGION_SIZE;
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), (void **)&lfh->base, 0, &size, MEM_RESERVE, PAGE_READWRITE ))
+    {
+        size = 0;
+        NtFreeVirtualMemory( NtCurrentProcess(), (void **)&lfh, &size, MEM_RELEASE );
+        return STATUS_NO_MEMORY;
+    }
+    list_init( &lfh->free_slots );
+    for (i = 0; i < LFH_NB_BINS; i++) list_init( &lfh->bins[i].groups );
+
+    if (interlocked_cmpxchg_ptr( (void **)&heap->lfh, lfh, NULL ))
+    {
+        size = 0;
+        NtFreeVirtualMemory( NtCurrentProcess(), (void **)&lfh->base, &size, MEM_RELEASE );
+        size = 0;
+        NtFreeVirtualMemory( NtCurrentProcess(), (void **)&lfh, &size, MEM_RELEASE );
+    }
+    else TRACE( "enabled LFH for heap %p\n", heap );
+    return STATUS_SUCCESS;
+}
+
+
 /***********************************************************************
  *           heap_set_debug_flags
  */
@@ -1622,6 +2103,15 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
         NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
     }
     subheap_notify_free_all(&heapPtr->subheap);
+    if (heapPtr->lfh)
+    {
+        size = 0;
+        addr = heapPtr->lfh->base;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+        size = 0;
+        addr = heapPtr->lfh;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    }
     if (heapPtr->pending_free)
     {
         size = 0;
@@ -1654,11 +2144,10 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
  */
 void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
 {
-    ARENA_FREE *pArena;
     ARENA_INUSE *pInUse;
-    SUBHEAP *subheap;
     HEAP *heapPtr = HEAP_GetPtr( heap );
     SIZE_T rounded_size;
+    void *ret;
 
     /* Validate the parameters */
 
@@ -1673,20 +2162,24 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
     }
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
+    if (heapPtr->lfh && size <= LFH_MAX_SIZE && (ret = lfh_allocate( heapPtr, flags, size )))
+    {
+        TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     if (rounded_size >= HEAP_MIN_LARGE_BLOCK_SIZE && (flags & HEAP_GROWABLE))
     {
-        void *ret = allocate_large_block( heap, flags, size );
+        ret = allocate_large_block( heap, flags, size );
         if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
         if (!ret && (flags & HEAP_GENERATE_EXCEPTIONS)) RtlRaiseStatus( STATUS_NO_MEMORY );
         TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
         return ret;
     }
 
-    /* Locate a suitable free block */
-
-    if (!(pArena = HEAP_FindFreeBlock( heapPtr, rounded_size, &subheap )))
+    if (!(pInUse = allocate_block( heapPtr, rounded_size, size )))
     {
         TRACE("(%p,%08x,%08lx): returning NULL\n",
                   heap, flags, size  );
@@ -1695,24 +2188,6 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
         return NULL;
     }
 
-    /* Remove the arena from the free list */
-
-    list_remove( &pArena->entry );
-
-    /* Build the in-use arena */
-
-    pInUse = (ARENA_INUSE *)pArena;
-
-    /* in-use arena is smaller than free arena,
-     * so we have to add the difference to the size */
-    pInUse->size  = (pInUse->size & ~ARENA_FLAG_FREE) + sizeof(ARENA_FREE) - sizeof(ARENA_INUSE);
-    pInUse->magic = ARENA_INUSE_MAGIC;
-
-    /* Shrink the block */
-
-    HEAP_ShrinkBlock( subheap, pInUse, rounded_size );
-    pInUse->unused_bytes = (pInUse->size & ARENA_SIZE_MASK) - size;
-
     notify_alloc( pInUse + 1, size, flags & HEAP_ZERO_MEMORY );
     initialize_block( pInUse + 1, size, pInUse->unused_bytes, flags );
 
@@ -1756,6 +2231,20 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
 
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
+
+    if (is_lfh_block( heapPtr, ptr ))
+    {
+        notify_free( ptr );
+        if (!lfh_free( heapPtr, ptr ))
+        {
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+            TRACE("(%p,%08x,%p): returning FALSE\n", heap, flags, ptr );
+            return FALSE;
+        }
+        TRACE("(%p,%08x,%p): returning TRUE\n", heap, flags, ptr );
+        return TRUE;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     /* Inform valgrind we are trying to free memory, so it can throw up an error message */
@@ -1817,6 +2306,14 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     flags &= HEAP_GENERATE_EXCEPTIONS | HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY |
              HEAP_REALLOC_IN_PLACE_ONLY;
     flags |= heapPtr->flags;
+
+    if (is_lfh_block( heapPtr, ptr ))
+    {
+        ret = lfh_realloc( heapPtr, flags, ptr, size );
+        TRACE("(%p,%08x,%p,%08lx): returning %p\n", heap, flags, ptr, size, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     rounded_size = ROUND_SIZE(size) + HEAP_TAIL_EXTRA_SIZE(flags);
@@ -2026,6 +2523,23 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
     }
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
+
+    if (is_lfh_block( heapPtr, ptr ))
+    {
+        const ARENA_LFH *arena = (const ARENA_LFH *)ptr - 1;
+        struct lfh_group *group;
+        unsigned int index;
+
+        if (!(group = lfh_get_block_group( heapPtr, arena, &index )))
+        {
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+            ret = ~0UL;
+        }
+        else ret = ROUND_SIZE( lfh_get_bin_size( group->bin )) - arena->unused_bytes;
+        TRACE("(%p,%08x,%p): returning %08lx\n", heap, flags, ptr, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     pArena = (const ARENA_INUSE *)ptr - 1;
@@ -2236,6 +2750,8 @@ ULONG WINAPI RtlGetProcessHeaps( ULONG count, HANDLE *heaps )
 NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class,
                                          PVOID info, SIZE_T size_in, PSIZE_T size_out)
 {
+    HEAP *heapPtr;
+
     switch (info_class)
     {
     case HeapCompatibilityInformation:
@@ -2244,7 +2760,8 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
         if (size_in < sizeof(ULONG))
             return STATUS_BUFFER_TOO_SMALL;
 
-        *(ULONG *)info = 0; /* standard heap */
+        heapPtr = HEAP_GetPtr( heap );
+        *(ULONG *)info = heapPtr && heapPtr->lfh ? 2 : 0; /* low-fragmentation or standard heap */
         return STATUS_SUCCESS;
 
     default:
@@ -2258,6 +2775,21 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
  */
 NTSTATUS WINAPI RtlSetHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class, PVOID info, SIZE_T size)
 {
-    FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
-    return STATUS_SUCCESS;
+    HEAP *heapPtr;
+
+    switch (info_class)
+    {
+    case HeapCompatibilityInformation:
+        if (size < sizeof(ULONG)) return STATUS_BUFFER_TOO_SMALL;
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+
+        if (*(ULONG *)info == 2) return enable_lfh( heapPtr );
+        if (heapPtr->lfh) return STATUS_UNSUCCESSFUL;  /* the LFH can't be disabled */
+        FIXME("%p: unsupported heap type %u\n", heap, *(ULONG *)info);
+        return STATUS_SUCCESS;
+
+    default:
+        FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
+        return STATUS_SUCCESS;
+    }
 }
@@ -23,10 +23,21 @@
 #include "wine/port.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #ifdef HAVE_SYS_MMAN_H
 # include <sys/mman.h>
 #endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -93,6 +104,26 @@ struct dll_dir_entry
 
 static struct list dll_dir_list = LIST_INIT( dll_dir_list );  /* extra dirs from LdrAddDllDirectory */
 
+/* directory of the dll search path, with the names known to be missing from it */
+struct dll_miss_dir
+{
+    struct list       entry;
+    WCHAR            *dir;       /* DOS path of the directory, with a trailing backslash */
+    char             *unix_dir;  /* unix path of the directory */
+    dev_t             dev;       /* device of the directory when the names were cached */
+    ino_t             ino;       /* inode of the directory */
+    ULONGLONG         mtime;     /* modification time of the directory, in nanoseconds */
+    ULONGLONG         ctime;     /* change time of the directory, in nanoseconds */
+    unsigned int      count;     /* number of missing names */
+    unsigned int      size;      /* size of the names array */
+    WCHAR           **names;     /* missing names, sorted case-insensitively */
+};
+
+static struct list dll_miss_dirs = LIST_INIT( dll_miss_dirs );  /* dirs of the search paths */
+static unsigned int dll_miss_hits;  /* number of file probes avoided */
+
+#define DLL_MISS_MAX_NAMES 4096
+
 struct ldr_notification
 {
     struct list                    entry;
@@ -123,8 +154,21 @@ typedef struct _wine_modref
     int                   alloc_deps;
     int                   nDeps;
     struct _wine_modref **deps;
+    DWORD                *export_hash;    /* hash index of the export names, built on demand */
+    DWORD                 export_mask;    /* size of the hash index minus one */
+    struct forward_entry *forwards;       /* resolved forwarded exports, indexed by ordinal */
 } WINE_MODREF;
 
+/* a forwarded export resolved by find_forwarded_export */
+struct forward_entry
+{
+    const char *forward;   /* forward string of the export, NULL if not resolved */
+    FARPROC     proc;      /* function it resolved to */
+};
+
+/* modules with fewer names than this use a binary search */
+#define EXPORT_HASH_MIN_NAMES 32
+
 /* info about the current builtin dll load */
 /* used to keep track of things across the register_dll constructor call */
 struct builtin_load_info
@@ -138,6 +182,19 @@ struct builtin_load_info
 static struct builtin_load_info default_load_info;
 static struct builtin_load_info *builtin_load_info = &default_load_info;
 
+/* builtin dlls loaded by the zygote before the load callback is set */
+/* they are registered once the forked process loads them */
+struct preloaded_dll
+{
+    void       *handle;    /* dlopen handle, NULL if loaded before the zygote started */
+    void       *module;    /* module to register, NULL once registered */
+    const char *filename;  /* file name passed to the load callback */
+};
+
+#define MAX_PRELOADED_DLLS 8
+static struct preloaded_dll preloaded_dlls[MAX_PRELOADED_DLLS];
+static unsigned int nb_preloaded_dlls;
+
 static UINT tls_module_count;      /* number of modules with TLS directory */
 static IMAGE_TLS_DIRECTORY *tls_dirs;  /* array of TLS directories */
 LIST_ENTRY tls_links = { &tls_links, &tls_links };
@@ -671,6 +728,92 @@ static FARPROC find_forwarded_export( HMODULE module, const char *forward, LPCWS
 }
 
 
+/*************************************************************************
+ *		hash_export_name
+ */
+static inline DWORD hash_export_name( const char *name )
+{
+    DWORD hash = 0;
+
+    while (*name) hash = hash * 33 + (unsigned char)*name++;
+    return hash ^ (hash >> 16);
+}
+
+
+/*************************************************************************
+ *		get_export_hash
+ *
+ * Get the hash index of the export names of a module, building it if needed.
+ * The loader_section must be locked while calling this function.
+ */
+static const DWORD *get_export_hash( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports )
+{
+    const DWORD *names = get_rva( module, exports->AddressOfNames );
+    WINE_MODREF *wm;
+    DWORD i, pos, size;
+
+    if (exports->NumberOfNames < EXPORT_HASH_MIN_NAMES) return NULL;
+    if (!(wm = get_modref( module ))) return NULL;
+    if (wm->export_hash) return wm->export_hash;
+
+    /* keep the table at most half full */
+    for (size = EXPORT_HASH_MIN_NAMES * 2; size < exports->NumberOfNames * 2; size *= 2)
+        if (size >= 0x40000000) return NULL;
+    if (!(wm->export_hash = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, size * sizeof(DWORD) )))
+        return NULL;
+    wm->export_mask = size - 1;
+
+    /* entries are name indexes plus one, 0 is an empty slot */
+    for (i = 0; i < exports->NumberOfNames; i++)
+    {
+        pos = hash_export_name( get_rva( module, names[i] )) & wm->export_mask;
+        while (wm->export_hash[pos]) pos = (pos + 1) & wm->export_mask;
+        wm->export_hash[pos] = i + 1;
+    }
+    return wm->export_hash;
+}
+
+
+/*************************************************************************
+ *		find_cached_forward
+ *
+ * Find the resolved forward of an export, or NULL if it hasn't been resolved yet.
+ * The loader_section must be locked while calling this function.
+ */
+static struct forward_entry *find_cached_forward( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports,
+                                                  DWORD ordinal, BOOL alloc )
+{
+    WINE_MODREF *wm = get_modref( module );
+
+    if (!wm) return NULL;
+    if (!wm->forwards && alloc)
+        wm->forwards = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                        exports->NumberOfFunctions * sizeof(*wm->forwards) );
+    return wm->forwards ? &wm->forwards[ordinal] : NULL;
+}
+
+
+/*************************************************************************
+ *		flush_cached_forwards
+ *
+ * Forget all the resolved forwards, their targets may be going away.
+ * The loader_section must be locked while calling this function.
+ */
+static void flush_cached_forwards(void)
+{
+    PLIST_ENTRY mark, entry;
+
+    mark = &NtCurrentTeb()->Peb->LdrData->InLoadOrderModuleList;
+    for (entry = mark->Flink; entry != mark; entry = entry->Flink)
+    {
+        WINE_MODREF *wm = CONTAINING_RECORD( entry, WINE_MODREF, ldr.InLoadOrderModuleList );
+
+        RtlFreeHeap( GetProcessHeap(), 0, wm->forwards );
+        wm->forwards = NULL;
+    }
+}
+
+
 /*************************************************************************
  *		find_ordinal_export
  *
@@ -696,7 +839,21 @@ static FARPROC find_ordinal_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY
     /* if the address falls into the export dir, it's a forward */
     if (((const char *)proc >= (const char *)exports) && 
         ((const char *)proc < (const char *)exports + exp_size))
-        return find_forwarded_export( module, (const char *)proc, load_path );
+    {
+        const char *forward = (const char *)proc;
+        struct forward_entry *entry;
+
+        if ((entry = find_cached_forward( module, exports, ordinal, FALSE )) && entry->forward == forward)
+            return entry->proc;
+        /* the lookup may load other modules, so the entry is only allocated afterwards */
+        if ((proc = find_forwarded_export( module, forward, load_path )) &&
+            (entry = find_cached_forward( module, exports, ordinal, TRUE )))
+        {
+            entry->forward = forward;
+            entry->proc = proc;
+        }
+        return proc;
+    }
 
     if (TRACE_ON(snoop))
     {
@@ -723,6 +880,7 @@ static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *
 {
     const WORD *ordinals = get_rva( module, exports->AddressOfNameOrdinals );
     const DWORD *names = get_rva( module, exports->AddressOfNames );
+    const DWORD *hash;
     int min = 0, max = exports->NumberOfNames - 1;
 
     /* first check the hint */
@@ -733,7 +891,22 @@ static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *
             return find_ordinal_export( module, exports, exp_size, ordinals[hint], load_path );
     }
 
-    /* then do a binary search */
+    /* then look it up in the hash index */
+    if ((hash = get_export_hash( module, exports )))
+    {
+        WINE_MODREF *wm = get_modref( module );
+        DWORD pos;
+
+        for (pos = hash_export_name( name ) & wm->export_mask; hash[pos]; pos = (pos + 1) & wm->export_mask)
+        {
+            char *ename = get_rva( module, names[hash[pos] - 1] );
+            if (!strcmp( ename, name ))
+                return find_ordinal_export( module, exports, exp_size, ordinals[hash[pos] - 1], load_path );
+        }
+        return NULL;
+    }
+
+    /* or do a binary search */
     while (min <= max)
     {
         int res, pos = (min + max) / 2;
@@ -1886,6 +2059,67 @@ static void load_builtin_callback( void *module, const char *filename )
 }
 
 
+/***********************************************************************
+ *           preload_builtin_callback
+ *
+ * Load callback used while the zygote loads the builtin dlls.
+ */
+static void preload_builtin_callback( void *module, const char *filename )
+{
+    if (!filename[0]) return;  /* the main exe is passed again when the real callback is set */
+    assert( nb_preloaded_dlls < MAX_PRELOADED_DLLS );
+    preloaded_dlls[nb_preloaded_dlls].handle   = NULL;
+    preloaded_dlls[nb_preloaded_dlls].module   = module;
+    preloaded_dlls[nb_preloaded_dlls].filename = filename;
+    nb_preloaded_dlls++;
+}
+
+
+/***********************************************************************
+ *           register_preloaded_dlls
+ *
+ * Register the dlls of a dlopen handle that have been loaded by the
+ * zygote, as if their constructors had just run.
+ */
+static void register_preloaded_dlls( void *handle )
+{
+    unsigned int i;
+    void *module;
+
+    for (i = 0; i < nb_preloaded_dlls; i++)
+    {
+        if (!(module = preloaded_dlls[i].module) || preloaded_dlls[i].handle != handle) continue;
+        preloaded_dlls[i].module = NULL;
+        load_builtin_callback( module, preloaded_dlls[i].filename );
+    }
+}
+
+
+/***********************************************************************
+ *           preload_builtin_dll
+ *
+ * Load a builtin dll in the zygote, before the process is initialized.
+ */
+void preload_builtin_dll( const char *dir, const char *name )
+{
+    const char *path, *build_dir = wine_get_build_dir();
+    unsigned int i, first = nb_preloaded_dlls;
+    char file[PATH_MAX];
+    void *handle = NULL;
+
+    wine_dll_set_callback( preload_builtin_callback );
+
+    if (build_dir && snprintf( file, sizeof(file), "%s/dlls/%s/%s.so", build_dir, dir, name ) < sizeof(file))
+        handle = dlopen( file, RTLD_NOW );
+
+    for (i = 0; !handle && (path = wine_dll_enum_load_path( i )); i++)
+        if (snprintf( file, sizeof(file), "%s/%s.so", path, name ) < sizeof(file))
+            handle = dlopen( file, RTLD_NOW );
+
+    for (i = first; i < nb_preloaded_dlls; i++) preloaded_dlls[i].handle = handle;
+}
+
+
 /***********************************************************************
  *           set_security_cookie
  *
@@ -1934,7 +2168,263 @@ static void set_security_cookie( void *module, SIZE_T len )
     }
 }
 
-static NTSTATUS perform_relocations( void *module, IMAGE_NT_HEADERS *nt, SIZE_T len )
+/***********************************************************************
+ *	get_file_stamp
+ *
+ * Get the modification and change times of a file in nanoseconds.
+ */
+static void get_file_stamp( const struct stat *st, ULONGLONG *mtime, ULONGLONG *ctime )
+{
+    *mtime = (ULONGLONG)st->st_mtime * 1000000000;
+    *ctime = (ULONGLONG)st->st_ctime * 1000000000;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    *mtime += st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    *mtime += st->st_mtimespec.tv_nsec;
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_CTIM
+    *ctime += st->st_ctim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_CTIMESPEC)
+    *ctime += st->st_ctimespec.tv_nsec;
+#endif
+}
+
+
+/*
+ * Relocated image cache
+ *
+ * When enabled, the pages modified by the relocation of an image are saved
+ * in a file of the server directory, keyed by the image file and the load
+ * address. Later loads of the same image at the same address map these pages
+ * privately from the cache file instead of relocating them again, so that
+ * processes share them until they are written to.
+ */
+
+#define IMAGE_CACHE_MAGIC  0x524c4357  /* 'WCLR' */
+
+struct image_cache_header
+{
+    DWORD     magic;      /* IMAGE_CACHE_MAGIC */
+    DWORD     page_size;  /* page size, the page data is aligned to it */
+    ULONGLONG dev;        /* device of the image file */
+    ULONGLONG ino;        /* inode of the image file */
+    ULONGLONG size;       /* size of the image file */
+    ULONGLONG mtime;      /* modification time of the image file in ns */
+    ULONGLONG ctime;      /* change time of the image file in ns */
+    ULONGLONG base;       /* address the image is relocated to */
+    ULONGLONG map_size;   /* size of the mapped image */
+    DWORD     nb_runs;    /* number of page runs following the header */
+    DWORD     __pad;
+};
+
+/* the pages of each run are stored consecutively after the runs array */
+struct image_cache_run
+{
+    DWORD     rva;        /* start of the run */
+    DWORD     size;       /* size of the run */
+};
+
+/* offset of the page data, following the header and the runs */
+#define IMAGE_CACHE_DATA_OFFSET(nb_runs) \
+    ((sizeof(struct image_cache_header) + (nb_runs) * sizeof(struct image_cache_run) + page_size - 1) & ~(page_size - 1))
+
+/***********************************************************************
+ *           get_image_cache_name
+ */
+static char *get_image_cache_name( void *module, const struct stat *st )
+{
+    static int enabled = -1;
+    const char *dir = wine_get_server_dir();
+    char *name;
+
+    if (enabled == -1)
+    {
+        const char *env = getenv( "WINEIMAGECACHE" );
+        enabled = env && atoi( env );
+    }
+    if (!enabled || !dir) return NULL;
+    if (!(name = RtlAllocateHeap( GetProcessHeap(), 0, strlen(dir) + 80 ))) return NULL;
+
+    sprintf( name, "%s/images", dir );
+    if (mkdir( name, 0700 ) == -1 && errno != EEXIST)
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, name );
+        return NULL;
+    }
+    sprintf( name + strlen(name), "/%lx-%lx-%lx", (unsigned long)st->st_dev, (unsigned long)st->st_ino,
+             (unsigned long)(ULONG_PTR)module );
+    return name;
+}
+
+
+/***********************************************************************
+ *           init_image_cache_header
+ */
+static void init_image_cache_header( struct image_cache_header *header, void *module, SIZE_T len,
+                                     const struct stat *st )
+{
+    memset( header, 0, sizeof(*header) );
+    header->magic     = IMAGE_CACHE_MAGIC;
+    header->page_size = page_size;
+    header->dev       = st->st_dev;
+    header->ino       = st->st_ino;
+    header->size      = st->st_size;
+    get_file_stamp( st, &header->mtime, &header->ctime );
+    header->base      = (ULONG_PTR)module;
+    header->map_size  = len;
+}
+
+
+/***********************************************************************
+ *           load_image_cache
+ *
+ * Map the relocated pages of an image from the cache, if it's up to date.
+ * Returns STATUS_NOT_FOUND if the image has to be relocated normally.
+ */
+static NTSTATUS load_image_cache( void *module, SIZE_T len, const struct stat *st )
+{
+    struct image_cache_header header, expect;
+    struct image_cache_run *runs = NULL;
+    struct stat cache_st;
+    NTSTATUS status = STATUS_NOT_FOUND;
+    char *name;
+    void *data;
+    off_t pos;
+    DWORD i;
+    int fd;
+
+    if (!(name = get_image_cache_name( module, st ))) return STATUS_NOT_FOUND;
+    fd = open( name, O_RDONLY );
+    RtlFreeHeap( GetProcessHeap(), 0, name );
+    if (fd == -1) return STATUS_NOT_FOUND;
+
+    init_image_cache_header( &expect, module, len, st );
+    if (pread( fd, &header, sizeof(header), 0 ) != sizeof(header)) goto done;
+    expect.nb_runs = header.nb_runs;
+    if (memcmp( &header, &expect, sizeof(header) )) goto done;
+    if (!header.nb_runs || header.nb_runs > len / page_size) goto done;
+    if (!(runs = RtlAllocateHeap( GetProcessHeap(), 0, header.nb_runs * sizeof(*runs) ))) goto done;
+    if (pread( fd, runs, header.nb_runs * sizeof(*runs), sizeof(header) ) != header.nb_runs * sizeof(*runs))
+        goto done;
+
+    /* validate everything before mapping anything, there's no going back after that */
+    pos = IMAGE_CACHE_DATA_OFFSET( header.nb_runs );
+    for (i = 0; i < header.nb_runs; i++)
+    {
+        if (((runs[i].rva | runs[i].size) & (page_size - 1)) || !runs[i].size) goto done;
+        if (runs[i].rva >= len || runs[i].size > len - runs[i].rva) goto done;
+        pos += runs[i].size;
+    }
+    if (fstat( fd, &cache_st ) == -1 || cache_st.st_size < pos) goto done;
+
+    /* make sure the data can be mapped, so that only running out of memory can fail below */
+    data = mmap( NULL, pos - IMAGE_CACHE_DATA_OFFSET( header.nb_runs ), PROT_READ, MAP_PRIVATE,
+                 fd, IMAGE_CACHE_DATA_OFFSET( header.nb_runs ));
+    if (data == (void *)-1) goto done;
+    munmap( data, pos - IMAGE_CACHE_DATA_OFFSET( header.nb_runs ));
+
+    /* once the first pages are replaced, the image can't be relocated normally anymore */
+    pos = IMAGE_CACHE_DATA_OFFSET( header.nb_runs );
+    for (i = 0; i < header.nb_runs; i++)
+    {
+        if ((status = virtual_map_image_pages( (char *)module + runs[i].rva, runs[i].size, fd, pos )))
+        {
+            ERR( "failed to map cached pages of %p, status %x\n", module, status );
+            goto done;
+        }
+        pos += runs[i].size;
+    }
+    TRACE( "mapped %u relocated page runs of %p from the cache\n", header.nb_runs, module );
+
+done:
+    RtlFreeHeap( GetProcessHeap(), 0, runs );
+    close( fd );
+    return status;
+}
+
+
+/***********************************************************************
+ *           save_image_cache
+ *
+ * Save the pages of a freshly relocated image to the cache.
+ */
+static void save_image_cache( void *module, SIZE_T len, const struct stat *st,
+                              const IMAGE_BASE_RELOCATION *rel, const IMAGE_BASE_RELOCATION *end )
+{
+    struct image_cache_header header;
+    struct image_cache_run *runs;
+    SIZE_T i, nb_pages = len / page_size;
+    BYTE *pages;
+    char *name, *tmp;
+    off_t pos;
+    int fd;
+
+    if (!(name = get_image_cache_name( module, st ))) return;
+    if (!(pages = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                   nb_pages + nb_pages * sizeof(*runs) + strlen(name) + 8 )))
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, name );
+        return;
+    }
+    runs = (struct image_cache_run *)(pages + nb_pages);
+    tmp = (char *)(runs + nb_pages);
+
+    /* relocation blocks cover a page each, but the last fixups may spill into the next one */
+    for ( ; rel < end - 1 && rel->SizeOfBlock; rel = (const IMAGE_BASE_RELOCATION *)((const char *)rel + rel->SizeOfBlock))
+    {
+        const USHORT *fixup = (const USHORT *)(rel + 1);
+        SIZE_T count = (rel->SizeOfBlock - sizeof(*rel)) / sizeof(USHORT);
+
+        if (rel->VirtualAddress / page_size < nb_pages) pages[rel->VirtualAddress / page_size] = 1;
+        while (count--)
+        {
+            SIZE_T page = (rel->VirtualAddress + (*fixup++ & 0xfff) + sizeof(ULONGLONG) - 1) / page_size;
+            if (page < nb_pages) pages[page] = 1;
+        }
+    }
+
+    init_image_cache_header( &header, module, len, st );
+    for (i = 0; i < nb_pages; i++)
+    {
+        if (!pages[i]) continue;
+        if (header.nb_runs && runs[header.nb_runs - 1].rva + runs[header.nb_runs - 1].size == i * page_size)
+            runs[header.nb_runs - 1].size += page_size;
+        else
+        {
+            runs[header.nb_runs].rva = i * page_size;
+            runs[header.nb_runs].size = page_size;
+            header.nb_runs++;
+        }
+    }
+    if (!header.nb_runs) goto done;
+
+    sprintf( tmp, "%s.XXXXXX", name );
+    if ((fd = mkstemp( tmp )) == -1) goto done;
+
+    pos = IMAGE_CACHE_DATA_OFFSET( header.nb_runs );
+    if (pwrite( fd, &header, sizeof(header), 0 ) != sizeof(header) ||
+        pwrite( fd, runs, header.nb_runs * sizeof(*runs), sizeof(header) ) != header.nb_runs * sizeof(*runs))
+        goto failed;
+    for (i = 0; i < header.nb_runs; i++)
+    {
+        if (pwrite( fd, (char *)module + runs[i].rva, runs[i].size, pos ) != runs[i].size) goto failed;
+        pos += runs[i].size;
+    }
+    close( fd );
+    if (!rename( tmp, name )) goto done;
+    unlink( tmp );
+    goto done;
+
+failed:
+    close( fd );
+    unlink( tmp );
+done:
+    RtlFreeHeap( GetProcessHeap(), 0, pages );
+    RtlFreeHeap( GetProcessHeap(), 0, name );
+}
+
+
+static NTSTATUS perform_relocations( void *module, IMAGE_NT_HEADERS *nt, SIZE_T len, const struct stat *st )
 {
     char *base;
     IMAGE_BASE_RELOCATION *rel, *end;
@@ -1942,6 +2432,7 @@ static NTSTATUS perform_relocations( void *module, IMAGE_NT_HEADERS *nt, SIZE_T
     const IMAGE_SECTION_HEADER *sec;
     INT_PTR delta;
     ULONG protect_old[96], i;
+    NTSTATUS status;
 
     base = (char *)nt->OptionalHeader.ImageBase;
     if (module == base) return STATUS_SUCCESS;  /* nothing to do */
@@ -1970,6 +2461,14 @@ static NTSTATUS perform_relocations( void *module, IMAGE_NT_HEADERS *nt, SIZE_T
 
     sec = (const IMAGE_SECTION_HEADER *)((const char *)&nt->OptionalHeader +
                                          nt->FileHeader.SizeOfOptionalHeader);
+
+    /* shared sections are relocated in place, they can't come from the cache */
+    for (i = 0; i < nt->FileHeader.NumberOfSections; i++)
+        if ((sec[i].Characteristics & IMAGE_SCN_MEM_SHARED) && (sec[i].Characteristics & IMAGE_SCN_MEM_WRITE))
+            st = NULL;
+
+    if (st && (status = load_image_cache( module, len, st )) != STATUS_NOT_FOUND) return status;
+
     for (i = 0; i < nt->FileHeader.NumberOfSections; i++)
     {
         void *addr = get_rva( module, sec[i].VirtualAddress );
@@ -1998,6 +2497,8 @@ static NTSTATUS perform_relocations( void *module, IMAGE_NT_HEADERS *nt, SIZE_T
         if (!rel) return STATUS_INVALID_IMAGE_FORMAT;
     }
 
+    if (st) save_image_cache( module, len, st, get_rva( module, relocs->VirtualAddress ), end );
+
     for (i = 0; i < nt->FileHeader.NumberOfSections; i++)
     {
         void *addr = get_rva( module, sec[i].VirtualAddress );
@@ -2353,7 +2854,7 @@ static NTSTATUS load_native_dll( LPCWSTR load_path, const UNICODE_STRING *nt_nam
 
     /* perform base relocation, if necessary */
 
-    if ((status = perform_relocations( *module, nt, image_info->map_size ))) return status;
+    if ((status = perform_relocations( *module, nt, image_info->map_size, st ))) return status;
 
     /* create the MODREF */
 
@@ -2620,6 +3121,7 @@ static NTSTATUS load_so_dll( LPCWSTR load_path, const UNICODE_STRING *nt_name,
     prev_info = builtin_load_info;
     builtin_load_info = &info;
     handle = dlopen( so_name ? so_name : unix_name.Buffer, RTLD_NOW );
+    if (handle) register_preloaded_dlls( handle );
     builtin_load_info = prev_info;
     RtlFreeHeap( GetProcessHeap(), 0, unix_name.Buffer );
 
@@ -2815,6 +3317,132 @@ done:
 }
 
 
+/***********************************************************************
+ *	get_dll_miss_dir
+ *
+ * Get the missing names of a directory of the search path, creating the entry
+ * if needed. Names are forgotten whenever the directory has been modified.
+ * The loader_section must be locked while calling this function.
+ */
+static struct dll_miss_dir *get_dll_miss_dir( const WCHAR *dir, ULONG len )
+{
+    struct dll_miss_dir *miss;
+    UNICODE_STRING nt_name;
+    ANSI_STRING unix_name;
+    ULONGLONG mtime, ctime;
+    struct stat st;
+    unsigned int i;
+    DOS_PATHNAME_TYPE type;
+
+    LIST_FOR_EACH_ENTRY( miss, &dll_miss_dirs, struct dll_miss_dir, entry )
+    {
+        if (wcsnicmp( miss->dir, dir, len ) || miss->dir[len]) continue;
+
+        if (stat( miss->unix_dir, &st ) == -1) memset( &st, 0, sizeof(st) );
+        get_file_stamp( &st, &mtime, &ctime );
+        if (st.st_dev != miss->dev || st.st_ino != miss->ino || mtime != miss->mtime || ctime != miss->ctime)
+        {
+            for (i = 0; i < miss->count; i++) RtlFreeHeap( GetProcessHeap(), 0, miss->names[i] );
+            miss->count = 0;
+            miss->dev   = st.st_dev;
+            miss->ino   = st.st_ino;
+            miss->mtime = mtime;
+            miss->ctime = ctime;
+        }
+        /* a directory that doesn't exist can't be used */
+        return miss->ino ? miss : NULL;
+    }
+
+    /* relative paths depend on the current directory, don't cache them */
+    type = RtlDetermineDosPathNameType_U( dir );
+    if (type != ABSOLUTE_DRIVE_PATH && type != UNC_PATH) return NULL;
+
+    if (!(miss = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*miss) + (len + 1) * sizeof(WCHAR) )))
+        return NULL;
+    miss->dir = (WCHAR *)(miss + 1);
+    memcpy( miss->dir, dir, len * sizeof(WCHAR) );
+    miss->dir[len] = 0;
+
+    if (RtlDosPathNameToNtPathName_U_WithStatus( miss->dir, &nt_name, NULL, NULL ))
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, miss );
+        return NULL;
+    }
+    /* strip the trailing backslash, except for the root directory */
+    if (nt_name.Length > 2 * sizeof(WCHAR) && nt_name.Buffer[nt_name.Length / sizeof(WCHAR) - 2] != ':')
+        nt_name.Length -= sizeof(WCHAR);
+    unix_name.Buffer = NULL;
+    if (wine_nt_to_unix_file_name( &nt_name, &unix_name, FILE_OPEN, FALSE ) ||
+        stat( unix_name.Buffer, &st ) == -1 || !S_ISDIR( st.st_mode ))
+    {
+        if (unix_name.Buffer) RtlFreeAnsiString( &unix_name );
+        RtlFreeUnicodeString( &nt_name );
+        RtlFreeHeap( GetProcessHeap(), 0, miss );
+        return NULL;
+    }
+    RtlFreeUnicodeString( &nt_name );
+
+    miss->unix_dir = unix_name.Buffer;
+    miss->dev = st.st_dev;
+    miss->ino = st.st_ino;
+    get_file_stamp( &st, &miss->mtime, &miss->ctime );
+    list_add_tail( &dll_miss_dirs, &miss->entry );
+    return miss;
+}
+
+
+/***********************************************************************
+ *	find_dll_miss
+ *
+ * Find the position of a name in the missing names of a directory.
+ */
+static BOOL find_dll_miss( const struct dll_miss_dir *miss, const WCHAR *name, unsigned int *pos )
+{
+    int min = 0, max = miss->count - 1;
+
+    while (min <= max)
+    {
+        int res, i = (min + max) / 2;
+        if (!(res = wcsicmp( miss->names[i], name )))
+        {
+            *pos = i;
+            return TRUE;
+        }
+        if (res > 0) max = i - 1;
+        else min = i + 1;
+    }
+    *pos = min;
+    return FALSE;
+}
+
+
+/***********************************************************************
+ *	add_dll_miss
+ */
+static void add_dll_miss( struct dll_miss_dir *miss, const WCHAR *name )
+{
+    unsigned int pos;
+    WCHAR **names, *str;
+
+    if (miss->count >= DLL_MISS_MAX_NAMES || find_dll_miss( miss, name, &pos )) return;
+    if (miss->count == miss->size)
+    {
+        unsigned int size = max( 16, miss->size * 2 );
+
+        if (miss->names) names = RtlReAllocateHeap( GetProcessHeap(), 0, miss->names, size * sizeof(*names) );
+        else names = RtlAllocateHeap( GetProcessHeap(), 0, size * sizeof(*names) );
+        if (!names) return;
+        miss->names = names;
+        miss->size = size;
+    }
+    if (!(str = RtlAllocateHeap( GetProcessHeap(), 0, (wcslen( name ) + 1) * sizeof(WCHAR) ))) return;
+    wcscpy( str, name );
+    memmove( miss->names + pos + 1, miss->names + pos, (miss->count - pos) * sizeof(*miss->names) );
+    miss->names[pos] = str;
+    miss->count++;
+}
+
+
 /***********************************************************************
  *	search_dll_file
  *
@@ -2838,6 +3466,8 @@ static NTSTATUS search_dll_file( LPCWSTR paths, LPCWSTR search, UNICODE_STRING *
     while (*paths)
     {
         LPCWSTR ptr = paths;
+        struct dll_miss_dir *miss = NULL;
+        unsigned int pos;
 
         while (*ptr && *ptr != ';') ptr++;
         len = ptr - paths;
@@ -2846,12 +3476,22 @@ static NTSTATUS search_dll_file( LPCWSTR paths, LPCWSTR search, UNICODE_STRING *
         if (len && name[len - 1] != '\\') name[len++] = '\\';
         wcscpy( name + len, search );
 
+        /* skip the directories that are known not to contain the file */
+        if (len && !wcschr( search, '\\' ) && !wcschr( search, '/' ) && (miss = get_dll_miss_dir( name, len )) &&
+            find_dll_miss( miss, search, &pos ))
+        {
+            TRACE( "%s known to be missing, %u probes saved\n", debugstr_w(name), ++dll_miss_hits );
+            paths = ptr;
+            continue;
+        }
+
         nt_name->Buffer = NULL;
         if ((status = RtlDosPathNameToNtPathName_U_WithStatus( name, nt_name, NULL, NULL ))) goto done;
 
         status = open_dll_file( nt_name, pwm, module, image_info, st );
         if (status == STATUS_IMAGE_MACHINE_TYPE_MISMATCH) found_image = TRUE;
         else if (status != STATUS_DLL_NOT_FOUND) goto done;
+        else if (miss) add_dll_miss( miss, search );
         RtlFreeUnicodeString( nt_name );
         paths = ptr;
     }
@@ -3498,6 +4138,7 @@ void WINAPI LdrShutdownProcess(void)
     TRACE("()\n");
     process_detaching = TRUE;
     process_detach();
+    critsection_dump_stats();
 }
 
 
@@ -3590,8 +4231,11 @@ static void free_modref( WINE_MODREF *wm )
     if ((wm->ldr.Flags & LDR_WINE_INTERNAL) && wm->ldr.SectionHandle) dlclose( wm->ldr.SectionHandle );
     NtUnmapViewOfSection( NtCurrentProcess(), wm->ldr.BaseAddress );
     if (cached_modref == wm) cached_modref = NULL;
+    flush_cached_forwards();
     RtlFreeUnicodeString( &wm->ldr.FullDllName );
     RtlFreeHeap( GetProcessHeap(), 0, wm->deps );
+    RtlFreeHeap( GetProcessHeap(), 0, wm->export_hash );
+    RtlFreeHeap( GetProcessHeap(), 0, wm->forwards );
     RtlFreeHeap( GetProcessHeap(), 0, wm );
 }
 
@@ -4249,6 +4893,7 @@ void __wine_process_init(void)
     /* setup the server connection */
     server_init_process();
     info_size = server_init_thread( peb, &suspend );
+    critsection_init();
 
     peb->ProcessHeap = RtlCreateHeap( HEAP_GROWABLE, NULL, 0, 0, NULL, NULL );
     peb->LoaderLock = &loader_section;
@@ -4268,6 +4913,7 @@ void __wine_process_init(void)
 
     /* setup the load callback and create ntdll modref */
     wine_dll_set_callback( load_builtin_callback );
+    register_preloaded_dlls( NULL );
 
     RtlInitUnicodeString( &nt_name, kernel32W );
     if ((status = load_builtin_dll( NULL, &nt_name, NULL, 0, &wm )) != STATUS_SUCCESS)
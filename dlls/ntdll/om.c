@@ -20,6 +20,7 @@
  */
 
 #include "config.h"
+#include "wine/port.h"
 
 #include <stdarg.h>
 #include <stdlib.h>
@@ -27,6 +28,9 @@
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -40,6 +44,112 @@
 WINE_DEFAULT_DEBUG_CHANNEL(ntdll);
 
 
+/*
+ *	Handle cache
+ *
+ * The server maintains a copy of the handle table of the process in shared
+ * memory, which lets us answer simple queries about handles without a
+ * server call. Entries are updated by the server when handles are created,
+ * modified or closed, so they are always current for the calling thread.
+ */
+
+struct type_name
+{
+    USHORT len;               /* name length in bytes */
+    WCHAR  name[1];
+};
+
+static struct handle_cache_entry *handle_cache;
+static BOOL handle_cache_disabled;
+static unsigned int process_type_index;
+static unsigned int thread_type_index;
+static struct type_name *type_names[256];  /* names of the types seen so far, by type index */
+
+/* map the handle cache on first use, returns NULL if the server doesn't support it */
+static struct handle_cache_entry *get_handle_cache(void)
+{
+    struct handle_cache_entry *cache;
+    data_size_t size = 0;
+    NTSTATUS ret;
+    int fd;
+
+    if (handle_cache || handle_cache_disabled) return handle_cache;
+
+    SERVER_START_REQ( get_handle_cache )
+    {
+        ret = server_call_receive_fd( req, &fd );
+        size = reply->size;
+        process_type_index = reply->process_type;
+        thread_type_index  = reply->thread_type;
+    }
+    SERVER_END_REQ;
+
+    if (ret) goto disable;
+    cache = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (cache == MAP_FAILED) goto disable;
+    if (size < HANDLE_CACHE_ENTRIES * sizeof(*cache))
+    {
+        munmap( cache, size );
+        goto disable;
+    }
+    if (interlocked_cmpxchg_ptr( (void **)&handle_cache, cache, NULL )) munmap( cache, size );
+    return handle_cache;
+
+disable:
+    TRACE( "handle cache not available (%08x)\n", ret );
+    handle_cache_disabled = TRUE;
+    return NULL;
+}
+
+/* retrieve the cached entry of a handle, or NULL if it has to be checked by the server */
+static const struct handle_cache_entry *get_cached_handle( HANDLE handle )
+{
+    struct handle_cache_entry *cache;
+    unsigned int idx = (wine_server_obj_handle( handle ) >> 2) - 1;
+
+    /* pseudo-handles and global handles are never cached */
+    if (idx >= HANDLE_CACHE_ENTRIES) return NULL;
+    if (!(cache = get_handle_cache())) return NULL;
+    return &cache[idx];
+}
+
+/* retrieve the type name of a handle if it is known, without a server call */
+static const struct type_name *get_cached_type_name( HANDLE handle )
+{
+    const struct handle_cache_entry *entry;
+    unsigned int index;
+
+    if (handle == NtCurrentProcess() || handle == GetCurrentThread())
+    {
+        if (!get_handle_cache()) return NULL;
+        index = handle == NtCurrentProcess() ? process_type_index : thread_type_index;
+    }
+    else
+    {
+        if (!(entry = get_cached_handle( handle ))) return NULL;
+        if (!(entry->flags & HANDLE_CACHE_VALID)) return NULL;
+        index = entry->type;
+    }
+    if (index >= ARRAY_SIZE(type_names)) return NULL;
+    return type_names[index];
+}
+
+/* remember the name of a type index returned by the server */
+static void cache_type_name( unsigned int index, const WCHAR *name, USHORT len )
+{
+    struct type_name *type;
+
+    if (!index || index >= ARRAY_SIZE(type_names) || type_names[index]) return;
+    if (!(type = RtlAllocateHeap( GetProcessHeap(), 0, offsetof( struct type_name, name[len / sizeof(WCHAR)] ))))
+        return;
+    type->len = len;
+    memcpy( type->name, name, len );
+    if (interlocked_cmpxchg_ptr( (void **)&type_names[index], type, NULL ))
+        RtlFreeHeap( GetProcessHeap(), 0, type );
+}
+
+
 /*
  *	Generic object functions
  */
@@ -151,6 +261,27 @@ NTSTATUS WINAPI NtQueryObject(IN HANDLE handle,
     case ObjectTypeInformation:
         {
             OBJECT_TYPE_INFORMATION *p = ptr;
+            const struct type_name *type;
+
+            if ((type = get_cached_type_name( handle )))
+            {
+                if (sizeof(*p) + type->len + sizeof(WCHAR) > len)
+                {
+                    if (used_len) *used_len = sizeof(*p) + type->len + sizeof(WCHAR);
+                    status = STATUS_INFO_LENGTH_MISMATCH;
+                }
+                else
+                {
+                    p->TypeName.Buffer = (WCHAR *)(p + 1);
+                    p->TypeName.Length = type->len;
+                    p->TypeName.MaximumLength = type->len + sizeof(WCHAR);
+                    memcpy( p->TypeName.Buffer, type->name, type->len );
+                    p->TypeName.Buffer[type->len / sizeof(WCHAR)] = 0;
+                    if (used_len) *used_len = sizeof(*p) + p->TypeName.MaximumLength;
+                    status = STATUS_SUCCESS;
+                }
+                break;
+            }
 
             SERVER_START_REQ( get_object_type )
             {
@@ -178,6 +309,7 @@ NTSTATUS WINAPI NtQueryObject(IN HANDLE handle,
                         p->TypeName.MaximumLength = res + sizeof(WCHAR);
                         p->TypeName.Buffer[res / sizeof(WCHAR)] = 0;
                         if (used_len) *used_len = sizeof(*p) + p->TypeName.MaximumLength;
+                        if (res == reply->total) cache_type_name( reply->index, p->TypeName.Buffer, res );
                     }
                 }
             }
@@ -187,9 +319,21 @@ NTSTATUS WINAPI NtQueryObject(IN HANDLE handle,
     case ObjectDataInformation:
         {
             OBJECT_DATA_INFORMATION* p = ptr;
+            const struct handle_cache_entry *entry;
 
             if (len < sizeof(*p)) return STATUS_INVALID_BUFFER_SIZE;
 
+            if ((entry = get_cached_handle( handle )) && (entry->flags & HANDLE_CACHE_VALID))
+            {
+                unsigned short flags = entry->flags;
+
+                p->InheritHandle = (flags & HANDLE_FLAG_INHERIT) != 0;
+                p->ProtectFromClose = (flags & HANDLE_FLAG_PROTECT_FROM_CLOSE) != 0;
+                if (used_len) *used_len = sizeof(*p);
+                status = STATUS_SUCCESS;
+                break;
+            }
+
             SERVER_START_REQ( set_handle_info )
             {
                 req->handle = wine_server_obj_handle( handle );
@@ -351,7 +495,13 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source,
                                    HANDLE dest_process, PHANDLE dest,
                                    ACCESS_MASK access, ULONG attributes, ULONG options )
 {
+    const struct handle_cache_entry *entry;
     NTSTATUS ret;
+
+    if (source_process == NtCurrentProcess() && (entry = get_cached_handle( source )) &&
+        !(entry->flags & HANDLE_CACHE_VALID))
+        return STATUS_INVALID_HANDLE;
+
     SERVER_START_REQ( dup_handle )
     {
         req->src_process = wine_server_obj_handle( source_process );
@@ -368,6 +518,7 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source,
             {
                 int fd = server_remove_fd_from_cache( source );
                 if (fd != -1) close( fd );
+                fast_sync_remove_from_cache( source );
             }
         }
     }
@@ -387,6 +538,7 @@ NTSTATUS close_handle( HANDLE handle )
     NTSTATUS ret;
     int fd = server_remove_fd_from_cache( handle );
 
+    fast_sync_remove_from_cache( handle );
     SERVER_START_REQ( close_handle )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -24,18 +24,31 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
 #include <sys/types.h>
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #endif
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+#ifdef HAVE_DIRENT_H
+# include <dirent.h>
+#endif
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif
@@ -1109,6 +1122,559 @@ static void set_stdio_fd( int stdin_fd, int stdout_fd )
 }
 
 
+#ifdef __linux__
+
+extern char **environ;
+extern char **__wine_main_environ;
+
+/*
+ * The zygote is an optional loader process that stops its initialization
+ * before connecting to the server, once the builtin kernel32 and kernelbase
+ * have been loaded. New processes are then forked from it instead of going
+ * through the exec of a new loader, which saves the startup of the loader,
+ * the loading of ntdll and the relocation of those dlls.
+ *
+ * There is one zygote per server directory, listening on a unix socket. The
+ * parent process sends it a zygote_request followed by the current directory,
+ * the arguments and the environment, along with the server socket and the
+ * stdio file descriptors. The zygote forks the new process, which then
+ * continues its initialization as if it had been started normally.
+ *
+ * The zygote stays in the session of the process that started it, in its own
+ * process group. A process that isn't detached joins the process group of
+ * its parent, so it can only be forked if the parent is in the same session,
+ * and it then shares its controlling terminal. The process also gets the
+ * parent's current directory, file mode creation mask and resource limits,
+ * and the range of its main exe is reserved, like for the processes that
+ * are started normally.
+ */
+
+struct zygote_request
+{
+    unsigned int  size;                  /* size of the strings following the request */
+    unsigned int  argc;                  /* number of arguments */
+    unsigned int  envc;                  /* number of environment variables */
+    unsigned int  flags;                 /* ZYGOTE_* flags */
+    unsigned int  umask;                 /* file mode creation mask */
+    pid_t         sid;                   /* session of the parent */
+    pid_t         pgid;                  /* process group of the parent */
+    void         *reserve_start;         /* start of the range of the main exe */
+    void         *reserve_end;           /* end of the range of the main exe */
+    struct rlimit limits[RLIM_NLIMITS];  /* resource limits */
+};
+
+#define ZYGOTE_DETACH  0x01  /* start a new session without stdin and stdout */
+#define ZYGOTE_STDIN   0x02  /* a stdin fd follows the server socket */
+#define ZYGOTE_STDOUT  0x04  /* a stdout fd follows the server socket */
+#define ZYGOTE_STDERR  0x08  /* a stderr fd follows the server socket */
+#define ZYGOTE_MAX_FDS 4
+
+#define ZYGOTE_MAX_SIZE      (1024 * 1024)  /* max size of the request strings */
+#define ZYGOTE_IDLE_TIMEOUT  60000          /* exit after one minute without requests */
+
+/* variables that are used by the loader before the zygote forks, they have to match */
+static const char * const zygote_vars[] =
+{
+    "HOME", "LD_LIBRARY_PATH", "LD_PRELOAD", "WINEDEBUG", "WINEDLLPATH", "WINELOADER",
+    "WINEPREFIX", "WINEWRITEWATCH"
+};
+
+
+/***********************************************************************
+ *           get_zygote_path
+ */
+static BOOL get_zygote_path( struct sockaddr_un *addr )
+{
+    const char *dir = wine_get_server_dir();
+
+    addr->sun_family = AF_UNIX;
+    return dir && snprintf( addr->sun_path, sizeof(addr->sun_path), "%s/zygote%u-%u", dir,
+                            (unsigned int)sizeof(void *) * 8, SERVER_PROTOCOL_VERSION ) < sizeof(addr->sun_path);
+}
+
+
+/***********************************************************************
+ *           close_other_fds
+ *
+ * Close all the file descriptors except stdio and the one to keep.
+ */
+static void close_other_fds( int keep )
+{
+    struct dirent *de;
+    DIR *dir;
+    int fd;
+
+    if (!(dir = opendir( "/proc/self/fd" ))) return;
+    while ((de = readdir( dir )))
+    {
+        if (de->d_name[0] < '0' || de->d_name[0] > '9') continue;
+        if ((fd = atoi( de->d_name )) > 2 && fd != keep && fd != dirfd( dir )) close( fd );
+    }
+    closedir( dir );
+}
+
+
+/***********************************************************************
+ *           get_umask
+ *
+ * Retrieve the file mode creation mask without changing it, since other
+ * threads may be creating files.
+ */
+static BOOL get_umask( unsigned int *mask )
+{
+    char buffer[64];
+    BOOL ret = FALSE;
+    FILE *f;
+
+    if (!(f = fopen( "/proc/self/status", "r" ))) return FALSE;
+    while (!ret && fgets( buffer, sizeof(buffer), f ))
+        ret = sscanf( buffer, "Umask: %o", mask ) == 1;
+    fclose( f );
+    return ret;
+}
+
+
+/***********************************************************************
+ *           start_zygote
+ *
+ * Create the zygote socket and start a loader that will listen on it.
+ */
+static void start_zygote( const struct sockaddr_un *addr )
+{
+    char *argv[3] = { NULL, (char *)"zygote", NULL };
+    char socket_env[64];
+    pid_t pid;
+    int fd;
+
+    if ((fd = socket( AF_UNIX, SOCK_STREAM, 0 )) == -1) return;
+    if (bind( fd, (const struct sockaddr *)addr, sizeof(*addr) ) == -1 || listen( fd, 16 ) == -1)
+    {
+        close( fd );
+        return;
+    }
+
+    if (!(pid = fork()))  /* child */
+    {
+        if (!(pid = fork()))  /* grandchild */
+        {
+            setpgid( 0, 0 );
+            set_stdio_fd( -1, -1 );
+            dup2( 1, 2 );  /* the processes get the stderr of their parent */
+            close_other_fds( fd );
+            signal( SIGPIPE, SIG_DFL );
+            sprintf( socket_env, "WINEZYGOTESOCKET=%u", fd );
+            putenv( socket_env );
+            unsetenv( "WINEPRELOADRESERVE" );
+            chdir( "/" );
+            wine_exec_wine_binary( NULL, argv, getenv("WINELOADER") );
+            _exit(1);
+        }
+        _exit(pid == -1);
+    }
+
+    if (pid != -1)
+    {
+        pid_t wret;
+        do {
+            wret = waitpid(pid, NULL, 0);
+        } while (wret < 0 && errno == EINTR);
+    }
+    close( fd );
+}
+
+
+/***********************************************************************
+ *           zygote_env_skipped
+ *
+ * Check if a variable of the parent environment is replaced in the new process.
+ */
+static BOOL zygote_env_skipped( const char *var, const char *winedebug )
+{
+    if (winedebug && !strncmp( var, "WINEDEBUG=", 10 )) return TRUE;
+    return !strncmp( var, "WINEPRELOADRESERVE=", 19 );
+}
+
+
+/***********************************************************************
+ *           zygote_spawn
+ *
+ * Ask the zygote to start a new process. Returns FALSE if the process
+ * has to be started the normal way.
+ */
+static BOOL zygote_spawn( char **argv, int socketfd, const char *unixdir, const char *winedebug,
+                          int stdin_fd, int stdout_fd, BOOL detach, const pe_image_info_t *pe_info )
+{
+    static int enabled = -1;
+    struct zygote_request req;
+    struct sockaddr_un addr;
+    struct msghdr msghdr;
+    struct cmsghdr *cmsg;
+    struct iovec vec;
+    char cmsg_buffer[256], preloader_reserve[64];
+    char *buffer, *p, *cwd = NULL;
+    int fd, *fds, nb_fds = 1, reply = -1;
+    ULONGLONG res_start = pe_info->base;
+    ULONGLONG res_end   = pe_info->base + pe_info->map_size;
+    unsigned int i;
+    ssize_t ret;
+
+    if (enabled == -1)
+    {
+        const char *env = getenv( "WINEZYGOTE" );
+        enabled = env && atoi( env );
+    }
+    if (!enabled || !get_zygote_path( &addr )) return FALSE;
+
+    memset( &req, 0, sizeof(req) );
+    req.sid = getsid( 0 );
+    req.pgid = getpgrp();
+    req.reserve_start = (void *)(ULONG_PTR)res_start;
+    req.reserve_end = (void *)(ULONG_PTR)res_end;
+    if (detach) req.flags |= ZYGOTE_DETACH;
+    if (!get_umask( &req.umask )) return FALSE;
+    for (i = 0; i < RLIM_NLIMITS; i++)
+        if (getrlimit( i, &req.limits[i] ) == -1) return FALSE;
+    /* the process is started in the current directory if there's no dos one */
+    if (!unixdir && !(unixdir = cwd = getcwd( NULL, 0 ))) return FALSE;
+
+    if ((fd = socket( AF_UNIX, SOCK_STREAM, 0 )) == -1) return FALSE;
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+    if (connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) == -1)
+    {
+        /* start one for the next processes, this one is spawned normally */
+        if (errno == ECONNREFUSED) unlink( addr.sun_path );
+        else if (errno != ENOENT) enabled = 0;
+        if (enabled) start_zygote( &addr );
+        close( fd );
+        free( cwd );
+        return FALSE;
+    }
+
+    sprintf( preloader_reserve, "WINEPRELOADRESERVE=%x%08x-%x%08x",
+             (ULONG)(res_start >> 32), (ULONG)res_start, (ULONG)(res_end >> 32), (ULONG)res_end );
+
+    req.size = strlen( unixdir ) + 1;
+    for (req.argc = 0; argv[req.argc]; req.argc++) req.size += strlen( argv[req.argc] ) + 1;
+    for (i = req.envc = 0; environ[i]; i++)
+    {
+        if (zygote_env_skipped( environ[i], winedebug )) continue;
+        req.size += strlen( environ[i] ) + 1;
+        req.envc++;
+    }
+    req.size += strlen( preloader_reserve ) + 1;
+    req.envc++;
+    if (winedebug)
+    {
+        req.size += strlen( winedebug ) + 1;
+        req.envc++;
+    }
+
+    if (req.size > ZYGOTE_MAX_SIZE || !(buffer = malloc( req.size )))
+    {
+        close( fd );
+        free( cwd );
+        return FALSE;
+    }
+    strcpy( buffer, unixdir );
+    p = buffer + strlen( buffer ) + 1;
+    for (i = 0; i < req.argc; i++) p += strlen( strcpy( p, argv[i] )) + 1;
+    for (i = 0; environ[i]; i++)
+    {
+        if (zygote_env_skipped( environ[i], winedebug )) continue;
+        p += strlen( strcpy( p, environ[i] )) + 1;
+    }
+    p += strlen( strcpy( p, preloader_reserve )) + 1;
+    if (winedebug) strcpy( p, winedebug );
+
+    if (!detach)
+    {
+        if (stdin_fd != -1) req.flags |= ZYGOTE_STDIN;
+        if (stdout_fd != -1) req.flags |= ZYGOTE_STDOUT;
+        nb_fds += (stdin_fd != -1) + (stdout_fd != -1);
+    }
+    if (fcntl( 2, F_GETFD ) != -1)
+    {
+        req.flags |= ZYGOTE_STDERR;
+        nb_fds++;
+    }
+
+    vec.iov_base = &req;
+    vec.iov_len  = sizeof(req);
+    memset( &msghdr, 0, sizeof(msghdr) );
+    msghdr.msg_iov        = &vec;
+    msghdr.msg_iovlen     = 1;
+    msghdr.msg_control    = cmsg_buffer;
+    msghdr.msg_controllen = CMSG_SPACE( nb_fds * sizeof(int) );
+    cmsg = CMSG_FIRSTHDR( &msghdr );
+    cmsg->cmsg_len   = CMSG_LEN( nb_fds * sizeof(int) );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    fds = (int *)CMSG_DATA(cmsg);
+    *fds++ = socketfd;
+    if (req.flags & ZYGOTE_STDIN) *fds++ = stdin_fd;
+    if (req.flags & ZYGOTE_STDOUT) *fds++ = stdout_fd;
+    if (req.flags & ZYGOTE_STDERR) *fds++ = 2;
+
+    if (sendmsg( fd, &msghdr, MSG_NOSIGNAL ) == sizeof(req))
+    {
+        for (p = buffer; p < buffer + req.size; p += ret)
+            if ((ret = send( fd, p, buffer + req.size - p, MSG_NOSIGNAL )) <= 0 && errno != EINTR) break;
+        if (p == buffer + req.size)
+        {
+            while ((ret = read( fd, &reply, sizeof(reply) )) == -1 && errno == EINTR);
+            if (ret != sizeof(reply)) reply = -1;
+        }
+    }
+    free( buffer );
+    free( cwd );
+    close( fd );
+    if (reply) TRACE( "zygote refused the request, spawning the process normally\n" );
+    return !reply;
+}
+
+
+/***********************************************************************
+ *           zygote_var_matches
+ */
+static BOOL zygote_var_matches( const char *var, char **env, unsigned int envc )
+{
+    const char *value = getenv( var );
+    size_t len = strlen( var );
+    unsigned int i;
+
+    for (i = 0; i < envc; i++)
+        if (!strncmp( env[i], var, len ) && env[i][len] == '=') return value && !strcmp( env[i] + len + 1, value );
+    return !value;
+}
+
+
+/***********************************************************************
+ *           zygote_receive
+ *
+ * Receive a request on a zygote connection, and return the strings.
+ */
+static char *zygote_receive( int fd, struct zygote_request *req, int fds[ZYGOTE_MAX_FDS] )
+{
+    struct msghdr msghdr;
+    struct cmsghdr *cmsg;
+    struct iovec vec;
+    char cmsg_buffer[256];
+    char *buffer, *p;
+    unsigned int i, count = 0;
+    ssize_t ret;
+
+    vec.iov_base = req;
+    vec.iov_len  = sizeof(*req);
+    memset( &msghdr, 0, sizeof(msghdr) );
+    msghdr.msg_iov        = &vec;
+    msghdr.msg_iovlen     = 1;
+    msghdr.msg_control    = cmsg_buffer;
+    msghdr.msg_controllen = sizeof(cmsg_buffer);
+
+    for (i = 0; i < ZYGOTE_MAX_FDS; i++) fds[i] = -1;
+    while ((ret = recvmsg( fd, &msghdr, MSG_CMSG_CLOEXEC )) == -1 && errno == EINTR);
+    if (ret <= 0) return NULL;
+    for (cmsg = CMSG_FIRSTHDR( &msghdr ); cmsg; cmsg = CMSG_NXTHDR( &msghdr, cmsg ))
+    {
+        int *data = (int *)CMSG_DATA(cmsg);
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        for (i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+            if (count < ZYGOTE_MAX_FDS) fds[count++] = data[i];
+            else close( data[i] );
+    }
+    if (ret != sizeof(*req) || !req->size || req->size > ZYGOTE_MAX_SIZE || !req->argc) return NULL;
+    if (count != 1 + !!(req->flags & ZYGOTE_STDIN) + !!(req->flags & ZYGOTE_STDOUT) +
+        !!(req->flags & ZYGOTE_STDERR)) return NULL;
+    if (!(buffer = malloc( req->size ))) return NULL;
+
+    for (p = buffer; p < buffer + req->size; p += ret)
+        if ((ret = read( fd, p, buffer + req->size - p )) <= 0 && errno != EINTR) break;
+    if (p == buffer + req->size && !buffer[req->size - 1]) return buffer;
+    free( buffer );
+    return NULL;
+}
+
+
+/***********************************************************************
+ *           zygote_split_strings
+ */
+static char **zygote_split_strings( char *buffer, const struct zygote_request *req )
+{
+    char **strings, *p = buffer, *end = buffer + req->size;
+    unsigned int i;
+
+    if (!(strings = malloc( (req->argc + req->envc + 3) * sizeof(*strings) ))) return NULL;
+    for (i = 0; i < 1 + req->argc + req->envc; i++)
+    {
+        if (p >= end) break;
+        strings[i] = p;
+        p += strlen( p ) + 1;
+    }
+    if (i == 1 + req->argc + req->envc) return strings;
+    free( strings );
+    return NULL;
+}
+
+
+/***********************************************************************
+ *           zygote_child_setup
+ *
+ * Apply the parent's state that is inherited by the process forked from
+ * the zygote. Returns FALSE if the process has to be started normally.
+ */
+static BOOL zygote_child_setup( const struct zygote_request *req, char **strings )
+{
+    unsigned int i;
+
+    if (!(req->flags & ZYGOTE_DETACH) && (getsid( 0 ) != req->sid || setpgid( 0, req->pgid ) == -1))
+        return FALSE;
+    if (!virtual_set_preload_reserve( req->reserve_start, req->reserve_end )) return FALSE;
+    umask( req->umask );
+    for (i = 0; i < RLIM_NLIMITS; i++)
+        if (setrlimit( i, &req->limits[i] ) == -1) return FALSE;
+    return !chdir( strings[0] );
+}
+
+
+/***********************************************************************
+ *           zygote_child_init
+ *
+ * Set up the state of a process forked from the zygote.
+ */
+static void zygote_child_init( const struct zygote_request *req, char **strings, const int fds[ZYGOTE_MAX_FDS] )
+{
+    char *socket_env, **argv;
+    char **args = strings + 1, **env = strings + 1 + req->argc;
+    int stdin_fd = -1, stdout_fd = -1, stderr_fd = -1, pos = 1;
+    size_t size = sizeof("wine");
+    unsigned int i;
+    char *p;
+
+    if (req->flags & ZYGOTE_STDIN) stdin_fd = fds[pos++];
+    if (req->flags & ZYGOTE_STDOUT) stdout_fd = fds[pos++];
+    if (req->flags & ZYGOTE_STDERR) stderr_fd = fds[pos++];
+
+    if (req->flags & ZYGOTE_DETACH)
+    {
+        setsid();
+        set_stdio_fd( -1, -1 );  /* close stdin and stdout */
+    }
+    else set_stdio_fd( stdin_fd, stdout_fd );
+    if (stdin_fd != -1) close( stdin_fd );
+    if (stdout_fd != -1) close( stdout_fd );
+    if (stderr_fd != -1)
+    {
+        dup2( stderr_fd, 2 );
+        close( stderr_fd );
+    }
+    else close( 2 );
+
+    clearenv();
+    for (i = 0; i < req->envc; i++) putenv( env[i] );
+    if ((socket_env = malloc( 32 )))
+    {
+        sprintf( socket_env, "WINESERVERSOCKET=%u", fds[0] );
+        putenv( socket_env );
+    }
+    __wine_main_environ = environ;
+
+    /* the process name is set from contiguous strings, with argv[0] replaced by the loader name */
+    for (i = 0; i < req->argc; i++) size += strlen( args[i] ) + 1;
+    if (!(argv = malloc( (req->argc + 2) * sizeof(*argv) + size ))) _exit(1);
+    p = (char *)(argv + req->argc + 2);
+    argv[0] = strcpy( p, "wine" );
+    p += sizeof("wine");
+    for (i = 0; i < req->argc; i++)
+    {
+        argv[i + 1] = strcpy( p, args[i] );
+        p += strlen( p ) + 1;
+    }
+    argv[i + 1] = NULL;
+    __wine_main_argc = req->argc + 1;
+    __wine_main_argv = argv;
+}
+
+
+/***********************************************************************
+ *           zygote_init
+ *
+ * Run the zygote loop if this process has been started as a zygote. This
+ * only returns in the processes that are forked from it.
+ */
+void zygote_init(void)
+{
+    const char *env = getenv( "WINEZYGOTESOCKET" );
+    struct zygote_request req;
+    struct pollfd pfd;
+    char *buffer, **strings;
+    int fd, listen_fd, fds[ZYGOTE_MAX_FDS], reply;
+    unsigned int i;
+    pid_t pid;
+
+    if (!env) return;
+    listen_fd = atoi( env );
+    unsetenv( "WINEZYGOTESOCKET" );
+    fcntl( listen_fd, F_SETFD, FD_CLOEXEC );
+
+    preload_builtin_dll( "kernelbase", "kernelbase.dll" );
+    preload_builtin_dll( "kernel32", "kernel32.dll" );
+
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    for (;;)
+    {
+        if (!poll( &pfd, 1, ZYGOTE_IDLE_TIMEOUT )) exit(0);
+        if ((fd = accept( listen_fd, NULL, NULL )) == -1) continue;
+
+        reply = -1;
+        strings = NULL;
+        if ((buffer = zygote_receive( fd, &req, fds )) && (strings = zygote_split_strings( buffer, &req )))
+        {
+            for (i = 0; i < ARRAY_SIZE(zygote_vars); i++)
+                if (!zygote_var_matches( zygote_vars[i], strings + 1 + req.argc, req.envc )) break;
+
+            if (i == ARRAY_SIZE(zygote_vars) && (pid = fork()) != -1)
+            {
+                if (!pid)  /* child */
+                {
+                    if (!zygote_child_setup( &req, strings )) _exit(1);
+                    if (!(pid = fork()))  /* grandchild */
+                    {
+                        close( listen_fd );
+                        close( fd );
+                        zygote_child_init( &req, strings, fds );
+                        return;
+                    }
+                    _exit(pid == -1);
+                }
+                while (waitpid( pid, &reply, 0 ) == -1 && errno == EINTR);
+                if (reply) reply = -1;
+            }
+        }
+        send( fd, &reply, sizeof(reply), MSG_NOSIGNAL );
+        close( fd );
+        for (i = 0; i < ZYGOTE_MAX_FDS; i++) if (fds[i] != -1) close( fds[i] );
+        free( strings );
+        free( buffer );
+    }
+}
+
+#else  /* __linux__ */
+
+static BOOL zygote_spawn( char **argv, int socketfd, const char *unixdir, const char *winedebug,
+                          int stdin_fd, int stdout_fd, BOOL detach, const pe_image_info_t *pe_info )
+{
+    return FALSE;
+}
+
+void zygote_init(void)
+{
+}
+
+#endif  /* __linux__ */
+
+
 /***********************************************************************
  *           spawn_loader
  */
@@ -1121,6 +1687,9 @@ static NTSTATUS spawn_loader( const RTL_USER_PROCESS_PARAMETERS *params, int soc
     const char *loader = NULL;
     char **argv;
     NTSTATUS status = STATUS_SUCCESS;
+    BOOL detach = (params->ConsoleFlags ||
+                   params->ConsoleHandle == (HANDLE)1 /* KERNEL32_CONSOLE_ALLOC */ ||
+                   (params->hStdInput == INVALID_HANDLE_VALUE && params->hStdOutput == INVALID_HANDLE_VALUE));
 
     argv = build_argv( &params->CommandLine, 1 );
 
@@ -1130,6 +1699,9 @@ static NTSTATUS spawn_loader( const RTL_USER_PROCESS_PARAMETERS *params, int soc
     wine_server_handle_to_fd( params->hStdInput, FILE_READ_DATA, &stdin_fd, NULL );
     wine_server_handle_to_fd( params->hStdOutput, FILE_WRITE_DATA, &stdout_fd, NULL );
 
+    if (!loader && argv && zygote_spawn( argv, socketfd, unixdir, winedebug, stdin_fd, stdout_fd, detach, pe_info ))
+        goto done;
+
     if (!(pid = fork()))  /* child */
     {
         if (!(pid = fork()))  /* grandchild */
@@ -1138,9 +1710,7 @@ static NTSTATUS spawn_loader( const RTL_USER_PROCESS_PARAMETERS *params, int soc
             ULONGLONG res_start = pe_info->base;
             ULONGLONG res_end   = pe_info->base + pe_info->map_size;
 
-            if (params->ConsoleFlags ||
-                params->ConsoleHandle == (HANDLE)1 /* KERNEL32_CONSOLE_ALLOC */ ||
-                (params->hStdInput == INVALID_HANDLE_VALUE && params->hStdOutput == INVALID_HANDLE_VALUE))
+            if (detach)
             {
                 setsid();
                 set_stdio_fd( -1, -1 );  /* close stdin and stdout */
@@ -1180,6 +1750,7 @@ static NTSTATUS spawn_loader( const RTL_USER_PROCESS_PARAMETERS *params, int soc
     }
     else status = FILE_GetNtStatus();
 
+done:
     if (stdin_fd != -1) close( stdin_fd );
     if (stdout_fd != -1) close( stdout_fd );
     RtlFreeHeap( GetProcessHeap(), 0, wineloader );
@@ -28,6 +28,9 @@
 #endif
 #include <errno.h>
 #include <fcntl.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 #ifdef HAVE_LWP_H
 #include <lwp.h>
 #endif
@@ -80,6 +83,7 @@
 #include "wine/library.h"
 #include "wine/server.h"
 #include "wine/debug.h"
+#include "wine/exception.h"
 #include "ntdll_misc.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(server);
@@ -118,6 +122,7 @@ timeout_t server_start_time = 0;  /* time of server startup */
 sigset_t server_block_set;  /* signals to block during server calls */
 static int fd_socket = -1;  /* socket to exchange file descriptors with the server */
 static pid_t server_pid;
+static BOOL use_request_shm;  /* exchange request data through shared memory */
 
 static RTL_CRITICAL_SECTION fd_cache_section;
 static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
@@ -277,6 +282,90 @@ static inline unsigned int wait_reply( struct __server_request_info *req )
 }
 
 
+#ifdef __linux__
+
+#define FUTEX_WAIT 0
+
+/* the shared area is mapped in both processes, so we can't use private futexes */
+static inline int futex_wait( const unsigned int *addr, unsigned int val, struct timespec *timeout )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAIT, val, timeout, 0, 0 );
+}
+
+/***********************************************************************
+ *           send_shm_request
+ *
+ * Send a request to the server, storing the data in the shared memory area.
+ */
+static unsigned int send_shm_request( const struct __server_request_info *req, struct request_shm *shm )
+{
+    char *ptr = (char *)(shm + 1);
+    unsigned int i, ret = STATUS_SUCCESS;
+    int res;
+
+    /* the server uses the same rule to decide where to read the data from */
+    if (req->u.req.request_header.request_size > REQUEST_SHM_DATA_SIZE) return send_request( req );
+
+    __TRY
+    {
+        for (i = 0; i < req->data_count; i++)
+        {
+            memcpy( ptr, req->data[i].ptr, req->data[i].size );
+            ptr += req->data[i].size;
+        }
+    }
+    __EXCEPT_PAGE_FAULT
+    {
+        ret = STATUS_ACCESS_VIOLATION;
+    }
+    __ENDTRY
+    if (ret) return ret;
+
+    if ((res = write( ntdll_get_thread_data()->request_fd, &req->u.req,
+                      sizeof(req->u.req) )) == sizeof(req->u.req)) return STATUS_SUCCESS;
+
+    if (res >= 0) server_protocol_error( "partial write %d\n", res );
+    if (errno == EPIPE) abort_thread(0);
+    server_protocol_perror( "write" );
+}
+
+
+/***********************************************************************
+ *           wait_shm_reply
+ *
+ * Wait for the server to store a reply in the shared memory area.
+ */
+static unsigned int wait_shm_reply( struct __server_request_info *req, struct request_shm *shm,
+                                    unsigned int seq )
+{
+    struct timespec timeout = { 1, 0 };
+    struct pollfd pfd;
+
+    while (interlocked_cmpxchg( (int *)&shm->seq, 0, 0 ) == seq)
+    {
+        if (futex_wait( &shm->seq, seq, &timeout ) != -1 || errno != ETIMEDOUT) continue;
+
+        /* make sure the server is still around, the reply pipe is closed when it dies */
+        pfd.fd = ntdll_get_thread_data()->reply_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll( &pfd, 1, 0 ) == 1 && (pfd.revents & (POLLHUP | POLLERR))) abort_thread(0);
+    }
+
+    memcpy( &req->u.reply, &shm->reply, sizeof(req->u.reply) );
+    if (req->u.reply.reply_header.reply_size)
+    {
+        if (shm->pipe_data)
+            read_reply_data( req->reply_data, req->u.reply.reply_header.reply_size );
+        else
+            memcpy( req->reply_data, shm + 1, req->u.reply.reply_header.reply_size );
+    }
+    return req->u.reply.reply_header.error;
+}
+
+#endif  /* __linux__ */
+
+
 /***********************************************************************
  *           server_call_unlocked
  */
@@ -285,6 +374,18 @@ unsigned int server_call_unlocked( void *req_ptr )
     struct __server_request_info * const req = req_ptr;
     unsigned int ret;
 
+#ifdef __linux__
+    struct request_shm *shm = ntdll_get_thread_data()->request_shm;
+
+    if (shm)
+    {
+        /* only the server modifies it, and only in reply to our own requests */
+        unsigned int seq = shm->seq;
+
+        if ((ret = send_shm_request( req, shm ))) return ret;
+        return wait_shm_reply( req, shm, seq );
+    }
+#endif
     if ((ret = send_request( req ))) return ret;
     return wait_reply( req );
 }
@@ -1005,6 +1106,27 @@ done:
 }
 
 
+/***********************************************************************
+ *           server_call_receive_fd
+ *
+ * Perform a server call whose reply is followed by a file descriptor.
+ * The returned fd is -1 on failure, and has to be closed by the caller.
+ */
+unsigned int server_call_receive_fd( void *req_ptr, int *fd )
+{
+    sigset_t sigset;
+    obj_handle_t fd_handle;
+    unsigned int ret;
+
+    *fd = -1;
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    if (!(ret = server_call_unlocked( req_ptr )) && (*fd = receive_fd( &fd_handle )) == -1)
+        ret = STATUS_TOO_MANY_OPENED_FILES;
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+    return ret;
+}
+
+
 /***********************************************************************
  *           wine_server_fd_to_handle   (NTDLL.@)
  *
@@ -1395,6 +1517,11 @@ void server_init_process(void)
 {
     obj_handle_t version;
     const char *env_socket = getenv( "WINESERVERSOCKET" );
+#ifdef __linux__
+    const char *env_shm = getenv( "WINESERVERSHM" );
+
+    use_request_shm = env_shm && atoi( env_shm );
+#endif
 
     server_pid = -1;
     if (env_socket)
@@ -1505,9 +1632,10 @@ size_t server_init_thread( void *entry_point, BOOL *suspend )
     static const char *cpu_names[] = { "x86", "x86_64", "PowerPC", "ARM", "ARM64" };
     static const BOOL is_win64 = (sizeof(void *) > sizeof(int));
     const char *arch = getenv( "WINEARCH" );
-    int ret;
+    int ret, request_shm;
     int reply_pipe[2];
     struct sigaction sig_act;
+    sigset_t sigset;
     size_t info_size;
 
     sig_act.sa_handler = SIG_IGN;
@@ -1525,6 +1653,9 @@ size_t server_init_thread( void *entry_point, BOOL *suspend )
     ntdll_get_thread_data()->reply_fd = reply_pipe[0];
     close( reply_pipe[1] );
 
+    /* the shared memory fd is sent on the process socket, make sure no other thread reads it */
+    if (use_request_shm) server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+
     SERVER_START_REQ( init_thread )
     {
         req->unix_pid    = getpid();
@@ -1535,6 +1666,7 @@ size_t server_init_thread( void *entry_point, BOOL *suspend )
         req->wait_fd     = ntdll_get_thread_data()->wait_fd[1];
         req->debug_level = (TRACE_ON(server) != 0);
         req->cpu         = client_cpu;
+        req->request_shm = use_request_shm;
         ret = wine_server_call( req );
         NtCurrentTeb()->ClientId.UniqueProcess = ULongToHandle(reply->pid);
         NtCurrentTeb()->ClientId.UniqueThread  = ULongToHandle(reply->tid);
@@ -1542,9 +1674,25 @@ size_t server_init_thread( void *entry_point, BOOL *suspend )
         server_start_time = reply->server_start;
         server_cpus       = reply->all_cpus;
         *suspend          = reply->suspend;
+        request_shm       = reply->request_shm;
     }
     SERVER_END_REQ;
 
+    if (use_request_shm)
+    {
+        if (!ret && request_shm)
+        {
+            obj_handle_t handle;
+            int fd = receive_fd( &handle );
+            void *ptr = mmap( NULL, REQUEST_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+            if (ptr != MAP_FAILED) ntdll_get_thread_data()->request_shm = ptr;
+            else server_protocol_perror( "mmap" );
+            close( fd );
+        }
+        server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+    }
+
     is_wow64 = !is_win64 && (server_cpus & ((1 << CPU_x86_64) | (1 << CPU_ARM64))) != 0;
     ntdll_get_thread_data()->wow64_redir = is_wow64;
 
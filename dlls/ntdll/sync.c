@@ -34,6 +34,9 @@
 #ifdef HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 #ifdef HAVE_POLL_H
 #include <poll.h>
 #endif
@@ -58,6 +61,7 @@
 #include "windef.h"
 #include "winternl.h"
 #include "wine/server.h"
+#include "wine/library.h"
 #include "wine/debug.h"
 #include "ntdll_misc.h"
 
@@ -133,6 +137,566 @@ static void timespec_from_timeout( struct timespec *timespec, const LARGE_INTEGE
 }
 #endif
 
+/*
+ *	Fast synchronization objects
+ *
+ * When enabled in the server, the state of events, semaphores and mutexes is
+ * kept in a memory area shared with the server and all the other processes,
+ * and the common operations on them are done with atomic operations and
+ * futexes instead of server calls. Objects that have threads waiting on them
+ * through the server, and anything more complex than a single object wait,
+ * still go through the server.
+ *
+ * I/O completion ports also have a packet queue in the shared area, which
+ * lets clients queue and remove packets without server calls as long as no
+ * server thread waits on the port and the queue doesn't overflow; see
+ * server/completion.c for the details.
+ */
+
+#ifdef __linux__
+
+union fast_sync_cache_entry
+{
+    LONG data;
+    struct
+    {
+        unsigned int index  : 24;  /* index of the object state in the shared area */
+        unsigned int type   : 3;   /* object type (enum fast_sync_type) */
+        unsigned int wait   : 1;   /* handle has SYNCHRONIZE access */
+        unsigned int modify : 1;   /* handle has EVENT_MODIFY_STATE, SEMAPHORE_MODIFY_STATE
+                                      or IO_COMPLETION_MODIFY_STATE access */
+        unsigned int valid  : 1;   /* entry has been retrieved from the server */
+    } s;
+};
+
+C_ASSERT( sizeof(union fast_sync_cache_entry) == sizeof(LONG) );
+
+#define FAST_SYNC_CACHE_BLOCK_SIZE  (65536 / sizeof(union fast_sync_cache_entry))
+#define FAST_SYNC_CACHE_ENTRIES     128
+
+static union fast_sync_cache_entry *fast_sync_cache[FAST_SYNC_CACHE_ENTRIES];
+
+static struct fast_sync_entry *fast_sync_area;
+static BOOL fast_sync_disabled;
+
+/* the shared area is mapped in several processes, so these can't use private futexes */
+static inline int futex_wait_shared( const int *addr, int val, struct timespec *timeout )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAIT, val, timeout, 0, 0 );
+}
+
+static inline int futex_wake_shared( const int *addr, int val )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAKE, val, NULL, 0, 0 );
+}
+
+/* wake up the threads waiting on an entry after changing its state */
+static inline void fast_sync_wake( struct fast_sync_entry *entry )
+{
+    interlocked_xchg_add( &entry->seq, 1 );
+    if (entry->waiters) futex_wake_shared( &entry->seq, INT_MAX );
+}
+
+/* map the shared area on first use, returns NULL if the server doesn't support it */
+static struct fast_sync_entry *get_fast_sync_area(void)
+{
+    struct fast_sync_entry *area;
+    data_size_t size = 0;
+    NTSTATUS ret;
+    int fd;
+
+    if (fast_sync_area || fast_sync_disabled) return fast_sync_area;
+
+    SERVER_START_REQ( get_fast_sync_area )
+    {
+        ret = server_call_receive_fd( req, &fd );
+        size = reply->size;
+    }
+    SERVER_END_REQ;
+
+    if (ret) goto disable;
+    area = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (area == MAP_FAILED) goto disable;
+    if (size < FAST_SYNC_AREA_SIZE)
+    {
+        munmap( area, size );
+        goto disable;
+    }
+    if (interlocked_cmpxchg_ptr( (void **)&fast_sync_area, area, NULL )) munmap( area, size );
+    return fast_sync_area;
+
+disable:
+    TRACE( "fast synchronization objects not available (%08x)\n", ret );
+    fast_sync_disabled = TRUE;
+    return NULL;
+}
+
+static union fast_sync_cache_entry *get_fast_sync_cache_entry( HANDLE handle, BOOL alloc )
+{
+    unsigned int idx = (wine_server_obj_handle( handle ) >> 2) - 1;
+    unsigned int entry = idx / FAST_SYNC_CACHE_BLOCK_SIZE;
+
+    if (entry >= FAST_SYNC_CACHE_ENTRIES) return NULL;
+    if (!fast_sync_cache[entry])  /* do we need to allocate a new block of entries? */
+    {
+        void *ptr;
+
+        if (!alloc) return NULL;
+        ptr = wine_anon_mmap( NULL, FAST_SYNC_CACHE_BLOCK_SIZE * sizeof(union fast_sync_cache_entry),
+                              PROT_READ | PROT_WRITE, 0 );
+        if (ptr == MAP_FAILED) return NULL;
+        if (interlocked_cmpxchg_ptr( (void **)&fast_sync_cache[entry], ptr, NULL ))
+            munmap( ptr, FAST_SYNC_CACHE_BLOCK_SIZE * sizeof(union fast_sync_cache_entry) );
+    }
+    return &fast_sync_cache[entry][idx % FAST_SYNC_CACHE_BLOCK_SIZE];
+}
+
+/* retrieve the location of an object in the shared area, FALSE if it has to go through the server */
+static BOOL get_fast_sync_info( HANDLE handle, ACCESS_MASK access, union fast_sync_cache_entry *ret_cache )
+{
+    union fast_sync_cache_entry *ptr, cache;
+    NTSTATUS ret;
+
+    if (!get_fast_sync_area()) return FALSE;
+    if (!(ptr = get_fast_sync_cache_entry( handle, TRUE ))) return FALSE;
+
+    if (!(cache.data = ptr->data))
+    {
+        SERVER_START_REQ( get_fast_sync_obj )
+        {
+            req->handle = wine_server_obj_handle( handle );
+            if (!(ret = wine_server_call( req )))
+            {
+                cache.s.index  = reply->index;
+                cache.s.type   = reply->type;
+                if (reply->index >= (reply->type == FAST_SYNC_COMPLETION ? FAST_COMPLETION_ENTRIES
+                                                                         : FAST_SYNC_ENTRIES))
+                    cache.s.type = FAST_SYNC_NONE;
+                cache.s.wait   = !!(reply->access & SYNCHRONIZE);
+                cache.s.modify = !!(reply->access & EVENT_MODIFY_STATE);
+                cache.s.valid  = 1;
+            }
+        }
+        SERVER_END_REQ;
+        /* let the server report invalid handles */
+        if (ret) return FALSE;
+        interlocked_xchg( &ptr->data, cache.data );
+    }
+
+    if (cache.s.type == FAST_SYNC_NONE) return FALSE;
+    if ((access & SYNCHRONIZE) && !cache.s.wait) return FALSE;
+    if ((access & EVENT_MODIFY_STATE) && !cache.s.modify) return FALSE;
+    *ret_cache = cache;
+    return TRUE;
+}
+
+/* retrieve the shared state of an object, or NULL if it has to go through the server */
+static struct fast_sync_entry *get_fast_sync_entry( HANDLE handle, ACCESS_MASK access,
+                                                    enum fast_sync_type *type )
+{
+    union fast_sync_cache_entry cache;
+
+    if (!get_fast_sync_info( handle, access, &cache )) return NULL;
+    if (cache.s.type == FAST_SYNC_COMPLETION) return NULL;
+    *type = cache.s.type;
+    return &fast_sync_area[cache.s.index];
+}
+
+/* retrieve the packet queue of a completion port, or NULL if it has to go through the server */
+static struct fast_completion *get_fast_completion( HANDLE handle )
+{
+    union fast_sync_cache_entry cache;
+
+    if (!get_fast_sync_info( handle, IO_COMPLETION_MODIFY_STATE, &cache )) return NULL;
+    if (cache.s.type != FAST_SYNC_COMPLETION) return NULL;
+    return (struct fast_completion *)(fast_sync_area + FAST_SYNC_ENTRIES) + cache.s.index;
+}
+
+/***********************************************************************
+ *           fast_sync_remove_from_cache
+ */
+void fast_sync_remove_from_cache( HANDLE handle )
+{
+    union fast_sync_cache_entry *ptr = get_fast_sync_cache_entry( handle, FALSE );
+
+    if (ptr) interlocked_xchg( &ptr->data, 0 );
+}
+
+static NTSTATUS fast_set_event( HANDLE handle, int state, LONG *prev_state )
+{
+    struct fast_sync_entry *entry;
+    enum fast_sync_type type;
+    int old;
+
+    if (!(entry = get_fast_sync_entry( handle, EVENT_MODIFY_STATE, &type )) || type != FAST_SYNC_EVENT)
+        return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        old = entry->state;
+        if (old & FAST_SYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+    } while (old != state && interlocked_cmpxchg( &entry->state, state, old ) != old);
+
+    if (state && !old) fast_sync_wake( entry );
+    if (prev_state) *prev_state = old;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fast_release_semaphore( HANDLE handle, ULONG count, ULONG *previous )
+{
+    struct fast_sync_entry *entry;
+    enum fast_sync_type type;
+    unsigned int cur;
+    int old;
+
+    if (!(entry = get_fast_sync_entry( handle, SEMAPHORE_MODIFY_STATE, &type )) || type != FAST_SYNC_SEMAPHORE)
+        return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        old = entry->state;
+        if (old & FAST_SYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+        cur = old & FAST_SYNC_STATE_MASK;
+        if (cur + count < cur || cur + count > entry->data) return STATUS_SEMAPHORE_LIMIT_EXCEEDED;
+    } while (interlocked_cmpxchg( &entry->state, old + count, old ) != old);
+
+    if (!cur) fast_sync_wake( entry );
+    if (previous) *previous = cur;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fast_release_mutex( HANDLE handle, LONG *prev_count )
+{
+    int tid = HandleToULong( NtCurrentTeb()->ClientId.UniqueThread );
+    struct fast_sync_entry *entry;
+    enum fast_sync_type type;
+    unsigned int count;
+    int old;
+
+    if (!(entry = get_fast_sync_entry( handle, 0, &type )) || type != FAST_SYNC_MUTEX)
+        return STATUS_NOT_IMPLEMENTED;
+
+    old = entry->state;
+    if (old & FAST_SYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+    if ((old & FAST_SYNC_STATE_MASK) != tid) return STATUS_MUTANT_NOT_OWNED;
+
+    /* only the owner changes the recursion count */
+    count = entry->data;
+    if (count > 1) entry->data = count - 1;
+    else
+    {
+        entry->data = 0;
+        if (interlocked_cmpxchg( &entry->state, old & ~FAST_SYNC_STATE_MASK, old ) != old)
+        {
+            /* server-side waiters showed up, let the server release it */
+            entry->data = count;
+            return STATUS_NOT_IMPLEMENTED;
+        }
+        fast_sync_wake( entry );
+    }
+    if (prev_count) *prev_count = 1 - count;
+    return STATUS_SUCCESS;
+}
+
+/* try to acquire an object; returns the wait status, STATUS_TIMEOUT with the current
+ * state in *old if it's not signaled, or STATUS_NOT_IMPLEMENTED to go through the server */
+static NTSTATUS fast_try_acquire( struct fast_sync_entry *entry, enum fast_sync_type type, int *old )
+{
+    int tid = HandleToULong( NtCurrentTeb()->ClientId.UniqueThread );
+    int new;
+
+    for (;;)
+    {
+        *old = entry->state;
+        if (*old & FAST_SYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+
+        switch (type)
+        {
+        case FAST_SYNC_EVENT:
+            if (!*old) return STATUS_TIMEOUT;
+            if (entry->data) return STATUS_WAIT_0;  /* manual reset */
+            new = 0;
+            break;
+        case FAST_SYNC_SEMAPHORE:
+            if (!*old) return STATUS_TIMEOUT;
+            new = *old - 1;
+            break;
+        case FAST_SYNC_MUTEX:
+            if ((*old & FAST_SYNC_STATE_MASK) == tid)
+            {
+                entry->data++;
+                return STATUS_WAIT_0;
+            }
+            if (*old & FAST_SYNC_STATE_MASK) return STATUS_TIMEOUT;
+            /* the server has to track the owner, see track_mutex() */
+            if (entry->thread != tid) return STATUS_NOT_IMPLEMENTED;
+            new = tid;  /* this also clears the abandoned flag */
+            break;
+        default:
+            return STATUS_NOT_IMPLEMENTED;
+        }
+
+        if (interlocked_cmpxchg( &entry->state, new, *old ) != *old) continue;
+        if (type != FAST_SYNC_MUTEX) return STATUS_WAIT_0;
+        /* another thread may have taken and released it through the server in the meantime;
+         * give it back, unless a server wait started, in which case the server tracks us */
+        if (entry->thread != tid && interlocked_cmpxchg( &entry->state, *old, new ) == new)
+        {
+            fast_sync_wake( entry );
+            return STATUS_NOT_IMPLEMENTED;
+        }
+        entry->data = 1;
+        return (*old & FAST_SYNC_ABANDONED) ? STATUS_ABANDONED_WAIT_0 : STATUS_WAIT_0;
+    }
+}
+
+/* check if an event was pulsed since *pulse was read; only one waiter takes an auto-reset pulse */
+static BOOL fast_event_pulsed( struct fast_sync_entry *entry, unsigned int *pulse )
+{
+    unsigned int cur;
+
+    for (;;)
+    {
+        cur = entry->pulse;
+        if (!((cur ^ *pulse) & ~1)) return FALSE;
+        if (entry->data) return TRUE;  /* manual reset */
+        if (!(cur & 1)) break;  /* another thread took it */
+        if (interlocked_cmpxchg( (LONG *)&entry->pulse, cur & ~1, cur ) == cur) return TRUE;
+    }
+    *pulse = cur;
+    return FALSE;
+}
+
+static NTSTATUS fast_wait_objects( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                                   BOOLEAN alertable, LARGE_INTEGER *timeout )
+{
+    struct fast_sync_entry *entry;
+    enum fast_sync_type type;
+    struct timespec ts;
+    LARGE_INTEGER now;
+    unsigned int pulse;
+    NTSTATUS ret;
+    DWORD i;
+    int old, seq;
+
+    /* APCs are only delivered by the server */
+    if (alertable || !count || count > MAXIMUM_WAIT_OBJECTS) return STATUS_NOT_IMPLEMENTED;
+
+    if (count > 1)
+    {
+        /* only polling for any object is supported */
+        if (!wait_any || !timeout || timeout->QuadPart) return STATUS_NOT_IMPLEMENTED;
+
+        for (i = 0; i < count; i++)
+            if (!get_fast_sync_entry( handles[i], SYNCHRONIZE, &type )) return STATUS_NOT_IMPLEMENTED;
+        for (i = 0; i < count; i++)
+        {
+            entry = get_fast_sync_entry( handles[i], SYNCHRONIZE, &type );
+            if ((ret = fast_try_acquire( entry, type, &old )) != STATUS_TIMEOUT)
+                return ret == STATUS_NOT_IMPLEMENTED ? ret : ret + i;
+        }
+        return STATUS_TIMEOUT;
+    }
+
+    if (!(entry = get_fast_sync_entry( handles[0], SYNCHRONIZE, &type ))) return STATUS_NOT_IMPLEMENTED;
+
+    /* use an absolute timeout, so that it can still be passed to the server after waiting a while */
+    if (timeout && timeout->QuadPart < 0)
+    {
+        NtQuerySystemTime( &now );
+        timeout->QuadPart = now.QuadPart - timeout->QuadPart;
+    }
+
+    pulse = entry->pulse;
+    for (;;)
+    {
+        seq = entry->seq;
+        if (type == FAST_SYNC_EVENT && fast_event_pulsed( entry, &pulse )) return STATUS_WAIT_0;
+        if ((ret = fast_try_acquire( entry, type, &old )) != STATUS_TIMEOUT) return ret;
+        if (timeout)
+        {
+            NtQuerySystemTime( &now );
+            if (now.QuadPart >= timeout->QuadPart) return STATUS_TIMEOUT;
+            timespec_from_timeout( &ts, timeout );
+        }
+        interlocked_xchg_add( &entry->waiters, 1 );
+        /* the server only reuses the entry of a destroyed object once it has no waiters */
+        if (get_fast_sync_entry( handles[0], SYNCHRONIZE, &type ) != entry)
+        {
+            interlocked_xchg_add( &entry->waiters, -1 );
+            return STATUS_NOT_IMPLEMENTED;
+        }
+        futex_wait_shared( &entry->seq, seq, timeout ? &ts : NULL );
+        interlocked_xchg_add( &entry->waiters, -1 );
+    }
+}
+
+#define FAST_COMPLETION_RETRIES 16  /* attempts at updating a queue position before going through the server */
+
+/* signed difference between two completion queue positions */
+static inline int completion_pos_diff( unsigned int a, unsigned int b )
+{
+    return (int)((a - b) << 2) >> 2;
+}
+
+/* queue a packet, fails if the queue is full or if it has to go through the server */
+static BOOL fast_completion_queue( struct fast_completion *fast, ULONG_PTR key, ULONG_PTR value,
+                                   NTSTATUS status, SIZE_T information )
+{
+    struct fast_completion_packet *packet;
+    unsigned int tail, i;
+
+    for (i = 0; ; i++)
+    {
+        if (i == FAST_COMPLETION_RETRIES) return FALSE;
+        tail = fast->tail;
+        if (tail & ~FAST_COMPLETION_POS_MASK) return FALSE;
+        packet = &fast->packets[tail % FAST_COMPLETION_PACKETS];
+        if (completion_pos_diff( packet->seq, tail ) < 0) return FALSE;
+        if (packet->seq == tail &&
+            interlocked_cmpxchg( (LONG *)&fast->tail, (tail + 1) & FAST_COMPLETION_POS_MASK, tail ) == tail)
+            break;
+    }
+    packet->ckey        = key;
+    packet->cvalue      = value;
+    packet->status      = status;
+    packet->information = information;
+    interlocked_xchg( (LONG *)&packet->seq, (tail + 1) & FAST_COMPLETION_POS_MASK );
+
+    interlocked_xchg_add( &fast->signal, 1 );
+    if (fast->waiters) futex_wake_shared( &fast->signal, 1 );
+    return TRUE;
+}
+
+/* remove a packet; returns 0 if there's none ready, -1 if it has to go through the server */
+static int fast_completion_remove( struct fast_completion *fast, FILE_IO_COMPLETION_INFORMATION *info )
+{
+    struct fast_completion_packet *packet;
+    unsigned int head, i;
+
+    for (i = 0; ; i++)
+    {
+        if (i == FAST_COMPLETION_RETRIES) return -1;
+        head = fast->head;
+        packet = &fast->packets[head % FAST_COMPLETION_PACKETS];
+        if (completion_pos_diff( packet->seq, head + 1 ) < 0) return 0;
+        if (packet->seq == ((head + 1) & FAST_COMPLETION_POS_MASK) &&
+            interlocked_cmpxchg( (LONG *)&fast->head, (head + 1) & FAST_COMPLETION_POS_MASK, head ) == head)
+            break;
+    }
+    info->CompletionKey             = packet->ckey;
+    info->CompletionValue           = packet->cvalue;
+    info->IoStatusBlock.Information = packet->information;
+    info->IoStatusBlock.u.Status    = packet->status;
+    interlocked_xchg( (LONG *)&packet->seq, (head + FAST_COMPLETION_PACKETS) & FAST_COMPLETION_POS_MASK );
+    return 1;
+}
+
+static NTSTATUS fast_set_completion( HANDLE port, ULONG_PTR key, ULONG_PTR value,
+                                     NTSTATUS status, SIZE_T information )
+{
+    struct fast_completion *fast;
+
+    if (!(fast = get_fast_completion( port ))) return STATUS_NOT_IMPLEMENTED;
+    if (!fast_completion_queue( fast, key, value, status, information )) return STATUS_NOT_IMPLEMENTED;
+
+    /* server threads that started waiting after the slot was reserved don't know about the packet */
+    if (fast->tail & FAST_COMPLETION_SERVER_WAIT)
+    {
+        SERVER_START_REQ( wake_completion )
+        {
+            req->handle = wine_server_obj_handle( port );
+            wine_server_call( req );
+        }
+        SERVER_END_REQ;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* remove up to count packets, waiting for the first one; alertable waits go through the server,
+ * which also returns the remaining packets after the ones already stored in *written */
+static NTSTATUS fast_remove_completion( HANDLE port, FILE_IO_COMPLETION_INFORMATION *info, ULONG count,
+                                        ULONG *written, BOOLEAN alertable, LARGE_INTEGER *timeout )
+{
+    struct fast_completion *fast;
+    struct timespec ts;
+    LARGE_INTEGER now;
+    ULONG i = 0;
+    int signal, ret = 0;
+
+    if (!(fast = get_fast_completion( port ))) return STATUS_NOT_IMPLEMENTED;
+
+    /* use an absolute timeout, so that it can still be passed to the server after waiting a while */
+    if (timeout && timeout->QuadPart < 0)
+    {
+        NtQuerySystemTime( &now );
+        timeout->QuadPart = now.QuadPart - timeout->QuadPart;
+    }
+
+    for (;;)
+    {
+        while (i < count && (ret = fast_completion_remove( fast, &info[i] )) > 0) i++;
+        *written = i;
+        /* the remaining packets, if any, are held by the server */
+        if (i && (i == count || ret < 0 || !(fast->tail & FAST_COMPLETION_OVERFLOW))) return STATUS_SUCCESS;
+        if (i || ret < 0 || alertable || (fast->tail & FAST_COMPLETION_OVERFLOW)) return STATUS_NOT_IMPLEMENTED;
+        if (timeout)
+        {
+            NtQuerySystemTime( &now );
+            if (now.QuadPart >= timeout->QuadPart) return STATUS_TIMEOUT;
+            timespec_from_timeout( &ts, timeout );
+        }
+        interlocked_xchg_add( &fast->waiters, 1 );
+        signal = fast->signal;
+        if ((ret = fast_completion_remove( fast, &info[0] )) > 0) i = 1;
+        else if (!ret && !(fast->tail & FAST_COMPLETION_OVERFLOW))
+            futex_wait_shared( &fast->signal, signal, timeout ? &ts : NULL );
+        interlocked_xchg_add( &fast->waiters, -1 );
+    }
+}
+
+#else  /* __linux__ */
+
+void fast_sync_remove_from_cache( HANDLE handle )
+{
+}
+
+static NTSTATUS fast_set_event( HANDLE handle, int state, LONG *prev_state )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_release_semaphore( HANDLE handle, ULONG count, ULONG *previous )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_release_mutex( HANDLE handle, LONG *prev_count )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_wait_objects( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                                   BOOLEAN alertable, LARGE_INTEGER *timeout )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_set_completion( HANDLE port, ULONG_PTR key, ULONG_PTR value,
+                                     NTSTATUS status, SIZE_T information )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_remove_completion( HANDLE port, FILE_IO_COMPLETION_INFORMATION *info, ULONG count,
+                                        ULONG *written, BOOLEAN alertable, LARGE_INTEGER *timeout )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+#endif  /* __linux__ */
+
 /* creates a struct security_descriptor and contained information in one contiguous piece of memory */
 NTSTATUS alloc_object_attributes( const OBJECT_ATTRIBUTES *attr, struct object_attributes **ret,
                                   data_size_t *ret_len )
@@ -329,6 +893,10 @@ NTSTATUS WINAPI NtQuerySemaphore( HANDLE handle, SEMAPHORE_INFORMATION_CLASS cla
 NTSTATUS WINAPI NtReleaseSemaphore( HANDLE handle, ULONG count, PULONG previous )
 {
     NTSTATUS ret;
+
+    if ((ret = fast_release_semaphore( handle, count, previous )) != STATUS_NOT_IMPLEMENTED)
+        return ret;
+
     SERVER_START_REQ( release_semaphore )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -406,6 +974,9 @@ NTSTATUS WINAPI NtOpenEvent( HANDLE *handle, ACCESS_MASK access, const OBJECT_AT
 NTSTATUS WINAPI NtSetEvent( HANDLE handle, LONG *prev_state )
 {
     NTSTATUS ret;
+
+    if ((ret = fast_set_event( handle, 1, prev_state )) != STATUS_NOT_IMPLEMENTED) return ret;
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -423,6 +994,9 @@ NTSTATUS WINAPI NtSetEvent( HANDLE handle, LONG *prev_state )
 NTSTATUS WINAPI NtResetEvent( HANDLE handle, LONG *prev_state )
 {
     NTSTATUS ret;
+
+    if ((ret = fast_set_event( handle, 0, prev_state )) != STATUS_NOT_IMPLEMENTED) return ret;
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -566,6 +1140,8 @@ NTSTATUS WINAPI NtReleaseMutant( IN HANDLE handle, OUT PLONG prev_count OPTIONAL
 {
     NTSTATUS    status;
 
+    if ((status = fast_release_mutex( handle, prev_count )) != STATUS_NOT_IMPLEMENTED) return status;
+
     SERVER_START_REQ( release_mutex )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -1085,9 +1661,16 @@ static NTSTATUS wait_objects( DWORD count, const HANDLE *handles,
 {
     select_op_t select_op;
     UINT i, flags = SELECT_INTERRUPTIBLE;
+    LARGE_INTEGER fast_timeout;
+    NTSTATUS ret;
 
     if (!count || count > MAXIMUM_WAIT_OBJECTS) return STATUS_INVALID_PARAMETER_1;
 
+    if (timeout) fast_timeout = *timeout;
+    ret = fast_wait_objects( count, handles, wait_any, alertable, timeout ? &fast_timeout : NULL );
+    if (ret != STATUS_NOT_IMPLEMENTED) return ret;
+    if (timeout) timeout = &fast_timeout;
+
     if (alertable) flags |= SELECT_ALERTABLE;
     select_op.wait.op = wait_any ? SELECT_WAIT : SELECT_WAIT_ALL;
     for (i = 0; i < count; i++) select_op.wait.handles[i] = wine_server_obj_handle( handles[i] );
@@ -1338,6 +1921,10 @@ NTSTATUS WINAPI NtSetIoCompletion( HANDLE CompletionPort, ULONG_PTR CompletionKe
     TRACE("(%p, %lx, %lx, %x, %lx)\n", CompletionPort, CompletionKey,
           CompletionValue, Status, NumberOfBytesTransferred);
 
+    if ((status = fast_set_completion( CompletionPort, CompletionKey, CompletionValue, Status,
+                                       NumberOfBytesTransferred )) != STATUS_NOT_IMPLEMENTED)
+        return status;
+
     SERVER_START_REQ( add_completion )
     {
         req->handle      = wine_server_obj_handle( CompletionPort );
@@ -1369,11 +1956,25 @@ NTSTATUS WINAPI NtRemoveIoCompletion( HANDLE CompletionPort, PULONG_PTR Completi
                                       PULONG_PTR CompletionValue, PIO_STATUS_BLOCK iosb,
                                       PLARGE_INTEGER WaitTime )
 {
+    FILE_IO_COMPLETION_INFORMATION info;
+    LARGE_INTEGER fast_timeout;
     NTSTATUS status;
+    ULONG count;
 
     TRACE("(%p, %p, %p, %p, %p)\n", CompletionPort, CompletionKey,
           CompletionValue, iosb, WaitTime);
 
+    if (WaitTime) fast_timeout = *WaitTime;
+    status = fast_remove_completion( CompletionPort, &info, 1, &count, FALSE, WaitTime ? &fast_timeout : NULL );
+    if (status == STATUS_SUCCESS)
+    {
+        *CompletionKey   = info.CompletionKey;
+        *CompletionValue = info.CompletionValue;
+        *iosb            = info.IoStatusBlock;
+    }
+    if (status != STATUS_NOT_IMPLEMENTED) return status;
+    if (WaitTime) WaitTime = &fast_timeout;
+
     for(;;)
     {
         SERVER_START_REQ( remove_completion )
@@ -1403,11 +2004,21 @@ NTSTATUS WINAPI NtRemoveIoCompletion( HANDLE CompletionPort, PULONG_PTR Completi
 NTSTATUS WINAPI NtRemoveIoCompletionEx( HANDLE port, FILE_IO_COMPLETION_INFORMATION *info, ULONG count,
                                         ULONG *written, LARGE_INTEGER *timeout, BOOLEAN alertable )
 {
+    LARGE_INTEGER fast_timeout;
     NTSTATUS ret;
     ULONG i = 0;
 
     TRACE("%p %p %u %p %p %u\n", port, info, count, written, timeout, alertable);
 
+    if (timeout) fast_timeout = *timeout;
+    ret = fast_remove_completion( port, info, count, &i, alertable, timeout ? &fast_timeout : NULL );
+    if (ret != STATUS_NOT_IMPLEMENTED)
+    {
+        *written = i ? i : 1;
+        return ret;
+    }
+    if (timeout) timeout = &fast_timeout;
+
     for (;;)
     {
         while (i < count)
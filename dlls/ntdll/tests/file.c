@@ -917,9 +917,9 @@ static void WINAPI user_apc_proc(ULONG_PTR arg)
 
 static void test_set_io_completion(void)
 {
-    FILE_IO_COMPLETION_INFORMATION info[2] = {{0}};
+    FILE_IO_COMPLETION_INFORMATION info[2] = {{0}}, many[256];
     LARGE_INTEGER timeout = {{0}};
-    unsigned int apc_count;
+    unsigned int apc_count, i;
     IO_STATUS_BLOCK iosb;
     ULONG_PTR key, value;
     NTSTATUS res;
@@ -1051,6 +1051,41 @@ static void test_set_io_completion(void)
 
     SleepEx( 1, TRUE );
 
+    for (i = 0; i < 200; i++)
+    {
+        res = pNtSetIoCompletion( h, i, i + 1, 789, size );
+        ok( res == STATUS_SUCCESS, "NtSetIoCompletion failed: %#x\n", res );
+    }
+
+    count = get_pending_msgs(h);
+    ok( count == 200, "Unexpected msg count: %d\n", count );
+
+    count = 0xdeadbeef;
+    res = pNtRemoveIoCompletionEx( h, many, 150, &count, &timeout, FALSE );
+    ok( res == STATUS_SUCCESS, "NtRemoveIoCompletionEx failed: %#x\n", res );
+    ok( count == 150, "wrong count %u\n", count );
+    for (i = 0; i < count; i++)
+    {
+        ok( many[i].CompletionKey == i, "%u: wrong key %#lx\n", i, many[i].CompletionKey );
+        ok( many[i].CompletionValue == i + 1, "%u: wrong value %#lx\n", i, many[i].CompletionValue );
+    }
+
+    res = pNtSetIoCompletion( h, 200, 201, 789, size );
+    ok( res == STATUS_SUCCESS, "NtSetIoCompletion failed: %#x\n", res );
+
+    count = 0xdeadbeef;
+    res = pNtRemoveIoCompletionEx( h, many, ARRAY_SIZE(many), &count, &timeout, FALSE );
+    ok( res == STATUS_SUCCESS, "NtRemoveIoCompletionEx failed: %#x\n", res );
+    ok( count == 51, "wrong count %u\n", count );
+    for (i = 0; i < count; i++)
+    {
+        ok( many[i].CompletionKey == i + 150, "%u: wrong key %#lx\n", i, many[i].CompletionKey );
+        ok( many[i].CompletionValue == i + 151, "%u: wrong value %#lx\n", i, many[i].CompletionValue );
+    }
+
+    count = get_pending_msgs(h);
+    ok( !count, "Unexpected msg count: %d\n", count );
+
     pNtClose( h );
 }
 
@@ -3480,6 +3515,91 @@ static void _test_completion_flags(unsigned line, HANDLE handle, DWORD expected_
                        "got %08x\n", info.Flags);
 }
 
+static void test_close_pending_io(void)
+{
+    static const char data[] = "testdata";
+    char buf[sizeof(data)];
+    IO_STATUS_BLOCK iosb, io;
+    LARGE_INTEGER offset, timeout;
+    HANDLE handle, dup, event, port;
+    ULONG_PTR key, value;
+    NTSTATUS status;
+    DWORD ret;
+
+    if (!(handle = create_temp_file( FILE_FLAG_OVERLAPPED ))) return;
+    event = CreateEventA( NULL, TRUE, FALSE, NULL );
+    port = CreateIoCompletionPort( handle, NULL, CKEY_FIRST, 0 );
+    ok( port != NULL, "CreateIoCompletionPort failed, error %u\n", GetLastError() );
+    timeout.QuadPart = -10000000;
+    offset.QuadPart = 0;
+
+    /* the handle used for the I/O is closed before the completion is reported */
+    ret = DuplicateHandle( GetCurrentProcess(), handle, GetCurrentProcess(), &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( ret, "DuplicateHandle failed, error %u\n", GetLastError() );
+    U(iosb).Status = 0xdeadbabe;
+    iosb.Information = 0xdeadbeef;
+    status = pNtWriteFile( dup, event, NULL, (void *)CVALUE_FIRST, &iosb, data, sizeof(data), &offset, NULL );
+    ok( status == STATUS_PENDING || status == STATUS_SUCCESS, "NtWriteFile returned %08x\n", status );
+    CloseHandle( dup );
+
+    status = pNtRemoveIoCompletion( port, &key, &value, &io, &timeout );
+    ok( status == STATUS_SUCCESS, "NtRemoveIoCompletion returned %08x\n", status );
+    ok( key == CKEY_FIRST, "wrong key %lx\n", key );
+    ok( value == CVALUE_FIRST, "wrong value %lx\n", value );
+    ok( U(io).Status == STATUS_SUCCESS, "wrong status %08x\n", U(io).Status );
+    ok( io.Information == sizeof(data), "wrong information %lu\n", io.Information );
+    ok( U(iosb).Status == STATUS_SUCCESS, "wrong status %08x\n", U(iosb).Status );
+    ok( iosb.Information == sizeof(data), "wrong information %lu\n", iosb.Information );
+
+    ret = DuplicateHandle( GetCurrentProcess(), handle, GetCurrentProcess(), &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( ret, "DuplicateHandle failed, error %u\n", GetLastError() );
+    memset( buf, 0, sizeof(buf) );
+    U(iosb).Status = 0xdeadbabe;
+    iosb.Information = 0xdeadbeef;
+    status = pNtReadFile( dup, event, NULL, (void *)CVALUE_FIRST, &iosb, buf, sizeof(buf), &offset, NULL );
+    ok( status == STATUS_PENDING || status == STATUS_SUCCESS, "NtReadFile returned %08x\n", status );
+    CloseHandle( dup );
+
+    ret = WaitForSingleObject( event, 1000 );
+    ok( ret == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", ret );
+    ok( U(iosb).Status == STATUS_SUCCESS, "wrong status %08x\n", U(iosb).Status );
+    ok( iosb.Information == sizeof(data), "wrong information %lu\n", iosb.Information );
+    ok( !memcmp( buf, data, sizeof(data) ), "wrong data %s\n", debugstr_an( buf, sizeof(buf) ));
+
+    status = pNtRemoveIoCompletion( port, &key, &value, &io, &timeout );
+    ok( status == STATUS_SUCCESS, "NtRemoveIoCompletion returned %08x\n", status );
+    ok( key == CKEY_FIRST, "wrong key %lx\n", key );
+    ok( value == CVALUE_FIRST, "wrong value %lx\n", value );
+    ok( U(io).Status == STATUS_SUCCESS, "wrong status %08x\n", U(io).Status );
+    ok( io.Information == sizeof(data), "wrong information %lu\n", io.Information );
+
+    CloseHandle( port );
+    CloseHandle( event );
+    CloseHandle( handle );
+}
+
+static void test_io_uring(void)
+{
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    char cmdline[MAX_PATH];
+    char **argv;
+    BOOL ret;
+
+    /* overlapped I/O at an offset goes through io_uring in the child process in Wine */
+    winetest_get_mainargs( &argv );
+    sprintf( cmdline, "%s file io_uring", argv[0] );
+    SetEnvironmentVariableA( "WINEIOURING", "1" );
+    ret = CreateProcessA( NULL, cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi );
+    SetEnvironmentVariableA( "WINEIOURING", NULL );
+    ok( ret, "CreateProcess failed, error %u\n", GetLastError() );
+    if (!ret) return;
+
+    wait_child_process( pi.hProcess );
+    CloseHandle( pi.hProcess );
+    CloseHandle( pi.hThread );
+}
+
 static void test_file_completion_information(void)
 {
     DECLSPEC_ALIGN(TEST_OVERLAPPED_READ_SIZE) static unsigned char aligned_buf[TEST_OVERLAPPED_READ_SIZE];
@@ -4953,6 +5073,8 @@ static void test_file_readonly_access(void)
 
 START_TEST(file)
 {
+    char **argv;
+    int argc;
     HMODULE hkernel32 = GetModuleHandleA("kernel32.dll");
     HMODULE hntdll = GetModuleHandleA("ntdll.dll");
     if (!hntdll)
@@ -4992,6 +5114,13 @@ START_TEST(file)
     pNtQueryFullAttributesFile = (void *)GetProcAddress(hntdll, "NtQueryFullAttributesFile");
     pNtFlushBuffersFile = (void *)GetProcAddress(hntdll, "NtFlushBuffersFile");
 
+    argc = winetest_get_mainargs(&argv);
+    if (argc >= 3 && !strcmp(argv[2], "io_uring"))
+    {
+        test_close_pending_io();
+        return;
+    }
+
     test_read_write();
     test_NtCreateFile();
     create_file_test();
@@ -5012,6 +5141,8 @@ START_TEST(file)
     test_file_link_information();
     test_file_disposition_information();
     test_file_completion_information();
+    test_close_pending_io();
+    test_io_uring();
     test_file_id_information();
     test_file_access_information();
     test_file_attribute_tag_information();
@@ -1583,6 +1583,43 @@ static void test_query_object(void)
 
 }
 
+static void test_handle_flags(void)
+{
+    OBJECT_DATA_INFORMATION info;
+    HANDLE handle, dup;
+    NTSTATUS status;
+    ULONG len;
+    BOOL ret;
+
+    handle = CreateEventA( NULL, FALSE, FALSE, NULL );
+    ok( handle != 0, "CreateEvent failed %u\n", GetLastError() );
+
+    len = 0;
+    status = pNtQueryObject( handle, ObjectDataInformation, &info, sizeof(info), &len );
+    ok( status == STATUS_SUCCESS, "NtQueryObject failed %x\n", status );
+    ok( len == sizeof(info), "unexpected len %u\n", len );
+    ok( !info.InheritHandle, "got InheritHandle %d\n", info.InheritHandle );
+    ok( !info.ProtectFromClose, "got ProtectFromClose %d\n", info.ProtectFromClose );
+
+    ret = SetHandleInformation( handle, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT );
+    ok( ret, "SetHandleInformation failed %u\n", GetLastError() );
+    status = pNtQueryObject( handle, ObjectDataInformation, &info, sizeof(info), NULL );
+    ok( status == STATUS_SUCCESS, "NtQueryObject failed %x\n", status );
+    ok( info.InheritHandle, "got InheritHandle %d\n", info.InheritHandle );
+    ok( !info.ProtectFromClose, "got ProtectFromClose %d\n", info.ProtectFromClose );
+
+    test_object_type( handle, "Event" );
+    pNtClose( handle );
+
+    status = pNtQueryObject( handle, ObjectDataInformation, &info, sizeof(info), NULL );
+    ok( status == STATUS_INVALID_HANDLE, "NtQueryObject returned %x\n", status );
+
+    SetLastError( 0xdeadbeef );
+    ret = DuplicateHandle( GetCurrentProcess(), handle, GetCurrentProcess(), &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( !ret, "DuplicateHandle succeeded\n" );
+    ok( GetLastError() == ERROR_INVALID_HANDLE, "got error %u\n", GetLastError() );
+}
+
 static void test_type_mismatch(void)
 {
     HANDLE h;
@@ -2215,6 +2252,7 @@ START_TEST(om)
     test_directory();
     test_symboliclink();
     test_query_object();
+    test_handle_flags();
     test_type_mismatch();
     test_event();
     test_mutant();
@@ -2391,11 +2391,45 @@ static void test_security_info(void)
     HeapFree(GetProcessHeap(), 0, local_sid);
 }
 
+static void test_pipe_sockets(void)
+{
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    char cmdline[MAX_PATH];
+    char **argv;
+    BOOL ret;
+
+    /* the pipes of the child process use socket pairs for byte mode connections in Wine */
+    winetest_get_mainargs(&argv);
+    sprintf(cmdline, "%s pipe sockets", argv[0]);
+    SetEnvironmentVariableA("WINEPIPESOCKETS", "1");
+    ret = CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi);
+    SetEnvironmentVariableA("WINEPIPESOCKETS", NULL);
+    ok(ret, "CreateProcess failed: %u\n", GetLastError());
+    if (!ret) return;
+
+    wait_child_process(pi.hProcess);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+}
+
 START_TEST(pipe)
 {
+    char **argv;
+    int argc;
+
     if (!init_func_ptrs())
         return;
 
+    argc = winetest_get_mainargs(&argv);
+    if (argc >= 3 && !strcmp(argv[2], "sockets"))
+    {
+        pipe_for_each_state(create_pipe_server, connect_pipe, test_pipe_state);
+        pipe_for_each_state(create_pipe_server, connect_and_write_pipe, test_pipe_with_data_state);
+        pipe_for_each_state(create_local_info_test_pipe, connect_pipe_reader, test_pipe_local_info);
+        return;
+    }
+
     trace("starting invalid create tests\n");
     test_create_invalid();
 
@@ -2448,4 +2482,5 @@ START_TEST(pipe)
     pipe_for_each_state(create_pipe_server, connect_pipe, test_pipe_state);
     pipe_for_each_state(create_pipe_server, connect_and_write_pipe, test_pipe_with_data_state);
     pipe_for_each_state(create_local_info_test_pipe, connect_pipe_reader, test_pipe_local_info);
+    test_pipe_sockets();
 }
@@ -3261,6 +3261,26 @@ static void test_RtlInitializeCriticalSectionEx(void)
     ok(cs.SpinCount == 0 || broken(cs.SpinCount != 0) /* >= Win 8 */,
        "expected SpinCount == 0, got %ld\n", cs.SpinCount);
     RtlDeleteCriticalSection(&cs);
+
+    memset(&cs, 0x11, sizeof(cs));
+    pRtlInitializeCriticalSectionEx(&cs, 4000, RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN);
+    ok(cs.LockCount == -1, "expected LockCount == -1, got %d\n", cs.LockCount);
+    ok(cs.RecursionCount == 0, "expected RecursionCount == 0, got %d\n", cs.RecursionCount);
+    ok(cs.LockSemaphore == NULL, "expected LockSemaphore == NULL, got %p\n", cs.LockSemaphore);
+    if (NtCurrentTeb()->Peb->NumberOfProcessors > 1)
+        ok(((cs.SpinCount & RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN) && (cs.SpinCount & 0xffffff)) ||
+           broken(cs.SpinCount == 4000) /* Windows */,
+           "expected dynamic SpinCount, got %#lx\n", cs.SpinCount);
+    else
+        ok(cs.SpinCount == 0, "expected SpinCount == 0, got %#lx\n", cs.SpinCount);
+    RtlEnterCriticalSection(&cs);
+    ok(RtlTryEnterCriticalSection(&cs), "RtlTryEnterCriticalSection failed\n");
+    ok(cs.RecursionCount == 2, "expected RecursionCount == 2, got %d\n", cs.RecursionCount);
+    RtlLeaveCriticalSection(&cs);
+    RtlLeaveCriticalSection(&cs);
+    ok(cs.LockCount == -1, "expected LockCount == -1, got %d\n", cs.LockCount);
+    ok(cs.RecursionCount == 0, "expected RecursionCount == 0, got %d\n", cs.RecursionCount);
+    RtlDeleteCriticalSection(&cs);
 }
 
 static void test_RtlLeaveCriticalSection(void)
@@ -714,6 +714,126 @@ static void test_tp_work_scheduler(void)
     pTpReleasePool(pool);
 }
 
+static TP_WORK *nested_work;
+
+static void CALLBACK nested_parent_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    int i;
+    trace("Running nested parent callback\n");
+    for (i = 0; i < 10; i++)
+        pTpPostWork(nested_work);
+    InterlockedIncrement((LONG *)userdata);
+}
+
+static void CALLBACK nested_child_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    InterlockedExchangeAdd((LONG *)userdata, 0x10000);
+}
+
+static void CALLBACK nested_wait_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    HANDLE event = userdata;
+    DWORD result;
+    trace("Running nested wait callback\n");
+    result = WaitForSingleObject(event, 5000);
+    ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+}
+
+static void CALLBACK nested_set_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    HANDLE event = userdata;
+    trace("Running nested set callback\n");
+    SetEvent(event);
+}
+
+static void test_tp_work_nested(void)
+{
+    TP_CALLBACK_ENVIRON environment;
+    TP_WORK *work, *work2, *work3;
+    TP_POOL *pool;
+    NTSTATUS status;
+    LONG userdata;
+    HANDLE event, event2;
+    int i;
+
+    event = CreateEventW(NULL, TRUE, FALSE, NULL);
+    ok(event != NULL, "CreateEvent failed with error %u\n", GetLastError());
+    event2 = CreateEventW(NULL, TRUE, FALSE, NULL);
+    ok(event2 != NULL, "CreateEvent failed with error %u\n", GetLastError());
+
+    /* allocate new threadpool */
+    pool = NULL;
+    status = pTpAllocPool(&pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    ok(pool != NULL, "expected pool != NULL\n");
+
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = pool;
+    work = NULL;
+    status = pTpAllocWork(&work, nested_parent_cb, &userdata, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    ok(work != NULL, "expected work != NULL\n");
+    nested_work = NULL;
+    status = pTpAllocWork(&nested_work, nested_child_cb, &userdata, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    ok(nested_work != NULL, "expected work != NULL\n");
+
+    /* work items posted from a callback are executed */
+    userdata = 0;
+    for (i = 0; i < 100; i++)
+        pTpPostWork(work);
+    pTpWaitForWork(work, FALSE);
+    pTpWaitForWork(nested_work, FALSE);
+    ok((userdata & 0xffff) == 100, "expected userdata & 0xffff = 100, got %u\n", userdata & 0xffff);
+    ok((userdata >> 16) == 1000, "expected userdata >> 16 = 1000, got %u\n", userdata >> 16);
+
+    pTpReleaseWork(work);
+    pTpReleaseWork(nested_work);
+
+    /* a blocked callback doesn't prevent other work items from running */
+    work = NULL;
+    status = pTpAllocWork(&work, nested_wait_cb, event, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    ok(work != NULL, "expected work != NULL\n");
+    work2 = NULL;
+    status = pTpAllocWork(&work2, nested_set_cb, event, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    ok(work2 != NULL, "expected work2 != NULL\n");
+
+    pTpPostWork(work);
+    Sleep(100);
+    pTpPostWork(work2);
+    pTpWaitForWork(work, FALSE);
+    pTpWaitForWork(work2, FALSE);
+    ok(WaitForSingleObject(event, 0) == WAIT_OBJECT_0, "expected event to be signaled\n");
+
+    /* dependent work items posted back to back while another worker is blocked */
+    work3 = NULL;
+    status = pTpAllocWork(&work3, nested_wait_cb, event2, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    ok(work3 != NULL, "expected work3 != NULL\n");
+
+    ResetEvent(event);
+    pTpPostWork(work3);
+    Sleep(100);
+    pTpPostWork(work);
+    pTpPostWork(work2);
+    pTpWaitForWork(work, FALSE);
+    pTpWaitForWork(work2, FALSE);
+    ok(WaitForSingleObject(event, 0) == WAIT_OBJECT_0, "expected event to be signaled\n");
+    SetEvent(event2);
+    pTpWaitForWork(work3, FALSE);
+
+    /* cleanup */
+    pTpReleaseWork(work);
+    pTpReleaseWork(work2);
+    pTpReleaseWork(work3);
+    pTpReleasePool(pool);
+    CloseHandle(event);
+    CloseHandle(event2);
+}
+
 static void CALLBACK simple_release_cb(TP_CALLBACK_INSTANCE *instance, void *userdata)
 {
     HANDLE *semaphores = userdata;
@@ -1413,6 +1533,87 @@ static void test_tp_timer(void)
     CloseHandle(semaphore);
 }
 
+struct timer_order_info
+{
+    HANDLE semaphore;
+    LONG index;
+    LONG order[10];
+};
+
+static struct timer_order_info timer_order;
+
+static void CALLBACK timer_order_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_TIMER *timer)
+{
+    LONG index = InterlockedIncrement(&timer_order.index) - 1;
+    if (index < ARRAY_SIZE(timer_order.order))
+        timer_order.order[index] = (LONG_PTR)userdata;
+    ReleaseSemaphore(timer_order.semaphore, 1, NULL);
+}
+
+static void test_tp_timer_order(void)
+{
+    TP_CALLBACK_ENVIRON environment;
+    TP_TIMER *timers[10];
+    LARGE_INTEGER when;
+    NTSTATUS status;
+    TP_POOL *pool;
+    DWORD result;
+    int i;
+
+    timer_order.semaphore = CreateSemaphoreA(NULL, 0, ARRAY_SIZE(timers), NULL);
+    ok(timer_order.semaphore != NULL, "CreateSemaphoreA failed %u\n", GetLastError());
+
+    /* allocate new threadpool with only one thread */
+    pool = NULL;
+    status = pTpAllocPool(&pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    ok(pool != NULL, "expected pool != NULL\n");
+    pTpSetPoolMaxThreads(pool, 1);
+
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = pool;
+
+    for (i = 0; i < ARRAY_SIZE(timers); i++)
+    {
+        timers[i] = NULL;
+        status = pTpAllocTimer(&timers[i], timer_order_cb, (void *)(LONG_PTR)i, &environment);
+        ok(!status, "TpAllocTimer failed with status %x\n", status);
+        ok(timers[i] != NULL, "expected timers[%u] != NULL\n", i);
+    }
+
+    /* timers set in reverse order expire in the order of their timeouts,
+     * the first timer is moved to the end when set again */
+    timer_order.index = 0;
+    for (i = ARRAY_SIZE(timers) - 1; i >= 0; i--)
+    {
+        when.QuadPart = (LONGLONG)(i + 1) * -30 * 10000;
+        pTpSetTimer(timers[i], &when, 0, 0);
+    }
+    when.QuadPart = (LONGLONG)(ARRAY_SIZE(timers) + 1) * -30 * 10000;
+    pTpSetTimer(timers[0], &when, 0, 0);
+
+    for (i = 0; i < ARRAY_SIZE(timers); i++)
+    {
+        result = WaitForSingleObject(timer_order.semaphore, 1000);
+        ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+    }
+    ok(timer_order.index == ARRAY_SIZE(timers), "expected %u callbacks, got %u\n",
+       (DWORD)ARRAY_SIZE(timers), timer_order.index);
+    for (i = 0; i < ARRAY_SIZE(timers); i++)
+        ok(timer_order.order[i] == (i + 1) % ARRAY_SIZE(timers), "expected timer %u at position %u, got %u\n",
+           (DWORD)((i + 1) % ARRAY_SIZE(timers)), i, timer_order.order[i]);
+
+    /* cleanup */
+    for (i = 0; i < ARRAY_SIZE(timers); i++)
+    {
+        pTpWaitForTimer(timers[i], FALSE);
+        pTpReleaseTimer(timers[i]);
+    }
+    pTpReleasePool(pool);
+    CloseHandle(timer_order.semaphore);
+}
+
 struct window_length_info
 {
     HANDLE semaphore;
@@ -1917,11 +2118,13 @@ START_TEST(threadpool)
     test_tp_simple();
     test_tp_work();
     test_tp_work_scheduler();
+    test_tp_work_nested();
     test_tp_group_wait();
     test_tp_group_cancel();
     test_tp_instance();
     test_tp_disassociate();
     test_tp_timer();
+    test_tp_timer_order();
     test_tp_window_length();
     test_tp_wait();
     test_tp_multi_wait();
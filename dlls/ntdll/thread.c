@@ -295,10 +295,13 @@ TEB *thread_init(void)
     thread_data->reply_fd   = -1;
     thread_data->wait_fd[0] = -1;
     thread_data->wait_fd[1] = -1;
+    thread_data->request_shm = NULL;
 
     signal_init_thread( teb );
     virtual_init_threading();
     debug_init();
+    zygote_init();
+    virtual_init_write_watches();
     set_process_name( __wine_main_argc, __wine_main_argv );
 
     /* initialize time values in user_shared_data */
@@ -360,6 +363,8 @@ void exit_thread( int status )
     close( ntdll_get_thread_data()->wait_fd[1] );
     close( ntdll_get_thread_data()->reply_fd );
     close( ntdll_get_thread_data()->request_fd );
+    if (ntdll_get_thread_data()->request_shm)
+        munmap( ntdll_get_thread_data()->request_shm, REQUEST_SHM_SIZE );
     pthread_exit( UIntToPtr(status) );
 }
 
@@ -575,6 +580,7 @@ NTSTATUS WINAPI RtlCreateUserThread( HANDLE process, SECURITY_DESCRIPTOR *descr,
     thread_data->reply_fd    = -1;
     thread_data->wait_fd[0]  = -1;
     thread_data->wait_fd[1]  = -1;
+    thread_data->request_shm = NULL;
     thread_data->start_stack = (char *)teb->Tib.StackBase;
 
     pthread_attr_init( &attr );
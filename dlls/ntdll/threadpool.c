@@ -33,6 +33,7 @@
 
 #include "wine/debug.h"
 #include "wine/list.h"
+#include "wine/rbtree.h"
 
 #include "ntdll_misc.h"
 
@@ -88,7 +89,7 @@ struct timer_queue;
 struct queue_timer
 {
     struct timer_queue *q;
-    struct list entry;
+    struct wine_rb_entry entry;
     ULONG runcount;             /* number of callbacks pending execution */
     RTL_WAITORTIMERCALLBACKFUNC callback;
     PVOID param;
@@ -103,7 +104,7 @@ struct timer_queue
 {
     DWORD magic;
     RTL_CRITICAL_SECTION cs;
-    struct list timers;         /* sorted by expiration time */
+    struct wine_rb_tree timers; /* sorted by expiration time, destroyed timers last */
     BOOL quit;                  /* queue should be deleted; once set, never unset */
     HANDLE event;
     HANDLE thread;
@@ -114,8 +115,29 @@ struct timer_queue
  */
 
 #define THREADPOOL_WORKER_TIMEOUT 5000
+#define THREADPOOL_MAX_QUEUES     64
 #define MAXIMUM_WAITQUEUE_OBJECTS (MAXIMUM_WAIT_OBJECTS - 1)
 
+/*
+ * Pending work items are kept in per-worker queues. A worker pushes the
+ * objects it submits at the head of its own queue and takes work from the
+ * head, so that related work items run in LIFO order on the same thread.
+ * Objects submitted from other threads are distributed among the queues
+ * that have a worker. A worker whose queue is empty steals work from the
+ * tail of the other queues before going to sleep.
+ *
+ * All the pending callbacks of an object are kept in the same queue, in
+ * object->queue, which can only be changed with the queue lock held.
+ */
+struct threadpool_queue
+{
+    RTL_SRWLOCK             lock;
+    /* Pending objects, locked via .lock, order matches TP_CALLBACK_PRIORITY - high, normal, low. */
+    struct list             pools[3];
+    /* number of workers using this queue, locked via pool->cs */
+    int                     num_workers;
+};
+
 /* internal threadpool representation */
 struct threadpool
 {
@@ -123,17 +145,30 @@ struct threadpool
     LONG                    objcount;
     BOOL                    shutdown;
     CRITICAL_SECTION        cs;
-    /* Pools of work items, locked via .cs, order matches TP_CALLBACK_PRIORITY - high, normal, low. */
-    struct list             pools[3];
+    /* queues of work items, see above */
+    struct threadpool_queue *queues;
+    unsigned int            num_queues;
+    LONG                    next_queue;
+    LONG                    num_queued;
     RTL_CONDITION_VARIABLE  update_event;
     /* information about worker threads, locked via .cs */
     int                     max_workers;
     int                     min_workers;
     int                     num_workers;
-    int                     num_busy_workers;
+    /* information about worker threads, updated with interlocked operations */
+    LONG                    num_busy_workers;
+    LONG                    num_idle_workers;
+    LONG                    num_starting_workers;
     TP_POOL_STACK_INFORMATION stack_info;
 };
 
+/* information about the worker running on the current thread */
+struct threadpool_worker
+{
+    struct threadpool       *pool;
+    struct threadpool_queue *queue;
+};
+
 enum threadpool_objtype
 {
     TP_OBJECT_TYPE_SIMPLE,
@@ -160,11 +195,13 @@ struct threadpool_object
     /* information about the group, locked via .group->cs */
     struct list             group_entry;
     BOOL                    is_group_member;
-    /* information about the pool, locked via .pool->cs */
+    /* information about the pool, locked via .queue->lock */
+    struct threadpool_queue *queue;
     struct list             pool_entry;
+    LONG                    num_pending_callbacks;
+    /* waited upon via .pool->cs, counters are updated with interlocked operations */
     RTL_CONDITION_VARIABLE  finished_event;
     RTL_CONDITION_VARIABLE  group_finished_event;
-    LONG                    num_pending_callbacks;
     LONG                    num_running_callbacks;
     LONG                    num_associated_callbacks;
     /* arguments for callback */
@@ -184,7 +221,7 @@ struct threadpool_object
             /* information about the timer, locked via timerqueue.cs */
             BOOL            timer_initialized;
             BOOL            timer_pending;
-            struct list     timer_entry;
+            struct wine_rb_entry timer_entry;
             BOOL            timer_set;
             ULONGLONG       timeout;
             LONG            period;
@@ -193,6 +230,7 @@ struct threadpool_object
         struct
         {
             PTP_WAIT_CALLBACK callback;
+            /* number of pending signaled callbacks, locked via .queue->lock */
             LONG            signaled;
             /* information about the wait object, locked via waitqueue.cs */
             struct waitqueue_bucket *bucket;
@@ -234,13 +272,14 @@ struct threadpool_group
 
 /* global timerqueue object */
 static RTL_CRITICAL_SECTION_DEBUG timerqueue_debug;
+static int compare_timer( const void *key, const struct wine_rb_entry *entry );
 
 static struct
 {
     CRITICAL_SECTION        cs;
     LONG                    objcount;
     BOOL                    thread_running;
-    struct list             pending_timers;
+    struct wine_rb_tree     pending_timers;     /* sorted by timeout */
     RTL_CONDITION_VARIABLE  update_event;
 }
 timerqueue =
@@ -248,7 +287,7 @@ timerqueue =
     { &timerqueue_debug, -1, 0, 0, 0, 0 },      /* cs */
     0,                                          /* objcount */
     FALSE,                                      /* thread_running */
-    LIST_INIT( timerqueue.pending_timers ),     /* pending_timers */
+    { compare_timer, NULL },                    /* pending_timers */
     RTL_CONDITION_VARIABLE_INIT                 /* update_event */
 };
 
@@ -289,6 +328,7 @@ struct waitqueue_bucket
     struct list             reserved;
     struct list             waiting;
     HANDLE                  update_event;
+    BOOL                    update_pending;
 };
 
 static inline struct threadpool *impl_from_TP_POOL( TP_POOL *pool )
@@ -722,12 +762,12 @@ static void queue_remove_timer(struct queue_timer *t)
     assert(t->runcount == 0);
     assert(t->destroy);
 
-    list_remove(&t->entry);
+    wine_rb_remove(&q->timers, &t->entry);
     if (t->event)
         NtSetEvent(t->event, NULL);
     RtlFreeHeap(GetProcessHeap(), 0, t);
 
-    if (q->quit && list_empty(&q->timers))
+    if (q->quit && !q->timers.root)
         NtSetEvent(q->event, NULL);
 }
 
@@ -760,29 +800,38 @@ static inline ULONGLONG queue_current_time(void)
     return now.QuadPart * 1000 / freq.QuadPart;
 }
 
+static int compare_queue_timer(const void *key, const struct wine_rb_entry *entry)
+{
+    const struct queue_timer *t = key;
+    const struct queue_timer *cur = WINE_RB_ENTRY_VALUE(entry, const struct queue_timer, entry);
+
+    /* Timers with the same expiration time are kept in insertion order,
+       destroyed timers go after all the others.  */
+    if (t->destroy != cur->destroy)
+        return t->destroy ? 1 : -1;
+    return t->expire < cur->expire ? -1 : 1;
+}
+
+static inline struct queue_timer *queue_first_timer(struct timer_queue *q)
+{
+    struct wine_rb_entry *ptr = wine_rb_head(q->timers.root);
+    return ptr ? WINE_RB_ENTRY_VALUE(ptr, struct queue_timer, entry) : NULL;
+}
+
 static void queue_add_timer(struct queue_timer *t, ULONGLONG time,
                             BOOL set_event)
 {
     /* We MUST hold the queue cs while calling this function.  */
     struct timer_queue *q = t->q;
-    struct list *ptr = &q->timers;
 
     assert(!q->quit || (t->destroy && time == EXPIRE_NEVER));
 
-    if (time != EXPIRE_NEVER)
-        LIST_FOR_EACH(ptr, &q->timers)
-        {
-            struct queue_timer *cur = LIST_ENTRY(ptr, struct queue_timer, entry);
-            if (time < cur->expire)
-                break;
-        }
-    list_add_before(ptr, &t->entry);
-
     t->expire = time;
+    wine_rb_put(&q->timers, t, &t->entry);
 
     /* If we insert at the head of the list, we need to expire sooner
        than expected.  */
-    if (set_event && &t->entry == list_head(&q->timers))
+    if (set_event && t == queue_first_timer(q))
         NtSetEvent(q->event, NULL);
 }
 
@@ -790,7 +839,7 @@ static inline void queue_move_timer(struct queue_timer *t, ULONGLONG time,
                                     BOOL set_event)
 {
     /* We MUST hold the queue cs while calling this function.  */
-    list_remove(&t->entry);
+    wine_rb_remove(&t->q->timers, &t->entry);
     queue_add_timer(t, time, set_event);
 }
 
@@ -799,10 +848,9 @@ static void queue_timer_expire(struct timer_queue *q)
     struct queue_timer *t = NULL;
 
     RtlEnterCriticalSection(&q->cs);
-    if (list_head(&q->timers))
+    if ((t = queue_first_timer(q)))
     {
         ULONGLONG now, next;
-        t = LIST_ENTRY(list_head(&q->timers), struct queue_timer, entry);
         if (!t->destroy && t->expire <= ((now = queue_current_time())))
         {
             ++t->runcount;
@@ -845,9 +893,8 @@ static ULONG queue_get_timeout(struct timer_queue *q)
     ULONG timeout = INFINITE;
 
     RtlEnterCriticalSection(&q->cs);
-    if (list_head(&q->timers))
+    if ((t = queue_first_timer(q)))
     {
-        t = LIST_ENTRY(list_head(&q->timers), struct queue_timer, entry);
         assert(!t->destroy || t->expire == EXPIRE_NEVER);
 
         if (t->expire != EXPIRE_NEVER)
@@ -883,7 +930,7 @@ static void WINAPI timer_queue_thread_proc(LPVOID p)
                timer got put at the head of the list so we need to adjust
                our timeout.  */
             RtlEnterCriticalSection(&q->cs);
-            if (q->quit && list_empty(&q->timers))
+            if (q->quit && !q->timers.root)
                 done = TRUE;
             RtlLeaveCriticalSection(&q->cs);
         }
@@ -938,7 +985,7 @@ NTSTATUS WINAPI RtlCreateTimerQueue(PHANDLE NewTimerQueue)
         return STATUS_NO_MEMORY;
 
     RtlInitializeCriticalSection(&q->cs);
-    list_init(&q->timers);
+    wine_rb_init(&q->timers, compare_queue_timer);
     q->quit = FALSE;
     q->magic = TIMER_QUEUE_MAGIC;
     status = NtCreateEvent(&q->event, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE);
@@ -979,7 +1026,7 @@ NTSTATUS WINAPI RtlCreateTimerQueue(PHANDLE NewTimerQueue)
 NTSTATUS WINAPI RtlDeleteTimerQueueEx(HANDLE TimerQueue, HANDLE CompletionEvent)
 {
     struct timer_queue *q = TimerQueue;
-    struct queue_timer *t, *temp;
+    struct queue_timer *t;
     HANDLE thread;
     NTSTATUS status;
 
@@ -990,11 +1037,13 @@ NTSTATUS WINAPI RtlDeleteTimerQueueEx(HANDLE TimerQueue, HANDLE CompletionEvent)
 
     RtlEnterCriticalSection(&q->cs);
     q->quit = TRUE;
-    if (list_head(&q->timers))
+    if (q->timers.root)
+    {
         /* When the last timer is removed, it will signal the timer thread to
            exit...  */
-        LIST_FOR_EACH_ENTRY_SAFE(t, temp, &q->timers, struct queue_timer, entry)
+        while ((t = queue_first_timer(q)) && !t->destroy)
             queue_destroy_timer(t);
+    }
     else
         /* However if we have none, we must do it ourselves.  */
         NtSetEvent(q->event, NULL);
@@ -1205,15 +1254,36 @@ NTSTATUS WINAPI RtlDeleteTimer(HANDLE TimerQueue, HANDLE Timer,
     return status;
 }
 
+static int compare_timer( const void *key, const struct wine_rb_entry *entry )
+{
+    const struct threadpool_object *timer = key;
+    const struct threadpool_object *other_timer = WINE_RB_ENTRY_VALUE( entry, const struct threadpool_object,
+                                                                       u.timer.timer_entry );
+
+    /* timers with the same timeout are kept in insertion order */
+    return timer->u.timer.timeout < other_timer->u.timer.timeout ? -1 : 1;
+}
+
+static inline struct threadpool_object *tp_timerqueue_first(void)
+{
+    struct wine_rb_entry *ptr = wine_rb_head( timerqueue.pending_timers.root );
+    struct threadpool_object *timer;
+
+    if (!ptr) return NULL;
+    timer = WINE_RB_ENTRY_VALUE( ptr, struct threadpool_object, u.timer.timer_entry );
+    assert( timer->type == TP_OBJECT_TYPE_TIMER );
+    return timer;
+}
+
 /***********************************************************************
  *           timerqueue_thread_proc    (internal)
  */
 static void CALLBACK timerqueue_thread_proc( void *param )
 {
     ULONGLONG timeout_lower, timeout_upper, new_timeout;
-    struct threadpool_object *other_timer;
+    struct threadpool_object *timer, *other_timer;
     LARGE_INTEGER now, timeout;
-    struct list *ptr;
+    struct wine_rb_entry *ptr;
 
     TRACE( "starting timer queue thread\n" );
 
@@ -1223,16 +1293,14 @@ static void CALLBACK timerqueue_thread_proc( void *param )
         NtQuerySystemTime( &now );
 
         /* Check for expired timers. */
-        while ((ptr = list_head( &timerqueue.pending_timers )))
+        while ((timer = tp_timerqueue_first()))
         {
-            struct threadpool_object *timer = LIST_ENTRY( ptr, struct threadpool_object, u.timer.timer_entry );
-            assert( timer->type == TP_OBJECT_TYPE_TIMER );
             assert( timer->u.timer.timer_pending );
             if (timer->u.timer.timeout > now.QuadPart)
                 break;
 
             /* Queue a new callback in one of the worker threads. */
-            list_remove( &timer->u.timer.timer_entry );
+            wine_rb_remove( &timerqueue.pending_timers, &timer->u.timer.timer_entry );
             timer->u.timer.timer_pending = FALSE;
             tp_object_submit( timer, FALSE );
 
@@ -1243,14 +1311,7 @@ static void CALLBACK timerqueue_thread_proc( void *param )
                 if (timer->u.timer.timeout <= now.QuadPart)
                     timer->u.timer.timeout = now.QuadPart + 1;
 
-                LIST_FOR_EACH_ENTRY( other_timer, &timerqueue.pending_timers,
-                                     struct threadpool_object, u.timer.timer_entry )
-                {
-                    assert( other_timer->type == TP_OBJECT_TYPE_TIMER );
-                    if (timer->u.timer.timeout < other_timer->u.timer.timeout)
-                        break;
-                }
-                list_add_before( &other_timer->u.timer.timer_entry, &timer->u.timer.timer_entry );
+                wine_rb_put( &timerqueue.pending_timers, timer, &timer->u.timer.timer_entry );
                 timer->u.timer.timer_pending = TRUE;
             }
         }
@@ -1259,9 +1320,9 @@ static void CALLBACK timerqueue_thread_proc( void *param )
         timeout_upper = TIMEOUT_INFINITE;
 
         /* Determine next timeout and use the window length to optimize wakeup times. */
-        LIST_FOR_EACH_ENTRY( other_timer, &timerqueue.pending_timers,
-                             struct threadpool_object, u.timer.timer_entry )
+        for (ptr = wine_rb_head( timerqueue.pending_timers.root ); ptr; ptr = wine_rb_next( ptr ))
         {
+            other_timer = WINE_RB_ENTRY_VALUE( ptr, struct threadpool_object, u.timer.timer_entry );
             assert( other_timer->type == TP_OBJECT_TYPE_TIMER );
             if (other_timer->u.timer.timeout >= timeout_upper)
                 break;
@@ -1312,13 +1373,66 @@ static NTSTATUS tp_new_worker_thread( struct threadpool *pool )
     if (status == STATUS_SUCCESS)
     {
         interlocked_inc( &pool->refcount );
+        interlocked_inc( &pool->num_busy_workers );
+        interlocked_inc( &pool->num_starting_workers );
         pool->num_workers++;
-        pool->num_busy_workers++;
         NtClose( thread );
     }
     return status;
 }
 
+/***********************************************************************
+ *           tp_threadpool_need_worker    (internal)
+ *
+ * Checks whether the queued work needs a new worker thread. Up to one worker
+ * per queue is started as long as more work is queued than the workers that
+ * aren't busy can take; more workers are only started when all of them are
+ * busy. Only one worker is started at a time, so workers check again whenever
+ * they take a work item while more work is queued.
+ */
+static BOOL tp_threadpool_need_worker( struct threadpool *pool )
+{
+    if (!pool->num_queued || pool->num_starting_workers) return FALSE;
+    if (pool->num_workers >= pool->max_workers) return FALSE;
+    if (pool->num_workers < pool->num_queues)
+        return pool->num_queued > pool->num_workers - pool->num_busy_workers;
+    return pool->num_busy_workers >= pool->num_workers;
+}
+
+/***********************************************************************
+ *           tp_threadpool_start_worker    (internal)
+ *
+ * Starts a new worker thread if required.
+ */
+static void tp_threadpool_start_worker( struct threadpool *pool )
+{
+    if (!tp_threadpool_need_worker( pool )) return;
+
+    RtlEnterCriticalSection( &pool->cs );
+    if (tp_threadpool_need_worker( pool )) tp_new_worker_thread( pool );
+    RtlLeaveCriticalSection( &pool->cs );
+}
+
+/***********************************************************************
+ *           tp_threadpool_wake_worker    (internal)
+ *
+ * Makes sure that newly queued work gets processed, by waking up an idle
+ * worker thread or starting a new one.
+ */
+static void tp_threadpool_wake_worker( struct threadpool *pool )
+{
+    /* The caller updated num_queued with an interlocked operation, so either
+     * idle workers are visible here, or they will see the new work before
+     * going to sleep. */
+    if (pool->num_idle_workers)
+    {
+        RtlEnterCriticalSection( &pool->cs );
+        RtlWakeConditionVariable( &pool->update_event );
+        RtlLeaveCriticalSection( &pool->cs );
+    }
+    else tp_threadpool_start_worker( pool );
+}
+
 /***********************************************************************
  *           tp_timerqueue_lock    (internal)
  *
@@ -1377,14 +1491,14 @@ static void tp_timerqueue_unlock( struct threadpool_object *timer )
         /* If timer was pending, remove it. */
         if (timer->u.timer.timer_pending)
         {
-            list_remove( &timer->u.timer.timer_entry );
+            wine_rb_remove( &timerqueue.pending_timers, &timer->u.timer.timer_entry );
             timer->u.timer.timer_pending = FALSE;
         }
 
         /* If the last timer object was destroyed, then wake up the thread. */
         if (!--timerqueue.objcount)
         {
-            assert( list_empty( &timerqueue.pending_timers ) );
+            assert( !timerqueue.pending_timers.root );
             RtlWakeAllConditionVariable( &timerqueue.update_event );
         }
 
@@ -1393,6 +1507,19 @@ static void tp_timerqueue_unlock( struct threadpool_object *timer )
     RtlLeaveCriticalSection( &timerqueue.cs );
 }
 
+/***********************************************************************
+ *           tp_waitqueue_update    (internal)
+ *
+ * Wakes up the thread of a wait queue bucket to pick up changes to its
+ * wait objects. Further changes are merged until the thread got to them.
+ */
+static void tp_waitqueue_update( struct waitqueue_bucket *bucket )
+{
+    if (bucket->update_pending) return;
+    bucket->update_pending = TRUE;
+    NtSetEvent( bucket->update_event, NULL );
+}
+
 /***********************************************************************
  *           waitqueue_thread_proc    (internal)
  */
@@ -1415,6 +1542,7 @@ static void CALLBACK waitqueue_thread_proc( void *param )
         NtQuerySystemTime( &now );
         timeout.QuadPart = TIMEOUT_INFINITE;
         num_handles = 0;
+        bucket->update_pending = FALSE;
 
         LIST_FOR_EACH_ENTRY_SAFE( wait, next, &bucket->waiting, struct threadpool_object,
                                   u.wait.wait_entry )
@@ -1492,6 +1620,10 @@ static void CALLBACK waitqueue_thread_proc( void *param )
             struct waitqueue_bucket *other_bucket;
             LIST_FOR_EACH_ENTRY( other_bucket, &waitqueue.buckets, struct waitqueue_bucket, bucket_entry )
             {
+                /* the remaining buckets are full */
+                if (other_bucket->objcount == MAXIMUM_WAITQUEUE_OBJECTS)
+                    break;
+
                 if (other_bucket != bucket && other_bucket->objcount &&
                     other_bucket->objcount + bucket->objcount <= MAXIMUM_WAITQUEUE_OBJECTS * 2 / 3)
                 {
@@ -1519,7 +1651,7 @@ static void CALLBACK waitqueue_thread_proc( void *param )
                     list_remove( &bucket->bucket_entry );
                     list_add_tail( &waitqueue.buckets, &bucket->bucket_entry );
 
-                    NtSetEvent( other_bucket->update_event, NULL );
+                    tp_waitqueue_update( other_bucket );
                     break;
                 }
             }
@@ -1550,6 +1682,7 @@ static void CALLBACK waitqueue_thread_proc( void *param )
 static NTSTATUS tp_waitqueue_lock( struct threadpool_object *wait )
 {
     struct waitqueue_bucket *bucket;
+    struct list *ptr;
     NTSTATUS status;
     HANDLE thread;
     assert( wait->type == TP_OBJECT_TYPE_WAIT );
@@ -1562,18 +1695,21 @@ static NTSTATUS tp_waitqueue_lock( struct threadpool_object *wait )
 
     RtlEnterCriticalSection( &waitqueue.cs );
 
-    /* Try to assign to existing bucket if possible. */
-    LIST_FOR_EACH_ENTRY( bucket, &waitqueue.buckets, struct waitqueue_bucket, bucket_entry )
+    /* Try to assign to existing bucket if possible. Buckets with free slots
+     * are kept at the head of the list, full buckets are moved to the end. */
+    if ((ptr = list_head( &waitqueue.buckets )) &&
+        (bucket = LIST_ENTRY( ptr, struct waitqueue_bucket, bucket_entry ))->objcount < MAXIMUM_WAITQUEUE_OBJECTS)
     {
-        if (bucket->objcount < MAXIMUM_WAITQUEUE_OBJECTS)
+        list_add_tail( &bucket->reserved, &wait->u.wait.wait_entry );
+        wait->u.wait.bucket = bucket;
+        if (++bucket->objcount == MAXIMUM_WAITQUEUE_OBJECTS)
         {
-            list_add_tail( &bucket->reserved, &wait->u.wait.wait_entry );
-            wait->u.wait.bucket = bucket;
-            bucket->objcount++;
-
-            status = STATUS_SUCCESS;
-            goto out;
+            list_remove( &bucket->bucket_entry );
+            list_add_tail( &waitqueue.buckets, &bucket->bucket_entry );
         }
+
+        status = STATUS_SUCCESS;
+        goto out;
     }
 
     /* Create a new bucket and corresponding worker thread. */
@@ -1587,6 +1723,7 @@ static NTSTATUS tp_waitqueue_lock( struct threadpool_object *wait )
     bucket->objcount = 0;
     list_init( &bucket->reserved );
     list_init( &bucket->waiting );
+    bucket->update_pending = FALSE;
 
     status = NtCreateEvent( &bucket->update_event, EVENT_ALL_ACCESS,
                             NULL, SynchronizationEvent, FALSE );
@@ -1600,7 +1737,7 @@ static NTSTATUS tp_waitqueue_lock( struct threadpool_object *wait )
                                   waitqueue_thread_proc, bucket, &thread, NULL );
     if (status == STATUS_SUCCESS)
     {
-        list_add_tail( &waitqueue.buckets, &bucket->bucket_entry );
+        list_add_head( &waitqueue.buckets, &bucket->bucket_entry );
         waitqueue.num_buckets++;
 
         list_add_tail( &bucket->reserved, &wait->u.wait.wait_entry );
@@ -1635,9 +1772,13 @@ static void tp_waitqueue_unlock( struct threadpool_object *wait )
 
         list_remove( &wait->u.wait.wait_entry );
         wait->u.wait.bucket = NULL;
-        bucket->objcount--;
+        if (bucket->objcount-- == MAXIMUM_WAITQUEUE_OBJECTS)
+        {
+            list_remove( &bucket->bucket_entry );
+            list_add_head( &waitqueue.buckets, &bucket->bucket_entry );
+        }
 
-        NtSetEvent( bucket->update_event, NULL );
+        tp_waitqueue_update( bucket );
     }
     RtlLeaveCriticalSection( &waitqueue.cs );
 }
@@ -1651,12 +1792,20 @@ static NTSTATUS tp_threadpool_alloc( struct threadpool **out )
 {
     IMAGE_NT_HEADERS *nt = RtlImageNtHeader( NtCurrentTeb()->Peb->ImageBaseAddress );
     struct threadpool *pool;
-    unsigned int i;
+    unsigned int i, j;
 
     pool = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*pool) );
     if (!pool)
         return STATUS_NO_MEMORY;
 
+    pool->num_queues = min( max( NtCurrentTeb()->Peb->NumberOfProcessors, 1 ), THREADPOOL_MAX_QUEUES );
+    pool->queues = RtlAllocateHeap( GetProcessHeap(), 0, pool->num_queues * sizeof(*pool->queues) );
+    if (!pool->queues)
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, pool );
+        return STATUS_NO_MEMORY;
+    }
+
     pool->refcount              = 1;
     pool->objcount              = 0;
     pool->shutdown              = FALSE;
@@ -1664,14 +1813,23 @@ static NTSTATUS tp_threadpool_alloc( struct threadpool **out )
     RtlInitializeCriticalSection( &pool->cs );
     pool->cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": threadpool.cs");
 
-    for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
-        list_init( &pool->pools[i] );
+    for (i = 0; i < pool->num_queues; ++i)
+    {
+        RtlInitializeSRWLock( &pool->queues[i].lock );
+        for (j = 0; j < ARRAY_SIZE(pool->queues[i].pools); ++j)
+            list_init( &pool->queues[i].pools[j] );
+        pool->queues[i].num_workers = 0;
+    }
+    pool->next_queue = 0;
+    pool->num_queued = 0;
     RtlInitializeConditionVariable( &pool->update_event );
 
     pool->max_workers             = 500;
     pool->min_workers             = 0;
     pool->num_workers             = 0;
     pool->num_busy_workers        = 0;
+    pool->num_idle_workers        = 0;
+    pool->num_starting_workers    = 0;
     pool->stack_info.StackReserve = nt->OptionalHeader.SizeOfStackReserve;
     pool->stack_info.StackCommit  = nt->OptionalHeader.SizeOfStackCommit;
 
@@ -1703,7 +1861,7 @@ static void tp_threadpool_shutdown( struct threadpool *pool )
  */
 static BOOL tp_threadpool_release( struct threadpool *pool )
 {
-    unsigned int i;
+    unsigned int i, j;
 
     if (interlocked_dec( &pool->refcount ))
         return FALSE;
@@ -1712,12 +1870,15 @@ static BOOL tp_threadpool_release( struct threadpool *pool )
 
     assert( pool->shutdown );
     assert( !pool->objcount );
-    for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
-        assert( list_empty( &pool->pools[i] ) );
+    assert( !pool->num_queued );
+    for (i = 0; i < pool->num_queues; ++i)
+        for (j = 0; j < ARRAY_SIZE(pool->queues[i].pools); ++j)
+            assert( list_empty( &pool->queues[i].pools[j] ) );
 
     pool->cs.DebugInfo->Spare[0] = 0;
     RtlDeleteCriticalSection( &pool->cs );
 
+    RtlFreeHeap( GetProcessHeap(), 0, pool->queues );
     RtlFreeHeap( GetProcessHeap(), 0, pool );
     return TRUE;
 }
@@ -1893,6 +2054,7 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
     memset( &object->group_entry, 0, sizeof(object->group_entry) );
     object->is_group_member         = FALSE;
 
+    object->queue                   = NULL;
     memset( &object->pool_entry, 0, sizeof(object->pool_entry) );
     RtlInitializeConditionVariable( &object->finished_event );
     RtlInitializeConditionVariable( &object->group_finished_event );
@@ -1915,7 +2077,7 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
             TP_CALLBACK_ENVIRON_V3 *environment_v3 = (TP_CALLBACK_ENVIRON_V3 *)environment;
 
             object->priority = environment_v3->CallbackPriority;
-            assert( object->priority < ARRAY_SIZE(pool->pools) );
+            assert( object->priority < ARRAY_SIZE(pool->queues->pools) );
         }
 
         if (environment->ActivationContext)
@@ -1952,9 +2114,28 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
         tp_object_release( object );
 }
 
-static void tp_object_prio_queue( struct threadpool_object *object )
+/***********************************************************************
+ *           tp_object_lock_queue    (internal)
+ *
+ * Locks the queue holding the pending callbacks of an object. If there are
+ * none, the target queue is locked and assigned to the object instead, or
+ * NULL is returned if no target is specified.
+ */
+static struct threadpool_queue *tp_object_lock_queue( struct threadpool_object *object,
+                                                      struct threadpool_queue *target )
 {
-    list_add_tail( &object->pool->pools[object->priority], &object->pool_entry );
+    struct threadpool_queue *queue;
+
+    for (;;)
+    {
+        if (!(queue = object->queue) && !(queue = target)) return NULL;
+        RtlAcquireSRWLockExclusive( &queue->lock );
+        if (object->queue == queue) return queue;
+        if (queue == target && !interlocked_cmpxchg_ptr( (void **)&object->queue, queue, NULL ))
+            return queue;
+        /* the object has been moved to or from the queue in the meantime */
+        RtlReleaseSRWLockExclusive( &queue->lock );
+    }
 }
 
 /***********************************************************************
@@ -1965,36 +2146,47 @@ static void tp_object_prio_queue( struct threadpool_object *object )
  */
 static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
 {
+    struct threadpool_worker *worker = ntdll_get_thread_data()->tp_worker;
     struct threadpool *pool = object->pool;
-    NTSTATUS status = STATUS_UNSUCCESSFUL;
+    struct threadpool_queue *queue;
+    unsigned int i, index;
 
     assert( !object->shutdown );
     assert( !pool->shutdown );
 
-    RtlEnterCriticalSection( &pool->cs );
-
-    /* Start new worker threads if required. */
-    if (pool->num_busy_workers >= pool->num_workers &&
-        pool->num_workers < pool->max_workers)
-        status = tp_new_worker_thread( pool );
+    /* Work submitted by a worker goes to its own queue, other work is
+     * distributed among the queues that have workers. The first worker
+     * uses the first queue. */
+    if (worker && worker->pool == pool) queue = worker->queue;
+    else
+    {
+        index = interlocked_xchg_add( &pool->next_queue, 1 );
+        for (i = 0; i < pool->num_queues; i++)
+            if (pool->queues[(index + i) % pool->num_queues].num_workers) break;
+        if (i < pool->num_queues) queue = &pool->queues[(index + i) % pool->num_queues];
+        else queue = &pool->queues[0];
+    }
 
     /* Queue work item and increment refcount. */
     interlocked_inc( &object->refcount );
+    queue = tp_object_lock_queue( object, queue );
     if (!object->num_pending_callbacks++)
-        tp_object_prio_queue( object );
+    {
+        if (worker && worker->queue == queue)
+            list_add_head( &queue->pools[object->priority], &object->pool_entry );
+        else
+            list_add_tail( &queue->pools[object->priority], &object->pool_entry );
+    }
 
     /* Count how often the object was signaled. */
     if (object->type == TP_OBJECT_TYPE_WAIT && signaled)
         object->u.wait.signaled++;
 
-    /* No new thread started - wake up one existing thread. */
-    if (status != STATUS_SUCCESS)
-    {
-        assert( pool->num_workers > 0 );
-        RtlWakeConditionVariable( &pool->update_event );
-    }
+    RtlReleaseSRWLockExclusive( &queue->lock );
 
-    RtlLeaveCriticalSection( &pool->cs );
+    assert( pool->num_workers > 0 );
+    interlocked_inc( &pool->num_queued );
+    tp_threadpool_wake_worker( pool );
 }
 
 /***********************************************************************
@@ -2005,19 +2197,22 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
 static void tp_object_cancel( struct threadpool_object *object )
 {
     struct threadpool *pool = object->pool;
+    struct threadpool_queue *queue;
     LONG pending_callbacks = 0;
 
-    RtlEnterCriticalSection( &pool->cs );
-    if (object->num_pending_callbacks)
+    if ((queue = tp_object_lock_queue( object, NULL )))
     {
         pending_callbacks = object->num_pending_callbacks;
         object->num_pending_callbacks = 0;
         list_remove( &object->pool_entry );
+        object->queue = NULL;
+        interlocked_xchg_add( &pool->num_queued, -pending_callbacks );
 
         if (object->type == TP_OBJECT_TYPE_WAIT)
             object->u.wait.signaled = 0;
+
+        RtlReleaseSRWLockExclusive( &queue->lock );
     }
-    RtlLeaveCriticalSection( &pool->cs );
 
     while (pending_callbacks--)
         tp_object_release( object );
@@ -2102,18 +2297,101 @@ static BOOL tp_object_release( struct threadpool_object *object )
     return TRUE;
 }
 
-static struct list *threadpool_get_next_item( const struct threadpool *pool )
+/***********************************************************************
+ *           tp_object_wake    (internal)
+ *
+ * Wakes up the threads waiting for the callbacks of an object to finish.
+ */
+static void tp_object_wake( struct threadpool_object *object, RTL_CONDITION_VARIABLE *event )
+{
+    struct threadpool *pool = object->pool;
+
+    RtlEnterCriticalSection( &pool->cs );
+    RtlWakeAllConditionVariable( event );
+    RtlLeaveCriticalSection( &pool->cs );
+}
+
+static inline BOOL tp_queue_is_empty( const struct threadpool_queue *queue )
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(queue->pools); ++i)
+        if (!list_empty( &queue->pools[i] )) return FALSE;
+    return TRUE;
+}
+
+/***********************************************************************
+ *           tp_queue_get_next_item    (internal)
+ *
+ * Takes a pending callback from a queue, at its head for the workers of
+ * the queue, or at its tail when stealing work from another queue.
+ */
+static struct threadpool_object *tp_queue_get_next_item( struct threadpool *pool, struct threadpool_queue *queue,
+                                                         BOOL steal, TP_WAIT_RESULT *wait_result )
 {
-    struct list *ptr;
+    struct threadpool_object *object = NULL;
+    struct list *ptr = NULL;
     unsigned int i;
 
-    for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
+    if (tp_queue_is_empty( queue )) return NULL;
+
+    RtlAcquireSRWLockExclusive( &queue->lock );
+    for (i = 0; i < ARRAY_SIZE(queue->pools); ++i)
     {
-        if ((ptr = list_head( &pool->pools[i] )))
+        if ((ptr = steal ? list_tail( &queue->pools[i] ) : list_head( &queue->pools[i] )))
             break;
     }
+    if (ptr)
+    {
+        object = LIST_ENTRY( ptr, struct threadpool_object, pool_entry );
+        assert( object->num_pending_callbacks > 0 );
+        assert( object->queue == queue );
+
+        /* Count the callback as running before it stops being pending,
+         * tp_object_wait() checks both without the queue lock. */
+        interlocked_inc( &object->num_associated_callbacks );
+        interlocked_inc( &object->num_running_callbacks );
+
+        /* If further pending callbacks are queued, move the work item to
+         * the end of the queue. Otherwise remove it from the queue. */
+        list_remove( &object->pool_entry );
+        if (--object->num_pending_callbacks)
+            list_add_tail( &queue->pools[object->priority], &object->pool_entry );
+        else
+            object->queue = NULL;
+        interlocked_dec( &pool->num_queued );
 
-    return ptr;
+        /* For wait objects check if they were signaled or have timed out. */
+        if (object->type == TP_OBJECT_TYPE_WAIT)
+        {
+            *wait_result = object->u.wait.signaled ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+            if (*wait_result == WAIT_OBJECT_0) object->u.wait.signaled--;
+        }
+    }
+    RtlReleaseSRWLockExclusive( &queue->lock );
+    return object;
+}
+
+/***********************************************************************
+ *           threadpool_get_next_item    (internal)
+ *
+ * Takes a pending callback from the queue of a worker, or steals one from
+ * the other queues if it's empty.
+ */
+static struct threadpool_object *threadpool_get_next_item( struct threadpool *pool, struct threadpool_queue *queue,
+                                                           TP_WAIT_RESULT *wait_result )
+{
+    struct threadpool_object *object;
+    unsigned int i, index = queue - pool->queues;
+
+    if ((object = tp_queue_get_next_item( pool, queue, FALSE, wait_result ))) return object;
+
+    for (i = 1; i < pool->num_queues; i++)
+    {
+        queue = &pool->queues[(index + i) % pool->num_queues];
+        if ((object = tp_queue_get_next_item( pool, queue, TRUE, wait_result ))) return object;
+    }
+    return NULL;
 }
 
 /***********************************************************************
@@ -2123,41 +2401,39 @@ static void CALLBACK threadpool_worker_proc( void *param )
 {
     TP_CALLBACK_INSTANCE *callback_instance;
     struct threadpool_instance instance;
+    struct threadpool_object *object;
+    struct threadpool_worker worker;
+    struct threadpool_queue *queue;
     struct threadpool *pool = param;
     TP_WAIT_RESULT wait_result = 0;
     LARGE_INTEGER timeout;
-    struct list *ptr;
     NTSTATUS status;
+    unsigned int i;
 
     TRACE( "starting worker thread for pool %p\n", pool );
 
+    /* Use the queue with the fewest workers. */
     RtlEnterCriticalSection( &pool->cs );
-    pool->num_busy_workers--;
+    queue = &pool->queues[0];
+    for (i = 1; i < pool->num_queues; i++)
+        if (pool->queues[i].num_workers < queue->num_workers) queue = &pool->queues[i];
+    queue->num_workers++;
+    interlocked_dec( &pool->num_busy_workers );
+    interlocked_dec( &pool->num_starting_workers );
+    RtlLeaveCriticalSection( &pool->cs );
+
+    worker.pool  = pool;
+    worker.queue = queue;
+    ntdll_get_thread_data()->tp_worker = &worker;
+
     for (;;)
     {
-        while ((ptr = threadpool_get_next_item( pool )))
+        while ((object = threadpool_get_next_item( pool, queue, &wait_result )))
         {
-            struct threadpool_object *object = LIST_ENTRY( ptr, struct threadpool_object, pool_entry );
-            assert( object->num_pending_callbacks > 0 );
-
-            /* If further pending callbacks are queued, move the work item to
-             * the end of the pool list. Otherwise remove it from the pool. */
-            list_remove( &object->pool_entry );
-            if (--object->num_pending_callbacks)
-                tp_object_prio_queue( object );
-
-            /* For wait objects check if they were signaled or have timed out. */
-            if (object->type == TP_OBJECT_TYPE_WAIT)
-            {
-                wait_result = object->u.wait.signaled ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
-                if (wait_result == WAIT_OBJECT_0) object->u.wait.signaled--;
-            }
-
-            /* Leave critical section and do the actual callback. */
-            object->num_associated_callbacks++;
-            object->num_running_callbacks++;
-            pool->num_busy_workers++;
-            RtlLeaveCriticalSection( &pool->cs );
+            /* Make sure that the remaining work doesn't wait for this callback
+             * while there are idle processors. */
+            interlocked_inc( &pool->num_busy_workers );
+            if (pool->num_queued) tp_threadpool_start_worker( pool );
 
             /* Initialize threadpool instance struct. */
             callback_instance = (TP_CALLBACK_INSTANCE *)&instance;
@@ -2250,8 +2526,7 @@ static void CALLBACK threadpool_worker_proc( void *param )
             }
 
         skip_cleanup:
-            RtlEnterCriticalSection( &pool->cs );
-            pool->num_busy_workers--;
+            interlocked_dec( &pool->num_busy_workers );
 
             /* Simple callbacks are automatically shutdown after execution. */
             if (object->type == TP_OBJECT_TYPE_SIMPLE)
@@ -2260,23 +2535,35 @@ static void CALLBACK threadpool_worker_proc( void *param )
                 object->shutdown = TRUE;
             }
 
-            object->num_running_callbacks--;
-            if (!object->num_pending_callbacks && !object->num_running_callbacks)
-                RtlWakeAllConditionVariable( &object->group_finished_event );
+            if (!interlocked_dec( &object->num_running_callbacks ) && !object->num_pending_callbacks)
+                tp_object_wake( object, &object->group_finished_event );
 
-            if (instance.associated)
-            {
-                object->num_associated_callbacks--;
-                if (!object->num_pending_callbacks && !object->num_associated_callbacks)
-                    RtlWakeAllConditionVariable( &object->finished_event );
-            }
+            if (instance.associated && !interlocked_dec( &object->num_associated_callbacks ) &&
+                !object->num_pending_callbacks)
+                tp_object_wake( object, &object->finished_event );
 
             tp_object_release( object );
         }
 
+        RtlEnterCriticalSection( &pool->cs );
+
+        /* Check again for new tasks once this thread is visible as idle,
+         * tp_threadpool_wake_worker() relies on it. */
+        interlocked_inc( &pool->num_idle_workers );
+        if (pool->num_queued)
+        {
+            interlocked_dec( &pool->num_idle_workers );
+            RtlLeaveCriticalSection( &pool->cs );
+            continue;
+        }
+
         /* Shutdown worker thread if requested. */
         if (pool->shutdown)
+        {
+            interlocked_dec( &pool->num_idle_workers );
+            interlocked_dec( &pool->num_workers );
             break;
+        }
 
         /* Wait for new tasks or until the timeout expires. A thread only terminates
          * when no new tasks are available, and the number of threads can be
@@ -2284,15 +2571,23 @@ static void CALLBACK threadpool_worker_proc( void *param )
          * min_workers == 0, then objcount is used to detect if the last thread
          * can be terminated. */
         timeout.QuadPart = (ULONGLONG)THREADPOOL_WORKER_TIMEOUT * -10000;
-        if (RtlSleepConditionVariableCS( &pool->update_event, &pool->cs, &timeout ) == STATUS_TIMEOUT &&
-            !threadpool_get_next_item( pool ) && (pool->num_workers > max( pool->min_workers, 1 ) ||
-            (!pool->min_workers && !pool->objcount)))
+        status = RtlSleepConditionVariableCS( &pool->update_event, &pool->cs, &timeout );
+        interlocked_dec( &pool->num_idle_workers );
+        if (status == STATUS_TIMEOUT &&
+            (pool->num_workers > max( pool->min_workers, 1 ) || (!pool->min_workers && !pool->objcount)))
         {
-            break;
+            /* Submitters check num_workers without the lock after queuing their
+             * work, so leave the pool before the last check for new work: either
+             * they see this thread gone, or the work is seen here. */
+            interlocked_dec( &pool->num_workers );
+            if (!pool->num_queued) break;
+            interlocked_inc( &pool->num_workers );
         }
+        RtlLeaveCriticalSection( &pool->cs );
     }
-    pool->num_workers--;
+    queue->num_workers--;
     RtlLeaveCriticalSection( &pool->cs );
+    ntdll_get_thread_data()->tp_worker = NULL;
 
     TRACE( "terminating worker thread for pool %p\n", pool );
     tp_threadpool_release( pool );
@@ -2550,7 +2845,6 @@ VOID WINAPI TpDisassociateCallback( TP_CALLBACK_INSTANCE *instance )
 {
     struct threadpool_instance *this = impl_from_TP_CALLBACK_INSTANCE( instance );
     struct threadpool_object *object = this->object;
-    struct threadpool *pool;
 
     TRACE( "%p\n", instance );
 
@@ -2563,14 +2857,9 @@ VOID WINAPI TpDisassociateCallback( TP_CALLBACK_INSTANCE *instance )
     if (!this->associated)
         return;
 
-    pool = object->pool;
-    RtlEnterCriticalSection( &pool->cs );
-
-    object->num_associated_callbacks--;
-    if (!object->num_pending_callbacks && !object->num_associated_callbacks)
-        RtlWakeAllConditionVariable( &object->finished_event );
+    if (!interlocked_dec( &object->num_associated_callbacks ) && !object->num_pending_callbacks)
+        tp_object_wake( object, &object->finished_event );
 
-    RtlLeaveCriticalSection( &pool->cs );
     this->associated = FALSE;
 }
 
@@ -2789,7 +3078,6 @@ BOOL WINAPI TpSetPoolMinThreads( TP_POOL *pool, DWORD minimum )
 VOID WINAPI TpSetTimer( TP_TIMER *timer, LARGE_INTEGER *timeout, LONG period, LONG window_length )
 {
     struct threadpool_object *this = impl_from_TP_TIMER( timer );
-    struct threadpool_object *other_timer;
     BOOL submit_timer = FALSE;
     ULONGLONG timestamp;
 
@@ -2828,7 +3116,7 @@ VOID WINAPI TpSetTimer( TP_TIMER *timer, LARGE_INTEGER *timeout, LONG period, LO
     /* First remove existing timeout. */
     if (this->u.timer.timer_pending)
     {
-        list_remove( &this->u.timer.timer_entry );
+        wine_rb_remove( &timerqueue.pending_timers, &this->u.timer.timer_entry );
         this->u.timer.timer_pending = FALSE;
     }
 
@@ -2839,17 +3127,10 @@ VOID WINAPI TpSetTimer( TP_TIMER *timer, LARGE_INTEGER *timeout, LONG period, LO
         this->u.timer.period        = period;
         this->u.timer.window_length = window_length;
 
-        LIST_FOR_EACH_ENTRY( other_timer, &timerqueue.pending_timers,
-                             struct threadpool_object, u.timer.timer_entry )
-        {
-            assert( other_timer->type == TP_OBJECT_TYPE_TIMER );
-            if (this->u.timer.timeout < other_timer->u.timer.timeout)
-                break;
-        }
-        list_add_before( &other_timer->u.timer.timer_entry, &this->u.timer.timer_entry );
+        wine_rb_put( &timerqueue.pending_timers, this, &this->u.timer.timer_entry );
 
         /* Wake up the timer thread when the timeout has to be updated. */
-        if (list_head( &timerqueue.pending_timers ) == &this->u.timer.timer_entry )
+        if (tp_timerqueue_first() == this)
             RtlWakeAllConditionVariable( &timerqueue.update_event );
 
         this->u.timer.timer_pending = TRUE;
@@ -2913,7 +3194,7 @@ VOID WINAPI TpSetWait( TP_WAIT *wait, HANDLE handle, LARGE_INTEGER *timeout )
         }
 
         /* Wake up the wait queue thread. */
-        NtSetEvent( bucket->update_event, NULL );
+        tp_waitqueue_update( bucket );
     }
 
     RtlLeaveCriticalSection( &waitqueue.cs );
@@ -0,0 +1,355 @@
+/*
+ * Asynchronous file I/O through io_uring
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+#endif
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#define NONAMELESSUNION
+#include "windef.h"
+#include "winternl.h"
+#include "ntdll_misc.h"
+#include "wine/server.h"
+#include "wine/debug.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(ntdll);
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+/*
+ * When WINEIOURING is set, overlapped reads and writes at an explicit offset
+ * on regular files are submitted to an io_uring instead of being performed
+ * synchronously. A dedicated thread reaps the completions and reports them
+ * through the I/O status block, the event and the completion port, so the
+ * data transfer itself never involves the server. Since the caller may close
+ * its handle before the completion, an operation keeps its own duplicates of
+ * the file handle and of the unix fd for as long as it needs them.
+ *
+ * Only operations that are reported through an event or a completion port are
+ * submitted; anything else, or anything submitted while the ring is full or
+ * unavailable, takes the usual synchronous path.
+ */
+
+#define URING_ENTRIES 256
+
+struct uring_op
+{
+    HANDLE           handle;   /* own duplicate of the file handle for the completion port, or 0 */
+    int              fd;       /* own duplicate of the unix fd for the EFAULT fallback, or -1 */
+    HANDLE           event;    /* event to signal on completion */
+    ULONG_PTR        cvalue;   /* completion port value */
+    IO_STATUS_BLOCK *io;       /* status block of the caller */
+    struct iovec     iov;      /* buffer of the caller */
+    off_t            offset;   /* file offset */
+    BOOL             write;    /* is this a write? */
+};
+
+static struct
+{
+    int                  fd;          /* io_uring fd, -1 if disabled */
+    unsigned int        *sq_head;     /* submission ring */
+    unsigned int        *sq_tail;
+    unsigned int        *sq_mask;
+    unsigned int        *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int        *cq_head;     /* completion ring */
+    unsigned int        *cq_tail;
+    unsigned int        *cq_mask;
+    struct io_uring_cqe *cqes;
+    LONG                 pending;     /* operations in flight */
+    LONG                 max_pending; /* never overflow the completion ring */
+} ring = { -1 };
+
+static int uring_enabled = -1;
+
+static RTL_CRITICAL_SECTION uring_section;
+static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
+{
+    0, 0, &uring_section,
+    { &critsect_debug.ProcessLocksList, &critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": uring_section") }
+};
+static RTL_CRITICAL_SECTION uring_section = { &critsect_debug, -1, 0, 0, 0, 0 };
+
+static int uring_setup( unsigned int entries, struct io_uring_params *params )
+{
+    return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int uring_enter( unsigned int to_submit, unsigned int min_complete, unsigned int flags )
+{
+    return syscall( __NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0 );
+}
+
+/* atomically read a ring index written by the kernel */
+static inline unsigned int load_index( unsigned int *ptr )
+{
+    return interlocked_xchg_add( (LONG *)ptr, 0 );
+}
+
+/* atomically publish a ring index to the kernel */
+static inline void store_index( unsigned int *ptr, unsigned int val )
+{
+    interlocked_xchg( (LONG *)ptr, val );
+}
+
+/* release an operation and the references it holds */
+static void free_op( struct uring_op *op )
+{
+    if (op->handle) NtClose( op->handle );
+    if (op->fd != -1) close( op->fd );
+    RtlFreeHeap( GetProcessHeap(), 0, op );
+    interlocked_xchg_add( &ring.pending, -1 );
+}
+
+/* report the result of an operation to the caller */
+static void complete_op( struct uring_op *op, int res )
+{
+    NTSTATUS status;
+    ULONG info = 0;
+
+    if (res == -EFAULT && !op->write)
+    {
+        /* the buffer may need a write watch or a guard page to be handled first */
+        while ((res = virtual_locked_pread( op->fd, op->iov.iov_base, op->iov.iov_len, op->offset )) == -1)
+            if (errno != EINTR) break;
+        if (res == -1) res = -errno;
+    }
+
+    if (res >= 0)
+    {
+        info = res;
+        status = (info || op->write) ? STATUS_SUCCESS : STATUS_END_OF_FILE;
+    }
+    else if (res == -EFAULT)
+        status = op->write ? STATUS_INVALID_USER_BUFFER : STATUS_ACCESS_VIOLATION;
+    else
+    {
+        errno = -res;
+        status = FILE_GetNtStatus();
+    }
+
+    TRACE( "%p %s %u bytes at %s -> %08x\n", op, op->write ? "write" : "read",
+           (unsigned int)op->iov.iov_len, wine_dbgstr_longlong( op->offset ), status );
+
+    op->io->Information = info;
+    interlocked_xchg( (LONG *)&op->io->u.Status, status );
+    if (op->event) NtSetEvent( op->event, NULL );
+    if (op->cvalue) NTDLL_AddCompletion( op->handle, op->cvalue, status, info, TRUE );
+    free_op( op );
+}
+
+/* thread reaping the completions */
+static void WINAPI uring_thread( void *arg )
+{
+    for (;;)
+    {
+        unsigned int head = *ring.cq_head;
+        struct io_uring_cqe *cqe;
+        struct uring_op *op;
+        int res;
+
+        if (head == load_index( ring.cq_tail ))
+        {
+            uring_enter( 0, 1, IORING_ENTER_GETEVENTS );
+            continue;
+        }
+        cqe = &ring.cqes[head & *ring.cq_mask];
+        op = (struct uring_op *)(ULONG_PTR)cqe->user_data;
+        res = cqe->res;
+        store_index( ring.cq_head, head + 1 );
+        complete_op( op, res );
+    }
+}
+
+/* map a region of the ring */
+static void *map_ring( size_t size, off_t offset )
+{
+    void *ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, offset );
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/* create the ring if enabled in the environment */
+static BOOL init_uring(void)
+{
+    struct io_uring_params params;
+    const char *env;
+    char *sq, *cq;
+    HANDLE thread;
+
+    if (!(env = getenv( "WINEIOURING" )) || !atoi( env )) return FALSE;
+
+    memset( &params, 0, sizeof(params) );
+    if ((ring.fd = uring_setup( URING_ENTRIES, &params )) == -1)
+    {
+        WARN( "io_uring not available (%s), using synchronous I/O\n", strerror( errno ) );
+        return FALSE;
+    }
+
+    if (!(sq = map_ring( params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+                         IORING_OFF_SQ_RING )) ||
+        !(cq = map_ring( params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe),
+                         IORING_OFF_CQ_RING )) ||
+        !(ring.sqes = map_ring( params.sq_entries * sizeof(struct io_uring_sqe), IORING_OFF_SQES )))
+        goto failed;
+
+    ring.sq_head  = (unsigned int *)(sq + params.sq_off.head);
+    ring.sq_tail  = (unsigned int *)(sq + params.sq_off.tail);
+    ring.sq_mask  = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned int *)(sq + params.sq_off.array);
+    ring.cq_head  = (unsigned int *)(cq + params.cq_off.head);
+    ring.cq_tail  = (unsigned int *)(cq + params.cq_off.tail);
+    ring.cq_mask  = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring.cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring.max_pending = params.cq_entries;
+
+    if (RtlCreateUserThread( GetCurrentProcess(), NULL, FALSE, NULL, 0, 0,
+                             uring_thread, NULL, &thread, NULL ))
+        goto failed;
+    NtClose( thread );
+    TRACE( "using io_uring with %u entries\n", params.sq_entries );
+    return TRUE;
+
+failed:
+    /* the mappings are leaked, this only happens when the address space is exhausted */
+    ERR( "cannot set up io_uring, using synchronous I/O\n" );
+    close( ring.fd );
+    ring.fd = -1;
+    return FALSE;
+}
+
+/***********************************************************************
+ *           uring_submit_rw
+ *
+ * Submit an overlapped read or write on a regular file. Returns STATUS_PENDING
+ * if the operation is queued, in which case it will be completed through the
+ * I/O status block, the event and the completion port. Any other status means
+ * that the caller has to perform the I/O itself.
+ */
+NTSTATUS uring_submit_rw( HANDLE handle, int fd, BOOL write, HANDLE event, ULONG_PTR cvalue,
+                          IO_STATUS_BLOCK *io, void *buffer, ULONG length, LONGLONG offset )
+{
+    struct io_uring_sqe *sqe;
+    struct uring_op *op;
+    unsigned int tail, index;
+    int ret, err;
+
+    if (uring_enabled == -1)
+    {
+        RtlEnterCriticalSection( &uring_section );
+        if (uring_enabled == -1) uring_enabled = init_uring();
+        RtlLeaveCriticalSection( &uring_section );
+    }
+    if (!uring_enabled) return STATUS_NOT_SUPPORTED;
+
+    if (interlocked_xchg_add( &ring.pending, 1 ) >= ring.max_pending)
+    {
+        interlocked_xchg_add( &ring.pending, -1 );
+        return STATUS_NOT_SUPPORTED;
+    }
+    if (!(op = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*op) )))
+    {
+        interlocked_xchg_add( &ring.pending, -1 );
+        return STATUS_NOT_SUPPORTED;
+    }
+    op->handle = 0;
+    op->fd = -1;
+    op->event = event;
+    op->cvalue = cvalue;
+    op->io = io;
+    op->iov.iov_base = buffer;
+    op->iov.iov_len = length;
+    op->offset = offset;
+    op->write = write;
+
+    /* the caller may close its handle before the operation completes */
+    if ((cvalue && NtDuplicateObject( NtCurrentProcess(), handle, NtCurrentProcess(), &op->handle,
+                                      0, 0, DUPLICATE_SAME_ACCESS )) ||
+        (!write && (op->fd = dup( fd )) == -1))
+    {
+        free_op( op );
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    /* the completion may be reported before we return */
+    if (event) NtResetEvent( event, NULL );
+    io->Information = 0;
+    io->u.Status = STATUS_PENDING;
+
+    RtlEnterCriticalSection( &uring_section );
+    tail = *ring.sq_tail;
+    index = tail & *ring.sq_mask;
+    sqe = &ring.sqes[index];
+    memset( sqe, 0, sizeof(*sqe) );
+    sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (ULONG_PTR)&op->iov;
+    sqe->len = 1;
+    sqe->user_data = (ULONG_PTR)op;
+    ring.sq_array[index] = index;
+    store_index( ring.sq_tail, tail + 1 );
+
+    while ((ret = uring_enter( 1, 0, 0 )) == -1 && errno == EINTR);
+    err = errno;
+
+    /* the kernel only consumes entries in io_uring_enter, so a failed entry can be taken back */
+    if (ret != 1 && load_index( ring.sq_head ) == tail) store_index( ring.sq_tail, tail );
+    else ret = 1;
+    RtlLeaveCriticalSection( &uring_section );
+
+    if (ret != 1)
+    {
+        WARN( "submission failed (%s), using synchronous I/O\n", strerror( err ));
+        free_op( op );
+        return STATUS_NOT_SUPPORTED;
+    }
+    return STATUS_PENDING;
+}
+
+#else  /* HAVE_LINUX_IO_URING_H */
+
+NTSTATUS uring_submit_rw( HANDLE handle, int fd, BOOL write, HANDLE event, ULONG_PTR cvalue,
+                          IO_STATUS_BLOCK *io, void *buffer, ULONG length, LONGLONG offset )
+{
+    return STATUS_NOT_SUPPORTED;
+}
+
+#endif  /* HAVE_LINUX_IO_URING_H */
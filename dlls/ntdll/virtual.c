@@ -44,6 +44,15 @@
 #ifdef HAVE_SYS_SYSINFO_H
 # include <sys/sysinfo.h>
 #endif
+#ifdef HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#ifdef HAVE_LINUX_USERFAULTFD_H
+# include <linux/userfaultfd.h>
+#endif
 #ifdef HAVE_VALGRIND_VALGRIND_H
 # include <valgrind/valgrind.h>
 #endif
@@ -86,6 +95,7 @@ struct file_view
 #define VPROT_WRITEWATCH 0x40
 /* per-mapping protection flags */
 #define VPROT_SYSTEM     0x0200  /* system view (underlying mmap not under our control) */
+#define VPROT_UFFD_WATCH 0x0400  /* write watches tracked by the kernel through userfaultfd */
 
 /* Conversion from VPROT_* to Win32 flags */
 static const BYTE VIRTUAL_Win32Flags[16] =
@@ -1100,6 +1110,226 @@ static void reset_write_watches( void *base, SIZE_T size )
 }
 
 
+/*
+ * When WINEWRITEWATCH is set, write watch views are registered with a userfaultfd
+ * in asynchronous write-protect mode. The kernel then resolves write faults on
+ * watched pages by itself, and the pages written since the last reset are found
+ * and write-protected again with the PAGEMAP_SCAN ioctl. The pages keep their
+ * normal protections, so writes don't raise signals and system calls can write
+ * to watched buffers directly.
+ *
+ * Soft-dirty bits are not used, as they can only be cleared for the whole process
+ * at once, and new mappings are reported as entirely dirty.
+ */
+
+static int uffd_fd = -1;     /* userfaultfd for write watches, -1 if disabled */
+
+#if defined(__NR_userfaultfd) && defined(UFFDIO_WRITEPROTECT)
+
+/* these are missing from older kernel headers */
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC       (1 << 15)
+#endif
+#ifndef PAGEMAP_SCAN
+struct page_region
+{
+    __u64 start;
+    __u64 end;
+    __u64 categories;
+};
+
+struct pm_scan_arg
+{
+    __u64 size;
+    __u64 flags;
+    __u64 start;
+    __u64 end;
+    __u64 walk_end;
+    __u64 vec;
+    __u64 vec_len;
+    __u64 max_pages;
+    __u64 category_inverted;
+    __u64 category_mask;
+    __u64 category_anyof_mask;
+    __u64 return_mask;
+};
+
+#define PAGEMAP_SCAN          _IOWR( 'f', 16, struct pm_scan_arg )
+#define PAGE_IS_WRITTEN       (1 << 1)
+#define PM_SCAN_WP_MATCHING   (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+#endif
+
+static int pagemap_fd = -1;  /* /proc/self/pagemap, for PAGEMAP_SCAN */
+
+/***********************************************************************
+ *           init_uffd_write_watches
+ *
+ * Set up kernel tracking of write watches if enabled in the environment.
+ */
+static void init_uffd_write_watches(void)
+{
+    const UINT64 features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+    struct uffdio_api api;
+    struct pm_scan_arg arg;
+    const char *env;
+    int fd;
+
+    if (!(env = getenv( "WINEWRITEWATCH" )) || !atoi( env )) return;
+
+    if ((fd = syscall( __NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY )) == -1)
+    {
+        WARN( "userfaultfd not available (%s), using write faults\n", strerror( errno ));
+        return;
+    }
+    memset( &api, 0, sizeof(api) );
+    api.api = UFFD_API;
+    api.features = features;
+    if (ioctl( fd, UFFDIO_API, &api ) == -1 || (api.features & features) != features) goto failed;
+
+    /* an empty scan fails if the kernel doesn't support PAGEMAP_SCAN */
+    memset( &arg, 0, sizeof(arg) );
+    arg.size = sizeof(arg);
+    if ((pagemap_fd = open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC )) == -1 ||
+        ioctl( pagemap_fd, PAGEMAP_SCAN, &arg ) == -1)
+        goto failed;
+
+    uffd_fd = fd;
+    TRACE( "tracking write watches with userfaultfd\n" );
+    return;
+
+failed:
+    WARN( "userfaultfd write protection not supported, using write faults\n" );
+    if (pagemap_fd != -1) close( pagemap_fd );
+    pagemap_fd = -1;
+    close( fd );
+}
+
+
+/***********************************************************************
+ *           uffd_watch_range
+ *
+ * Register a range with the userfaultfd and write-protect it.
+ */
+static BOOL uffd_watch_range( void *base, size_t size )
+{
+    struct uffdio_register reg;
+    struct uffdio_writeprotect wp;
+
+    reg.range.start = (UINT_PTR)base;
+    reg.range.len   = size;
+    reg.mode        = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl( uffd_fd, UFFDIO_REGISTER, &reg ) == -1) return FALSE;
+
+    wp.range = reg.range;
+    wp.mode  = UFFDIO_WRITEPROTECT_MODE_WP;
+    return !ioctl( uffd_fd, UFFDIO_WRITEPROTECT, &wp );
+}
+
+
+/***********************************************************************
+ *           uffd_reset_write_watches
+ */
+static void uffd_reset_write_watches( void *base, SIZE_T size )
+{
+    struct uffdio_writeprotect wp;
+
+    wp.range.start = (UINT_PTR)base;
+    wp.range.len   = size;
+    wp.mode        = UFFDIO_WRITEPROTECT_MODE_WP;
+    if (ioctl( uffd_fd, UFFDIO_WRITEPROTECT, &wp ) == -1)
+        ERR( "failed to reset %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+}
+
+
+/***********************************************************************
+ *           uffd_get_write_watches
+ *
+ * Retrieve the pages written in a range, optionally write-protecting them
+ * again in the same scan. Returns the number of addresses stored.
+ */
+static ULONG_PTR uffd_get_write_watches( void *base, SIZE_T size, void **addresses,
+                                         ULONG_PTR count, BOOL reset )
+{
+    struct page_region regions[64];
+    struct pm_scan_arg arg;
+    ULONG_PTR pos = 0;
+    char *addr;
+    int i, ret;
+
+    memset( &arg, 0, sizeof(arg) );
+    arg.size          = sizeof(arg);
+    arg.flags         = PM_SCAN_CHECK_WPASYNC | (reset ? PM_SCAN_WP_MATCHING : 0);
+    arg.start         = (UINT_PTR)base;
+    arg.end           = (UINT_PTR)base + size;
+    arg.vec           = (UINT_PTR)regions;
+    arg.vec_len       = ARRAY_SIZE(regions);
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask   = PAGE_IS_WRITTEN;
+
+    while (pos < count && arg.start < arg.end)
+    {
+        arg.max_pages = count - pos;
+        if ((ret = ioctl( pagemap_fd, PAGEMAP_SCAN, &arg )) == -1)
+        {
+            /* report the rest of the range as written rather than missing writes */
+            ERR( "failed to scan %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+            for (addr = (char *)(UINT_PTR)arg.start; pos < count && addr < (char *)base + size; addr += page_size)
+                addresses[pos++] = addr;
+            break;
+        }
+        for (i = 0; i < ret; i++)
+            for (addr = (char *)(UINT_PTR)regions[i].start; addr < (char *)(UINT_PTR)regions[i].end; addr += page_size)
+                addresses[pos++] = addr;
+        arg.start = arg.walk_end;
+    }
+    return pos;
+}
+
+#else  /* __NR_userfaultfd && UFFDIO_WRITEPROTECT */
+
+static void init_uffd_write_watches(void)
+{
+}
+
+static BOOL uffd_watch_range( void *base, size_t size )
+{
+    return FALSE;
+}
+
+static void uffd_reset_write_watches( void *base, SIZE_T size )
+{
+}
+
+static ULONG_PTR uffd_get_write_watches( void *base, SIZE_T size, void **addresses,
+                                         ULONG_PTR count, BOOL reset )
+{
+    return 0;
+}
+
+#endif  /* __NR_userfaultfd && UFFDIO_WRITEPROTECT */
+
+
+/***********************************************************************
+ *           enable_uffd_write_watches
+ *
+ * Start tracking writes to a new view through the userfaultfd, falling back
+ * to write faults if the range cannot be registered.
+ */
+static void enable_uffd_write_watches( struct file_view *view )
+{
+    if (uffd_watch_range( view->base, view->size )) return;
+
+    WARN( "cannot register %p-%p, using write faults\n", view->base, (char *)view->base + view->size );
+    view->protect = (view->protect & ~VPROT_UFFD_WATCH) | VPROT_WRITEWATCH;
+    reset_write_watches( view->base, view->size );
+}
+
+
 /***********************************************************************
  *           unmap_extra_space
  *
@@ -1412,6 +1642,9 @@ static NTSTATUS decommit_pages( struct file_view *view, size_t start, size_t siz
     if (wine_anon_mmap( (char *)view->base + start, size, PROT_NONE, MAP_FIXED ) != (void *)-1)
     {
         set_page_vprot_bits( (char *)view->base + start, size, 0, VPROT_COMMITTED );
+        /* the new mapping is not registered with the userfaultfd */
+        if ((view->protect & VPROT_UFFD_WATCH) && !uffd_watch_range( (char *)view->base + start, size ))
+            ERR( "cannot register %p-%p\n", (char *)view->base + start, (char *)view->base + start + size );
         return STATUS_SUCCESS;
     }
     return FILE_GetNtStatus();
@@ -2008,6 +2241,53 @@ void virtual_init_threading(void)
 }
 
 
+/***********************************************************************
+ *           virtual_set_preload_reserve
+ *
+ * Reserve the range of the main exe in a process forked from the zygote,
+ * like the preloader does for the processes that are started normally.
+ */
+BOOL virtual_set_preload_reserve( void *start, void *end )
+{
+    size_t size = (char *)end - (char *)start;
+    void *ptr;
+
+    if (start < address_space_start || end <= start) return FALSE;
+    if (find_view_range( start, size )) return FALSE;
+
+    switch (wine_mmap_is_in_reserved_area( start, size ))
+    {
+    case -1:  /* partially in a reserved area */
+        return FALSE;
+    case 0:  /* not in a reserved area, make sure the range is free */
+        if ((ptr = wine_anon_mmap( start, size, PROT_NONE, MAP_NORESERVE )) == (void *)-1) return FALSE;
+        if (ptr != start)
+        {
+            munmap( ptr, size );
+            return FALSE;
+        }
+        wine_mmap_add_reserved_area( start, size );
+        break;
+    }
+    preload_reserve_start = start;
+    preload_reserve_end = end;
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           virtual_init_write_watches
+ *
+ * The userfaultfd and pagemap descriptors are bound to the address space
+ * that opened them, so this must only be done once the process has been
+ * forked from the zygote.
+ */
+void virtual_init_write_watches(void)
+{
+    init_uffd_write_watches();
+}
+
+
 /***********************************************************************
  *           virtual_get_system_info
  */
@@ -2081,6 +2361,49 @@ NTSTATUS virtual_create_builtin_view( void *module )
 }
 
 
+/***********************************************************************
+ *           virtual_map_image_pages
+ *
+ * Replace pages of an image view by a private mapping of a file, keeping
+ * their current protections.
+ */
+NTSTATUS virtual_map_image_pages( void *addr, SIZE_T size, int fd, off_t offset )
+{
+    struct file_view *view;
+    NTSTATUS status = STATUS_INVALID_PARAMETER;
+    sigset_t sigset;
+    char *ptr = addr, *end = ptr + size, *next;
+
+    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    if ((view = VIRTUAL_FindView( addr, size )) && (view->protect & SEC_IMAGE))
+    {
+        for (status = STATUS_SUCCESS; ptr < end; ptr = next)
+        {
+            BYTE vprot = get_page_vprot( ptr );
+            int prot = VIRTUAL_GetUnixProt( vprot );
+            off_t pos = offset + (ptr - (char *)addr);
+
+            for (next = ptr + page_size; next < end; next += page_size)
+                if (get_page_vprot( next ) != vprot) break;
+            if (force_exec_prot && (prot & PROT_READ)) prot |= PROT_EXEC;
+
+            if (mmap( ptr, next - ptr, prot, MAP_FIXED | MAP_PRIVATE, fd, pos ) != (void *)-1) continue;
+
+            /* fall back to read(), the previous contents are lost anyway */
+            if (wine_anon_mmap( ptr, next - ptr, PROT_READ | PROT_WRITE, MAP_FIXED ) == (void *)-1 ||
+                pread( fd, ptr, next - ptr, pos ) != next - ptr)
+            {
+                status = STATUS_INVALID_IMAGE_FORMAT;
+                break;
+            }
+            if (prot != (PROT_READ | PROT_WRITE)) mprotect( ptr, next - ptr, prot );
+        }
+    }
+    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    return status;
+}
+
+
 /***********************************************************************
  *           virtual_alloc_thread_stack
  */
@@ -2770,14 +3093,18 @@ NTSTATUS virtual_alloc_aligned( PVOID *ret, unsigned short zero_bits_64, SIZE_T
         if (!(status = get_vprot_flags( protect, &vprot, FALSE )))
         {
             if (type & MEM_COMMIT) vprot |= VPROT_COMMITTED;
-            if (type & MEM_WRITE_WATCH) vprot |= VPROT_WRITEWATCH;
+            if (type & MEM_WRITE_WATCH) vprot |= (uffd_fd != -1) ? VPROT_UFFD_WATCH : VPROT_WRITEWATCH;
             if (protect & PAGE_NOCACHE) vprot |= SEC_NOCACHE;
 
             if (vprot & VPROT_WRITECOPY) status = STATUS_INVALID_PAGE_PROTECTION;
             else if (is_dos_memory) status = allocate_dos_memory( &view, vprot );
             else status = map_view( &view, base, size, alignment, type & MEM_TOP_DOWN, vprot, zero_bits_64 );
 
-            if (status == STATUS_SUCCESS) base = view->base;
+            if (status == STATUS_SUCCESS)
+            {
+                base = view->base;
+                if (vprot & VPROT_UFFD_WATCH) enable_uffd_write_watches( view );
+            }
         }
     }
     else if (type & MEM_RESET)
@@ -3631,6 +3958,7 @@ NTSTATUS WINAPI NtFlushVirtualMemory( HANDLE process, LPCVOID *addr_ptr,
 NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T size, PVOID *addresses,
                                  ULONG_PTR *count, ULONG *granularity )
 {
+    struct file_view *view;
     NTSTATUS status = STATUS_SUCCESS;
     sigset_t sigset;
 
@@ -3648,7 +3976,12 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
 
     server_enter_uninterrupted_section( &csVirtual, &sigset );
 
-    if (is_write_watch_range( base, size ))
+    if ((view = VIRTUAL_FindView( base, size )) && (view->protect & VPROT_UFFD_WATCH))
+    {
+        *count = uffd_get_write_watches( base, size, addresses, *count, flags & WRITE_WATCH_FLAG_RESET );
+        *granularity = page_size;
+    }
+    else if (view && (view->protect & VPROT_WRITEWATCH))
     {
         ULONG_PTR pos = 0;
         char *addr = base;
@@ -3676,6 +4009,7 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
  */
 NTSTATUS WINAPI NtResetWriteWatch( HANDLE process, PVOID base, SIZE_T size )
 {
+    struct file_view *view;
     NTSTATUS status = STATUS_SUCCESS;
     sigset_t sigset;
 
@@ -3688,7 +4022,9 @@ NTSTATUS WINAPI NtResetWriteWatch( HANDLE process, PVOID base, SIZE_T size )
 
     server_enter_uninterrupted_section( &csVirtual, &sigset );
 
-    if (is_write_watch_range( base, size ))
+    if ((view = VIRTUAL_FindView( base, size )) && (view->protect & VPROT_UFFD_WATCH))
+        uffd_reset_write_watches( base, size );
+    else if (view && (view->protect & VPROT_WRITEWATCH))
         reset_write_watches( base, size );
     else
         status = STATUS_INVALID_PARAMETER;
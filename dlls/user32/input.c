@@ -54,6 +54,63 @@ WINE_DECLARE_DEBUG_CHANNEL(keyboard);
 
 INT global_key_state_counter = 0;
 
+/***********************************************************************
+ *           get_desktop_shared
+ *
+ * Map the cursor position and async key state that the server shares for
+ * the current thread desktop.
+ */
+static const volatile struct desktop_shared *get_desktop_shared(void)
+{
+    struct user_thread_info *thread_info = get_user_thread_info();
+    struct user_key_state_info *key_state_info = thread_info->key_state;
+    HANDLE file = 0, mapping;
+    void *ptr = NULL;
+
+    if (!key_state_info)
+    {
+        if (!(key_state_info = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*key_state_info) )))
+            return NULL;
+        thread_info->key_state = key_state_info;
+    }
+    if (key_state_info->shared || key_state_info->shared_failed) return key_state_info->shared;
+
+    SERVER_START_REQ( get_desktop_shared )
+    {
+        if (!wine_server_call( req )) file = wine_server_ptr_handle( reply->handle );
+    }
+    SERVER_END_REQ;
+
+    if (file)
+    {
+        if ((mapping = CreateFileMappingW( file, NULL, PAGE_READONLY, 0, 0, NULL )))
+        {
+            ptr = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+            CloseHandle( mapping );
+        }
+        CloseHandle( file );
+    }
+    if (!ptr) key_state_info->shared_failed = TRUE;
+    return key_state_info->shared = ptr;
+}
+
+
+/***********************************************************************
+ *           release_desktop_shared
+ *
+ * Unmap the shared desktop state, when the thread desktop changes or the thread exits.
+ */
+void release_desktop_shared(void)
+{
+    struct user_key_state_info *key_state_info = get_user_thread_info()->key_state;
+
+    if (!key_state_info) return;
+    if (key_state_info->shared) UnmapViewOfFile( (void *)key_state_info->shared );
+    key_state_info->shared = NULL;
+    key_state_info->shared_failed = FALSE;
+}
+
+
 /***********************************************************************
  *           get_key_state
  */
@@ -249,22 +306,41 @@ void WINAPI mouse_event( DWORD dwFlags, DWORD dx, DWORD dy,
  */
 BOOL WINAPI DECLSPEC_HOTPATCH GetCursorPos( POINT *pt )
 {
+    const volatile struct desktop_shared *shared;
+    unsigned int seq;
     BOOL ret;
     DWORD last_change;
     UINT dpi;
 
     if (!pt) return FALSE;
 
-    SERVER_START_REQ( set_cursor )
+    if ((shared = get_desktop_shared()))
     {
-        if ((ret = !wine_server_call( req )))
+        /* the server makes the counter odd while it updates the state */
+        do
         {
-            pt->x = reply->new_x;
-            pt->y = reply->new_y;
-            last_change = reply->last_change;
+            seq = shared->seq;
+            __sync_synchronize();
+            pt->x = shared->cursor_x;
+            pt->y = shared->cursor_y;
+            last_change = shared->cursor_last_change;
+            __sync_synchronize();
+        } while ((seq & 1) || seq != shared->seq);
+        ret = TRUE;
+    }
+    else
+    {
+        SERVER_START_REQ( set_cursor )
+        {
+            if ((ret = !wine_server_call( req )))
+            {
+                pt->x = reply->new_x;
+                pt->y = reply->new_y;
+                last_change = reply->last_change;
+            }
         }
+        SERVER_END_REQ;
     }
-    SERVER_END_REQ;
 
     /* query new position from graphics driver if we haven't updated recently */
     if (ret && GetTickCount() - last_change > 100) ret = USER_Driver->pGetCursorPos( pt );
@@ -392,15 +468,22 @@ static void check_for_events( UINT flags )
  */
 SHORT WINAPI DECLSPEC_HOTPATCH GetAsyncKeyState( INT key )
 {
-    struct user_key_state_info *key_state_info = get_user_thread_info()->key_state;
+    struct user_key_state_info *key_state_info;
+    const volatile struct desktop_shared *shared;
     INT counter = global_key_state_counter;
-    BYTE prev_key_state;
+    BYTE prev_key_state, state;
     SHORT ret;
 
     if (key < 0 || key >= 256) return 0;
 
     check_for_events( QS_INPUT );
 
+    /* the server only needs to be called to clear the "pressed since last call" bit */
+    if ((shared = get_desktop_shared()) && !((state = shared->keystate[key]) & 0x40))
+        return (state & 0x80) ? 0x8000 : 0;
+
+    key_state_info = get_user_thread_info()->key_state;
+
     if (key_state_info && !(key_state_info->state[key] & 0xc0) &&
         key_state_info->counter == counter && GetTickCount() - key_state_info->time < 50)
     {
@@ -451,6 +534,7 @@ SHORT WINAPI DECLSPEC_HOTPATCH GetAsyncKeyState( INT key )
  */
 DWORD WINAPI GetQueueStatus( UINT flags )
 {
+    struct user_queue_info *queue_info = get_user_thread_info()->queue_info;
     DWORD ret;
 
     if (flags & ~(QS_ALLINPUT | QS_ALLPOSTMESSAGE | QS_SMRESULT))
@@ -461,6 +545,10 @@ DWORD WINAPI GetQueueStatus( UINT flags )
 
     check_for_events( flags );
 
+    /* no need to ask the server if there are no changed bits to clear */
+    if (queue_info && !(queue_info->shared->changed_bits & flags))
+        return MAKELONG( 0, queue_info->shared->wake_bits & flags );
+
     SERVER_START_REQ( get_queue_status )
     {
         req->clear_bits = flags;
@@ -477,10 +565,13 @@ DWORD WINAPI GetQueueStatus( UINT flags )
  */
 BOOL WINAPI GetInputState(void)
 {
+    struct user_queue_info *queue_info = get_user_thread_info()->queue_info;
     DWORD ret;
 
     check_for_events( QS_INPUT );
 
+    if (queue_info) return queue_info->shared->wake_bits & (QS_KEY | QS_MOUSEBUTTON);
+
     SERVER_START_REQ( get_queue_status )
     {
         req->clear_bits = 0;
@@ -2740,6 +2740,103 @@ static inline void call_sendmsg_callback( SENDASYNCPROC callback, HWND hwnd, UIN
 }
 
 
+/***********************************************************************
+ *           get_queue_shared_area
+ *
+ * Map the area where the server publishes the state of the message queues.
+ */
+static const volatile struct queue_shared *get_queue_shared_area(void)
+{
+    static const volatile struct queue_shared *queue_shared_area;
+    static BOOL disabled;
+    HANDLE file = 0, mapping;
+    void *ptr = NULL;
+
+    if (queue_shared_area || disabled) return queue_shared_area;
+
+    SERVER_START_REQ( get_queue_shared_area )
+    {
+        if (!wine_server_call( req )) file = wine_server_ptr_handle( reply->handle );
+    }
+    SERVER_END_REQ;
+
+    if (file)
+    {
+        if ((mapping = CreateFileMappingW( file, NULL, PAGE_READONLY, 0, 0, NULL )))
+        {
+            ptr = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+            CloseHandle( mapping );
+        }
+        CloseHandle( file );
+    }
+    if (!ptr)
+    {
+        disabled = TRUE;
+        return NULL;
+    }
+    if (InterlockedCompareExchangePointer( (void **)&queue_shared_area, ptr, NULL ))
+        UnmapViewOfFile( ptr );  /* another thread beat us to it */
+    return queue_shared_area;
+}
+
+
+/***********************************************************************
+ *           get_server_queue_handle
+ *
+ * Get a handle to the server message queue for the current thread.
+ */
+static HANDLE get_server_queue_handle(void)
+{
+    struct user_thread_info *thread_info = get_user_thread_info();
+    const volatile struct queue_shared *area;
+    unsigned int index = 0;
+    HANDLE ret;
+
+    if (!(ret = thread_info->server_queue))
+    {
+        SERVER_START_REQ( get_msg_queue )
+        {
+            wine_server_call( req );
+            ret = wine_server_ptr_handle( reply->handle );
+            index = reply->shared_index;
+        }
+        SERVER_END_REQ;
+        thread_info->server_queue = ret;
+        if (!ret) ERR( "Cannot get server thread queue\n" );
+        if (index && (area = get_queue_shared_area()) &&
+            (thread_info->queue_info = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                                  sizeof(*thread_info->queue_info) )))
+            thread_info->queue_info->shared = &area[index];
+    }
+    return ret;
+}
+
+
+/***********************************************************************
+ *           is_queue_empty
+ *
+ * Check from the shared queue state whether a get_message call for the
+ * current thread would find nothing, and wouldn't change the queue state
+ * either. The server is still called regularly, to keep the active hooks
+ * up to date and so that the thread isn't considered hung.
+ */
+static BOOL is_queue_empty( HWND hwnd, UINT changed_mask )
+{
+    struct user_thread_info *thread_info = get_user_thread_info();
+    const volatile struct queue_shared *shared;
+    const unsigned int pending = QS_ALLINPUT | QS_ALLPOSTMESSAGE;
+
+    if (hwnd) return FALSE;  /* let the server validate the window */
+    if (!thread_info->server_queue) get_server_queue_handle();
+    if (!thread_info->queue_info) return FALSE;
+    if (GetTickCount() - thread_info->queue_info->last_get_message >= 50) return FALSE;
+    shared = thread_info->queue_info->shared;
+    if (shared->wake_mask != (changed_mask & (QS_SENDMESSAGE | QS_SMRESULT))) return FALSE;
+    if (shared->changed_mask != changed_mask) return FALSE;
+    return !(shared->wake_bits & pending) && !(shared->changed_bits & pending);
+}
+
+
 /***********************************************************************
  *           peek_message
  *
@@ -2757,6 +2854,8 @@ static int peek_message( MSG *msg, HWND hwnd, UINT first, UINT last, UINT flags,
     void *buffer;
     size_t buffer_size = 256;
 
+    if (is_queue_empty( hwnd, changed_mask )) return 0;
+
     if (!(buffer = HeapAlloc( GetProcessHeap(), 0, buffer_size ))) return -1;
 
     if (!first && !last) last = ~0;
@@ -2797,6 +2896,7 @@ static int peek_message( MSG *msg, HWND hwnd, UINT first, UINT last, UINT flags,
             else buffer_size = reply->total;
         }
         SERVER_END_REQ;
+        if (thread_info->queue_info) thread_info->queue_info->last_get_message = GetTickCount();
 
         if (res)
         {
@@ -3003,31 +3103,6 @@ static inline void process_sent_messages(void)
 }
 
 
-/***********************************************************************
- *           get_server_queue_handle
- *
- * Get a handle to the server message queue for the current thread.
- */
-static HANDLE get_server_queue_handle(void)
-{
-    struct user_thread_info *thread_info = get_user_thread_info();
-    HANDLE ret;
-
-    if (!(ret = thread_info->server_queue))
-    {
-        SERVER_START_REQ( get_msg_queue )
-        {
-            wine_server_call( req );
-            ret = wine_server_ptr_handle( reply->handle );
-        }
-        SERVER_END_REQ;
-        thread_info->server_queue = ret;
-        if (!ret) ERR( "Cannot get server thread queue\n" );
-    }
-    return ret;
-}
-
-
 /***********************************************************************
  *           wait_message_reply
  *
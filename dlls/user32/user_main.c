@@ -380,9 +380,11 @@ static void thread_detach(void)
 
     destroy_thread_windows();
     CloseHandle( thread_info->server_queue );
+    release_desktop_shared();
     HeapFree( GetProcessHeap(), 0, thread_info->wmchar_data );
     HeapFree( GetProcessHeap(), 0, thread_info->key_state );
     HeapFree( GetProcessHeap(), 0, thread_info->rawinput );
+    HeapFree( GetProcessHeap(), 0, thread_info->queue_info );
 
     exiting_thread_id = 0;
 }
@@ -192,6 +192,7 @@ struct user_thread_info
     HWND                          top_window;             /* Desktop window */
     HWND                          msg_window;             /* HWND_MESSAGE parent window */
     RAWINPUT                     *rawinput;
+    struct user_queue_info       *queue_info;             /* Shared queue state, if available */
 };
 
 C_ASSERT( sizeof(struct user_thread_info) <= sizeof(((TEB *)0)->Win32ClientInfo) );
@@ -205,6 +206,14 @@ struct user_key_state_info
     UINT                          time;                   /* Time of last key state refresh */
     INT                           counter;                /* Counter to invalidate the key state */
     BYTE                          state[256];             /* State for each key */
+    const volatile struct desktop_shared *shared;         /* Desktop state shared by the server */
+    BOOL                          shared_failed;          /* Mapping the shared state failed */
+};
+
+struct user_queue_info
+{
+    const volatile struct queue_shared *shared;           /* Queue state in the shared area */
+    DWORD                         last_get_message;       /* Time of last get_message server call */
 };
 
 struct hook_extra_info
@@ -232,6 +241,7 @@ struct tagWND;
 extern void CLIPBOARD_ReleaseOwner( HWND hwnd ) DECLSPEC_HIDDEN;
 extern BOOL FOCUS_MouseActivate( HWND hwnd ) DECLSPEC_HIDDEN;
 extern BOOL set_capture_window( HWND hwnd, UINT gui_flags, HWND *prev_ret ) DECLSPEC_HIDDEN;
+extern void release_desktop_shared(void) DECLSPEC_HIDDEN;
 extern void free_dce( struct dce *dce, HWND hwnd ) DECLSPEC_HIDDEN;
 extern void invalidate_dce( struct tagWND *win, const RECT *rect ) DECLSPEC_HIDDEN;
 extern HDC get_display_dc(void) DECLSPEC_HIDDEN;
@@ -1155,9 +1155,135 @@ static inline void release_sock_fd( SOCKET s, int fd )
     wine_server_release_fd( SOCKET2HANDLE(s), fd );
 }
 
+/* location of the state of the sockets created by this process, indexed by handle
+ *
+ * Entries are updated whenever ws2_32 creates, duplicates or closes a socket
+ * handle. Handles closed with CloseHandle() or duplicated with DuplicateHandle()
+ * directly are not seen; the serial check makes their stale entries harmless,
+ * except if the handle value is reused for another socket while the old socket
+ * is still open through a different handle. */
+struct socket_cache_entry
+{
+    unsigned int index;   /* index in the shared area */
+    unsigned int serial;  /* serial number of the socket */
+};
+
+#define SOCKET_CACHE_BLOCK_SIZE  (65536 / sizeof(struct socket_cache_entry))
+#define SOCKET_CACHE_ENTRIES     128
+
+static struct socket_cache_entry *socket_cache[SOCKET_CACHE_ENTRIES];
+static const volatile struct socket_shared *socket_shared_area;
+
+/***********************************************************************
+ *           get_socket_shared_area
+ *
+ * Map the area where the server publishes the state of the sockets.
+ */
+static const volatile struct socket_shared *get_socket_shared_area(void)
+{
+    static BOOL disabled;
+    HANDLE file = 0, mapping;
+    void *ptr = NULL;
+
+    if (socket_shared_area || disabled) return socket_shared_area;
+
+    SERVER_START_REQ( get_socket_shared_area )
+    {
+        if (!wine_server_call( req )) file = wine_server_ptr_handle( reply->handle );
+    }
+    SERVER_END_REQ;
+
+    if (file)
+    {
+        if ((mapping = CreateFileMappingW( file, NULL, PAGE_READONLY, 0, 0, NULL )))
+        {
+            ptr = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+            CloseHandle( mapping );
+        }
+        CloseHandle( file );
+    }
+    if (!ptr)
+    {
+        disabled = TRUE;
+        return NULL;
+    }
+    if (InterlockedCompareExchangePointer( (void **)&socket_shared_area, ptr, NULL ))
+        UnmapViewOfFile( ptr );  /* another thread beat us to it */
+    return socket_shared_area;
+}
+
+static struct socket_cache_entry *get_socket_cache_entry( SOCKET s, BOOL alloc )
+{
+    unsigned int idx = (wine_server_obj_handle( SOCKET2HANDLE(s) ) >> 2) - 1;
+    unsigned int block = idx / SOCKET_CACHE_BLOCK_SIZE;
+    struct socket_cache_entry *ptr;
+
+    if (block >= SOCKET_CACHE_ENTRIES) return NULL;
+    if (!socket_cache[block])
+    {
+        if (!alloc) return NULL;
+        if (!(ptr = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                               SOCKET_CACHE_BLOCK_SIZE * sizeof(*ptr) ))) return NULL;
+        if (InterlockedCompareExchangePointer( (void **)&socket_cache[block], ptr, NULL ))
+            HeapFree( GetProcessHeap(), 0, ptr );  /* another thread beat us to it */
+    }
+    return &socket_cache[block][idx % SOCKET_CACHE_BLOCK_SIZE];
+}
+
+static void clear_socket_shared( SOCKET s )
+{
+    struct socket_cache_entry *entry = get_socket_cache_entry( s, FALSE );
+
+    if (!entry) return;
+    entry->index  = 0;
+    entry->serial = 0;
+}
+
+/* remember where the server keeps the state of a new socket */
+static void set_socket_shared( SOCKET s, unsigned int index, unsigned int serial )
+{
+    struct socket_cache_entry *entry;
+
+    if (!index || !get_socket_shared_area())
+    {
+        /* the handle value may have been used for another socket before */
+        clear_socket_shared( s );
+        return;
+    }
+    if (!(entry = get_socket_cache_entry( s, TRUE ))) return;
+    entry->index  = index;
+    entry->serial = serial;
+}
+
+/* retrieve the state of a socket, if the server shares it with us */
+static const volatile struct socket_shared *get_socket_shared( SOCKET s )
+{
+    const volatile struct socket_shared *shared;
+    struct socket_cache_entry *entry;
+    unsigned int index, serial;
+
+    if (!socket_shared_area || !(entry = get_socket_cache_entry( s, FALSE ))) return NULL;
+    index  = entry->index;
+    serial = entry->serial;
+    if (!index) return NULL;
+    shared = &socket_shared_area[index];
+    /* the entry may have been reused for another socket */
+    if (shared->serial != serial) return NULL;
+    return shared;
+}
+
 static void _enable_event( HANDLE s, unsigned int event,
                            unsigned int sstate, unsigned int cstate )
 {
+    const volatile struct socket_shared *shared = get_socket_shared( HANDLE2SOCKET(s) );
+
+    /* don't bother the server if nothing would change */
+    if (shared && !((shared->hmask | shared->pmask) & event) &&
+        ((shared->state | sstate) & ~cstate) == shared->state &&
+        (shared->type == SOCK_STREAM ||
+         !(shared->state & (FD_CONNECT | FD_ACCEPT | FD_WINE_LISTENING | FD_WINE_CONNECTED))))
+        return;
+
     SERVER_START_REQ( enable_socket_event )
     {
         req->handle = wine_server_obj_handle( s );
@@ -1171,7 +1297,15 @@ static void _enable_event( HANDLE s, unsigned int event,
 
 static DWORD sock_is_blocking(SOCKET s, BOOL *ret)
 {
+    const volatile struct socket_shared *shared = get_socket_shared( s );
     DWORD err;
+
+    if (shared)
+    {
+        *ret = (shared->state & FD_WINE_NONBLOCKING) == 0;
+        return 0;
+    }
+
     SERVER_START_REQ( get_socket_event )
     {
         req->handle  = wine_server_obj_handle( SOCKET2HANDLE(s) );
@@ -1186,7 +1320,11 @@ static DWORD sock_is_blocking(SOCKET s, BOOL *ret)
 
 static unsigned int _get_sock_mask(SOCKET s)
 {
+    const volatile struct socket_shared *shared = get_socket_shared( s );
     unsigned int ret;
+
+    if (shared) return shared->mask;
+
     SERVER_START_REQ( get_socket_event )
     {
         req->handle  = wine_server_obj_handle( SOCKET2HANDLE(s) );
@@ -1201,10 +1339,16 @@ static unsigned int _get_sock_mask(SOCKET s)
 
 static void _sync_sock_state(SOCKET s)
 {
-    BOOL dummy;
     /* do a dummy wineserver request in order to let
        the wineserver run through its select loop once */
-    sock_is_blocking(s, &dummy);
+    SERVER_START_REQ( get_socket_event )
+    {
+        req->handle  = wine_server_obj_handle( SOCKET2HANDLE(s) );
+        req->service = FALSE;
+        req->c_event = 0;
+        wine_server_call( req );
+    }
+    SERVER_END_REQ;
 }
 
 static void _get_sock_errors(SOCKET s, int *events)
@@ -2140,6 +2284,14 @@ static INT WS_DuplicateSocket(BOOL unicode, SOCKET s, DWORD dwProcessId, LPWSAPR
                     hProcess, (LPHANDLE)&lpProtocolInfo->dwServiceFlags3,
                     0, FALSE, DUPLICATE_SAME_ACCESS);
     CloseHandle(hProcess);
+    if (dwProcessId == GetCurrentProcessId())
+    {
+        struct socket_cache_entry *entry = get_socket_cache_entry( s, FALSE );
+        SOCKET dup = lpProtocolInfo->dwServiceFlags3;
+
+        if (entry && entry->index) set_socket_shared( dup, entry->index, entry->serial );
+        else clear_socket_shared( dup );
+    }
     lpProtocolInfo->dwServiceFlags4 = 0xff00ff00; /* magic */
     return 0;
 }
@@ -2799,6 +2951,7 @@ SOCKET WINAPI WS_accept(SOCKET s, struct WS_sockaddr *addr, int *addrlen32)
     SOCKET as;
     int fd;
     BOOL is_blocking;
+    unsigned int shared_index = 0, shared_serial = 0;
 
     TRACE("socket %04lx\n", s );
     err = sock_is_blocking(s, &is_blocking);
@@ -2815,10 +2968,13 @@ SOCKET WINAPI WS_accept(SOCKET s, struct WS_sockaddr *addr, int *addrlen32)
             req->attributes = OBJ_INHERIT;
             err = NtStatusToWSAError( wine_server_call( req ));
             as = HANDLE2SOCKET( wine_server_ptr_handle( reply->handle ));
+            shared_index  = reply->shared_index;
+            shared_serial = reply->shared_serial;
         }
         SERVER_END_REQ;
         if (!err)
         {
+            set_socket_shared( as, shared_index, shared_serial );
             if (addr && addrlen32 && WS_getpeername(as, addr, addrlen32))
             {
                 WS_closesocket(as);
@@ -3454,6 +3610,7 @@ int WINAPI WS_closesocket(SOCKET s)
         if (fd >= 0)
         {
             release_sock_fd(s, fd);
+            clear_socket_shared(s);
             if (CloseHandle(SOCKET2HANDLE(s)))
                 res = 0;
         }
@@ -7568,6 +7725,7 @@ SOCKET WINAPI WSASocketW(int af, int type, int protocol,
     SOCKET ret;
     DWORD err;
     int unixaf, unixtype, ipxptype = -1;
+    unsigned int shared_index = 0, shared_serial = 0;
 
    /*
       FIXME: The "advanced" parameters of WSASocketW (lpProtocolInfo,
@@ -7680,10 +7838,13 @@ SOCKET WINAPI WSASocketW(int af, int type, int protocol,
         req->flags      = dwFlags & ~WSA_FLAG_NO_HANDLE_INHERIT;
         err = NtStatusToWSAError( wine_server_call( req ) );
         ret = HANDLE2SOCKET( wine_server_ptr_handle( reply->handle ));
+        shared_index  = reply->shared_index;
+        shared_serial = reply->shared_serial;
     }
     SERVER_END_REQ;
     if (ret)
     {
+        set_socket_shared( ret, shared_index, shared_serial );
         TRACE("\tcreated %04lx\n", ret );
         if (ipxptype > 0)
             set_ipx_packettype(ret, ipxptype);
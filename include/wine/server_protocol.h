@@ -195,6 +195,111 @@ struct wake_up_reply
 };
 
 
+struct request_shm
+{
+    unsigned int            seq;
+    int                     pipe_data;
+    struct request_max_size reply;
+
+};
+#define REQUEST_SHM_SIZE      0x10000
+#define REQUEST_SHM_DATA_SIZE (REQUEST_SHM_SIZE - sizeof(struct request_shm))
+
+
+struct fast_sync_entry
+{
+    int          state;
+    int          waiters;
+    unsigned int data;
+    int          seq;
+    unsigned int pulse;
+    int          thread;
+};
+#define FAST_SYNC_SERVER_WAIT 0x80000000
+#define FAST_SYNC_ABANDONED   0x40000000
+#define FAST_SYNC_STATE_MASK  0x3fffffff
+#define FAST_SYNC_ENTRIES     65536
+
+enum fast_sync_type
+{
+    FAST_SYNC_NONE,
+    FAST_SYNC_EVENT,
+    FAST_SYNC_SEMAPHORE,
+    FAST_SYNC_MUTEX,
+    FAST_SYNC_COMPLETION
+};
+
+
+struct fast_completion_packet
+{
+    unsigned int  seq;
+    unsigned int  status;
+    apc_param_t   ckey;
+    apc_param_t   cvalue;
+    apc_param_t   information;
+};
+#define FAST_COMPLETION_PACKETS 64
+
+
+struct fast_completion
+{
+    unsigned int  tail;
+    unsigned int  head;
+    int           signal;
+    int           waiters;
+    struct fast_completion_packet packets[FAST_COMPLETION_PACKETS];
+};
+#define FAST_COMPLETION_SERVER_WAIT 0x80000000
+#define FAST_COMPLETION_OVERFLOW    0x40000000
+#define FAST_COMPLETION_POS_MASK    0x3fffffff
+#define FAST_COMPLETION_ENTRIES     1024
+
+
+#define FAST_SYNC_AREA_SIZE (FAST_SYNC_ENTRIES * sizeof(struct fast_sync_entry) + FAST_COMPLETION_ENTRIES * sizeof(struct fast_completion))
+
+
+struct handle_cache_entry
+{
+    unsigned int   access;
+    unsigned short type;
+    unsigned short flags;
+};
+#define HANDLE_CACHE_VALID    0x8000
+#define HANDLE_CACHE_ENTRIES  16384
+
+
+struct queue_shared
+{
+    unsigned int   wake_bits;
+    unsigned int   wake_mask;
+    unsigned int   changed_bits;
+    unsigned int   changed_mask;
+};
+#define QUEUE_SHARED_ENTRIES  16384
+
+
+struct desktop_shared
+{
+    unsigned int   seq;
+    int            cursor_x;
+    int            cursor_y;
+    unsigned int   cursor_last_change;
+    unsigned char  keystate[256];
+};
+
+
+struct socket_shared
+{
+    unsigned int   serial;
+    unsigned int   state;
+    unsigned int   mask;
+    unsigned int   hmask;
+    unsigned int   pmask;
+    int            type;
+};
+#define SOCKET_SHARED_ENTRIES  65536
+
+
 typedef __int64 timeout_t;
 #define TIMEOUT_INFINITE (((timeout_t)0x7fffffff) << 32 | 0xffffffff)
 
@@ -887,7 +992,7 @@ struct init_thread_request
     int          reply_fd;
     int          wait_fd;
     client_cpu_t cpu;
-    char __pad_52[4];
+    int          request_shm;
 };
 struct init_thread_reply
 {
@@ -899,6 +1004,8 @@ struct init_thread_reply
     int          version;
     unsigned int all_cpus;
     int          suspend;
+    int          request_shm;
+    char __pad_44[4];
 };
 
 
@@ -1213,6 +1320,22 @@ struct dup_handle_reply
 
 
 
+struct get_handle_cache_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_handle_cache_reply
+{
+    struct reply_header __header;
+    data_size_t    size;
+    unsigned int   process_type;
+    unsigned int   thread_type;
+    char __pad_20[4];
+};
+
+
+
 struct open_process_request
 {
     struct request_header __header;
@@ -1424,6 +1547,36 @@ struct query_mutex_reply
 
 
 
+struct get_fast_sync_area_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_fast_sync_area_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
+    char __pad_12[4];
+};
+
+
+
+struct get_fast_sync_obj_request
+{
+    struct request_header __header;
+    obj_handle_t  handle;
+};
+struct get_fast_sync_obj_reply
+{
+    struct reply_header __header;
+    unsigned int index;
+    int          type;
+    unsigned int access;
+    char __pad_20[4];
+};
+
+
+
 struct create_semaphore_request
 {
     struct request_header __header;
@@ -1688,7 +1841,9 @@ struct create_socket_reply
 {
     struct reply_header __header;
     obj_handle_t handle;
-    char __pad_12[4];
+    unsigned int shared_index;
+    unsigned int shared_serial;
+    char __pad_20[4];
 };
 
 
@@ -1704,8 +1859,24 @@ struct accept_socket_reply
 {
     struct reply_header __header;
     obj_handle_t handle;
+    unsigned int shared_index;
+    unsigned int shared_serial;
+    char __pad_20[4];
+};
+
+
+
+struct get_socket_shared_area_request
+{
+    struct request_header __header;
     char __pad_12[4];
 };
+struct get_socket_shared_area_reply
+{
+    struct reply_header __header;
+    obj_handle_t handle;
+    data_size_t  size;
+};
 
 
 
@@ -3055,8 +3226,22 @@ struct get_msg_queue_reply
 {
     struct reply_header __header;
     obj_handle_t handle;
+    unsigned int shared_index;
+};
+
+
+
+struct get_queue_shared_area_request
+{
+    struct request_header __header;
     char __pad_12[4];
 };
+struct get_queue_shared_area_reply
+{
+    struct reply_header __header;
+    obj_handle_t handle;
+    data_size_t  size;
+};
 
 
 
@@ -3102,6 +3287,20 @@ struct get_queue_status_reply
 
 
 
+struct get_desktop_shared_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_desktop_shared_reply
+{
+    struct reply_header __header;
+    obj_handle_t handle;
+    data_size_t  size;
+};
+
+
+
 struct get_process_idle_event_request
 {
     struct request_header __header;
@@ -3478,6 +3677,7 @@ struct create_named_pipe_reply
 #define NAMED_PIPE_MESSAGE_STREAM_WRITE 0x0001
 #define NAMED_PIPE_MESSAGE_STREAM_READ  0x0002
 #define NAMED_PIPE_NONBLOCKING_MODE     0x0004
+#define NAMED_PIPE_USE_SOCKETS          0x0008
 #define NAMED_PIPE_SERVER_END           0x8000
 
 
@@ -5171,8 +5371,8 @@ struct get_object_type_reply
 {
     struct reply_header __header;
     data_size_t    total;
+    unsigned int   index;
     /* VARARG(type,unicode_str); */
-    char __pad_12[4];
 };
 
 
@@ -5438,6 +5638,18 @@ struct add_completion_reply
 
 
 
+struct wake_completion_request
+{
+    struct request_header __header;
+    obj_handle_t  handle;
+};
+struct wake_completion_reply
+{
+    struct reply_header __header;
+};
+
+
+
 struct remove_completion_request
 {
     struct request_header __header;
@@ -5828,6 +6040,7 @@ enum request
     REQ_close_handle,
     REQ_set_handle_info,
     REQ_dup_handle,
+    REQ_get_handle_cache,
     REQ_open_process,
     REQ_open_thread,
     REQ_select,
@@ -5841,6 +6054,8 @@ enum request
     REQ_release_mutex,
     REQ_open_mutex,
     REQ_query_mutex,
+    REQ_get_fast_sync_area,
+    REQ_get_fast_sync_obj,
     REQ_create_semaphore,
     REQ_release_semaphore,
     REQ_query_semaphore,
@@ -5858,6 +6073,7 @@ enum request
     REQ_unlock_file,
     REQ_create_socket,
     REQ_accept_socket,
+    REQ_get_socket_shared_area,
     REQ_accept_into_socket,
     REQ_set_socket_event,
     REQ_get_socket_event,
@@ -5936,9 +6152,11 @@ enum request
     REQ_empty_atom_table,
     REQ_init_atom_table,
     REQ_get_msg_queue,
+    REQ_get_queue_shared_area,
     REQ_set_queue_fd,
     REQ_set_queue_mask,
     REQ_get_queue_status,
+    REQ_get_desktop_shared,
     REQ_get_process_idle_event,
     REQ_send_message,
     REQ_post_quit_message,
@@ -6076,6 +6294,7 @@ enum request
     REQ_create_completion,
     REQ_open_completion,
     REQ_add_completion,
+    REQ_wake_completion,
     REQ_remove_completion,
     REQ_query_completion,
     REQ_set_completion_info,
@@ -6132,6 +6351,7 @@ union generic_request
     struct close_handle_request close_handle_request;
     struct set_handle_info_request set_handle_info_request;
     struct dup_handle_request dup_handle_request;
+    struct get_handle_cache_request get_handle_cache_request;
     struct open_process_request open_process_request;
     struct open_thread_request open_thread_request;
     struct select_request select_request;
@@ -6145,6 +6365,8 @@ union generic_request
     struct release_mutex_request release_mutex_request;
     struct open_mutex_request open_mutex_request;
     struct query_mutex_request query_mutex_request;
+    struct get_fast_sync_area_request get_fast_sync_area_request;
+    struct get_fast_sync_obj_request get_fast_sync_obj_request;
     struct create_semaphore_request create_semaphore_request;
     struct release_semaphore_request release_semaphore_request;
     struct query_semaphore_request query_semaphore_request;
@@ -6162,6 +6384,7 @@ union generic_request
     struct unlock_file_request unlock_file_request;
     struct create_socket_request create_socket_request;
     struct accept_socket_request accept_socket_request;
+    struct get_socket_shared_area_request get_socket_shared_area_request;
     struct accept_into_socket_request accept_into_socket_request;
     struct set_socket_event_request set_socket_event_request;
     struct get_socket_event_request get_socket_event_request;
@@ -6240,9 +6463,11 @@ union generic_request
     struct empty_atom_table_request empty_atom_table_request;
     struct init_atom_table_request init_atom_table_request;
     struct get_msg_queue_request get_msg_queue_request;
+    struct get_queue_shared_area_request get_queue_shared_area_request;
     struct set_queue_fd_request set_queue_fd_request;
     struct set_queue_mask_request set_queue_mask_request;
     struct get_queue_status_request get_queue_status_request;
+    struct get_desktop_shared_request get_desktop_shared_request;
     struct get_process_idle_event_request get_process_idle_event_request;
     struct send_message_request send_message_request;
     struct post_quit_message_request post_quit_message_request;
@@ -6380,6 +6605,7 @@ union generic_request
     struct create_completion_request create_completion_request;
     struct open_completion_request open_completion_request;
     struct add_completion_request add_completion_request;
+    struct wake_completion_request wake_completion_request;
     struct remove_completion_request remove_completion_request;
     struct query_completion_request query_completion_request;
     struct set_completion_info_request set_completion_info_request;
@@ -6434,6 +6660,7 @@ union generic_reply
     struct close_handle_reply close_handle_reply;
     struct set_handle_info_reply set_handle_info_reply;
     struct dup_handle_reply dup_handle_reply;
+    struct get_handle_cache_reply get_handle_cache_reply;
     struct open_process_reply open_process_reply;
     struct open_thread_reply open_thread_reply;
     struct select_reply select_reply;
@@ -6447,6 +6674,8 @@ union generic_reply
     struct release_mutex_reply release_mutex_reply;
     struct open_mutex_reply open_mutex_reply;
     struct query_mutex_reply query_mutex_reply;
+    struct get_fast_sync_area_reply get_fast_sync_area_reply;
+    struct get_fast_sync_obj_reply get_fast_sync_obj_reply;
     struct create_semaphore_reply create_semaphore_reply;
     struct release_semaphore_reply release_semaphore_reply;
     struct query_semaphore_reply query_semaphore_reply;
@@ -6464,6 +6693,7 @@ union generic_reply
     struct unlock_file_reply unlock_file_reply;
     struct create_socket_reply create_socket_reply;
     struct accept_socket_reply accept_socket_reply;
+    struct get_socket_shared_area_reply get_socket_shared_area_reply;
     struct accept_into_socket_reply accept_into_socket_reply;
     struct set_socket_event_reply set_socket_event_reply;
     struct get_socket_event_reply get_socket_event_reply;
@@ -6542,9 +6772,11 @@ union generic_reply
     struct empty_atom_table_reply empty_atom_table_reply;
     struct init_atom_table_reply init_atom_table_reply;
     struct get_msg_queue_reply get_msg_queue_reply;
+    struct get_queue_shared_area_reply get_queue_shared_area_reply;
     struct set_queue_fd_reply set_queue_fd_reply;
     struct set_queue_mask_reply set_queue_mask_reply;
     struct get_queue_status_reply get_queue_status_reply;
+    struct get_desktop_shared_reply get_desktop_shared_reply;
     struct get_process_idle_event_reply get_process_idle_event_reply;
     struct send_message_reply send_message_reply;
     struct post_quit_message_reply post_quit_message_reply;
@@ -6682,6 +6914,7 @@ union generic_reply
     struct create_completion_reply create_completion_reply;
     struct open_completion_reply open_completion_reply;
     struct add_completion_reply add_completion_reply;
+    struct wake_completion_reply wake_completion_reply;
     struct remove_completion_reply remove_completion_reply;
     struct query_completion_reply query_completion_reply;
     struct set_completion_info_reply set_completion_info_reply;
@@ -6710,7 +6943,7 @@ union generic_reply
 
 /* ### protocol_version begin ### */
 
-#define SERVER_PROTOCOL_VERSION 597
+#define SERVER_PROTOCOL_VERSION 608
 
 /* ### protocol_version end ### */
 
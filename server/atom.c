@@ -67,6 +67,7 @@ struct atom_table
     struct atom_entry **handles;             /* atom handles */
     int                 entries_count;       /* number of hash entries */
     struct atom_entry **entries;             /* hash table entries */
+    int                 nb_atoms;            /* number of atoms in the table */
 };
 
 static void atom_table_dump( struct object *obj, int verbose );
@@ -116,6 +117,7 @@ static struct atom_table *create_table(int entries_count)
         memset( table->entries, 0, sizeof(*table->entries) * table->entries_count );
         table->count = 64;
         table->last  = -1;
+        table->nb_atoms = 0;
         if ((table->handles = mem_alloc( sizeof(*table->handles) * table->count )))
             return table;
 fail:
@@ -211,6 +213,29 @@ static struct atom_entry *find_atom_entry( struct atom_table *table, const struc
     return entry;
 }
 
+/* grow the hash table once it gets too loaded; atoms are limited to MAX_ATOMS
+ * so rehashing all of them at once is cheap enough */
+static void grow_atom_hash( struct atom_table *table )
+{
+    struct atom_entry **entries, *entry;
+    int i, new_size = table->entries_count * 2 + 1;
+
+    if (table->nb_atoms <= 2 * table->entries_count || new_size > MAX_ATOMS) return;
+    if (!(entries = calloc( new_size, sizeof(*entries) ))) return;  /* keep the current table */
+
+    for (i = 0; i <= table->last; i++)
+    {
+        if (!(entry = table->handles[i])) continue;
+        entry->hash = hash_strW( entry->str, entry->len, new_size );
+        entry->prev = NULL;
+        if ((entry->next = entries[entry->hash])) entry->next->prev = entry;
+        entries[entry->hash] = entry;
+    }
+    free( table->entries );
+    table->entries = entries;
+    table->entries_count = new_size;
+}
+
 /* add an atom to the table */
 static atom_t add_atom( struct atom_table *table, const struct unicode_str *str )
 {
@@ -246,6 +271,8 @@ static atom_t add_atom( struct atom_table *table, const struct unicode_str *str
             entry->hash   = hash;
             entry->len    = str->len;
             memcpy( entry->str, str->str, str->len );
+            table->nb_atoms++;
+            grow_atom_hash( table );
         }
         else free( entry );
     }
@@ -265,6 +292,7 @@ static void delete_atom( struct atom_table *table, atom_t atom, int if_pinned )
         if (entry->prev) entry->prev->next = entry->next;
         else table->entries[entry->hash] = entry->next;
         table->handles[atom - MIN_STR_ATOM] = NULL;
+        table->nb_atoms--;
         free( entry );
     }
 }
@@ -477,6 +505,7 @@ DECL_HANDLER(empty_atom_table)
                 if (entry->prev) entry->prev->next = entry->next;
                 else table->entries[entry->hash] = entry->next;
                 table->handles[i] = NULL;
+                table->nb_atoms--;
                 free( entry );
             }
         }
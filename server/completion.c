@@ -43,15 +43,50 @@
 #include "request.h"
 
 
+/*
+ * Packets are queued in a fast_completion queue, which lives in the memory
+ * area shared with the clients when fast synchronization objects are enabled.
+ * Clients then queue and remove packets themselves, and only go through the
+ * server to wait alertably or in the cases described below.
+ *
+ * The queue is a bounded multi-producer multi-consumer ring: a producer
+ * reserves the slot at the tail position by moving the tail forward, fills it
+ * and sets its seq to the position + 1; a consumer does the same at the head
+ * position once the seq shows that the slot was filled, and then sets the seq
+ * to the position of the next round. Positions are masked with
+ * FAST_COMPLETION_POS_MASK, which leaves room for the flags in the tail.
+ *
+ * When the ring is full, packets are kept in the server list instead and the
+ * overflow flag is set until the list is empty again, so that everything goes
+ * through the server in the meantime and the packet order is preserved. The
+ * server wait flag is set while server threads wait on the port, so that
+ * clients queue packets through the server, which wakes them up. A client that
+ * publishes a packet reserved before the flag was set sends a wake_completion
+ * request instead.
+ *
+ * The ring is writable by all the clients, so the server never trusts it: it
+ * gives up after a few attempts at moving the positions, falling back to its
+ * own list, and only counts the slots that have been published. Flags that
+ * can't be cleared that way are left set, which only sends the clients to the
+ * server; flags that have to be set are forced in with a plain exchange that
+ * stops the clients, and the position they left is then put back.
+ */
+
+#define FAST_COMPLETION_RETRIES 16  /* attempts at updating a position before giving up */
+
 struct completion
 {
-    struct object  obj;
-    struct list    queue;
-    unsigned int   depth;
+    struct object           obj;
+    struct list             queue;       /* packets that didn't fit in the fast queue */
+    unsigned int            depth;       /* number of packets in the list */
+    struct fast_completion *fast;        /* fast queue, possibly in the shared area */
+    unsigned int            fast_index;  /* index of the fast queue in the shared area */
 };
 
 static void completion_dump( struct object*, int );
 static struct object_type *completion_get_type( struct object *obj );
+static int completion_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void completion_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int completion_signaled( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int completion_map_access( struct object *obj, unsigned int access );
 static void completion_destroy( struct object * );
@@ -61,8 +96,8 @@ static const struct object_ops completion_ops =
     sizeof(struct completion), /* size */
     completion_dump,           /* dump */
     completion_get_type,       /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    completion_add_queue,      /* add_queue */
+    completion_remove_queue,   /* remove_queue */
     completion_signaled,       /* signaled */
     no_satisfied,              /* satisfied */
     no_signal,                 /* signal */
@@ -97,6 +132,95 @@ static void completion_destroy( struct object *obj)
     {
         free( tmp );
     }
+    if (completion->fast) free_fast_completion( completion->fast, completion->fast_index );
+}
+
+/* signed difference between two queue positions */
+static inline int pos_diff( unsigned int a, unsigned int b )
+{
+    return (int)((a - b) << 2) >> 2;
+}
+
+/* atomically replace the flags in mask by value */
+static void fast_completion_set_flags( struct fast_completion *fast, unsigned int mask, unsigned int value )
+{
+    unsigned int old, i;
+
+    for (i = 0; i < FAST_COMPLETION_RETRIES; i++)
+    {
+        old = fast->tail;
+        if (interlocked_cmpxchg( (int *)&fast->tail, (old & ~mask) | value, old ) == old) return;
+    }
+    if (!value) return;
+
+    /* the clients don't move the tail while any flag is set */
+    old = interlocked_xchg( (int *)&fast->tail, fast->tail | value );
+    interlocked_xchg( (int *)&fast->tail, (old & ~mask) | value );
+}
+
+/* check if a slot of the fast queue holds the packet published at a given position */
+static inline int fast_completion_published( struct fast_completion *fast, unsigned int pos )
+{
+    return !pos_diff( fast->packets[pos % FAST_COMPLETION_PACKETS].seq, pos + 1 );
+}
+
+/* number of packets published in the fast queue, the ones still being queued are not counted */
+static unsigned int fast_completion_depth( struct fast_completion *fast )
+{
+    unsigned int head = fast->head, count = (fast->tail - head) & FAST_COMPLETION_POS_MASK;
+    unsigned int i, depth = 0;
+
+    for (i = 0; i < min( count, FAST_COMPLETION_PACKETS ); i++)
+        if (fast_completion_published( fast, head + i )) depth++;
+    return depth;
+}
+
+/* queue a packet in the fast queue, fails if it's full */
+static int fast_completion_queue( struct fast_completion *fast, apc_param_t ckey, apc_param_t cvalue,
+                                  unsigned int status, apc_param_t information )
+{
+    struct fast_completion_packet *packet;
+    unsigned int tail, pos, i;
+
+    for (i = 0; ; i++)
+    {
+        if (i == FAST_COMPLETION_RETRIES) return 0;
+        tail = fast->tail;
+        pos = tail & FAST_COMPLETION_POS_MASK;
+        packet = &fast->packets[pos % FAST_COMPLETION_PACKETS];
+        if (pos_diff( packet->seq, pos ) < 0) return 0;  /* full */
+        if (packet->seq == pos &&
+            interlocked_cmpxchg( (int *)&fast->tail, (tail & ~FAST_COMPLETION_POS_MASK) |
+                                 ((pos + 1) & FAST_COMPLETION_POS_MASK), tail ) == tail) break;
+    }
+    packet->ckey        = ckey;
+    packet->cvalue      = cvalue;
+    packet->status      = status;
+    packet->information = information;
+    interlocked_xchg( (int *)&packet->seq, (pos + 1) & FAST_COMPLETION_POS_MASK );
+    fast_completion_wake( fast );
+    return 1;
+}
+
+/* remove a packet from the fast queue, fails if there's none ready */
+static int fast_completion_remove( struct fast_completion *fast, struct fast_completion_packet *ret )
+{
+    struct fast_completion_packet *packet;
+    unsigned int head, i;
+
+    for (i = 0; ; i++)
+    {
+        if (i == FAST_COMPLETION_RETRIES) return 0;
+        head = fast->head;
+        packet = &fast->packets[head % FAST_COMPLETION_PACKETS];
+        /* a slot that is not published yet is treated as empty */
+        if (pos_diff( packet->seq, head + 1 ) < 0) return 0;
+        if (fast_completion_published( fast, head ) &&
+            interlocked_cmpxchg( (int *)&fast->head, (head + 1) & FAST_COMPLETION_POS_MASK, head ) == head) break;
+    }
+    *ret = *packet;
+    interlocked_xchg( (int *)&packet->seq, (head + FAST_COMPLETION_PACKETS) & FAST_COMPLETION_POS_MASK );
+    return 1;
 }
 
 static void completion_dump( struct object *obj, int verbose )
@@ -104,7 +228,7 @@ static void completion_dump( struct object *obj, int verbose )
     struct completion *completion = (struct completion *) obj;
 
     assert( obj->ops == &completion_ops );
-    fprintf( stderr, "Completion depth=%u\n", completion->depth );
+    fprintf( stderr, "Completion depth=%u\n", completion->depth + fast_completion_depth( completion->fast ) );
 }
 
 static struct object_type *completion_get_type( struct object *obj )
@@ -114,11 +238,30 @@ static struct object_type *completion_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int completion_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct completion *completion = (struct completion *)obj;
+
+    add_queue( obj, entry );
+    fast_completion_set_flags( completion->fast, FAST_COMPLETION_SERVER_WAIT, FAST_COMPLETION_SERVER_WAIT );
+    return 1;
+}
+
+static void completion_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct completion *completion = (struct completion *)obj;
+
+    remove_queue( obj, entry );
+    if (list_empty( &obj->wait_queue ))
+        fast_completion_set_flags( completion->fast, FAST_COMPLETION_SERVER_WAIT, 0 );
+}
+
 static int completion_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct completion *completion = (struct completion *)obj;
 
-    return !list_empty( &completion->queue );
+    /* the clients that publish a packet while server threads wait send a wake_completion request */
+    return !list_empty( &completion->queue ) || fast_completion_published( completion->fast, completion->fast->head );
 }
 
 static unsigned int completion_map_access( struct object *obj, unsigned int access )
@@ -142,6 +285,11 @@ static struct completion *create_completion( struct object *root, const struct u
         {
             list_init( &completion->queue );
             completion->depth = 0;
+            if (!(completion->fast = alloc_fast_completion( &completion->fast_index )))
+            {
+                release_object( completion );
+                return NULL;
+            }
         }
     }
 
@@ -153,12 +301,25 @@ struct completion *get_completion_obj( struct process *process, obj_handle_t han
     return (struct completion *) get_handle_obj( process, handle, access, &completion_ops );
 }
 
+unsigned int get_completion_fast_sync_index( struct object *obj )
+{
+    if (obj->ops != &completion_ops) return 0;
+    return ((struct completion *)obj)->fast_index;
+}
+
 void add_completion( struct completion *completion, apc_param_t ckey, apc_param_t cvalue,
                      unsigned int status, apc_param_t information )
 {
-    struct comp_msg *msg = mem_alloc( sizeof( *msg ) );
+    struct comp_msg *msg;
 
-    if (!msg)
+    if (!(completion->fast->tail & FAST_COMPLETION_OVERFLOW) &&
+        fast_completion_queue( completion->fast, ckey, cvalue, status, information ))
+    {
+        wake_up( &completion->obj, 1 );
+        return;
+    }
+
+    if (!(msg = mem_alloc( sizeof( *msg ) )))
         return;
 
     msg->ckey = ckey;
@@ -168,6 +329,9 @@ void add_completion( struct completion *completion, apc_param_t ckey, apc_param_
 
     list_add_tail( &completion->queue, &msg->queue_entry );
     completion->depth++;
+    /* client threads waiting on the fast queue have to come to the server for this packet */
+    fast_completion_set_flags( completion->fast, FAST_COMPLETION_OVERFLOW, FAST_COMPLETION_OVERFLOW );
+    fast_completion_wake( completion->fast );
     wake_up( &completion->obj, 1 );
 }
 
@@ -213,17 +377,36 @@ DECL_HANDLER(add_completion)
     release_object( completion );
 }
 
+/* wake up the threads waiting for a packet queued in the fast queue */
+DECL_HANDLER(wake_completion)
+{
+    struct completion* completion = get_completion_obj( current->process, req->handle, IO_COMPLETION_MODIFY_STATE );
+
+    if (!completion) return;
+
+    wake_up( &completion->obj, 1 );
+
+    release_object( completion );
+}
+
 /* get completion from completion port */
 DECL_HANDLER(remove_completion)
 {
     struct completion* completion = get_completion_obj( current->process, req->handle, IO_COMPLETION_MODIFY_STATE );
+    struct fast_completion_packet packet;
     struct list *entry;
     struct comp_msg *msg;
 
     if (!completion) return;
 
-    entry = list_head( &completion->queue );
-    if (!entry)
+    if (fast_completion_remove( completion->fast, &packet ))
+    {
+        reply->ckey = packet.ckey;
+        reply->cvalue = packet.cvalue;
+        reply->status = packet.status;
+        reply->information = packet.information;
+    }
+    else if (!(entry = list_head( &completion->queue )))
         set_error( STATUS_PENDING );
     else
     {
@@ -235,6 +418,8 @@ DECL_HANDLER(remove_completion)
         reply->status = msg->status;
         reply->information = msg->information;
         free( msg );
+        if (list_empty( &completion->queue ))
+            fast_completion_set_flags( completion->fast, FAST_COMPLETION_OVERFLOW, 0 );
     }
 
     release_object( completion );
@@ -247,7 +432,7 @@ DECL_HANDLER(query_completion)
 
     if (!completion) return;
 
-    reply->depth = completion->depth;
+    reply->depth = completion->depth + fast_completion_depth( completion->fast );
 
     release_object( completion );
 }
@@ -44,6 +44,7 @@
 struct object_type
 {
     struct object     obj;        /* object header */
+    unsigned int      index;      /* type index, as exposed in the handle cache */
 };
 
 static void object_type_dump( struct object *obj, int verbose );
@@ -195,7 +196,7 @@ static void directory_destroy( struct object *obj )
 {
     struct directory *dir = (struct directory *)obj;
     assert( obj->ops == &directory_ops );
-    free( dir->entries );
+    free_namespace( dir->entries );
 }
 
 static struct directory *create_directory( struct object *root, const struct unicode_str *name,
@@ -230,12 +231,14 @@ struct object *get_directory_obj( struct process *process, obj_handle_t handle )
 /* retrieve an object type, creating it if needed */
 struct object_type *get_object_type( const struct unicode_str *name )
 {
+    static unsigned int nb_types;
     struct object_type *type;
 
     if ((type = create_named_object( &dir_objtype->obj, &object_type_ops, name, OBJ_OPENIF, NULL )))
     {
         if (get_error() != STATUS_OBJECT_NAME_EXISTS)
         {
+            type->index = ++nb_types;
             grab_object( type );
             make_object_static( &type->obj );
         }
@@ -244,6 +247,37 @@ struct object_type *get_object_type( const struct unicode_str *name )
     return type;
 }
 
+/* return the type index of an object, 0 if it has no type */
+unsigned int get_object_type_index( struct object *obj )
+{
+    /* the type only depends on the object ops, so cache it */
+    static struct
+    {
+        const struct object_ops *ops;
+        unsigned int             index;
+    } cache[64];
+    struct object_type *type;
+    unsigned int i, index = 0, error;
+
+    for (i = 0; i < ARRAY_SIZE(cache) && cache[i].ops; i++)
+        if (cache[i].ops == obj->ops) return cache[i].index;
+
+    error = get_error();
+    if ((type = obj->ops->get_type( obj )))
+    {
+        index = type->index;
+        release_object( type );
+    }
+    set_error( error );
+
+    if (i < ARRAY_SIZE(cache))
+    {
+        cache[i].ops   = obj->ops;
+        cache[i].index = index;
+    }
+    return index;
+}
+
 /* Global initialization */
 
 static void create_session( unsigned int id )
@@ -525,6 +559,7 @@ DECL_HANDLER(get_object_type)
     {
         if ((name = get_object_name( &type->obj, &reply->total )))
             set_reply_data( name, min( reply->total, get_reply_max_size() ) );
+        reply->index = type->index;
         release_object( type );
     }
     release_object( obj );
@@ -38,27 +38,31 @@
 
 struct event
 {
-    struct object  obj;             /* object header */
-    struct list    kernel_object;   /* list of kernel object pointers */
-    int            manual_reset;    /* is it a manual reset event? */
-    int            signaled;        /* event has been signaled */
+    struct object           obj;             /* object header */
+    struct list             kernel_object;   /* list of kernel object pointers */
+    int                     manual_reset;    /* is it a manual reset event? */
+    struct fast_sync_entry *sync;            /* event state, non-zero if signaled */
+    unsigned int            sync_index;      /* index of the state in the shared area */
 };
 
 static void event_dump( struct object *obj, int verbose );
 static struct object_type *event_get_type( struct object *obj );
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int event_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void event_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int event_map_access( struct object *obj, unsigned int access );
 static int event_signal( struct object *obj, unsigned int access);
 static struct list *event_get_kernel_obj_list( struct object *obj );
+static void event_destroy( struct object *obj );
 
 static const struct object_ops event_ops =
 {
     sizeof(struct event),      /* size */
     event_dump,                /* dump */
     event_get_type,            /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    event_add_queue,           /* add_queue */
+    event_remove_queue,        /* remove_queue */
     event_signaled,            /* signaled */
     event_satisfied,           /* satisfied */
     event_signal,              /* signal */
@@ -72,7 +76,7 @@ static const struct object_ops event_ops =
     no_open_file,              /* open_file */
     event_get_kernel_obj_list, /* get_kernel_obj_list */
     no_close_handle,           /* close_handle */
-    no_destroy                 /* destroy */
+    event_destroy              /* destroy */
 };
 
 
@@ -123,12 +127,23 @@ struct event *create_event( struct object *root, const struct unicode_str *name,
             /* initialize it if it didn't already exist */
             list_init( &event->kernel_object );
             event->manual_reset = manual_reset;
-            event->signaled     = initial_state;
+            if (!(event->sync = alloc_fast_sync_entry( &event->sync_index )))
+            {
+                release_object( event );
+                return NULL;
+            }
+            event->sync->data  = manual_reset;
+            event->sync->state = initial_state ? 1 : 0;
         }
     }
     return event;
 }
 
+static inline int event_is_signaled( struct event *event )
+{
+    return (event->sync->state & FAST_SYNC_STATE_MASK) != 0;
+}
+
 struct event *get_event_obj( struct process *process, obj_handle_t handle, unsigned int access )
 {
     return (struct event *)get_handle_obj( process, handle, access, &event_ops );
@@ -136,22 +151,31 @@ struct event *get_event_obj( struct process *process, obj_handle_t handle, unsig
 
 void pulse_event( struct event *event )
 {
-    event->signaled = 1;
+    fast_sync_update( event->sync, FAST_SYNC_STATE_MASK, 1 );
     /* wake up all waiters if manual reset, a single one otherwise */
     wake_up( &event->obj, !event->manual_reset );
-    event->signaled = 0;
+    /* the client threads waiting on the futex would only see the state once it's reset */
+    if (event->manual_reset || event_is_signaled( event ))
+        fast_sync_pulse( event->sync, !event->manual_reset );
+    fast_sync_update( event->sync, FAST_SYNC_STATE_MASK, 0 );
 }
 
 void set_event( struct event *event )
 {
-    event->signaled = 1;
+    fast_sync_update( event->sync, FAST_SYNC_STATE_MASK, 1 );
     /* wake up all waiters if manual reset, a single one otherwise */
     wake_up( &event->obj, !event->manual_reset );
 }
 
 void reset_event( struct event *event )
 {
-    event->signaled = 0;
+    fast_sync_update( event->sync, FAST_SYNC_STATE_MASK, 0 );
+}
+
+unsigned int get_event_fast_sync_index( struct object *obj )
+{
+    if (obj->ops != &event_ops) return 0;
+    return ((struct event *)obj)->sync_index;
 }
 
 static void event_dump( struct object *obj, int verbose )
@@ -159,7 +183,7 @@ static void event_dump( struct object *obj, int verbose )
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
     fprintf( stderr, "Event manual=%d signaled=%d\n",
-             event->manual_reset, event->signaled );
+             event->manual_reset, event_is_signaled( event ) );
 }
 
 static struct object_type *event_get_type( struct object *obj )
@@ -169,11 +193,25 @@ static struct object_type *event_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    return fast_sync_add_queue( obj, entry, event->sync );
+}
+
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    fast_sync_remove_queue( obj, entry, event->sync );
+}
+
 static int event_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
-    return event->signaled;
+    return event_is_signaled( event );
 }
 
 static void event_satisfied( struct object *obj, struct wait_queue_entry *entry )
@@ -181,7 +219,7 @@ static void event_satisfied( struct object *obj, struct wait_queue_entry *entry
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
     /* Reset if it's an auto-reset event */
-    if (!event->manual_reset) event->signaled = 0;
+    if (!event->manual_reset) fast_sync_update( event->sync, FAST_SYNC_STATE_MASK, 0 );
 }
 
 static unsigned int event_map_access( struct object *obj, unsigned int access )
@@ -213,6 +251,14 @@ static struct list *event_get_kernel_obj_list( struct object *obj )
     return &event->kernel_object;
 }
 
+static void event_destroy( struct object *obj )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+
+    if (event->sync) free_fast_sync_entry( event->sync, event->sync_index );
+}
+
 struct keyed_event *create_keyed_event( struct object *root, const struct unicode_str *name,
                                         unsigned int attr, const struct security_descriptor *sd )
 {
@@ -322,7 +368,7 @@ DECL_HANDLER(event_op)
     struct event *event;
 
     if (!(event = get_event_obj( current->process, req->handle, EVENT_MODIFY_STATE ))) return;
-    reply->state = event->signaled;
+    reply->state = event_is_signaled( event );
     switch(req->op)
     {
     case PULSE_EVENT:
@@ -349,7 +395,7 @@ DECL_HANDLER(query_event)
     if (!(event = get_event_obj( current->process, req->handle, EVENT_QUERY_STATE ))) return;
 
     reply->manual_reset = event->manual_reset;
-    reply->state = event->signaled;
+    reply->state = event_is_signaled( event );
 
     release_object( event );
 }
@@ -0,0 +1,317 @@
+/*
+ * Server-side support for client-side synchronization objects
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winternl.h"
+
+#include "file.h"
+#include "handle.h"
+#include "thread.h"
+#include "request.h"
+
+/*
+ * The state of events, semaphores and mutexes is stored in a fast_sync_entry
+ * instead of the object itself. When enabled, these entries live in a memory
+ * area that is mapped in all client processes, which lets clients signal and
+ * wait on the objects with atomic operations and futexes, without a server
+ * round-trip.
+ *
+ * Clients may only change an entry while FAST_SYNC_SERVER_WAIT is clear. The
+ * server sets that flag as long as a thread is waiting on the object through
+ * the server, so that such waits keep being satisfied by the server in the
+ * usual way; clients seeing the flag fall back to server requests. The server
+ * itself always updates entries atomically, and wakes up the client threads
+ * waiting on the futex whenever the state changes. Clients wait on the seq
+ * counter rather than on the state, so that a change that is undone right
+ * away, like a PulseEvent, still wakes them up; the pulse counter then tells
+ * them that the event was pulsed while they were waiting.
+ *
+ * Client threads may still be waiting on an entry when its object is
+ * destroyed, so such an entry is kept aside until its waiters are gone
+ * instead of being reused right away.
+ *
+ * The area also holds a packet queue for each completion port, following the
+ * entries; see server/completion.c for the details.
+ *
+ * When the area is disabled or full, entries are allocated privately and
+ * the objects work exactly as before.
+ *
+ * The area is writable by all the clients, so the server never spins on it:
+ * when an entry keeps changing under its atomic updates, it first sets
+ * FAST_SYNC_SERVER_WAIT with a plain exchange so that the clients stop
+ * changing the entry, and then applies its update to the state they left.
+ */
+
+#define FAST_SYNC_RETRIES 16  /* attempts at updating an entry before forcing the update */
+
+static struct fast_sync_entry *fast_sync_area;   /* shared area, NULL if disabled */
+static int fast_sync_fd = -1;                    /* fd of the shared area */
+static unsigned int fast_sync_used = 1;          /* entries used so far, entry 0 is never used */
+static unsigned int fast_sync_nb_free;           /* number of freed entries */
+static unsigned int fast_sync_free[FAST_SYNC_ENTRIES];  /* freed entries, kept out of reach of the clients */
+static unsigned int fast_sync_nb_pinned;         /* number of freed entries that still have waiters */
+static unsigned int fast_sync_pinned[FAST_SYNC_ENTRIES];  /* freed entries that still have waiters */
+static struct fast_completion *fast_completion_area;    /* completion port queues in the shared area */
+static unsigned int fast_completion_used = 1;           /* queues used so far, queue 0 is never used */
+static unsigned int fast_completion_nb_free;            /* number of freed queues */
+static unsigned int fast_completion_free[FAST_COMPLETION_ENTRIES];  /* freed queues */
+
+#ifdef __linux__
+#define FUTEX_WAKE 1
+
+static inline void futex_wake( int *addr, int count )
+{
+    syscall( __NR_futex, addr, FUTEX_WAKE, count, NULL, 0, 0 );
+}
+#else
+static inline void futex_wake( int *addr, int count )
+{
+    assert(0);  /* the shared area is never enabled */
+}
+#endif
+
+/* create the shared area if enabled in the environment */
+void init_fast_sync(void)
+{
+#ifdef __linux__
+    const char *env = getenv( "WINEFASTSYNC" );
+    void *ptr;
+
+    if (!env || !atoi( env )) return;
+    if ((fast_sync_fd = create_shared_memory( FAST_SYNC_AREA_SIZE, &ptr )) == -1)
+    {
+        fprintf( stderr, "wineserver: cannot create the fast sync area, disabling it\n" );
+        clear_error();
+        return;
+    }
+    fast_sync_area = ptr;
+    fast_completion_area = (struct fast_completion *)(fast_sync_area + FAST_SYNC_ENTRIES);
+#endif
+}
+
+/* move the freed entries whose waiters are gone to the free list */
+static void release_pinned_fast_sync_entries(void)
+{
+    unsigned int i = 0, index;
+
+    while (i < fast_sync_nb_pinned)
+    {
+        index = fast_sync_pinned[i];
+        if (fast_sync_area[index].waiters > 0)
+        {
+            i++;
+            continue;
+        }
+        fast_sync_free[fast_sync_nb_free++] = index;
+        fast_sync_pinned[i] = fast_sync_pinned[--fast_sync_nb_pinned];
+    }
+}
+
+/* allocate the state of a synchronization object; index is 0 for private entries */
+struct fast_sync_entry *alloc_fast_sync_entry( unsigned int *index )
+{
+    struct fast_sync_entry *entry;
+
+    *index = 0;
+    if (fast_sync_area)
+    {
+        if (!fast_sync_nb_free && fast_sync_used == FAST_SYNC_ENTRIES) release_pinned_fast_sync_entries();
+        if (fast_sync_nb_free) *index = fast_sync_free[--fast_sync_nb_free];
+        else if (fast_sync_used < FAST_SYNC_ENTRIES) *index = fast_sync_used++;
+    }
+
+    if (*index) entry = &fast_sync_area[*index];
+    else if (!(entry = mem_alloc( sizeof(*entry) ))) return NULL;
+
+    entry->state   = 0;
+    entry->waiters = 0;
+    entry->data    = 0;
+    entry->seq     = 0;
+    entry->pulse   = 0;
+    entry->thread  = 0;
+    return entry;
+}
+
+/* free the state of a synchronization object */
+void free_fast_sync_entry( struct fast_sync_entry *entry, unsigned int index )
+{
+    if (!index)
+    {
+        free( entry );
+        return;
+    }
+    assert( entry == &fast_sync_area[index] );
+    entry->state = 0;
+    if (entry->waiters > 0) fast_sync_pinned[fast_sync_nb_pinned++] = index;
+    else fast_sync_free[fast_sync_nb_free++] = index;
+}
+
+/* wake up the client threads waiting on an entry */
+void fast_sync_wake( struct fast_sync_entry *entry )
+{
+    interlocked_xchg_add( &entry->seq, 1 );
+    /* waiters re-check the state themselves, so it's safe to wake them all */
+    if (entry->waiters) futex_wake( &entry->seq, 0x7fffffff );
+}
+
+/* atomically replace the bits in mask by value, and return the previous state */
+int fast_sync_update( struct fast_sync_entry *entry, int mask, int value )
+{
+    int old, new, i;
+
+    for (i = 0; i < FAST_SYNC_RETRIES; i++)
+    {
+        old = entry->state;
+        new = (old & ~mask) | (value & mask);
+        if (interlocked_cmpxchg( &entry->state, new, old ) == old) goto done;
+    }
+
+    /* the clients keep changing the state, send them to the server while it's updated */
+    old = interlocked_xchg( &entry->state, entry->state | FAST_SYNC_SERVER_WAIT );
+    new = (old & ~mask) | (value & mask);
+    interlocked_xchg( &entry->state, new );
+
+done:
+    if (new != old) fast_sync_wake( entry );
+    return old;
+}
+
+/* release the client threads waiting on an event that is pulsed; for an auto-reset
+ * event, only the first of them that sees the pulse is released */
+void fast_sync_pulse( struct fast_sync_entry *entry, int auto_reset )
+{
+    unsigned int old, i;
+
+    for (i = 0; i < FAST_SYNC_RETRIES; i++)
+    {
+        old = entry->pulse;
+        if (interlocked_cmpxchg( (int *)&entry->pulse, ((old & ~1) + 2) | !!auto_reset, old ) == old)
+            goto done;
+    }
+    /* the clients keep changing the counter; the pulse is still seen, but an auto-reset
+     * pulse only releases a waiter if the previous one wasn't taken */
+    interlocked_xchg_add( (int *)&entry->pulse, 2 );
+
+done:
+    fast_sync_wake( entry );
+}
+
+/* add a server-side wait on an object, clients have to go through the server until it's removed */
+int fast_sync_add_queue( struct object *obj, struct wait_queue_entry *wait, struct fast_sync_entry *entry )
+{
+    add_queue( obj, wait );
+    fast_sync_update( entry, FAST_SYNC_SERVER_WAIT, FAST_SYNC_SERVER_WAIT );
+    return 1;
+}
+
+/* remove a server-side wait on an object */
+void fast_sync_remove_queue( struct object *obj, struct wait_queue_entry *wait, struct fast_sync_entry *entry )
+{
+    remove_queue( obj, wait );
+    if (list_empty( &obj->wait_queue )) fast_sync_update( entry, FAST_SYNC_SERVER_WAIT, 0 );
+}
+
+/* allocate the packet queue of a completion port; index is 0 for private queues */
+struct fast_completion *alloc_fast_completion( unsigned int *index )
+{
+    struct fast_completion *queue;
+    unsigned int i;
+
+    *index = 0;
+    if (fast_completion_area)
+    {
+        if (fast_completion_nb_free) *index = fast_completion_free[--fast_completion_nb_free];
+        else if (fast_completion_used < FAST_COMPLETION_ENTRIES) *index = fast_completion_used++;
+    }
+
+    if (*index) queue = &fast_completion_area[*index];
+    else if (!(queue = mem_alloc( sizeof(*queue) ))) return NULL;
+
+    queue->tail    = 0;
+    queue->head    = 0;
+    queue->signal  = 0;
+    queue->waiters = 0;
+    for (i = 0; i < FAST_COMPLETION_PACKETS; i++) queue->packets[i].seq = i;
+    return queue;
+}
+
+/* free the packet queue of a completion port */
+void free_fast_completion( struct fast_completion *queue, unsigned int index )
+{
+    if (!index)
+    {
+        free( queue );
+        return;
+    }
+    assert( queue == &fast_completion_area[index] );
+    fast_completion_free[fast_completion_nb_free++] = index;
+}
+
+/* wake up a client thread waiting for a packet on a completion port */
+void fast_completion_wake( struct fast_completion *queue )
+{
+    interlocked_xchg_add( &queue->signal, 1 );
+    if (queue->waiters) futex_wake( &queue->signal, 1 );
+}
+
+/* retrieve the shared area */
+DECL_HANDLER(get_fast_sync_area)
+{
+    if (!fast_sync_area)
+    {
+        set_error( STATUS_NOT_IMPLEMENTED );
+        return;
+    }
+    if (!send_client_fd( current->process, fast_sync_fd, 0 ))
+        reply->size = FAST_SYNC_AREA_SIZE;
+}
+
+/* retrieve the location of a synchronization object in the shared area */
+DECL_HANDLER(get_fast_sync_obj)
+{
+    struct object *obj;
+
+    if (!fast_sync_area)
+    {
+        set_error( STATUS_NOT_IMPLEMENTED );
+        return;
+    }
+    if (!(obj = get_handle_obj( current->process, req->handle, 0, NULL ))) return;
+
+    if ((reply->index = get_event_fast_sync_index( obj ))) reply->type = FAST_SYNC_EVENT;
+    else if ((reply->index = get_semaphore_fast_sync_index( obj ))) reply->type = FAST_SYNC_SEMAPHORE;
+    else if ((reply->index = get_mutex_fast_sync_index( obj ))) reply->type = FAST_SYNC_MUTEX;
+    else if ((reply->index = get_completion_fast_sync_index( obj ))) reply->type = FAST_SYNC_COMPLETION;
+    else reply->type = FAST_SYNC_NONE;
+    reply->access = get_handle_access( current->process, req->handle );
+    release_object( obj );
+}
@@ -114,6 +114,7 @@
 # define EPOLLOUT POLLOUT
 # define EPOLLERR POLLERR
 # define EPOLLHUP POLLHUP
+# define EPOLLET (1u << 31)
 # define EPOLL_CTL_ADD 1
 # define EPOLL_CTL_DEL 2
 # define EPOLL_CTL_MOD 3
@@ -363,14 +364,26 @@ static file_pos_t max_unix_offset = OFF_T_MAX;
 
 struct timeout_user
 {
-    struct list           entry;      /* entry in sorted timeout list */
+    struct list           entry;      /* entry in expired timeouts list */
     abstime_t             when;       /* timeout expiry */
+    unsigned int          seq;        /* insertion sequence, to order timeouts with the same expiry */
+    int                   index;      /* index in the timeout heap, -1 once expired */
     timeout_callback      callback;   /* callback function */
     void                 *private;    /* callback private data */
 };
 
-static struct list abs_timeout_list = LIST_INIT(abs_timeout_list); /* sorted absolute timeouts list */
-static struct list rel_timeout_list = LIST_INIT(rel_timeout_list); /* sorted relative timeouts list */
+/* binary min-heap of timeouts, ordered by expiry */
+struct timeout_heap
+{
+    struct timeout_user **users;      /* heap array */
+    int                   count;      /* number of timeouts in the heap */
+    int                   size;       /* allocated size of the array */
+};
+
+static struct timeout_heap abs_timeouts;  /* absolute timeouts */
+static struct timeout_heap rel_timeouts;  /* relative timeouts, stored as negative monotonic times */
+static unsigned int timeout_seq;          /* sequence number of the last added timeout */
+
 timeout_t current_time;
 timeout_t monotonic_time;
 
@@ -383,43 +396,110 @@ void set_current_time(void)
     monotonic_time = monotonic_counter();
 }
 
+/* check if timeout a expires before b; timeouts with the same expiry go in reverse order of insertion */
+static inline int timeout_before( const struct timeout_user *a, const struct timeout_user *b )
+{
+    timeout_t when_a = a->when > 0 ? a->when : -a->when;
+    timeout_t when_b = b->when > 0 ? b->when : -b->when;
+
+    if (when_a != when_b) return when_a < when_b;
+    return (int)(a->seq - b->seq) > 0;
+}
+
+/* move a timeout up the heap until it's in the right position */
+static void timeout_heap_up( struct timeout_heap *heap, int pos )
+{
+    struct timeout_user *user = heap->users[pos];
+
+    while (pos)
+    {
+        int parent = (pos - 1) / 2;
+        if (!timeout_before( user, heap->users[parent] )) break;
+        heap->users[pos] = heap->users[parent];
+        heap->users[pos]->index = pos;
+        pos = parent;
+    }
+    heap->users[pos] = user;
+    user->index = pos;
+}
+
+/* move a timeout down the heap until it's in the right position */
+static void timeout_heap_down( struct timeout_heap *heap, int pos )
+{
+    struct timeout_user *user = heap->users[pos];
+
+    for (;;)
+    {
+        int child = 2 * pos + 1;
+        if (child >= heap->count) break;
+        if (child + 1 < heap->count && timeout_before( heap->users[child + 1], heap->users[child] )) child++;
+        if (!timeout_before( heap->users[child], user )) break;
+        heap->users[pos] = heap->users[child];
+        heap->users[pos]->index = pos;
+        pos = child;
+    }
+    heap->users[pos] = user;
+    user->index = pos;
+}
+
+/* remove a timeout from its heap */
+static void timeout_heap_remove( struct timeout_heap *heap, struct timeout_user *user )
+{
+    int pos = user->index;
+    struct timeout_user *last = heap->users[--heap->count];
+
+    user->index = -1;
+    if (last == user) return;
+    heap->users[pos] = last;
+    last->index = pos;
+    if (pos && timeout_before( last, heap->users[(pos - 1) / 2] )) timeout_heap_up( heap, pos );
+    else timeout_heap_down( heap, pos );
+}
+
+static inline struct timeout_heap *get_timeout_heap( const struct timeout_user *user )
+{
+    return user->when > 0 ? &abs_timeouts : &rel_timeouts;
+}
+
 /* add a timeout user */
 struct timeout_user *add_timeout_user( timeout_t when, timeout_callback func, void *private )
 {
     struct timeout_user *user;
-    struct list *ptr;
+    struct timeout_heap *heap;
 
     if (!(user = mem_alloc( sizeof(*user) ))) return NULL;
     user->when     = timeout_to_abstime( when );
+    user->seq      = ++timeout_seq;
     user->callback = func;
     user->private  = private;
 
-    /* Now insert it in the linked list */
+    /* Now insert it in the heap */
 
-    if (user->when > 0)
+    heap = get_timeout_heap( user );
+    if (heap->count == heap->size)
     {
-        LIST_FOR_EACH( ptr, &abs_timeout_list )
-        {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-            if (timeout->when >= user->when) break;
-        }
-    }
-    else
-    {
-        LIST_FOR_EACH( ptr, &rel_timeout_list )
+        int new_size = heap->size ? heap->size * 2 : 64;
+        struct timeout_user **new_users;
+
+        if (!(new_users = realloc( heap->users, new_size * sizeof(*new_users) )))
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-            if (timeout->when <= user->when) break;
+            set_error( STATUS_NO_MEMORY );
+            free( user );
+            return NULL;
         }
+        heap->users = new_users;
+        heap->size  = new_size;
     }
-    list_add_before( ptr, &user->entry );
+    heap->users[heap->count] = user;
+    timeout_heap_up( heap, heap->count++ );
     return user;
 }
 
 /* remove a timeout user */
 void remove_timeout_user( struct timeout_user *user )
 {
-    list_remove( &user->entry );
+    if (user->index == -1) list_remove( &user->entry );  /* already expired */
+    else timeout_heap_remove( get_timeout_heap( user ), user );
     free( user );
 }
 
@@ -478,42 +558,74 @@ static inline void fd_poll_event( struct fd *fd, int event )
 
 #ifdef USE_EPOLL
 
+/*
+ * Changes to the events of an fd are not passed to epoll right away, they are
+ * recorded and flushed once before waiting, so that an fd whose events change
+ * several times while processing a batch of events costs at most one
+ * epoll_ctl() call. Removing an fd is still done immediately, as the unix fd
+ * may be closed right after that.
+ *
+ * When WINESERVEREPOLLET is set, sockets are registered in edge-triggered
+ * mode: events that are no longer wanted are then simply filtered out
+ * instead of being removed from epoll, and the fd is only re-registered when
+ * new events are wanted or an edge has been consumed since the last time.
+ */
+
+#define EPOLL_BATCH_SIZE 512
+
+struct epoll_user
+{
+    int          events;  /* events registered with epoll, -1 if not registered */
+    unsigned int dirty:1; /* events need to be flushed to epoll */
+    unsigned int edge:1;  /* registered in edge-triggered mode */
+    unsigned int rearm:1; /* an edge was reported since the fd was last registered */
+};
+
 static int epoll_fd = -1;
+static int epoll_edge_triggered;           /* use edge-triggered mode for sockets */
+static struct epoll_user *epoll_users;     /* epoll state of each poll user */
+static int *epoll_dirty;                   /* users whose events need to be flushed */
+static int nb_epoll_dirty;                 /* number of users in the dirty array */
+static unsigned int epoll_ctl_count;       /* number of epoll_ctl calls */
+static unsigned int epoll_wait_count;      /* number of epoll_wait calls */
 
 static inline void init_epoll(void)
 {
+    const char *env = getenv( "WINESERVEREPOLLET" );
+
     epoll_fd = epoll_create( 128 );
+    epoll_edge_triggered = env && atoi( env );
 }
 
-/* set the events that epoll waits for on this fd; helper for set_fd_events */
-static inline void set_fd_epoll_events( struct fd *fd, int user, int events )
+/* grow the epoll state arrays along with the poll array */
+static inline int resize_epoll_users( int old_count, int new_count )
 {
-    struct epoll_event ev;
-    int ctl;
-
-    if (epoll_fd == -1) return;
+    struct epoll_user *new_users;
+    int i, *new_dirty;
 
-    if (events == -1)  /* stop waiting on this fd completely */
+    if (!(new_users = realloc( epoll_users, new_count * sizeof(*epoll_users) ))) return 0;
+    epoll_users = new_users;
+    if (!(new_dirty = realloc( epoll_dirty, new_count * sizeof(*epoll_dirty) ))) return 0;
+    epoll_dirty = new_dirty;
+    for (i = old_count; i < new_count; i++)
     {
-        if (pollfd[user].fd == -1) return;  /* already removed */
-        ctl = EPOLL_CTL_DEL;
-    }
-    else if (pollfd[user].fd == -1)
-    {
-        if (pollfd[user].events) return;  /* stopped waiting on it, don't restart */
-        ctl = EPOLL_CTL_ADD;
-    }
-    else
-    {
-        if (pollfd[user].events == events) return;  /* nothing to do */
-        ctl = EPOLL_CTL_MOD;
+        epoll_users[i].events = -1;
+        epoll_users[i].dirty = epoll_users[i].edge = epoll_users[i].rearm = 0;
     }
+    return 1;
+}
+
+/* call epoll_ctl for a user, giving up on epoll if we run out of memory */
+static void do_epoll_ctl( int user, int ctl, int unix_fd, int events )
+{
+    struct epoll_event ev;
 
+    epoll_ctl_count++;
     ev.events = events;
     memset(&ev.data, 0, sizeof(ev.data));
     ev.data.u32 = user;
 
-    if (epoll_ctl( epoll_fd, ctl, fd->unix_fd, &ev ) == -1)
+    if (epoll_ctl( epoll_fd, ctl, unix_fd, &ev ) == -1)
     {
         if (errno == ENOMEM)  /* not enough memory, give up on epoll */
         {
@@ -524,21 +636,98 @@ static inline void set_fd_epoll_events( struct fd *fd, int user, int events )
     }
 }
 
+/* set the events that epoll waits for on this fd; helper for set_fd_events */
+static inline void set_fd_epoll_events( struct fd *fd, int user, int events )
+{
+    if (epoll_fd == -1) return;
+
+    if (events == -1)  /* stop waiting on this fd completely */
+    {
+        if (epoll_users[user].events != -1)
+        {
+            do_epoll_ctl( user, EPOLL_CTL_DEL, fd->unix_fd, 0 );
+            epoll_users[user].events = -1;
+        }
+        return;
+    }
+
+    if (!epoll_users[user].dirty)
+    {
+        epoll_users[user].dirty = 1;
+        epoll_dirty[nb_epoll_dirty++] = user;
+    }
+}
+
+/* pass the recorded event changes to epoll */
+static void flush_epoll_events(void)
+{
+    int i;
+
+    for (i = 0; i < nb_epoll_dirty && epoll_fd != -1; i++)
+    {
+        int user = epoll_dirty[i];
+        struct epoll_user *state = &epoll_users[user];
+        int events = pollfd[user].events;
+
+        if (!state->dirty) continue;
+        state->dirty = 0;
+        if (pollfd[user].fd == -1) continue;  /* removed, or stopped waiting on it */
+
+        if (state->events == -1)
+        {
+            struct fd *fd = poll_users[user];
+
+            state->edge = epoll_edge_triggered && fd->fd_ops->get_fd_type &&
+                          fd->fd_ops->get_fd_type( fd ) == FD_TYPE_SOCKET;
+            do_epoll_ctl( user, EPOLL_CTL_ADD, pollfd[user].fd, state->edge ? events | EPOLLET : events );
+        }
+        else if (state->edge)
+        {
+            /* re-registering makes epoll check the current state of the fd again */
+            if (!(events & ~state->events) && !(state->rearm && events)) continue;
+            do_epoll_ctl( user, EPOLL_CTL_MOD, pollfd[user].fd, events | EPOLLET );
+        }
+        else
+        {
+            if (state->events == events) continue;
+            do_epoll_ctl( user, EPOLL_CTL_MOD, pollfd[user].fd, events );
+        }
+        state->events = events;
+        state->rearm = 0;
+    }
+    nb_epoll_dirty = 0;
+}
+
 static inline void remove_epoll_user( struct fd *fd, int user )
 {
     if (epoll_fd == -1) return;
 
-    if (pollfd[user].fd != -1)
+    if (epoll_users[user].events != -1)
     {
         struct epoll_event dummy;
+        epoll_ctl_count++;
         epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd->unix_fd, &dummy );
+        epoll_users[user].events = -1;
     }
+    /* the user stays in the dirty array until the next flush, where it will be ignored */
+    epoll_users[user].rearm = 0;
+}
+
+/* print the epoll statistics */
+void dump_poll_stats(void)
+{
+    fprintf( stderr, "wineserver: %u requests, %u epoll_wait calls, %u epoll_ctl calls",
+             request_count, epoll_wait_count, epoll_ctl_count );
+    if (request_count)
+        fprintf( stderr, " (%.2f epoll_wait and %.2f epoll_ctl per request)",
+                 (double)epoll_wait_count / request_count, (double)epoll_ctl_count / request_count );
+    fprintf( stderr, "\n" );
 }
 
 static inline void main_loop_epoll(void)
 {
     int i, ret, timeout;
-    struct epoll_event events[128];
+    struct epoll_event events[EPOLL_BATCH_SIZE];
 
     assert( POLLIN == EPOLLIN );
     assert( POLLOUT == EPOLLOUT );
@@ -552,8 +741,10 @@ static inline void main_loop_epoll(void)
         timeout = get_next_timeout();
 
         if (!active_users) break;  /* last user removed by a timeout */
+        flush_epoll_events();
         if (epoll_fd == -1) break;  /* an error occurred with epoll */
 
+        epoll_wait_count++;
         ret = epoll_wait( epoll_fd, events, ARRAY_SIZE( events ), timeout );
         set_current_time();
 
@@ -561,7 +752,15 @@ static inline void main_loop_epoll(void)
         for (i = 0; i < ret; i++)
         {
             int user = events[i].data.u32;
-            pollfd[user].revents = events[i].events;
+            int revents = events[i].events;
+
+            if (epoll_users[user].edge)
+            {
+                /* events that are no longer wanted may still be registered */
+                epoll_users[user].rearm = 1;
+                revents &= pollfd[user].events | POLLERR | POLLHUP;
+            }
+            pollfd[user].revents = revents;
         }
 
         /* read events from the pollfd array, as set_fd_events may modify them */
@@ -806,6 +1005,14 @@ static inline void main_loop_epoll(void) { }
 
 #endif /* USE_EPOLL */
 
+#ifndef USE_EPOLL
+/* print the poll statistics */
+void dump_poll_stats(void)
+{
+    fprintf( stderr, "wineserver: %u requests\n", request_count );
+}
+#endif
+
 
 /* add a user in the poll array and return its index, or -1 on failure */
 static int add_poll_user( struct fd *fd )
@@ -834,6 +1041,9 @@ static int add_poll_user( struct fd *fd )
             }
             poll_users = newusers;
             pollfd = newpoll;
+#ifdef USE_EPOLL
+            if (!resize_epoll_users( allocated_users, new_count )) return -1;
+#endif
             if (!allocated_users) init_epoll();
             allocated_users = new_count;
         }
@@ -865,32 +1075,32 @@ static void remove_poll_user( struct fd *fd, int user )
 /* process pending timeouts and return the time until the next timeout, in milliseconds */
 static int get_next_timeout(void)
 {
-    if (!list_empty( &abs_timeout_list ) || !list_empty( &rel_timeout_list ))
+    if (abs_timeouts.count || rel_timeouts.count)
     {
         struct list expired_list, *ptr;
         int ret = -1;
 
-        /* first remove all expired timers from the list */
+        /* first remove all expired timers from the heaps */
 
         list_init( &expired_list );
-        while ((ptr = list_head( &abs_timeout_list )) != NULL)
+        while (abs_timeouts.count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = abs_timeouts.users[0];
 
             if (timeout->when <= current_time)
             {
-                list_remove( &timeout->entry );
+                timeout_heap_remove( &abs_timeouts, timeout );
                 list_add_tail( &expired_list, &timeout->entry );
             }
             else break;
         }
-        while ((ptr = list_head( &rel_timeout_list )) != NULL)
+        while (rel_timeouts.count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = rel_timeouts.users[0];
 
             if (-timeout->when <= monotonic_time)
             {
-                list_remove( &timeout->entry );
+                timeout_heap_remove( &rel_timeouts, timeout );
                 list_add_tail( &expired_list, &timeout->entry );
             }
             else break;
@@ -906,17 +1116,17 @@ static int get_next_timeout(void)
             free( timeout );
         }
 
-        if ((ptr = list_head( &abs_timeout_list )) != NULL)
+        if (abs_timeouts.count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = abs_timeouts.users[0];
             int diff = (timeout->when - current_time + 9999) / 10000;
             if (diff < 0) diff = 0;
             ret = diff;
         }
 
-        if ((ptr = list_head( &rel_timeout_list )) != NULL)
+        if (rel_timeouts.count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = rel_timeouts.users[0];
             int diff = (-timeout->when - monotonic_time + 9999) / 10000;
             if (diff < 0) diff = 0;
             if (ret == -1 || diff < ret) ret = diff;
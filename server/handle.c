@@ -27,12 +27,17 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
 #include "windef.h"
 #include "winternl.h"
 
+#include "file.h"
 #include "handle.h"
 #include "process.h"
 #include "thread.h"
@@ -53,6 +58,8 @@ struct handle_table
     int                  last;        /* last used entry */
     int                  free;        /* first entry that may be free */
     struct handle_entry *entries;     /* handle entries */
+    struct handle_cache_entry *cache; /* copy of the entries shared with the client, if requested */
+    int                  cache_fd;    /* fd of the shared copy */
 };
 
 static struct handle_table *global_table;
@@ -97,6 +104,26 @@ static inline obj_handle_t handle_global_to_local( obj_handle_t handle )
     return handle ^ HANDLE_OBFUSCATOR;
 }
 
+/* update the copy of a handle entry shared with the client */
+static void update_handle_cache( struct handle_table *table, struct handle_entry *entry )
+{
+    struct handle_cache_entry *cache;
+    int index = entry - table->entries;
+
+    if (!table->cache || index >= HANDLE_CACHE_ENTRIES) return;
+    cache = &table->cache[index];
+    if (!entry->ptr)
+    {
+        cache->flags = 0;
+        return;
+    }
+    /* the client checks the flags first, so make sure the entry is valid before they are set */
+    cache->flags  = 0;
+    cache->access = entry->access & ~RESERVED_ALL;
+    cache->type   = get_object_type_index( entry->ptr );
+    cache->flags  = HANDLE_CACHE_VALID | ((entry->access & RESERVED_ALL) >> RESERVED_SHIFT);
+}
+
 /* grab an object and increment its handle count */
 static struct object *grab_object_for_handle( struct object *obj )
 {
@@ -187,6 +214,11 @@ static void handle_table_destroy( struct object *obj )
         if (obj) release_object_from_handle( obj );
     }
     free( table->entries );
+    if (table->cache)
+    {
+        munmap( table->cache, HANDLE_CACHE_ENTRIES * sizeof(*table->cache) );
+        close( table->cache_fd );
+    }
 }
 
 /* close all the process handles and free the handle table */
@@ -210,6 +242,8 @@ struct handle_table *alloc_handle_table( struct process *process, int count )
     table->count   = count;
     table->last    = -1;
     table->free    = 0;
+    table->cache   = NULL;
+    table->cache_fd = -1;
     if ((table->entries = mem_alloc( count * sizeof(*table->entries) ))) return table;
     release_object( table );
     return NULL;
@@ -249,6 +283,7 @@ static obj_handle_t alloc_entry( struct handle_table *table, void *obj, unsigned
     table->free = i + 1;
     entry->ptr    = grab_object_for_handle( obj );
     entry->access = access;
+    update_handle_cache( table, entry );
     return index_to_handle(i);
 }
 
@@ -396,6 +431,7 @@ unsigned int close_handle( struct process *process, obj_handle_t handle )
     if (!obj->ops->close_handle( obj, process, handle )) return STATUS_HANDLE_NOT_CLOSABLE;
     entry->ptr = NULL;
     table = handle_is_global(handle) ? global_table : process->handles;
+    update_handle_cache( table, entry );
     if (entry < table->entries + table->free) table->free = entry - table->entries;
     if (entry == table->entries + table->last) shrink_handle_table( table );
     release_object_from_handle( obj );
@@ -529,6 +565,7 @@ static int set_handle_flags( struct process *process, obj_handle_t handle, int m
     mask  = (mask << RESERVED_SHIFT) & RESERVED_ALL;
     flags = (flags << RESERVED_SHIFT) & mask;
     entry->access = (entry->access & ~mask) | flags;
+    if (!handle_is_global( handle )) update_handle_cache( process->handles, entry );
     return (old_access & RESERVED_ALL) >> RESERVED_SHIFT;
 }
 
@@ -570,6 +607,7 @@ obj_handle_t duplicate_handle( struct process *src, obj_handle_t src_handle, str
         {
             if (attr & OBJ_INHERIT) access |= RESERVED_INHERIT;
             entry->access = access;
+            if (!handle_is_global( src_handle )) update_handle_cache( src->handles, entry );
             res = src_handle;
         }
         else
@@ -632,6 +670,32 @@ DECL_HANDLER(set_handle_info)
     reply->old_flags = set_handle_flags( current->process, req->handle, req->mask, req->flags );
 }
 
+/* retrieve the copy of the handle table shared with the client */
+DECL_HANDLER(get_handle_cache)
+{
+    struct handle_table *table = current->process->handles;
+    struct object *obj;
+    void *ptr;
+    int i;
+
+    if (!table) return;
+    if (!table->cache)
+    {
+        if ((table->cache_fd = create_shared_memory( HANDLE_CACHE_ENTRIES * sizeof(*table->cache), &ptr )) == -1)
+            return;
+        table->cache = ptr;
+        for (i = 0; i <= table->last && i < HANDLE_CACHE_ENTRIES; i++)
+            update_handle_cache( table, &table->entries[i] );
+    }
+    if (send_client_fd( current->process, table->cache_fd, 0 )) return;
+
+    reply->size = HANDLE_CACHE_ENTRIES * sizeof(*table->cache);
+    obj = get_magic_handle( 0xffffffff );
+    reply->process_type = get_object_type_index( obj );
+    obj = get_magic_handle( 0xfffffffe );
+    reply->thread_type = get_object_type_index( obj );
+}
+
 /* duplicate a handle */
 DECL_HANDLER(dup_handle)
 {
@@ -143,8 +143,10 @@ int main( int argc, char *argv[] )
     if (debug_level) fprintf( stderr, "wineserver: starting (pid=%ld)\n", (long) getpid() );
     set_current_time();
     init_signals();
+    init_fast_sync();
     init_directories();
     init_registry();
     main_loop();
+    if (debug_level) dump_poll_stats();
     return 0;
 }
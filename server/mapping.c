@@ -943,6 +943,21 @@ int get_page_size(void)
     return page_mask + 1;
 }
 
+/* create a memory area shared with a client, return its Unix fd */
+int create_shared_memory( mem_size_t size, void **ptr )
+{
+    int fd;
+
+    if ((fd = create_temp_file( size )) == -1) return -1;
+    if ((*ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED)
+    {
+        file_set_error();
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
 /* create a file mapping */
 DECL_HANDLER(create_mapping)
 {
@@ -38,15 +38,16 @@
 
 struct mutex
 {
-    struct object  obj;             /* object header */
-    struct thread *owner;           /* mutex owner */
-    unsigned int   count;           /* recursion count */
-    int            abandoned;       /* has it been abandoned? */
-    struct list    entry;           /* entry in owner thread mutex list */
+    struct object           obj;         /* object header */
+    struct fast_sync_entry *sync;        /* mutex state: owner and tracking thread ids, abandoned flag and recursion count */
+    unsigned int            sync_index;  /* index of the state in the shared area */
+    struct list             entry;       /* entry in the mutex list of the tracking thread */
 };
 
 static void mutex_dump( struct object *obj, int verbose );
 static struct object_type *mutex_get_type( struct object *obj );
+static int mutex_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void mutex_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int mutex_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int mutex_map_access( struct object *obj, unsigned int access );
@@ -58,8 +59,8 @@ static const struct object_ops mutex_ops =
     sizeof(struct mutex),      /* size */
     mutex_dump,                /* dump */
     mutex_get_type,            /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    mutex_add_queue,           /* add_queue */
+    mutex_remove_queue,        /* remove_queue */
     mutex_signaled,            /* signaled */
     mutex_satisfied,           /* satisfied */
     mutex_signal,              /* signal */
@@ -77,29 +78,55 @@ static const struct object_ops mutex_ops =
 };
 
 
+static inline thread_id_t mutex_owner( struct mutex *mutex )
+{
+    return mutex->sync->state & FAST_SYNC_STATE_MASK;
+}
+
+/* move a mutex to the mutex list of a thread
+ *
+ * Clients acquire and release shared mutexes without the server, so a mutex
+ * stays in the list of the last thread that acquired it through the server
+ * even once released, and only that thread may acquire it again on the client
+ * side. Any thread that owns a mutex is thus the one tracking it, and only
+ * its own list has to be checked when it terminates.
+ */
+static void track_mutex( struct mutex *mutex, struct thread *thread )
+{
+    if (mutex->sync->thread == thread->id) return;
+    if (mutex->sync->thread) list_remove( &mutex->entry );
+    list_add_head( &thread->mutex_list, &mutex->entry );
+    mutex->sync->thread = thread->id;
+}
+
 /* grab a mutex for a given thread */
 static void do_grab( struct mutex *mutex, struct thread *thread )
 {
-    assert( !mutex->count || (mutex->owner == thread) );
+    assert( !mutex->sync->data || (mutex_owner( mutex ) == thread->id) );
 
-    if (!mutex->count++)  /* FIXME: avoid wrap-around */
+    if (!mutex->sync->data++)  /* FIXME: avoid wrap-around */
     {
-        assert( !mutex->owner );
-        mutex->owner = thread;
-        list_add_head( &thread->mutex_list, &mutex->entry );
+        track_mutex( mutex, thread );
+        fast_sync_update( mutex->sync, FAST_SYNC_STATE_MASK, thread->id );
     }
 }
 
 /* release a mutex once the recursion count is 0 */
 static void do_release( struct mutex *mutex )
 {
-    assert( !mutex->count );
-    /* remove the mutex from the thread list of owned mutexes */
-    list_remove( &mutex->entry );
-    mutex->owner = NULL;
+    assert( !mutex->sync->data );
+    fast_sync_update( mutex->sync, FAST_SYNC_STATE_MASK, 0 );
     wake_up( &mutex->obj, 0 );
 }
 
+/* release a mutex whose owner is gone */
+static void do_abandon( struct mutex *mutex )
+{
+    mutex->sync->data = 0;
+    fast_sync_update( mutex->sync, FAST_SYNC_ABANDONED, FAST_SYNC_ABANDONED );
+    do_release( mutex );
+}
+
 static struct mutex *create_mutex( struct object *root, const struct unicode_str *name,
                                    unsigned int attr, int owned, const struct security_descriptor *sd )
 {
@@ -110,9 +137,11 @@ static struct mutex *create_mutex( struct object *root, const struct unicode_str
         if (get_error() != STATUS_OBJECT_NAME_EXISTS)
         {
             /* initialize it if it didn't already exist */
-            mutex->count = 0;
-            mutex->owner = NULL;
-            mutex->abandoned = 0;
+            if (!(mutex->sync = alloc_fast_sync_entry( &mutex->sync_index )))
+            {
+                release_object( mutex );
+                return NULL;
+            }
             if (owned) do_grab( mutex, current );
         }
     }
@@ -121,23 +150,29 @@ static struct mutex *create_mutex( struct object *root, const struct unicode_str
 
 void abandon_mutexes( struct thread *thread )
 {
+    struct mutex *mutex;
     struct list *ptr;
 
     while ((ptr = list_head( &thread->mutex_list )) != NULL)
     {
-        struct mutex *mutex = LIST_ENTRY( ptr, struct mutex, entry );
-        assert( mutex->owner == thread );
-        mutex->count = 0;
-        mutex->abandoned = 1;
-        do_release( mutex );
+        mutex = LIST_ENTRY( ptr, struct mutex, entry );
+        list_remove( &mutex->entry );
+        mutex->sync->thread = 0;
+        if (mutex_owner( mutex ) == thread->id) do_abandon( mutex );
     }
 }
 
+unsigned int get_mutex_fast_sync_index( struct object *obj )
+{
+    if (obj->ops != &mutex_ops) return 0;
+    return ((struct mutex *)obj)->sync_index;
+}
+
 static void mutex_dump( struct object *obj, int verbose )
 {
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
-    fprintf( stderr, "Mutex count=%u owner=%p\n", mutex->count, mutex->owner );
+    fprintf( stderr, "Mutex count=%u owner=%04x\n", mutex->sync->data, mutex_owner( mutex ));
 }
 
 static struct object_type *mutex_get_type( struct object *obj )
@@ -147,11 +182,41 @@ static struct object_type *mutex_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int mutex_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct mutex *mutex = (struct mutex *)obj;
+    struct thread *thread;
+    thread_id_t owner;
+
+    assert( obj->ops == &mutex_ops );
+    if (!fast_sync_add_queue( obj, entry, mutex->sync )) return 0;
+
+    /* the owner can't change anymore; a client that acquired the mutex while another thread
+     * was tracking it could not give it back in time, so track it in the owner list now */
+    owner = mutex_owner( mutex );
+    if (owner && owner != mutex->sync->thread && (thread = get_thread_from_id( owner )))
+    {
+        track_mutex( mutex, thread );
+        release_object( thread );
+    }
+    return 1;
+}
+
+static void mutex_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct mutex *mutex = (struct mutex *)obj;
+    assert( obj->ops == &mutex_ops );
+    fast_sync_remove_queue( obj, entry, mutex->sync );
+}
+
 static int mutex_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct mutex *mutex = (struct mutex *)obj;
+    thread_id_t owner;
+
     assert( obj->ops == &mutex_ops );
-    return (!mutex->count || (mutex->owner == get_wait_queue_thread( entry )));
+    owner = mutex_owner( mutex );
+    return (!owner || (owner == get_wait_queue_thread( entry )->id));
 }
 
 static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry )
@@ -160,8 +225,8 @@ static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry
     assert( obj->ops == &mutex_ops );
 
     do_grab( mutex, get_wait_queue_thread( entry ));
-    if (mutex->abandoned) make_wait_abandoned( entry );
-    mutex->abandoned = 0;
+    if (fast_sync_update( mutex->sync, FAST_SYNC_ABANDONED, 0 ) & FAST_SYNC_ABANDONED)
+        make_wait_abandoned( entry );
 }
 
 static unsigned int mutex_map_access( struct object *obj, unsigned int access )
@@ -183,12 +248,12 @@ static int mutex_signal( struct object *obj, unsigned int access )
         set_error( STATUS_ACCESS_DENIED );
         return 0;
     }
-    if (!mutex->count || (mutex->owner != current))
+    if (!mutex->sync->data || (mutex_owner( mutex ) != current->id))
     {
         set_error( STATUS_MUTANT_NOT_OWNED );
         return 0;
     }
-    if (!--mutex->count) do_release( mutex );
+    if (!--mutex->sync->data) do_release( mutex );
     return 1;
 }
 
@@ -197,9 +262,14 @@ static void mutex_destroy( struct object *obj )
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
 
-    if (!mutex->count) return;
-    mutex->count = 0;
-    do_release( mutex );
+    if (!mutex->sync) return;
+    if (mutex_owner( mutex ))
+    {
+        mutex->sync->data = 0;
+        do_release( mutex );
+    }
+    if (mutex->sync->thread) list_remove( &mutex->entry );
+    free_fast_sync_entry( mutex->sync, mutex->sync_index );
 }
 
 /* create a mutex */
@@ -243,11 +313,11 @@ DECL_HANDLER(release_mutex)
     if ((mutex = (struct mutex *)get_handle_obj( current->process, req->handle,
                                                  0, &mutex_ops )))
     {
-        if (!mutex->count || (mutex->owner != current)) set_error( STATUS_MUTANT_NOT_OWNED );
+        if (!mutex->sync->data || (mutex_owner( mutex ) != current->id)) set_error( STATUS_MUTANT_NOT_OWNED );
         else
         {
-            reply->prev_count = mutex->count;
-            if (!--mutex->count) do_release( mutex );
+            reply->prev_count = mutex->sync->data;
+            if (!--mutex->sync->data) do_release( mutex );
         }
         release_object( mutex );
     }
@@ -261,9 +331,9 @@ DECL_HANDLER(query_mutex)
     if ((mutex = (struct mutex *)get_handle_obj( current->process, req->handle,
                                                  MUTANT_QUERY_STATE, &mutex_ops )))
     {
-        reply->count = mutex->count;
-        reply->owned = (mutex->owner == current);
-        reply->abandoned = mutex->abandoned;
+        reply->count = mutex->sync->data;
+        reply->owned = (mutex_owner( mutex ) == current->id);
+        reply->abandoned = (mutex->sync->state & FAST_SYNC_ABANDONED) != 0;
 
         release_object( mutex );
     }
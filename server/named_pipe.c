@@ -24,10 +24,25 @@
 #include "wine/port.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_FILIO_H
+#include <sys/filio.h>
+#endif
+#ifdef HAVE_LINUX_SOCKIOS_H
+#include <linux/sockios.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -56,6 +71,7 @@ struct pipe_end
 {
     struct object        obj;        /* object header */
     struct fd           *fd;         /* pipe file descriptor */
+    struct fd           *data_fd;    /* socket used for the data of the connection, if any */
     unsigned int         flags;      /* pipe flags */
     unsigned int         state;      /* pipe state */
     struct named_pipe   *pipe;
@@ -66,6 +82,8 @@ struct pipe_end
     struct list          message_queue;
     struct async_queue   read_q;     /* read queue */
     struct async_queue   write_q;    /* write queue */
+    struct async_queue   flush_q;    /* flushes waiting for the socket data to be read */
+    struct timeout_user *flush_timeout; /* timeout to check the socket data again */
 };
 
 struct pipe_server
@@ -86,6 +104,7 @@ struct named_pipe
     unsigned int        insize;
     unsigned int        instances;
     timeout_t           timeout;
+    int                 use_sockets; /* connections exchange data through a socket pair */
     struct list         listeners;   /* list of servers listening on this pipe */
     struct async_queue  waiters;     /* list of clients waiting to connect */
 };
@@ -232,6 +251,54 @@ static const struct fd_ops pipe_client_fd_ops =
     pipe_end_reselect_async       /* reselect_async */
 };
 
+/*
+ * When WINEPIPESOCKETS is set, connections of byte mode pipes get a unix
+ * socket pair, and the data is then read and written by the clients directly
+ * on the socket instead of being queued in the server. The server still
+ * handles connection state, peeking and all the other ioctls; it hands out the
+ * socket as the fd of the pipe end for as long as the connection lasts.
+ * The clients cache the sockets. When a pipe end is disconnected, the server
+ * discards its pending data and shuts down its socket; the clients then see the
+ * end of the socket, drop it from their cache and get the current fd of the
+ * pipe end from the server, which fails with STATUS_PIPE_DISCONNECTED.
+ * Flushing waits until the peer has read the socket data, which the server
+ * checks periodically since the peer reads it without the server's help.
+ */
+
+static int use_pipe_sockets = -1;
+
+#define PIPE_FLUSH_INTERVAL (-TICKS_PER_SEC / 100)  /* 10 ms */
+
+static const struct fd_ops pipe_server_data_fd_ops =
+{
+    default_fd_get_poll_events,   /* get_poll_events */
+    default_poll_event,           /* poll_event */
+    pipe_end_get_fd_type,         /* get_fd_type */
+    no_fd_read,                   /* read */
+    no_fd_write,                  /* write */
+    pipe_end_flush,               /* flush */
+    pipe_end_get_file_info,       /* get_file_info */
+    pipe_end_get_volume_info,     /* get_volume_info */
+    pipe_server_ioctl,            /* ioctl */
+    default_fd_queue_async,       /* queue_async */
+    default_fd_reselect_async     /* reselect_async */
+};
+
+static const struct fd_ops pipe_client_data_fd_ops =
+{
+    default_fd_get_poll_events,   /* get_poll_events */
+    default_poll_event,           /* poll_event */
+    pipe_end_get_fd_type,         /* get_fd_type */
+    no_fd_read,                   /* read */
+    no_fd_write,                  /* write */
+    pipe_end_flush,               /* flush */
+    pipe_end_get_file_info,       /* get_file_info */
+    pipe_end_get_volume_info,     /* get_volume_info */
+    pipe_client_ioctl,            /* ioctl */
+    default_fd_queue_async,       /* queue_async */
+    default_fd_reselect_async     /* reselect_async */
+};
+
 static void named_pipe_device_dump( struct object *obj, int verbose );
 static struct object_type *named_pipe_device_get_type( struct object *obj );
 static struct object *named_pipe_device_lookup_name( struct object *obj,
@@ -348,7 +415,115 @@ static void named_pipe_destroy( struct object *obj)
 static struct fd *pipe_end_get_fd( struct object *obj )
 {
     struct pipe_end *pipe_end = (struct pipe_end *) obj;
-    return (struct fd *) grab_object( pipe_end->fd );
+    return (struct fd *) grab_object( pipe_end->data_fd ? pipe_end->data_fd : pipe_end->fd );
+}
+
+static int pipe_sockets_enabled(void)
+{
+    if (use_pipe_sockets == -1)
+    {
+        const char *env = getenv( "WINEPIPESOCKETS" );
+        use_pipe_sockets = env && atoi( env );
+    }
+    return use_pipe_sockets;
+}
+
+/* give both ends of a new connection a socket pair to exchange the data directly */
+static void connect_pipe_sockets( struct pipe_end *server, struct pipe_end *client )
+{
+    int fds[2];
+
+    if (socketpair( PF_UNIX, SOCK_STREAM, 0, fds ) == -1) return;
+    fcntl( fds[0], F_SETFL, O_NONBLOCK );
+    fcntl( fds[1], F_SETFL, O_NONBLOCK );
+
+    if (!(server->data_fd = create_anonymous_fd( &pipe_server_data_fd_ops, fds[0], &server->obj,
+                                                 get_fd_options( server->fd ) )))
+    {
+        close( fds[1] );
+        clear_error();
+        return;
+    }
+    if (!(client->data_fd = create_anonymous_fd( &pipe_client_data_fd_ops, fds[1], &client->obj,
+                                                 get_fd_options( client->fd ) )))
+    {
+        release_object( server->data_fd );
+        server->data_fd = NULL;
+        clear_error();
+        return;
+    }
+    allow_fd_caching( server->data_fd );
+    allow_fd_caching( client->data_fd );
+    fd_copy_completion( server->fd, server->data_fd );
+    set_fd_signaled( server->data_fd, 1 );
+    set_fd_signaled( client->data_fd, 1 );
+}
+
+/* stop using the socket of a pipe end, the connection is over */
+static void release_pipe_socket( struct pipe_end *pipe_end, unsigned int status )
+{
+    struct fd *data_fd = pipe_end->data_fd;
+    struct completion *completion;
+    apc_param_t key;
+    char buffer[4096];
+    int unix_fd;
+
+    if (!data_fd) return;
+    pipe_end->data_fd = NULL;
+
+    /* the clients may have cached the socket, make them notice the disconnection */
+    unix_fd = get_unix_fd( data_fd );
+    shutdown( unix_fd, SHUT_RDWR );
+    while (recv( unix_fd, buffer, sizeof(buffer), MSG_DONTWAIT ) > 0);
+
+    if (pipe_end->flush_timeout)
+    {
+        remove_timeout_user( pipe_end->flush_timeout );
+        pipe_end->flush_timeout = NULL;
+    }
+    fd_async_wake_up( data_fd, ASYNC_TYPE_READ, status );
+    fd_async_wake_up( data_fd, ASYNC_TYPE_WRITE, status );
+    fd_async_wake_up( data_fd, ASYNC_TYPE_WAIT, status );
+
+    /* a completion port attached while connected still applies to the next connections */
+    if ((completion = fd_get_completion( pipe_end->fd, &key ))) release_object( completion );
+    else fd_copy_completion( data_fd, pipe_end->fd );
+
+    release_object( data_fd );
+}
+
+/* retrieve the amount of data waiting in the socket of a pipe end */
+static data_size_t get_pipe_socket_avail( struct pipe_end *pipe_end )
+{
+    int avail;
+
+    if (!pipe_end->data_fd || ioctl( get_unix_fd( pipe_end->data_fd ), FIONREAD, &avail ) == -1)
+        return 0;
+    return avail;
+}
+
+/* check if the peer of a pipe end hasn't read all the data written to its socket yet */
+static int is_pipe_socket_data_pending( struct pipe_end *pipe_end )
+{
+#ifdef SIOCOUTQ
+    int pending;
+
+    /* for unix sockets, this includes the data queued at the peer until it's read */
+    if (pipe_end->data_fd && ioctl( get_unix_fd( pipe_end->data_fd ), SIOCOUTQ, &pending ) != -1)
+        return pending > 0;
+#endif
+    return 0;
+}
+
+static void check_pipe_socket_flush( void *private )
+{
+    struct pipe_end *pipe_end = private;
+
+    pipe_end->flush_timeout = NULL;
+    if (is_pipe_socket_data_pending( pipe_end ) && async_waiting( &pipe_end->flush_q ))
+        pipe_end->flush_timeout = add_timeout_user( PIPE_FLUSH_INTERVAL, check_pipe_socket_flush, pipe_end );
+    else
+        async_wake_up( &pipe_end->flush_q, STATUS_SUCCESS );
 }
 
 static struct pipe_message *queue_message( struct pipe_end *pipe_end, struct iosb *iosb )
@@ -394,6 +569,7 @@ static void pipe_end_disconnect( struct pipe_end *pipe_end, unsigned int status
     pipe_end->state = status == STATUS_PIPE_DISCONNECTED
         ? FILE_PIPE_DISCONNECTED_STATE : FILE_PIPE_CLOSING_STATE;
     fd_async_wake_up( pipe_end->fd, ASYNC_TYPE_WAIT, status );
+    async_wake_up( &pipe_end->flush_q, status );
     async_wake_up( &pipe_end->read_q, status );
     LIST_FOR_EACH_ENTRY_SAFE( message, next, &pipe_end->message_queue, struct pipe_message, entry )
     {
@@ -403,7 +579,11 @@ static void pipe_end_disconnect( struct pipe_end *pipe_end, unsigned int status
         async_terminate( async, status );
         release_object( async );
     }
-    if (status == STATUS_PIPE_DISCONNECTED) set_fd_signaled( pipe_end->fd, 0 );
+    if (status == STATUS_PIPE_DISCONNECTED)
+    {
+        set_fd_signaled( pipe_end->fd, 0 );
+        release_pipe_socket( pipe_end, status );
+    }
 
     if (connection)
     {
@@ -426,8 +606,10 @@ static void pipe_end_destroy( struct object *obj )
         free_message( message );
     }
 
+    release_pipe_socket( pipe_end, STATUS_PIPE_BROKEN );
     free_async_queue( &pipe_end->read_q );
     free_async_queue( &pipe_end->write_q );
+    free_async_queue( &pipe_end->flush_q );
     if (pipe_end->fd) release_object( pipe_end->fd );
     if (pipe_end->pipe) release_object( pipe_end->pipe );
 }
@@ -497,7 +679,7 @@ static void named_pipe_device_destroy( struct object *obj )
 {
     struct named_pipe_device *device = (struct named_pipe_device*)obj;
     assert( obj->ops == &named_pipe_device_ops );
-    free( device->pipes );
+    free_namespace( device->pipes );
 }
 
 struct object *create_named_pipe_device( struct object *root, const struct unicode_str *name )
@@ -553,7 +735,14 @@ static int pipe_end_flush( struct fd *fd, struct async *async )
         return 0;
     }
 
-    if (pipe_end->connection && !list_empty( &pipe_end->connection->message_queue ))
+    if (is_pipe_socket_data_pending( pipe_end ))
+    {
+        queue_async( &pipe_end->flush_q, async );
+        if (!pipe_end->flush_timeout)
+            pipe_end->flush_timeout = add_timeout_user( PIPE_FLUSH_INTERVAL, check_pipe_socket_flush, pipe_end );
+        set_error( STATUS_PENDING );
+    }
+    else if (pipe_end->connection && !list_empty( &pipe_end->connection->message_queue ))
     {
         fd_queue_async( pipe_end->fd, async, ASYNC_TYPE_WAIT );
         set_error( STATUS_PENDING );
@@ -933,6 +1122,27 @@ static enum server_fd_type pipe_end_get_fd_type( struct fd *fd )
     return FD_TYPE_PIPE;
 }
 
+/* peek at the data waiting in the socket of a pipe end */
+static int pipe_end_peek_socket( struct pipe_end *pipe_end, data_size_t reply_size )
+{
+    FILE_PIPE_PEEK_BUFFER *buffer;
+    data_size_t avail = get_pipe_socket_avail( pipe_end );
+    int ret = 0;
+
+    reply_size = min( reply_size, avail );
+    if (!(buffer = mem_alloc( offsetof( FILE_PIPE_PEEK_BUFFER, Data[reply_size] )))) return 0;
+    /* the client may have read some of the data in the meantime */
+    if (reply_size &&
+        (ret = recv( get_unix_fd( pipe_end->data_fd ), buffer->Data, reply_size, MSG_PEEK | MSG_DONTWAIT )) < 0)
+        ret = 0;
+    buffer->NamedPipeState    = pipe_end->state;
+    buffer->ReadDataAvailable = avail;
+    buffer->NumberOfMessages  = 0;  /* FIXME */
+    buffer->MessageLength     = 0;
+    set_reply_data_ptr( buffer, offsetof( FILE_PIPE_PEEK_BUFFER, Data[ret] ));
+    return 1;
+}
+
 static int pipe_end_peek( struct pipe_end *pipe_end )
 {
     unsigned reply_size = get_reply_max_size();
@@ -953,7 +1163,7 @@ static int pipe_end_peek( struct pipe_end *pipe_end )
     case FILE_PIPE_CONNECTED_STATE:
         break;
     case FILE_PIPE_CLOSING_STATE:
-        if (!list_empty( &pipe_end->message_queue )) break;
+        if (!list_empty( &pipe_end->message_queue ) || get_pipe_socket_avail( pipe_end )) break;
         set_error( STATUS_PIPE_BROKEN );
         return 0;
     default:
@@ -961,6 +1171,8 @@ static int pipe_end_peek( struct pipe_end *pipe_end )
         return 0;
     }
 
+    if (pipe_end->data_fd) return pipe_end_peek_socket( pipe_end, reply_size );
+
     LIST_FOR_EACH_ENTRY( message, &pipe_end->message_queue, struct pipe_message, entry )
         avail += message->iosb->in_size - message->read_pos;
     reply_size = min( reply_size, avail );
@@ -1163,11 +1375,14 @@ static void init_pipe_end( struct pipe_end *pipe_end, struct named_pipe *pipe,
 {
     pipe_end->pipe = (struct named_pipe *)grab_object( pipe );
     pipe_end->fd = NULL;
+    pipe_end->data_fd = NULL;
+    pipe_end->flush_timeout = NULL;
     pipe_end->flags = pipe_flags;
     pipe_end->connection = NULL;
     pipe_end->buffer_size = buffer_size;
     init_async_queue( &pipe_end->read_q );
     init_async_queue( &pipe_end->write_q );
+    init_async_queue( &pipe_end->flush_q );
     list_init( &pipe_end->message_queue );
 }
 
@@ -1192,7 +1407,8 @@ static struct pipe_server *create_pipe_server( struct named_pipe *pipe, unsigned
         release_object( server );
         return NULL;
     }
-    allow_fd_caching( server->pipe_end.fd );
+    /* a cached pseudo fd would hide the sockets of the next connections */
+    if (!pipe->use_sockets) allow_fd_caching( server->pipe_end.fd );
     set_fd_signaled( server->pipe_end.fd, 1 );
     async_wake_up( &pipe->waiters, STATUS_SUCCESS );
     return server;
@@ -1268,6 +1484,9 @@ static struct object *named_pipe_open_file( struct object *obj, unsigned int acc
         server->pipe_end.client_pid = client->client_pid;
         client->server_pid = server->pipe_end.server_pid;
         list_remove( &server->entry );
+        if (pipe->use_sockets && !pipe->message_mode &&
+            !(server->pipe_end.flags & NAMED_PIPE_NONBLOCKING_MODE))
+            connect_pipe_sockets( &server->pipe_end, client );
     }
     return &client->obj;
 }
@@ -1360,6 +1579,7 @@ DECL_HANDLER(create_named_pipe)
         pipe->timeout = req->timeout;
         pipe->message_mode = (req->flags & NAMED_PIPE_MESSAGE_STREAM_WRITE) != 0;
         pipe->sharing = req->sharing;
+        pipe->use_sockets = pipe_sockets_enabled() || (req->flags & NAMED_PIPE_USE_SOCKETS);
         if (sd) default_set_sd( &pipe->obj, sd, OWNER_SECURITY_INFORMATION |
                                                 GROUP_SECURITY_INFORMATION |
                                                 DACL_SECURITY_INFORMATION |
@@ -1382,7 +1602,7 @@ DECL_HANDLER(create_named_pipe)
         clear_error(); /* clear the name collision */
     }
 
-    server = create_pipe_server( pipe, req->options, req->flags );
+    server = create_pipe_server( pipe, req->options, req->flags & ~NAMED_PIPE_USE_SOCKETS );
     if (server)
     {
         reply->handle = alloc_handle( current->process, server, req->access, objattr->attributes );
@@ -1419,6 +1639,11 @@ DECL_HANDLER(set_named_pipe_info)
     {
         set_error( STATUS_INVALID_PARAMETER );
     }
+    else if (pipe_end->data_fd && (req->flags & NAMED_PIPE_NONBLOCKING_MODE))
+    {
+        /* clients access the socket directly, they wouldn't notice the change */
+        set_error( STATUS_NOT_SUPPORTED );
+    }
     else
     {
         pipe_end->flags = req->flags;
@@ -43,12 +43,26 @@
 #include "security.h"
 
 
+/*
+ * Namespaces grow as names are added. The entries of the old hash table are
+ * moved to the new one a few buckets at a time on each insertion, so that
+ * growing a large namespace doesn't stall the server; lookups check both
+ * tables until all the entries have been moved.
+ */
+
 struct namespace
 {
     unsigned int        hash_size;       /* size of hash table */
-    struct list         names[1];        /* array of hash entry lists */
+    unsigned int        count;           /* number of names in the namespace */
+    struct list        *names;           /* array of hash entry lists */
+    unsigned int        old_size;        /* size of the table being moved, 0 if none */
+    unsigned int        old_pos;         /* next bucket of the old table to move */
+    struct list        *old_names;       /* table being moved */
 };
 
+#define NAMESPACE_MAX_LOAD    2          /* average entries per bucket before growing */
+#define NAMESPACE_MOVE_STEP   4          /* old buckets moved on each insertion */
+
 
 #ifdef DEBUG_OBJECTS
 static struct list object_list = LIST_INIT(object_list);
@@ -127,11 +141,58 @@ void *memdup( const void *data, size_t len )
 
 /*****************************************************************/
 
+/* move some buckets of the old hash table to the new one */
+static void move_namespace_entries( struct namespace *namespace, unsigned int count )
+{
+    struct object_name *ptr, *next;
+
+    for ( ; count && namespace->old_pos < namespace->old_size; count--, namespace->old_pos++)
+    {
+        LIST_FOR_EACH_ENTRY_SAFE( ptr, next, &namespace->old_names[namespace->old_pos],
+                                  struct object_name, entry )
+        {
+            list_remove( &ptr->entry );
+            list_add_head( &namespace->names[hash_strW( ptr->name, ptr->len, namespace->hash_size )],
+                           &ptr->entry );
+        }
+    }
+    if (namespace->old_pos < namespace->old_size) return;
+    free( namespace->old_names );
+    namespace->old_names = NULL;
+    namespace->old_size = 0;
+}
+
+/* grow the hash table of a namespace that got too loaded */
+static void grow_namespace( struct namespace *namespace )
+{
+    unsigned int i, new_size = namespace->hash_size * 2 + 1;
+    struct list *names;
+
+    /* finish moving the previous table first */
+    if (namespace->old_size) move_namespace_entries( namespace, namespace->old_size );
+
+    if (new_size <= namespace->hash_size) return;
+    if (!(names = malloc( new_size * sizeof(*names) ))) return;  /* keep the current table */
+    for (i = 0; i < new_size; i++) list_init( &names[i] );
+
+    namespace->old_names = namespace->names;
+    namespace->old_size  = namespace->hash_size;
+    namespace->old_pos   = 0;
+    namespace->names     = names;
+    namespace->hash_size = new_size;
+}
+
 void namespace_add( struct namespace *namespace, struct object_name *ptr )
 {
-    unsigned int hash = hash_strW( ptr->name, ptr->len, namespace->hash_size );
+    unsigned int hash;
+
+    if (namespace->old_size) move_namespace_entries( namespace, NAMESPACE_MOVE_STEP );
+    else if (namespace->count >= namespace->hash_size * NAMESPACE_MAX_LOAD) grow_namespace( namespace );
 
+    hash = hash_strW( ptr->name, ptr->len, namespace->hash_size );
     list_add_head( &namespace->names[hash], &ptr->entry );
+    ptr->namespace = namespace;
+    namespace->count++;
 }
 
 /* allocate a name for an object */
@@ -143,6 +204,7 @@ static struct object_name *alloc_name( const struct unicode_str *name )
     {
         ptr->len = name->len;
         ptr->parent = NULL;
+        ptr->namespace = NULL;
         memcpy( ptr->name, name->str, name->len );
     }
     return ptr;
@@ -433,16 +495,12 @@ void release_object( void *ptr )
     }
 }
 
-/* find an object by its name; the refcount is incremented */
-struct object *find_object( const struct namespace *namespace, const struct unicode_str *name,
-                            unsigned int attributes )
+/* find a name in a hash list */
+static struct object *find_object_in_list( const struct list *list, const struct unicode_str *name,
+                                           unsigned int attributes )
 {
-    const struct list *list;
     struct list *p;
 
-    if (!name || !name->len) return NULL;
-
-    list = &namespace->names[ hash_strW( name->str, name->len, namespace->hash_size ) ];
     LIST_FOR_EACH( p, list )
     {
         const struct object_name *ptr = LIST_ENTRY( p, struct object_name, entry );
@@ -461,15 +519,38 @@ struct object *find_object( const struct namespace *namespace, const struct unic
     return NULL;
 }
 
+/* find an object by its name; the refcount is incremented */
+struct object *find_object( const struct namespace *namespace, const struct unicode_str *name,
+                            unsigned int attributes )
+{
+    struct object *obj;
+
+    if (!name || !name->len) return NULL;
+
+    if ((obj = find_object_in_list( &namespace->names[hash_strW( name->str, name->len, namespace->hash_size )],
+                                    name, attributes )))
+        return obj;
+    if (!namespace->old_size) return NULL;
+    return find_object_in_list( &namespace->old_names[hash_strW( name->str, name->len, namespace->old_size )],
+                                name, attributes );
+}
+
 /* find an object by its index; the refcount is incremented */
 struct object *find_object_index( const struct namespace *namespace, unsigned int index )
 {
+    const struct object_name *ptr;
     unsigned int i;
 
     /* FIXME: not efficient at all */
+    for (i = namespace->old_pos; i < namespace->old_size; i++)
+    {
+        LIST_FOR_EACH_ENTRY( ptr, &namespace->old_names[i], const struct object_name, entry )
+        {
+            if (!index--) return grab_object( ptr->obj );
+        }
+    }
     for (i = 0; i < namespace->hash_size; i++)
     {
-        const struct object_name *ptr;
         LIST_FOR_EACH_ENTRY( ptr, &namespace->names[i], const struct object_name, entry )
         {
             if (!index--) return grab_object( ptr->obj );
@@ -485,15 +566,30 @@ struct namespace *create_namespace( unsigned int hash_size )
     struct namespace *namespace;
     unsigned int i;
 
-    namespace = mem_alloc( sizeof(*namespace) + (hash_size - 1) * sizeof(namespace->names[0]) );
-    if (namespace)
+    if (!(namespace = mem_alloc( sizeof(*namespace) ))) return NULL;
+    if (!(namespace->names = mem_alloc( hash_size * sizeof(namespace->names[0]) )))
     {
-        namespace->hash_size      = hash_size;
-        for (i = 0; i < hash_size; i++) list_init( &namespace->names[i] );
+        free( namespace );
+        return NULL;
     }
+    namespace->hash_size = hash_size;
+    namespace->count     = 0;
+    namespace->old_size  = 0;
+    namespace->old_pos   = 0;
+    namespace->old_names = NULL;
+    for (i = 0; i < hash_size; i++) list_init( &namespace->names[i] );
     return namespace;
 }
 
+/* free a namespace, it must not contain any names */
+void free_namespace( struct namespace *namespace )
+{
+    if (!namespace) return;
+    free( namespace->old_names );
+    free( namespace->names );
+    free( namespace );
+}
+
 /* functions for unimplemented/default object operations */
 
 struct object_type *no_get_type( struct object *obj )
@@ -685,6 +781,7 @@ int no_link_name( struct object *obj, struct object_name *name, struct object *p
 void default_unlink_name( struct object *obj, struct object_name *name )
 {
     list_remove( &name->entry );
+    if (name->namespace) name->namespace->count--;
 }
 
 struct object *no_open_file( struct object *obj, unsigned int access, unsigned int sharing,
@@ -115,6 +115,7 @@ struct object_name
     struct list         entry;           /* entry in the hash list */
     struct object      *obj;             /* object owning this name */
     struct object      *parent;          /* parent object */
+    struct namespace   *namespace;       /* namespace containing the name */
     data_size_t         len;             /* name length in bytes */
     WCHAR               name[1];
 };
@@ -144,6 +145,7 @@ extern void *open_named_object( struct object *parent, const struct object_ops *
 extern void unlink_named_object( struct object *obj );
 extern void make_object_static( struct object *obj );
 extern struct namespace *create_namespace( unsigned int hash_size );
+extern void free_namespace( struct namespace *namespace );
 extern void free_kernel_objects( struct object *obj );
 /* grab/release_object can take any pointer, but you better make sure */
 /* that the thing pointed to starts with a struct object... */
@@ -190,10 +192,35 @@ extern struct keyed_event *get_keyed_event_obj( struct process *process, obj_han
 extern void pulse_event( struct event *event );
 extern void set_event( struct event *event );
 extern void reset_event( struct event *event );
+extern unsigned int get_event_fast_sync_index( struct object *obj );
 
 /* mutex functions */
 
 extern void abandon_mutexes( struct thread *thread );
+extern unsigned int get_mutex_fast_sync_index( struct object *obj );
+
+/* semaphore functions */
+
+extern unsigned int get_semaphore_fast_sync_index( struct object *obj );
+
+/* fast synchronization functions */
+
+struct fast_sync_entry;
+struct fast_completion;
+
+extern void init_fast_sync(void);
+extern struct fast_sync_entry *alloc_fast_sync_entry( unsigned int *index );
+extern void free_fast_sync_entry( struct fast_sync_entry *entry, unsigned int index );
+extern void fast_sync_wake( struct fast_sync_entry *entry );
+extern int fast_sync_update( struct fast_sync_entry *entry, int mask, int value );
+extern void fast_sync_pulse( struct fast_sync_entry *entry, int auto_reset );
+extern int fast_sync_add_queue( struct object *obj, struct wait_queue_entry *wait,
+                                struct fast_sync_entry *entry );
+extern void fast_sync_remove_queue( struct object *obj, struct wait_queue_entry *wait,
+                                    struct fast_sync_entry *entry );
+extern struct fast_completion *alloc_fast_completion( unsigned int *index );
+extern void free_fast_completion( struct fast_completion *queue, unsigned int index );
+extern void fast_completion_wake( struct fast_completion *queue );
 
 /* serial functions */
 
@@ -236,6 +263,7 @@ extern void release_global_atom( struct winstation *winstation, atom_t atom );
 extern struct object *get_root_directory(void);
 extern struct object *get_directory_obj( struct process *process, obj_handle_t handle );
 extern struct object_type *get_object_type( const struct unicode_str *name );
+extern unsigned int get_object_type_index( struct object *obj );
 extern int directory_link_name( struct object *obj, struct object_name *name, struct object *parent );
 extern void init_directories(void);
 
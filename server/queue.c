@@ -25,9 +25,11 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #ifdef HAVE_POLL_H
 # include <poll.h>
 #endif
+#include <sys/mman.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -120,10 +122,8 @@ struct msg_queue
 {
     struct object          obj;             /* object header */
     struct fd             *fd;              /* optional file descriptor to poll */
-    unsigned int           wake_bits;       /* wakeup bits */
-    unsigned int           wake_mask;       /* wakeup mask */
-    unsigned int           changed_bits;    /* changed wakeup bits */
-    unsigned int           changed_mask;    /* changed wakeup mask */
+    struct queue_shared   *shared;          /* wakeup bits and masks, possibly in the shared area */
+    unsigned int           shared_index;    /* index in the shared area, 0 if private */
     int                    paint_count;     /* pending paint messages count */
     int                    hotkey_count;    /* pending hotkey messages count */
     int                    quit_message;    /* is there a pending quit message? */
@@ -270,26 +270,95 @@ static struct thread_input *create_thread_input( struct thread *thread )
     return input;
 }
 
+/*
+ * The wakeup bits and masks of the queues are stored in a memory area that is
+ * mapped in all client processes, so that clients can check whether anything
+ * is pending in their queue without a server round-trip. Only the server
+ * writes to it. When the area cannot be created or is full, the state is
+ * allocated privately and clients always ask the server.
+ */
+
+static struct queue_shared *queue_shared_area;   /* shared area, NULL if not created */
+static int queue_shared_fd = -1;                 /* fd of the shared area */
+static int queue_shared_failed;                  /* creating the area failed, don't retry */
+static unsigned int queue_shared_used = 1;       /* entries used so far, entry 0 is never used */
+static unsigned int queue_shared_nb_free;        /* number of freed entries */
+static unsigned int queue_shared_free[QUEUE_SHARED_ENTRIES];  /* freed entries */
+
+/* allocate the shared state of a queue; index is 0 for private entries */
+static struct queue_shared *alloc_queue_shared( unsigned int *index )
+{
+    struct queue_shared *shared;
+    void *ptr;
+
+    if (!queue_shared_area && !queue_shared_failed)
+    {
+        if ((queue_shared_fd = create_shared_memory( QUEUE_SHARED_ENTRIES * sizeof(*shared), &ptr )) != -1)
+            queue_shared_area = ptr;
+        else
+        {
+            queue_shared_failed = 1;
+            clear_error();
+        }
+    }
+
+    *index = 0;
+    if (queue_shared_area)
+    {
+        if (queue_shared_nb_free) *index = queue_shared_free[--queue_shared_nb_free];
+        else if (queue_shared_used < QUEUE_SHARED_ENTRIES) *index = queue_shared_used++;
+    }
+
+    if (*index) shared = &queue_shared_area[*index];
+    else if (!(shared = mem_alloc( sizeof(*shared) ))) return NULL;
+
+    shared->wake_bits    = 0;
+    shared->wake_mask    = 0;
+    shared->changed_bits = 0;
+    shared->changed_mask = 0;
+    return shared;
+}
+
+/* free the shared state of a queue */
+static void free_queue_shared( struct queue_shared *shared, unsigned int index )
+{
+    if (!index)
+    {
+        free( shared );
+        return;
+    }
+    /* the entry may be reused right away, make sure stale readers see nothing pending */
+    shared->wake_bits    = 0;
+    shared->changed_bits = 0;
+    queue_shared_free[queue_shared_nb_free++] = index;
+}
+
 /* create a message queue object */
 static struct msg_queue *create_msg_queue( struct thread *thread, struct thread_input *input )
 {
     struct thread_input *new_input = NULL;
+    struct queue_shared *shared;
     struct msg_queue *queue;
+    unsigned int index;
     int i;
 
+    if (!(shared = alloc_queue_shared( &index ))) return NULL;
+
     if (!input)
     {
-        if (!(new_input = create_thread_input( thread ))) return NULL;
+        if (!(new_input = create_thread_input( thread )))
+        {
+            free_queue_shared( shared, index );
+            return NULL;
+        }
         input = new_input;
     }
 
     if ((queue = alloc_object( &msg_queue_ops )))
     {
         queue->fd              = NULL;
-        queue->wake_bits       = 0;
-        queue->wake_mask       = 0;
-        queue->changed_bits    = 0;
-        queue->changed_mask    = 0;
+        queue->shared          = shared;
+        queue->shared_index    = index;
         queue->paint_count     = 0;
         queue->hotkey_count    = 0;
         queue->quit_message    = 0;
@@ -308,6 +377,7 @@ static struct msg_queue *create_msg_queue( struct thread *thread, struct thread_
 
         thread->queue = queue;
     }
+    else free_queue_shared( shared, index );
     if (new_input) release_object( new_input );
     return queue;
 }
@@ -380,6 +450,31 @@ static void set_cursor_pos( struct desktop *desktop, int x, int y )
     queue_hardware_message( desktop, msg, 1 );
 }
 
+/* copy the cursor position and async key state of a desktop to the state shared with the clients */
+static void update_desktop_shared( struct desktop *desktop )
+{
+    struct desktop_shared *shared = desktop->shared;
+
+    if (!shared) return;
+    /* clients retry as long as the counter is odd or has changed while they read */
+    interlocked_xchg_add( (int *)&shared->seq, 1 );
+    shared->cursor_x = desktop->cursor.x;
+    shared->cursor_y = desktop->cursor.y;
+    shared->cursor_last_change = desktop->cursor.last_change;
+    memcpy( shared->keystate, desktop->keystate, sizeof(shared->keystate) );
+    interlocked_xchg_add( (int *)&shared->seq, 1 );
+}
+
+/* free the state of a desktop shared with the clients */
+void free_desktop_shared( struct desktop *desktop )
+{
+    if (!desktop->shared) return;
+    munmap( desktop->shared, sizeof(*desktop->shared) );
+    close( desktop->shared_fd );
+    desktop->shared = NULL;
+    desktop->shared_fd = -1;
+}
+
 /* retrieve default position and time for synthesized messages */
 static void get_message_defaults( struct msg_queue *queue, int *x, int *y, unsigned int *time )
 {
@@ -445,22 +540,23 @@ void set_queue_hooks( struct thread *thread, struct hook_table *hooks )
 /* check the queue status */
 static inline int is_signaled( struct msg_queue *queue )
 {
-    return ((queue->wake_bits & queue->wake_mask) || (queue->changed_bits & queue->changed_mask));
+    return ((queue->shared->wake_bits & queue->shared->wake_mask) ||
+            (queue->shared->changed_bits & queue->shared->changed_mask));
 }
 
 /* set some queue bits */
 static inline void set_queue_bits( struct msg_queue *queue, unsigned int bits )
 {
-    queue->wake_bits |= bits;
-    queue->changed_bits |= bits;
+    queue->shared->wake_bits |= bits;
+    queue->shared->changed_bits |= bits;
     if (is_signaled( queue )) wake_up( &queue->obj, 0 );
 }
 
 /* clear some queue bits */
 static inline void clear_queue_bits( struct msg_queue *queue, unsigned int bits )
 {
-    queue->wake_bits &= ~bits;
-    queue->changed_bits &= ~bits;
+    queue->shared->wake_bits &= ~bits;
+    queue->shared->changed_bits &= ~bits;
 }
 
 /* check whether msg is a keyboard message */
@@ -924,7 +1020,7 @@ static int msg_queue_add_queue( struct object *obj, struct wait_queue_entry *ent
         set_error( STATUS_ACCESS_DENIED );
         return 0;
     }
-    if (process->idle_event && !(queue->wake_mask & QS_SMRESULT)) set_event( process->idle_event );
+    if (process->idle_event && !(queue->shared->wake_mask & QS_SMRESULT)) set_event( process->idle_event );
 
     if (queue->fd && list_empty( &obj->wait_queue ))  /* first on the queue */
         set_fd_events( queue->fd, POLLIN );
@@ -945,7 +1041,7 @@ static void msg_queue_dump( struct object *obj, int verbose )
 {
     struct msg_queue *queue = (struct msg_queue *)obj;
     fprintf( stderr, "Msg queue bits=%x mask=%x\n",
-             queue->wake_bits, queue->wake_mask );
+             queue->shared->wake_bits, queue->shared->wake_mask );
 }
 
 static int msg_queue_signaled( struct object *obj, struct wait_queue_entry *entry )
@@ -968,8 +1064,8 @@ static int msg_queue_signaled( struct object *obj, struct wait_queue_entry *entr
 static void msg_queue_satisfied( struct object *obj, struct wait_queue_entry *entry )
 {
     struct msg_queue *queue = (struct msg_queue *)obj;
-    queue->wake_mask = 0;
-    queue->changed_mask = 0;
+    queue->shared->wake_mask = 0;
+    queue->shared->changed_mask = 0;
 }
 
 static void msg_queue_destroy( struct object *obj )
@@ -1008,6 +1104,7 @@ static void msg_queue_destroy( struct object *obj )
     release_object( queue->input );
     if (queue->hooks) release_object( queue->hooks );
     if (queue->fd) release_object( queue->fd );
+    free_queue_shared( queue->shared, queue->shared_index );
 }
 
 static void msg_queue_poll_event( struct fd *fd, int event )
@@ -1488,6 +1585,7 @@ static void queue_hardware_message( struct desktop *desktop, struct message *msg
     unsigned int msg_code;
 
     update_input_key_state( desktop, desktop->keystate, msg );
+    update_desktop_shared( desktop );
     last_input_time = get_tick_count();
     if (msg->msg != WM_MOUSEMOVE) always_queue = 1;
 
@@ -1508,6 +1606,7 @@ static void queue_hardware_message( struct desktop *desktop, struct message *msg
             desktop->cursor.x = x;
             desktop->cursor.y = y;
             desktop->cursor.last_change = get_tick_count();
+            update_desktop_shared( desktop );
         }
         if (desktop->keystate[VK_LBUTTON] & 0x80)  msg->wparam |= MK_LBUTTON;
         if (desktop->keystate[VK_MBUTTON] & 0x80)  msg->wparam |= MK_MBUTTON;
@@ -2179,7 +2278,34 @@ DECL_HANDLER(get_msg_queue)
     struct msg_queue *queue = get_current_queue();
 
     reply->handle = 0;
-    if (queue) reply->handle = alloc_handle( current->process, queue, SYNCHRONIZE, 0 );
+    reply->shared_index = 0;
+    if (queue && (reply->handle = alloc_handle( current->process, queue, SYNCHRONIZE, 0 )))
+        reply->shared_index = queue->shared_index;
+}
+
+
+/* retrieve the shared area of message queue states */
+DECL_HANDLER(get_queue_shared_area)
+{
+    struct file *file;
+    int fd;
+
+    if (!queue_shared_area)
+    {
+        set_error( STATUS_NOT_IMPLEMENTED );
+        return;
+    }
+    if ((fd = dup( queue_shared_fd )) == -1)
+    {
+        file_set_error();
+        return;
+    }
+    if ((file = create_file_for_fd( fd, FILE_READ_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE )))
+    {
+        reply->handle = alloc_handle( current->process, file, FILE_READ_DATA, 0 );
+        reply->size   = QUEUE_SHARED_ENTRIES * sizeof(*queue_shared_area);
+        release_object( file );
+    }
 }
 
 
@@ -2215,14 +2341,14 @@ DECL_HANDLER(set_queue_mask)
 
     if (queue)
     {
-        queue->wake_mask    = req->wake_mask;
-        queue->changed_mask = req->changed_mask;
-        reply->wake_bits    = queue->wake_bits;
-        reply->changed_bits = queue->changed_bits;
+        queue->shared->wake_mask    = req->wake_mask;
+        queue->shared->changed_mask = req->changed_mask;
+        reply->wake_bits    = queue->shared->wake_bits;
+        reply->changed_bits = queue->shared->changed_bits;
         if (is_signaled( queue ))
         {
             /* if skip wait is set, do what would have been done in the subsequent wait */
-            if (req->skip_wait) queue->wake_mask = queue->changed_mask = 0;
+            if (req->skip_wait) queue->shared->wake_mask = queue->shared->changed_mask = 0;
             else wake_up( &queue->obj, 0 );
         }
     }
@@ -2235,9 +2361,9 @@ DECL_HANDLER(get_queue_status)
     struct msg_queue *queue = current->queue;
     if (queue)
     {
-        reply->wake_bits    = queue->wake_bits;
-        reply->changed_bits = queue->changed_bits;
-        queue->changed_bits &= ~req->clear_bits;
+        reply->wake_bits    = queue->shared->wake_bits;
+        reply->changed_bits = queue->shared->changed_bits;
+        queue->shared->changed_bits &= ~req->clear_bits;
     }
     else reply->wake_bits = reply->changed_bits = 0;
 }
@@ -2415,11 +2541,11 @@ DECL_HANDLER(get_message)
     /* clear changed bits so we can wait on them if we don't find a message */
     if (filter & QS_POSTMESSAGE)
     {
-        queue->changed_bits &= ~(QS_POSTMESSAGE | QS_HOTKEY | QS_TIMER);
-        if (req->get_first == 0 && req->get_last == ~0U) queue->changed_bits &= ~QS_ALLPOSTMESSAGE;
+        queue->shared->changed_bits &= ~(QS_POSTMESSAGE | QS_HOTKEY | QS_TIMER);
+        if (req->get_first == 0 && req->get_last == ~0U) queue->shared->changed_bits &= ~QS_ALLPOSTMESSAGE;
     }
-    if (filter & QS_INPUT) queue->changed_bits &= ~QS_INPUT;
-    if (filter & QS_PAINT) queue->changed_bits &= ~QS_PAINT;
+    if (filter & QS_INPUT) queue->shared->changed_bits &= ~QS_INPUT;
+    if (filter & QS_PAINT) queue->shared->changed_bits &= ~QS_PAINT;
 
     /* then check for posted messages */
     if ((filter & QS_POSTMESSAGE) &&
@@ -2472,8 +2598,8 @@ DECL_HANDLER(get_message)
     }
 
     if (get_win == -1 && current->process->idle_event) set_event( current->process->idle_event );
-    queue->wake_mask = req->wake_mask;
-    queue->changed_mask = req->changed_mask;
+    queue->shared->wake_mask = req->wake_mask;
+    queue->shared->changed_mask = req->changed_mask;
     set_error( STATUS_PENDING );  /* FIXME */
 }
 
@@ -2849,7 +2975,11 @@ DECL_HANDLER(get_key_state)
         if (req->key >= 0)
         {
             reply->state = desktop->keystate[req->key & 0xff];
-            desktop->keystate[req->key & 0xff] &= ~0x40;
+            if (reply->state & 0x40)
+            {
+                desktop->keystate[req->key & 0xff] &= ~0x40;
+                update_desktop_shared( desktop );
+            }
         }
         set_reply_data( desktop->keystate, size );
         release_object( desktop );
@@ -2880,6 +3010,39 @@ DECL_HANDLER(get_key_state)
 }
 
 
+/* retrieve the state of the thread desktop shared with the clients */
+DECL_HANDLER(get_desktop_shared)
+{
+    struct desktop *desktop;
+    struct file *file;
+    void *ptr;
+    int fd;
+
+    if (!(desktop = get_thread_desktop( current, 0 ))) return;
+
+    if (!desktop->shared)
+    {
+        if ((desktop->shared_fd = create_shared_memory( sizeof(*desktop->shared), &ptr )) == -1)
+        {
+            release_object( desktop );
+            return;
+        }
+        desktop->shared = ptr;
+        desktop->shared->seq = 0;
+        update_desktop_shared( desktop );
+    }
+
+    if ((fd = dup( desktop->shared_fd )) == -1) file_set_error();
+    else if ((file = create_file_for_fd( fd, FILE_READ_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE )))
+    {
+        reply->handle = alloc_handle( current->process, file, FILE_READ_DATA, 0 );
+        reply->size   = sizeof(*desktop->shared);
+        release_object( file );
+    }
+    release_object( desktop );
+}
+
+
 /* set queue keyboard state for a given thread */
 DECL_HANDLER(set_key_state)
 {
@@ -2891,6 +3054,7 @@ DECL_HANDLER(set_key_state)
     {
         if (!(desktop = get_thread_desktop( current, 0 ))) return;
         memcpy( desktop->keystate, get_req_data(), size );
+        update_desktop_shared( desktop );
         release_object( desktop );
     }
     else
@@ -2900,6 +3064,7 @@ DECL_HANDLER(set_key_state)
         if (req->async && (desktop = get_thread_desktop( thread, 0 )))
         {
             memcpy( desktop->keystate, get_req_data(), size );
+            update_desktop_shared( desktop );
             release_object( desktop );
         }
         release_object( thread );
@@ -35,6 +35,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
 #include <unistd.h>
 
 #include "ntstatus.h"
@@ -74,6 +80,8 @@ struct key
     int               last_value;  /* last in use value */
     int               nb_values;   /* count of allocated values in array */
     struct key_value *values;      /* values array */
+    struct key_index *subkey_index; /* hash index of the subkeys, NULL for small keys */
+    struct key_index *value_index; /* hash index of the values, NULL for small keys */
     unsigned int      flags;       /* flags */
     timeout_t         modif;       /* last modification time */
     struct list       notify_list; /* list of notifications */
@@ -100,6 +108,23 @@ struct key_value
 #define MIN_SUBKEYS  8   /* min. number of allocated subkeys per key */
 #define MIN_VALUES   8   /* min. number of allocated values per key */
 
+/*
+ * Subkeys and values are kept sorted by name and looked up with a binary
+ * search. Once a key has more than MIN_INDEXED_CHILDREN of them, existing ones
+ * are looked up through a hash index instead. The index holds the positions in
+ * the array, which are updated when entries are inserted or removed.
+ */
+#define MIN_INDEXED_CHILDREN 64
+
+/* hash index of the subkeys or values of a key */
+struct key_index
+{
+    unsigned int size;     /* number of buckets, a power of 2 */
+    int          pos[1];   /* position in the array + 1, 0 for an empty bucket */
+};
+
+typedef const WCHAR *(*get_child_name_func)( const struct key *key, int pos, data_size_t *len );
+
 #define MAX_NAME_LEN  256    /* max. length of a key name */
 #define MAX_VALUE_LEN 16383  /* max. length of a value name */
 
@@ -117,6 +142,7 @@ static const WCHAR symlink_value[] = {'S','y','m','b','o','l','i','c','L','i','n
 static const struct unicode_str symlink_str = { symlink_value, sizeof(symlink_value) };
 
 static void set_periodic_save_timer(void);
+static void write_binary_hive( struct key *key, const char *path );
 static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index );
 
 /* information about where to save a registry branch */
@@ -124,12 +150,72 @@ struct save_branch_info
 {
     struct key  *key;
     const char  *path;
+    char        *journal_path;      /* journal of the changes since the last save of the hive */
+    char        *old_journal_path;  /* journal being merged into the hive in the background */
+    FILE        *journal;           /* open journal, NULL if changes are not journaled */
+    unsigned int changes;           /* number of changes in the journal */
+    off_t        hive_size;         /* size of the hive file at the last full save */
+    pid_t        compact_pid;       /* process writing the hive in the background */
+    int          full_save;         /* the whole hive needs to be written on next save */
 };
 
+/* journals are merged into the hive once they grow larger than this or than half the hive */
+#define MIN_JOURNAL_COMPACT_SIZE (1024 * 1024)
+
 #define MAX_SAVE_BRANCH_INFO 3
 static int save_branch_count;
 static struct save_branch_info save_branch_info[MAX_SAVE_BRANCH_INFO];
 
+/*
+ * The binary hive is a copy of a text hive that can be mapped and loaded
+ * without any parsing. It is written next to the text hive every time the
+ * latter is saved, and only used as long as the text hive hasn't changed,
+ * so the text hive remains the reference and can still be edited by hand.
+ *
+ * The file starts with a header followed by the branch key; each key is
+ * followed by its name, class, values and subkeys, in the same order as the
+ * key arrays so that they can be loaded without searching. All records are
+ * aligned on 8 bytes and stored in the native byte order.
+ */
+
+#define BINARY_HIVE_VERSION 2
+
+struct binary_hive_header
+{
+    char            magic[8];     /* "WINEHIVE" */
+    unsigned int    version;      /* BINARY_HIVE_VERSION, also detects a different byte order */
+    unsigned int    prefix_type;  /* prefix architecture */
+    unsigned int    size;         /* total size of the file */
+    unsigned int    __pad;
+    unsigned __int64 reg_size;    /* size of the text hive */
+    __int64         reg_mtime;    /* modification time of the text hive in ns */
+    unsigned __int64 reg_ino;     /* inode of the text hive */
+};
+
+struct binary_hive_key
+{
+    timeout_t       modif;        /* last modification time */
+    unsigned int    flags;        /* KEY_SYMLINK */
+    unsigned short  namelen;      /* length of key name */
+    unsigned short  classlen;     /* length of class name */
+    unsigned int    nb_values;    /* number of values */
+    unsigned int    nb_subkeys;   /* number of non-volatile subkeys */
+    /* followed by the name, class, values and subkeys */
+};
+
+struct binary_hive_value
+{
+    unsigned int    type;         /* value type */
+    data_size_t     len;          /* value data length in bytes */
+    unsigned short  namelen;      /* length of value name */
+    unsigned short  __pad[3];
+    /* followed by the name and data */
+};
+
+#define BINARY_HIVE_ALIGN(len) (((len) + 7) & ~7)
+
+static int use_binary_hive;  /* set from WINEBINARYHIVE */
+
 
 /* information about a file being loaded */
 struct file_load_info
@@ -141,6 +227,7 @@ struct file_load_info
     int         line;     /* current input line */
     WCHAR      *tmp;      /* temp buffer to use while parsing input */
     size_t      tmplen;   /* length of temp buffer */
+    int         journal;  /* replaying a journal, allow deletions */
 };
 
 
@@ -280,6 +367,93 @@ static void save_subkeys( const struct key *key, const struct key *base, FILE *f
     for (i = 0; i <= key->last_subkey; i++) save_subkeys( key->subkeys[i], base, f );
 }
 
+/*
+ * Changes to the keys of the saved branches are appended to a journal as
+ * they happen, using the same text format. A key section updates the time
+ * and options of the key, creating it if needed; a "#delete" option deletes
+ * the key and "name"=- deletes a value. The journal is replayed on top of the
+ * hive on startup, and merged into the hive by a background process once it
+ * grows too large, so that periodic saves only have to flush the journal.
+ */
+
+/* find the saved branch that contains a key */
+static struct save_branch_info *get_save_branch_info( const struct key *key )
+{
+    int i;
+
+    for ( ; key; key = key->parent)
+        for (i = 0; i < save_branch_count; i++)
+            if (save_branch_info[i].key == key) return &save_branch_info[i];
+    return NULL;
+}
+
+/* start a journal record for a key, return NULL if the key changes are not journaled */
+static FILE *journal_key( const struct key *key, int with_time )
+{
+    struct save_branch_info *info;
+
+    if (key->flags & KEY_VOLATILE) return NULL;
+    if (!(info = get_save_branch_info( key )) || !info->journal) return NULL;
+
+    info->changes++;
+    fprintf( info->journal, "\n[" );
+    if (key != info->key) dump_path( key, info->key, info->journal );
+    fprintf( info->journal, "]" );
+    if (with_time)
+    {
+        fprintf( info->journal, " %u\n", (unsigned int)((key->modif - ticks_1601_to_1970) / TICKS_PER_SEC) );
+        fprintf( info->journal, "#time=%x%08x\n", (unsigned int)(key->modif >> 32), (unsigned int)key->modif );
+    }
+    else fputc( '\n', info->journal );
+    return info->journal;
+}
+
+/* record the creation of a key in the journal */
+static void journal_create_key( const struct key *key )
+{
+    FILE *f;
+
+    if (!(f = journal_key( key, 1 ))) return;
+    if (key->class)
+    {
+        fprintf( f, "#class=\"" );
+        dump_strW( key->class, key->classlen, f, "\"\"" );
+        fprintf( f, "\"\n" );
+    }
+    if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
+}
+
+/* record the deletion of a key in the journal */
+static void journal_delete_key( const struct key *key )
+{
+    FILE *f;
+
+    if ((f = journal_key( key, 0 ))) fputs( "#delete\n", f );
+}
+
+/* record the new value of a key in the journal */
+static void journal_set_value( const struct key *key, const struct key_value *value )
+{
+    FILE *f;
+
+    if ((f = journal_key( key, 1 ))) dump_value( value, f );
+}
+
+/* record the deletion of a key value in the journal */
+static void journal_delete_value( const struct key *key, const struct key_value *value )
+{
+    FILE *f;
+
+    if (!(f = journal_key( key, 1 ))) return;
+    if (value->namelen)
+    {
+        fputc( '\"', f );
+        dump_strW( value->name, value->namelen, f, "\"\"" );
+        fprintf( f, "\"=-\n" );
+    }
+    else fprintf( f, "@=-\n" );
+}
+
 static void dump_operation( const struct key *key, const struct key_value *value, const char *op )
 {
     fprintf( stderr, "%s key ", op );
@@ -423,6 +597,8 @@ static void key_destroy( struct object *obj )
         release_object( key->subkeys[i] );
     }
     free( key->subkeys );
+    free( key->subkey_index );
+    free( key->value_index );
     /* unconditionally notify everything waiting on this key */
     while ((ptr = list_head( &key->notify_list )))
     {
@@ -488,6 +664,8 @@ static struct key *alloc_key( const struct unicode_str *name, timeout_t modif )
         key->nb_values   = 0;
         key->last_value  = -1;
         key->values      = NULL;
+        key->subkey_index = NULL;
+        key->value_index = NULL;
         key->modif       = modif;
         key->parent      = NULL;
         list_init( &key->notify_list );
@@ -549,6 +727,124 @@ static void touch_key( struct key *key, unsigned int change )
         check_notify( k, change, 0 );
 }
 
+static const WCHAR *get_subkey_name( const struct key *key, int pos, data_size_t *len )
+{
+    *len = key->subkeys[pos]->namelen;
+    return key->subkeys[pos]->name;
+}
+
+static const WCHAR *get_value_name( const struct key *key, int pos, data_size_t *len )
+{
+    *len = key->values[pos].namelen;
+    return key->values[pos].name;
+}
+
+/* add the child at a given position to a hash index */
+static void key_index_add( struct key_index *index, const struct key *key, int pos,
+                           get_child_name_func get_name )
+{
+    const WCHAR *name;
+    data_size_t len;
+    unsigned int i;
+
+    name = get_name( key, pos, &len );
+    for (i = hash_strW( name, len, index->size ); index->pos[i]; i = (i + 1) & (index->size - 1)) ;
+    index->pos[i] = pos + 1;
+}
+
+/* find the bucket of the child at a given position */
+static unsigned int key_index_bucket( const struct key_index *index, const struct key *key, int pos,
+                                      get_child_name_func get_name )
+{
+    const WCHAR *name;
+    data_size_t len;
+    unsigned int i;
+
+    name = get_name( key, pos, &len );
+    for (i = hash_strW( name, len, index->size ); index->pos[i] != pos + 1; i = (i + 1) & (index->size - 1))
+        assert( index->pos[i] );
+    return i;
+}
+
+/* remove the child at a given position from a hash index */
+static void key_index_remove( struct key_index *index, const struct key *key, int pos,
+                              get_child_name_func get_name )
+{
+    unsigned int i, j, k, mask = index->size - 1;
+    const WCHAR *name;
+    data_size_t len;
+
+    i = j = key_index_bucket( index, key, pos, get_name );
+    /* move back the following entries of the probe sequence to fill the hole */
+    for (;;)
+    {
+        j = (j + 1) & mask;
+        if (!index->pos[j]) break;
+        name = get_name( key, index->pos[j] - 1, &len );
+        k = hash_strW( name, len, index->size );
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        index->pos[i] = index->pos[j];
+        i = j;
+    }
+    index->pos[i] = 0;
+}
+
+/* update the positions of the children from a given position on, after they moved by delta */
+static void key_index_shift( struct key_index *index, int pos, int delta )
+{
+    unsigned int i;
+
+    for (i = 0; i < index->size; i++) if (index->pos[i] > pos) index->pos[i] += delta;
+}
+
+/* find a child in a hash index and return its position, or -1 if not found */
+static int key_index_find( const struct key_index *index, const struct key *key,
+                           const struct unicode_str *name, get_child_name_func get_name )
+{
+    const WCHAR *str;
+    data_size_t len;
+    unsigned int i;
+
+    for (i = hash_strW( name->str, name->len, index->size ); index->pos[i]; i = (i + 1) & (index->size - 1))
+    {
+        str = get_name( key, index->pos[i] - 1, &len );
+        if (len == name->len && !memicmp_strW( str, name->str, len )) return index->pos[i] - 1;
+    }
+    return -1;
+}
+
+/* build a hash index for a given number of children */
+static struct key_index *build_key_index( const struct key *key, int count, get_child_name_func get_name )
+{
+    struct key_index *index;
+    unsigned int size = 2 * MIN_INDEXED_CHILDREN;
+    int i;
+
+    while (size < 2 * count) size *= 2;
+    if (!(index = calloc( 1, offsetof( struct key_index, pos[size] ) ))) return NULL;
+    index->size = size;
+    for (i = 0; i < count; i++) key_index_add( index, key, i, get_name );
+    return index;
+}
+
+/* rebuild the subkey index after the number of subkeys has changed */
+static void rebuild_subkey_index( struct key *key )
+{
+    free( key->subkey_index );
+    key->subkey_index = NULL;
+    if (key->last_subkey + 1 >= MIN_INDEXED_CHILDREN)
+        key->subkey_index = build_key_index( key, key->last_subkey + 1, get_subkey_name );
+}
+
+/* rebuild the value index after the number of values has changed */
+static void rebuild_value_index( struct key *key )
+{
+    free( key->value_index );
+    key->value_index = NULL;
+    if (key->last_value + 1 >= MIN_INDEXED_CHILDREN)
+        key->value_index = build_key_index( key, key->last_value + 1, get_value_name );
+}
+
 /* try to grow the array of subkeys; return 1 if OK, 0 on error */
 static int grow_subkeys( struct key *key )
 {
@@ -597,6 +893,13 @@ static struct key *alloc_subkey( struct key *parent, const struct unicode_str *n
         for (i = ++parent->last_subkey; i > index; i--)
             parent->subkeys[i] = parent->subkeys[i-1];
         parent->subkeys[index] = key;
+        if (parent->subkey_index && 2 * (parent->last_subkey + 1) <= parent->subkey_index->size)
+        {
+            key_index_shift( parent->subkey_index, index, 1 );
+            key_index_add( parent->subkey_index, parent, index, get_subkey_name );
+        }
+        else if (parent->last_subkey + 1 >= MIN_INDEXED_CHILDREN)
+            rebuild_subkey_index( parent );
         if (is_wow6432node( key->name, key->namelen ) && !is_wow6432node( parent->name, parent->namelen ))
             parent->flags |= KEY_WOW64;
     }
@@ -613,8 +916,14 @@ static void free_subkey( struct key *parent, int index )
     assert( index <= parent->last_subkey );
 
     key = parent->subkeys[index];
+    if (parent->subkey_index) key_index_remove( parent->subkey_index, parent, index, get_subkey_name );
     for (i = index; i < parent->last_subkey; i++) parent->subkeys[i] = parent->subkeys[i + 1];
     parent->last_subkey--;
+    if (parent->subkey_index)
+    {
+        if (parent->last_subkey + 1 < MIN_INDEXED_CHILDREN / 2) rebuild_subkey_index( parent );
+        else key_index_shift( parent->subkey_index, index + 1, -1 );
+    }
     key->flags |= KEY_DELETED;
     key->parent = NULL;
     if (is_wow6432node( key->name, key->namelen )) parent->flags &= ~KEY_WOW64;
@@ -639,6 +948,13 @@ static struct key *find_subkey( const struct key *key, const struct unicode_str
     int i, min, max, res;
     data_size_t len;
 
+    if (key->subkey_index &&
+        (i = key_index_find( key->subkey_index, key, name, get_subkey_name )) != -1)
+    {
+        *index = i;
+        return key->subkeys[i];
+    }
+
     min = 0;
     max = key->last_subkey;
     while (min <= max)
@@ -827,6 +1143,8 @@ static struct key *create_key( struct key *key, const struct unicode_str *name,
         if (!(key->class = memdup( class->str, key->classlen ))) key->classlen = 0;
     }
     touch_key( key->parent, REG_NOTIFY_CHANGE_NAME );
+    journal_create_key( key );
+    journal_key( key->parent, 1 );
     grab_object( key );
     return key;
 }
@@ -984,7 +1302,8 @@ static void enum_key( const struct key *key, int index, int info_class,
 static int delete_key( struct key *key, int recurse )
 {
     int index;
-    struct key *parent = key->parent;
+    struct key *parent = key->parent, *tmp;
+    struct unicode_str name;
 
     /* must find parent and index */
     if (key == root_key)
@@ -998,9 +1317,10 @@ static int delete_key( struct key *key, int recurse )
         if (0 > delete_key(key->subkeys[key->last_subkey], 1))
             return -1;
 
-    for (index = 0; index <= parent->last_subkey; index++)
-        if (parent->subkeys[index] == key) break;
-    assert( index <= parent->last_subkey );
+    name.str = key->name;
+    name.len = key->namelen;
+    tmp = find_subkey( parent, &name, &index );
+    assert( tmp == key );
 
     /* we can only delete a key that has no subkeys */
     if (key->last_subkey >= 0)
@@ -1010,8 +1330,10 @@ static int delete_key( struct key *key, int recurse )
     }
 
     if (debug_level > 1) dump_operation( key, NULL, "Delete" );
+    journal_delete_key( key );
     free_subkey( parent, index );
     touch_key( parent, REG_NOTIFY_CHANGE_NAME );
+    journal_key( parent, 1 );
     return 0;
 }
 
@@ -1046,6 +1368,13 @@ static struct key_value *find_value( const struct key *key, const struct unicode
     int i, min, max, res;
     data_size_t len;
 
+    if (key->value_index &&
+        (i = key_index_find( key->value_index, key, name, get_value_name )) != -1)
+    {
+        *index = i;
+        return &key->values[i];
+    }
+
     min = 0;
     max = key->last_value;
     while (min <= max)
@@ -1089,6 +1418,13 @@ static struct key_value *insert_value( struct key *key, const struct unicode_str
     value->namelen = name->len;
     value->len     = 0;
     value->data    = NULL;
+    if (key->value_index && 2 * (key->last_value + 1) <= key->value_index->size)
+    {
+        key_index_shift( key->value_index, index, 1 );
+        key_index_add( key->value_index, key, index, get_value_name );
+    }
+    else if (key->last_value + 1 >= MIN_INDEXED_CHILDREN)
+        rebuild_value_index( key );
     return value;
 }
 
@@ -1137,6 +1473,7 @@ static void set_value( struct key *key, const struct unicode_str *name,
     value->len   = len;
     value->data  = ptr;
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
+    journal_set_value( key, value );
     if (debug_level > 1) dump_operation( key, value, "Set" );
 }
 
@@ -1223,11 +1560,18 @@ static void delete_value( struct key *key, const struct unicode_str *name )
         return;
     }
     if (debug_level > 1) dump_operation( key, value, "Delete" );
+    touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
+    journal_delete_value( key, value );
+    if (key->value_index) key_index_remove( key->value_index, key, index, get_value_name );
     free( value->name );
     free( value->data );
     for (i = index; i < key->last_value; i++) key->values[i] = key->values[i + 1];
     key->last_value--;
-    touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
+    if (key->value_index)
+    {
+        if (key->last_value + 1 < MIN_INDEXED_CHILDREN / 2) rebuild_value_index( key );
+        else key_index_shift( key->value_index, index + 1, -1 );
+    }
 
     /* try to shrink the array */
     nb_values = key->nb_values;
@@ -1449,7 +1793,8 @@ static int load_key_option( struct key *key, const char *buffer, struct file_loa
             else if (*p >= 'a' && *p <= 'f') modif = (modif << 4) | (*p - 'a' + 10);
             else break;
         }
-        update_key_time( key, modif );
+        if (info->journal) key->modif = modif;
+        else update_key_time( key, modif );
     }
     if (!strncmp( buffer, "#class=", 7 ))
     {
@@ -1463,6 +1808,7 @@ static int load_key_option( struct key *key, const char *buffer, struct file_loa
         key->classlen = len;
     }
     if (!strncmp( buffer, "#link", 5 )) key->flags |= KEY_SYMLINK;
+    if (!strncmp( buffer, "#delete", 7 ) && info->journal && key->parent) delete_key( key, 1 );
     /* ignore unknown options */
     return 1;
 }
@@ -1489,7 +1835,7 @@ static int parse_hex( unsigned char *dest, data_size_t *len, const char *buffer
     return p - buffer;
 }
 
-/* parse a value name and create the corresponding value */
+/* parse a value name, and create the corresponding value unless it is being deleted */
 static struct key_value *parse_value_name( struct key *key, const char *buffer, data_size_t *len,
                                            struct file_load_info *info )
 {
@@ -1516,6 +1862,15 @@ static struct key_value *parse_value_name( struct key *key, const char *buffer,
     if (buffer[*len] != '=') goto error;
     (*len)++;
     while (isspace(buffer[*len])) (*len)++;
+    if (info->journal && buffer[*len] == '-')
+    {
+        timeout_t modif = key->modif;
+
+        /* keep the time recorded in the journal */
+        if (find_value( key, &name, &index )) delete_value( key, &name );
+        key->modif = modif;
+        return NULL;
+    }
     if (!(value = find_value( key, &name, &index ))) value = insert_value( key, &name, index );
     return value;
 
@@ -1585,6 +1940,8 @@ static int load_value( struct key *key, const char *buffer, struct file_load_inf
 
  error:
     file_read_error( "Malformed value", info );
+    /* a truncated journal record must not clobber the loaded value */
+    if (info->journal) return 0;
     free( value->data );
     value->data = NULL;
     value->len  = 0;
@@ -1621,7 +1978,7 @@ static int get_prefix_len( struct key *key, const char *name, struct file_load_i
 
 /* load all the keys from the input file */
 /* prefix_len is the number of key name prefixes to skip, or -1 for autodetection */
-static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len )
+static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len, int journal )
 {
     struct key *subkey = NULL;
     struct file_load_info info;
@@ -1633,6 +1990,7 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
     info.len    = 4;
     info.tmplen = 4;
     info.line   = 0;
+    info.journal = journal;
     if (!(info.buffer = mem_alloc( info.len ))) return;
     if (!(info.tmp = mem_alloc( info.tmplen )))
     {
@@ -1705,35 +2063,230 @@ static void load_registry( struct key *key, obj_handle_t handle )
         FILE *f = fdopen( fd, "r" );
         if (f)
         {
-            load_keys( key, NULL, f, -1 );
+            load_keys( key, NULL, f, -1, 0 );
             fclose( f );
         }
         else file_set_error();
     }
 }
 
+/* get the modification time of a text hive in nanoseconds, to detect same-second edits */
+static __int64 get_hive_mtime( const struct stat *st )
+{
+    __int64 ret = (__int64)st->st_mtime * 1000000000;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    ret += st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    ret += st->st_mtimespec.tv_nsec;
+#endif
+    return ret;
+}
+
+/* get a record of the binary hive, checking that it fits in the file */
+static const void *get_binary_data( const char *base, size_t *pos, size_t size, size_t len )
+{
+    const void *ret = base + *pos;
+
+    if (len > size - *pos) return NULL;
+    *pos += BINARY_HIVE_ALIGN(len);
+    if (*pos > size) *pos = size;
+    return ret;
+}
+
+/* load a key and its subkeys from the binary hive */
+static int load_binary_key( struct key *key, const char *base, size_t *pos, size_t size )
+{
+    const struct binary_hive_key *hive_key;
+    const struct binary_hive_value *hive_value;
+    struct key_value *value;
+    struct unicode_str name;
+    const void *class, *data;
+    unsigned int i;
+    int index;
+
+    if (!(hive_key = get_binary_data( base, pos, size, sizeof(*hive_key) ))) return 0;
+    if (!get_binary_data( base, pos, size, hive_key->namelen )) return 0;
+    if (!(class = get_binary_data( base, pos, size, hive_key->classlen ))) return 0;
+
+    key->modif = hive_key->modif;
+    key->flags |= hive_key->flags & KEY_SYMLINK;
+    if (hive_key->classlen)
+    {
+        free( key->class );
+        if (!(key->class = memdup( class, hive_key->classlen ))) key->classlen = 0;
+        else key->classlen = hive_key->classlen;
+    }
+
+    for (i = 0; i < hive_key->nb_values; i++)
+    {
+        if (!(hive_value = get_binary_data( base, pos, size, sizeof(*hive_value) ))) return 0;
+        if (!(name.str = get_binary_data( base, pos, size, hive_value->namelen ))) return 0;
+        if (!(data = get_binary_data( base, pos, size, hive_value->len ))) return 0;
+        name.len = hive_value->namelen;
+
+        /* values are sorted, so this normally appends */
+        if (!(value = find_value( key, &name, &index )) &&
+            !(value = insert_value( key, &name, index ))) return 0;
+        free( value->data );
+        value->type = hive_value->type;
+        value->len  = 0;
+        if (!(value->data = memdup( data, hive_value->len ))) return 0;
+        value->len  = hive_value->len;
+    }
+
+    for (i = 0; i < hive_key->nb_subkeys; i++)
+    {
+        const struct binary_hive_key *hive_subkey;
+        struct key *subkey;
+        size_t subkey_pos = *pos;
+
+        if (!(hive_subkey = get_binary_data( base, &subkey_pos, size, sizeof(*hive_subkey) ))) return 0;
+        if (!(name.str = get_binary_data( base, &subkey_pos, size, hive_subkey->namelen ))) return 0;
+        name.len = hive_subkey->namelen;
+
+        /* subkeys are sorted too */
+        if (!(subkey = find_subkey( key, &name, &index )) &&
+            !(subkey = alloc_subkey( key, &name, index, hive_subkey->modif ))) return 0;
+        if (!load_binary_key( subkey, base, pos, size )) return 0;
+    }
+    return 1;
+}
+
+/* load a branch from its binary hive, if it is up to date with the text hive */
+static int load_binary_hive( struct key *key, const char *path )
+{
+    const struct binary_hive_header *header;
+    struct stat st, reg_st;
+    char *bin_path;
+    void *base;
+    size_t pos = 0;
+    int fd, ret = 0;
+
+    if (!use_binary_hive) return 0;
+    if (stat( path, &reg_st )) return 0;
+    if (!(bin_path = malloc( strlen(path) + sizeof(".bin") ))) return 0;
+    sprintf( bin_path, "%s.bin", path );
+    fd = open( bin_path, O_RDONLY );
+    free( bin_path );
+    if (fd == -1) return 0;
+
+    if (fstat( fd, &st ) || st.st_size < sizeof(*header) ||
+        (base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 )) == MAP_FAILED)
+    {
+        close( fd );
+        return 0;
+    }
+    close( fd );
+
+    header = base;
+    if (memcmp( header->magic, "WINEHIVE", sizeof(header->magic) ) ||
+        header->version != BINARY_HIVE_VERSION || header->size != st.st_size ||
+        header->reg_size != reg_st.st_size || header->reg_mtime != get_hive_mtime( &reg_st ) ||
+        header->reg_ino != reg_st.st_ino)
+        goto done;
+    if (header->prefix_type != PREFIX_UNKNOWN && prefix_type != PREFIX_UNKNOWN &&
+        header->prefix_type != prefix_type)
+        goto done;  /* let the text hive report the error */
+
+    /* the binary hive can only be loaded into a new branch */
+    if (key->last_subkey != -1 || key->last_value != -1) goto done;
+
+    get_binary_data( base, &pos, st.st_size, sizeof(*header) );
+    if (!(ret = load_binary_key( key, base, &pos, st.st_size )))
+    {
+        fprintf( stderr, "%s.bin: corrupted binary hive, loading the text hive\n", path );
+        clear_error();
+        /* start over from the text hive */
+        while (key->last_subkey >= 0)
+            delete_key( key->subkeys[key->last_subkey], 1 );
+        while (key->last_value >= 0)
+        {
+            struct unicode_str name = { key->values[key->last_value].name, key->values[key->last_value].namelen };
+            delete_value( key, &name );
+        }
+        make_clean( key );
+    }
+    else if (prefix_type == PREFIX_UNKNOWN) prefix_type = header->prefix_type;
+
+ done:
+    munmap( base, st.st_size );
+    return ret;
+}
+
+/* replay a journal on top of its hive */
+static int replay_journal( struct key *key, const char *path )
+{
+    FILE *f;
+
+    if (!(f = fopen( path, "r" ))) return 0;
+    load_keys( key, path, f, 0, 1 );
+    fclose( f );
+    if (get_error() == STATUS_NOT_REGISTRY_FILE)
+        fprintf( stderr, "%s is not a valid registry journal, ignoring it\n", path );
+    clear_error();
+    return 1;
+}
+
+/* open the journal of a branch for appending */
+static void open_journal( struct save_branch_info *info, const char *mode )
+{
+    if (!(info->journal = fopen( info->journal_path, mode )))
+    {
+        /* fall back to saving the whole hive */
+        info->full_save = 1;
+        return;
+    }
+    fseek( info->journal, 0, SEEK_END );
+    if (!ftell( info->journal )) fprintf( info->journal, "WINE REGISTRY Version 2\n" );
+}
+
+/* replay the journals of a branch that has just been loaded, and start journaling changes */
+static void init_journal( struct save_branch_info *info )
+{
+    struct stat st;
+    size_t len = strlen( info->path );
+
+    if (!stat( info->path, &st )) info->hive_size = st.st_size;
+    if (!(info->journal_path = malloc( len + sizeof(".journal") ))) return;
+    if (!(info->old_journal_path = malloc( len + sizeof(".journal.old") ))) return;
+    sprintf( info->journal_path, "%s.journal", info->path );
+    sprintf( info->old_journal_path, "%s.journal.old", info->path );
+
+    /* the old journal is left over if merging it into the hive didn't complete */
+    if (replay_journal( info->key, info->old_journal_path )) info->full_save = 1;
+    if (replay_journal( info->key, info->journal_path )) info->full_save = 1;
+    if (info->full_save) make_dirty( info->key );
+    open_journal( info, "a" );
+}
+
 /* load one of the initial registry files */
 static int load_init_registry_from_file( const char *filename, struct key *key )
 {
-    FILE *f;
+    struct save_branch_info *info;
+    FILE *f = NULL;
+    int loaded = load_binary_hive( key, filename );
 
-    if ((f = fopen( filename, "r" )))
+    if (!loaded && (f = fopen( filename, "r" )))
     {
-        load_keys( key, filename, f, 0 );
+        load_keys( key, filename, f, 0, 0 );
         fclose( f );
         if (get_error() == STATUS_NOT_REGISTRY_FILE)
         {
             fprintf( stderr, "%s is not a valid registry file\n", filename );
             return 1;
         }
+        /* convert it so that the next startup doesn't need to parse it */
+        if (use_binary_hive) write_binary_hive( key, filename );
     }
 
     assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
 
-    save_branch_info[save_branch_count].path = filename;
-    save_branch_info[save_branch_count++].key = (struct key *)grab_object( key );
+    info = &save_branch_info[save_branch_count++];
+    info->path = filename;
+    info->key = (struct key *)grab_object( key );
     make_object_static( &key->obj );
-    return (f != NULL);
+    init_journal( info );
+    return loaded || (f != NULL);
 }
 
 static WCHAR *format_user_registry_path( const SID *sid, struct unicode_str *path )
@@ -1800,6 +2353,9 @@ void init_registry(void)
 
     if (fchdir( config_dir_fd ) == -1) fatal_error( "chdir to config dir: %s\n", strerror( errno ));
 
+    p = getenv( "WINEBINARYHIVE" );
+    use_binary_hive = p && atoi( p );
+
     /* create the root key */
     root_key = alloc_key( &root_name, current_time );
     assert( root_key );
@@ -1913,20 +2469,101 @@ static void save_registry( struct key *key, obj_handle_t handle )
     }
 }
 
-/* save a registry branch to a file */
-static int save_branch( struct key *key, const char *path )
+/* write data followed by padding to the binary hive */
+static void write_binary_data( const void *data, size_t len, FILE *f )
 {
+    static const char padding[8];
+
+    fwrite( data, len, 1, f );
+    fwrite( padding, BINARY_HIVE_ALIGN(len) - len, 1, f );
+}
+
+/* write a key and its subkeys to the binary hive */
+static void write_binary_key( const struct key *key, FILE *f )
+{
+    struct binary_hive_key hive_key;
+    struct binary_hive_value hive_value;
+    int i;
+
+    memset( &hive_key, 0, sizeof(hive_key) );
+    hive_key.modif      = key->modif;
+    hive_key.flags      = key->flags & KEY_SYMLINK;
+    hive_key.namelen    = key->namelen;
+    hive_key.classlen   = key->classlen;
+    hive_key.nb_values  = key->last_value + 1;
+    for (i = 0; i <= key->last_subkey; i++)
+        if (!(key->subkeys[i]->flags & KEY_VOLATILE)) hive_key.nb_subkeys++;
+
+    write_binary_data( &hive_key, sizeof(hive_key), f );
+    write_binary_data( key->name, key->namelen, f );
+    write_binary_data( key->class, key->classlen, f );
+    for (i = 0; i <= key->last_value; i++)
+    {
+        memset( &hive_value, 0, sizeof(hive_value) );
+        hive_value.type    = key->values[i].type;
+        hive_value.len     = key->values[i].len;
+        hive_value.namelen = key->values[i].namelen;
+        write_binary_data( &hive_value, sizeof(hive_value), f );
+        write_binary_data( key->values[i].name, key->values[i].namelen, f );
+        write_binary_data( key->values[i].data, key->values[i].len, f );
+    }
+    for (i = 0; i <= key->last_subkey; i++)
+        if (!(key->subkeys[i]->flags & KEY_VOLATILE)) write_binary_key( key->subkeys[i], f );
+}
+
+/* write the binary copy of a text hive that has just been saved */
+static void write_binary_hive( struct key *key, const char *path )
+{
+    struct binary_hive_header header;
     struct stat st;
-    char *p, *tmp = NULL;
-    int fd, count = 0, ret = 0;
+    char *bin_path, *tmp;
+    long size;
     FILE *f;
+    int ret;
 
-    if (!(key->flags & KEY_DIRTY))
+    if (!(bin_path = malloc( 2 * strlen(path) + sizeof(".bin") + sizeof(".tmp") ))) return;
+    tmp = bin_path + sprintf( bin_path, "%s.bin", path ) + 1;
+    sprintf( tmp, "%s.bin.tmp", path );
+
+    if (stat( path, &st ) || !(f = fopen( tmp, "w" )))
     {
-        if (debug_level > 1) dump_operation( key, NULL, "Not saving clean" );
-        return 1;
+        unlink( bin_path );
+        free( bin_path );
+        return;
     }
 
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, "WINEHIVE", sizeof(header.magic) );
+    header.version     = BINARY_HIVE_VERSION;
+    header.prefix_type = prefix_type;
+    header.reg_size    = st.st_size;
+    header.reg_mtime   = get_hive_mtime( &st );
+    header.reg_ino     = st.st_ino;
+    write_binary_data( &header, sizeof(header), f );
+    write_binary_key( key, f );
+
+    /* now that the size is known, update the header */
+    size = ftell( f );
+    header.size = size;
+    ret = size > 0 && size == header.size && !fseek( f, 0, SEEK_SET ) &&
+          fwrite( &header, sizeof(header), 1, f ) == 1;
+    ret = !fclose( f ) && ret;
+    if (!ret || rename( tmp, bin_path ))
+    {
+        unlink( tmp );
+        unlink( bin_path );
+    }
+    free( bin_path );
+}
+
+/* write a whole registry branch to its hive file */
+static int write_branch( struct key *key, const char *path )
+{
+    struct stat st;
+    char *p, *tmp = NULL;
+    int fd, count = 0, ret = 0;
+    FILE *f;
+
     /* test the file type */
 
     if ((fd = open( path, O_WRONLY )) != -1)
@@ -1979,11 +2616,117 @@ static int save_branch( struct key *key, const char *path )
         /* if successfully written, rename to final name */
         if (ret) ret = !rename( tmp, path );
         if (!ret) unlink( tmp );
+        else if (use_binary_hive) write_binary_hive( key, path );
     }
 
 done:
     free( tmp );
-    if (ret) make_clean( key );
+    return ret;
+}
+
+/* check whether the hive is still being written in the background */
+static int is_compacting( struct save_branch_info *info, int wait )
+{
+    int status;
+    pid_t pid;
+
+    if (!info->compact_pid) return 0;
+    while ((pid = waitpid( info->compact_pid, &status, wait ? 0 : WNOHANG )) == -1 && errno == EINTR);
+    if (!pid) return 1;
+    /* the status may have been collected by the SIGCHLD handler already, a failure
+     * is detected by the old journal still being there on the next compaction */
+    info->compact_pid = 0;
+    return 0;
+}
+
+/* write the whole hive, and discard the journals it makes obsolete */
+static int save_branch_full( struct save_branch_info *info )
+{
+    struct stat st;
+
+    is_compacting( info, 1 );
+    if (!write_branch( info->key, info->path )) return 0;
+
+    if (info->journal)
+    {
+        fclose( info->journal );
+        info->journal = NULL;
+    }
+    if (info->journal_path)
+    {
+        unlink( info->old_journal_path );
+        open_journal( info, "w" );
+    }
+    if (!stat( info->path, &st )) info->hive_size = st.st_size;
+    info->changes = 0;
+    info->full_save = 0;
+    return 1;
+}
+
+/* merge the journal into the hive from a child process, working on a snapshot of the keys */
+static int compact_branch( struct save_branch_info *info )
+{
+    struct stat st;
+    pid_t pid;
+
+    if (!info->journal || !stat( info->old_journal_path, &st )) return 0;
+
+    fclose( info->journal );
+    info->journal = NULL;
+    if (rename( info->journal_path, info->old_journal_path ) == -1)
+    {
+        open_journal( info, "a" );
+        return 0;
+    }
+    open_journal( info, "w" );
+
+    if (!(pid = fork()))
+    {
+        /* the old journal is only removed once the hive contains its changes */
+        if (write_branch( info->key, info->path ) && !unlink( info->old_journal_path )) _exit( 0 );
+        _exit( 1 );
+    }
+    if (pid == -1) return 0;  /* the old journal will be removed by the full save */
+
+    if (debug_level > 1) fprintf( stderr, "%s: compacting in process %d\n", info->path, (int)pid );
+    if (!stat( info->path, &st )) info->hive_size = st.st_size;
+    info->compact_pid = pid;
+    info->changes = 0;
+    return 1;
+}
+
+/* save the changes to a registry branch */
+static int save_branch( struct save_branch_info *info, int flush )
+{
+    struct key *key = info->key;
+    int ret;
+
+    if (!(key->flags & KEY_DIRTY) && !(flush && (info->changes || info->full_save)))
+    {
+        if (debug_level > 1) dump_operation( key, NULL, "Not saving clean" );
+        return 1;
+    }
+
+    if (debug_level > 1)
+    {
+        fprintf( stderr, "%s: ", info->path );
+        dump_operation( key, NULL, flush ? "saving" : "journaling" );
+    }
+
+    if (!flush && !info->full_save && info->journal && !fflush( info->journal ))
+    {
+        long size = ftell( info->journal );
+
+        if (size <= MIN_JOURNAL_COMPACT_SIZE || size <= info->hive_size / 2 ||
+            is_compacting( info, 0 ) || compact_branch( info ))
+        {
+            make_clean( key );
+            return 1;
+        }
+    }
+
+    /* on exit, leave a complete hive behind so that it can be edited offline */
+    if ((ret = save_branch_full( info ))) make_clean( key );
     return ret;
 }
 
@@ -1995,7 +2738,7 @@ static void periodic_save( void *arg )
     if (fchdir( config_dir_fd ) == -1) return;
     save_timeout_user = NULL;
     for (i = 0; i < save_branch_count; i++)
-        save_branch( save_branch_info[i].key, save_branch_info[i].path );
+        save_branch( &save_branch_info[i], 0 );
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
     set_periodic_save_timer();
 }
@@ -2015,12 +2758,26 @@ void flush_registry(void)
     if (fchdir( config_dir_fd ) == -1) return;
     for (i = 0; i < save_branch_count; i++)
     {
-        if (!save_branch( save_branch_info[i].key, save_branch_info[i].path ))
+        struct save_branch_info *info = &save_branch_info[i];
+        struct stat st;
+
+        is_compacting( info, 1 );
+        if (info->journal_path && !stat( info->old_journal_path, &st )) info->full_save = 1;
+        if (!save_branch( info, 1 ))
         {
             fprintf( stderr, "wineserver: could not save registry branch to %s",
-                     save_branch_info[i].path );
+                     info->path );
             perror( " " );
+            if (info->journal) fflush( info->journal );
+            continue;
         }
+        /* the hive is up to date, the journal is no longer needed */
+        if (info->journal)
+        {
+            fclose( info->journal );
+            info->journal = NULL;
+        }
+        if (info->journal_path) unlink( info->journal_path );
     }
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
 }
@@ -2109,7 +2866,10 @@ DECL_HANDLER(flush_key)
     struct key *key = get_hkey_obj( req->hkey, 0 );
     if (key)
     {
-        /* we don't need to do anything here with the current implementation */
+        struct save_branch_info *info = get_save_branch_info( key );
+
+        /* changes are saved periodically, only make sure the journal reaches the disk */
+        if (info && info->journal) fflush( info->journal );
         release_object( key );
     }
 }
@@ -2218,6 +2978,10 @@ DECL_HANDLER(load_registry)
         int dummy;
         if ((key = create_key( parent, &name, NULL, 0, KEY_WOW64_64KEY, 0, sd, &dummy )))
         {
+            struct save_branch_info *info = get_save_branch_info( key );
+
+            /* the loaded keys are not journaled */
+            if (info) info->full_save = 1;
             load_registry( key, req->file );
             release_object( key );
         }
@@ -47,6 +47,9 @@
 #ifdef HAVE_SYS_UN_H
 #include <sys/un.h>
 #endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
 #include <unistd.h>
 #ifdef HAVE_POLL_H
 #include <poll.h>
@@ -129,6 +132,7 @@ timeout_t server_start_time = 0;  /* server startup time */
 char *server_dir = NULL;   /* server directory */
 int server_dir_fd = -1;    /* file descriptor for the server dir */
 int config_dir_fd = -1;    /* file descriptor for the config dir */
+unsigned int request_count = 0; /* number of requests processed so far */
 
 static struct master_socket *master_socket;  /* the master socket object */
 static struct timeout_user *master_timeout;
@@ -293,17 +297,73 @@ static void send_reply( union generic_reply *reply )
         fatal_protocol_error( current, "reply write: %s\n", strerror( errno ));
 }
 
+#ifdef __linux__
+#define FUTEX_WAKE 1
+
+/* wake up the client waiting on the shared memory reply sequence */
+static inline void wake_request_shm( struct request_shm *shm )
+{
+    interlocked_xchg_add( (int *)&shm->seq, 1 );
+    syscall( __NR_futex, &shm->seq, FUTEX_WAKE, 1, NULL, 0, 0 );
+}
+#else
+static inline void wake_request_shm( struct request_shm *shm )
+{
+    assert(0);  /* shared memory requests are never enabled */
+}
+#endif
+
+/* send a reply to the current thread through its shared memory area */
+static void send_shm_reply( struct request_shm *shm, union generic_reply *reply )
+{
+    int ret = 0;
+
+    memcpy( &shm->reply, reply, sizeof(*reply) );
+    if (!(shm->pipe_data = (current->reply_size > REQUEST_SHM_DATA_SIZE)))
+    {
+        memcpy( shm + 1, current->reply_data, current->reply_size );
+    }
+    else if ((ret = write( get_unix_fd( current->reply_fd ),
+                           current->reply_data, current->reply_size )) == -1)
+    {
+        if (errno == EPIPE)
+        {
+            kill_thread( current, 0 );  /* normal death */
+            return;
+        }
+        if (errno != EWOULDBLOCK && (EWOULDBLOCK == EAGAIN || errno != EAGAIN))
+        {
+            fatal_protocol_error( current, "reply write: %s\n", strerror( errno ));
+            return;
+        }
+        ret = 0;
+    }
+    wake_request_shm( shm );
+
+    if (shm->pipe_data && (current->reply_towrite = current->reply_size - ret))
+    {
+        /* couldn't write it all, wait for POLLOUT */
+        set_fd_events( current->reply_fd, POLLOUT );
+        set_fd_events( current->request_fd, 0 );
+        return;
+    }
+    free( current->reply_data );
+    current->reply_data = NULL;
+}
+
 /* call a request handler */
 static void call_req_handler( struct thread *thread )
 {
     union generic_reply reply;
     enum request req = thread->req.request_header.req;
+    struct request_shm *shm = thread->request_shm;  /* may get enabled by the request itself */
 
     current = thread;
     current->reply_size = 0;
     clear_error();
     memset( &reply, 0, sizeof(reply) );
 
+    request_count++;
     if (debug_level) trace_request();
 
     if (req < REQ_NB_REQUESTS)
@@ -318,7 +378,8 @@ static void call_req_handler( struct thread *thread )
             reply.reply_header.error = current->error;
             reply.reply_header.reply_size = current->reply_size;
             if (debug_level) trace_reply( req, &reply );
-            send_reply( &reply );
+            if (shm) send_shm_reply( shm, &reply );
+            else send_reply( &reply );
         }
         else
         {
@@ -350,6 +411,16 @@ void read_request( struct thread *thread )
                                   thread->req_toread, thread->req.request_header.req );
             return;
         }
+        if (thread->request_shm && thread->req_toread <= REQUEST_SHM_DATA_SIZE)
+        {
+            /* the client stored the data in the shared area, no need to read it */
+            memcpy( thread->req_data, thread->request_shm + 1, thread->req_toread );
+            thread->req_toread = 0;
+            call_req_handler( thread );
+            free( thread->req_data );
+            thread->req_data = NULL;
+            return;
+        }
     }
 
     /* read the variable sized data */
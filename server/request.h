@@ -52,6 +52,7 @@ extern const struct object_attributes *get_req_object_attributes( const struct s
 extern const void *get_req_data_after_objattr( const struct object_attributes *attr, data_size_t *len );
 extern int receive_fd( struct process *process );
 extern int send_client_fd( struct process *process, int fd, obj_handle_t handle );
+extern unsigned int request_count;
 extern void read_request( struct thread *thread );
 extern void write_reply( struct thread *thread );
 extern timeout_t monotonic_counter(void);
@@ -144,6 +145,7 @@ DECL_HANDLER(get_apc_result);
 DECL_HANDLER(close_handle);
 DECL_HANDLER(set_handle_info);
 DECL_HANDLER(dup_handle);
+DECL_HANDLER(get_handle_cache);
 DECL_HANDLER(open_process);
 DECL_HANDLER(open_thread);
 DECL_HANDLER(select);
@@ -157,6 +159,8 @@ DECL_HANDLER(create_mutex);
 DECL_HANDLER(release_mutex);
 DECL_HANDLER(open_mutex);
 DECL_HANDLER(query_mutex);
+DECL_HANDLER(get_fast_sync_area);
+DECL_HANDLER(get_fast_sync_obj);
 DECL_HANDLER(create_semaphore);
 DECL_HANDLER(release_semaphore);
 DECL_HANDLER(query_semaphore);
@@ -174,6 +178,7 @@ DECL_HANDLER(lock_file);
 DECL_HANDLER(unlock_file);
 DECL_HANDLER(create_socket);
 DECL_HANDLER(accept_socket);
+DECL_HANDLER(get_socket_shared_area);
 DECL_HANDLER(accept_into_socket);
 DECL_HANDLER(set_socket_event);
 DECL_HANDLER(get_socket_event);
@@ -252,9 +257,11 @@ DECL_HANDLER(set_atom_information);
 DECL_HANDLER(empty_atom_table);
 DECL_HANDLER(init_atom_table);
 DECL_HANDLER(get_msg_queue);
+DECL_HANDLER(get_queue_shared_area);
 DECL_HANDLER(set_queue_fd);
 DECL_HANDLER(set_queue_mask);
 DECL_HANDLER(get_queue_status);
+DECL_HANDLER(get_desktop_shared);
 DECL_HANDLER(get_process_idle_event);
 DECL_HANDLER(send_message);
 DECL_HANDLER(post_quit_message);
@@ -392,6 +399,7 @@ DECL_HANDLER(get_token_statistics);
 DECL_HANDLER(create_completion);
 DECL_HANDLER(open_completion);
 DECL_HANDLER(add_completion);
+DECL_HANDLER(wake_completion);
 DECL_HANDLER(remove_completion);
 DECL_HANDLER(query_completion);
 DECL_HANDLER(set_completion_info);
@@ -447,6 +455,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_close_handle,
     (req_handler)req_set_handle_info,
     (req_handler)req_dup_handle,
+    (req_handler)req_get_handle_cache,
     (req_handler)req_open_process,
     (req_handler)req_open_thread,
     (req_handler)req_select,
@@ -460,6 +469,8 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_release_mutex,
     (req_handler)req_open_mutex,
     (req_handler)req_query_mutex,
+    (req_handler)req_get_fast_sync_area,
+    (req_handler)req_get_fast_sync_obj,
     (req_handler)req_create_semaphore,
     (req_handler)req_release_semaphore,
     (req_handler)req_query_semaphore,
@@ -477,6 +488,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_unlock_file,
     (req_handler)req_create_socket,
     (req_handler)req_accept_socket,
+    (req_handler)req_get_socket_shared_area,
     (req_handler)req_accept_into_socket,
     (req_handler)req_set_socket_event,
     (req_handler)req_get_socket_event,
@@ -555,9 +567,11 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_empty_atom_table,
     (req_handler)req_init_atom_table,
     (req_handler)req_get_msg_queue,
+    (req_handler)req_get_queue_shared_area,
     (req_handler)req_set_queue_fd,
     (req_handler)req_set_queue_mask,
     (req_handler)req_get_queue_status,
+    (req_handler)req_get_desktop_shared,
     (req_handler)req_get_process_idle_event,
     (req_handler)req_send_message,
     (req_handler)req_post_quit_message,
@@ -695,6 +709,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_create_completion,
     (req_handler)req_open_completion,
     (req_handler)req_add_completion,
+    (req_handler)req_wake_completion,
     (req_handler)req_remove_completion,
     (req_handler)req_query_completion,
     (req_handler)req_set_completion_info,
@@ -799,6 +814,7 @@ C_ASSERT( FIELD_OFFSET(struct init_thread_request, entry) == 32 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_request, reply_fd) == 40 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_request, wait_fd) == 44 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_request, cpu) == 48 );
+C_ASSERT( FIELD_OFFSET(struct init_thread_request, request_shm) == 52 );
 C_ASSERT( sizeof(struct init_thread_request) == 56 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, pid) == 8 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, tid) == 12 );
@@ -807,7 +823,8 @@ C_ASSERT( FIELD_OFFSET(struct init_thread_reply, info_size) == 24 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, version) == 28 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, all_cpus) == 32 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, suspend) == 36 );
-C_ASSERT( sizeof(struct init_thread_reply) == 40 );
+C_ASSERT( FIELD_OFFSET(struct init_thread_reply, request_shm) == 40 );
+C_ASSERT( sizeof(struct init_thread_reply) == 48 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, exit_code) == 16 );
 C_ASSERT( sizeof(struct terminate_process_request) == 24 );
@@ -923,6 +940,11 @@ C_ASSERT( FIELD_OFFSET(struct dup_handle_reply, handle) == 8 );
 C_ASSERT( FIELD_OFFSET(struct dup_handle_reply, self) == 12 );
 C_ASSERT( FIELD_OFFSET(struct dup_handle_reply, closed) == 16 );
 C_ASSERT( sizeof(struct dup_handle_reply) == 24 );
+C_ASSERT( sizeof(struct get_handle_cache_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_handle_cache_reply, size) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_handle_cache_reply, process_type) == 12 );
+C_ASSERT( FIELD_OFFSET(struct get_handle_cache_reply, thread_type) == 16 );
+C_ASSERT( sizeof(struct get_handle_cache_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct open_process_request, pid) == 12 );
 C_ASSERT( FIELD_OFFSET(struct open_process_request, access) == 16 );
 C_ASSERT( FIELD_OFFSET(struct open_process_request, attributes) == 20 );
@@ -996,6 +1018,15 @@ C_ASSERT( FIELD_OFFSET(struct query_mutex_reply, count) == 8 );
 C_ASSERT( FIELD_OFFSET(struct query_mutex_reply, owned) == 12 );
 C_ASSERT( FIELD_OFFSET(struct query_mutex_reply, abandoned) == 16 );
 C_ASSERT( sizeof(struct query_mutex_reply) == 24 );
+C_ASSERT( sizeof(struct get_fast_sync_area_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_fast_sync_area_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_fast_sync_area_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_fast_sync_obj_request, handle) == 12 );
+C_ASSERT( sizeof(struct get_fast_sync_obj_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_fast_sync_obj_reply, index) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_fast_sync_obj_reply, type) == 12 );
+C_ASSERT( FIELD_OFFSET(struct get_fast_sync_obj_reply, access) == 16 );
+C_ASSERT( sizeof(struct get_fast_sync_obj_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct create_semaphore_request, access) == 12 );
 C_ASSERT( FIELD_OFFSET(struct create_semaphore_request, initial) == 16 );
 C_ASSERT( FIELD_OFFSET(struct create_semaphore_request, max) == 20 );
@@ -1088,13 +1119,21 @@ C_ASSERT( FIELD_OFFSET(struct create_socket_request, protocol) == 28 );
 C_ASSERT( FIELD_OFFSET(struct create_socket_request, flags) == 32 );
 C_ASSERT( sizeof(struct create_socket_request) == 40 );
 C_ASSERT( FIELD_OFFSET(struct create_socket_reply, handle) == 8 );
-C_ASSERT( sizeof(struct create_socket_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct create_socket_reply, shared_index) == 12 );
+C_ASSERT( FIELD_OFFSET(struct create_socket_reply, shared_serial) == 16 );
+C_ASSERT( sizeof(struct create_socket_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct accept_socket_request, lhandle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct accept_socket_request, access) == 16 );
 C_ASSERT( FIELD_OFFSET(struct accept_socket_request, attributes) == 20 );
 C_ASSERT( sizeof(struct accept_socket_request) == 24 );
 C_ASSERT( FIELD_OFFSET(struct accept_socket_reply, handle) == 8 );
-C_ASSERT( sizeof(struct accept_socket_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct accept_socket_reply, shared_index) == 12 );
+C_ASSERT( FIELD_OFFSET(struct accept_socket_reply, shared_serial) == 16 );
+C_ASSERT( sizeof(struct accept_socket_reply) == 24 );
+C_ASSERT( sizeof(struct get_socket_shared_area_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_socket_shared_area_reply, handle) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_socket_shared_area_reply, size) == 12 );
+C_ASSERT( sizeof(struct get_socket_shared_area_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct accept_into_socket_request, lhandle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct accept_into_socket_request, ahandle) == 16 );
 C_ASSERT( sizeof(struct accept_into_socket_request) == 24 );
@@ -1535,7 +1574,12 @@ C_ASSERT( FIELD_OFFSET(struct init_atom_table_reply, table) == 8 );
 C_ASSERT( sizeof(struct init_atom_table_reply) == 16 );
 C_ASSERT( sizeof(struct get_msg_queue_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_msg_queue_reply, handle) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_msg_queue_reply, shared_index) == 12 );
 C_ASSERT( sizeof(struct get_msg_queue_reply) == 16 );
+C_ASSERT( sizeof(struct get_queue_shared_area_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_queue_shared_area_reply, handle) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_queue_shared_area_reply, size) == 12 );
+C_ASSERT( sizeof(struct get_queue_shared_area_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct set_queue_fd_request, handle) == 12 );
 C_ASSERT( sizeof(struct set_queue_fd_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct set_queue_mask_request, wake_mask) == 12 );
@@ -1550,6 +1594,10 @@ C_ASSERT( sizeof(struct get_queue_status_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_queue_status_reply, wake_bits) == 8 );
 C_ASSERT( FIELD_OFFSET(struct get_queue_status_reply, changed_bits) == 12 );
 C_ASSERT( sizeof(struct get_queue_status_reply) == 16 );
+C_ASSERT( sizeof(struct get_desktop_shared_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_desktop_shared_reply, handle) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_desktop_shared_reply, size) == 12 );
+C_ASSERT( sizeof(struct get_desktop_shared_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_process_idle_event_request, handle) == 12 );
 C_ASSERT( sizeof(struct get_process_idle_event_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_process_idle_event_reply, event) == 8 );
@@ -2270,6 +2318,7 @@ C_ASSERT( sizeof(struct get_object_info_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct get_object_type_request, handle) == 12 );
 C_ASSERT( sizeof(struct get_object_type_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_object_type_reply, total) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_object_type_reply, index) == 12 );
 C_ASSERT( sizeof(struct get_object_type_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct unlink_object_request, handle) == 12 );
 C_ASSERT( sizeof(struct unlink_object_request) == 16 );
@@ -2353,6 +2402,8 @@ C_ASSERT( FIELD_OFFSET(struct add_completion_request, cvalue) == 24 );
 C_ASSERT( FIELD_OFFSET(struct add_completion_request, information) == 32 );
 C_ASSERT( FIELD_OFFSET(struct add_completion_request, status) == 40 );
 C_ASSERT( sizeof(struct add_completion_request) == 48 );
+C_ASSERT( FIELD_OFFSET(struct wake_completion_request, handle) == 12 );
+C_ASSERT( sizeof(struct wake_completion_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct remove_completion_request, handle) == 12 );
 C_ASSERT( sizeof(struct remove_completion_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct remove_completion_reply, ckey) == 8 );
@@ -38,25 +38,29 @@
 
 struct semaphore
 {
-    struct object  obj;    /* object header */
-    unsigned int   count;  /* current count */
-    unsigned int   max;    /* maximum possible count */
+    struct object           obj;         /* object header */
+    struct fast_sync_entry *sync;        /* semaphore state, holding the current count */
+    unsigned int            sync_index;  /* index of the state in the shared area */
+    unsigned int            max;         /* maximum possible count */
 };
 
 static void semaphore_dump( struct object *obj, int verbose );
 static struct object_type *semaphore_get_type( struct object *obj );
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int semaphore_map_access( struct object *obj, unsigned int access );
 static int semaphore_signal( struct object *obj, unsigned int access );
+static void semaphore_destroy( struct object *obj );
 
 static const struct object_ops semaphore_ops =
 {
     sizeof(struct semaphore),      /* size */
     semaphore_dump,                /* dump */
     semaphore_get_type,            /* get_type */
-    add_queue,                     /* add_queue */
-    remove_queue,                  /* remove_queue */
+    semaphore_add_queue,           /* add_queue */
+    semaphore_remove_queue,        /* remove_queue */
     semaphore_signaled,            /* signaled */
     semaphore_satisfied,           /* satisfied */
     semaphore_signal,              /* signal */
@@ -70,7 +74,7 @@ static const struct object_ops semaphore_ops =
     no_open_file,                  /* open_file */
     no_kernel_obj_list,            /* get_kernel_obj_list */
     no_close_handle,               /* close_handle */
-    no_destroy                     /* destroy */
+    semaphore_destroy              /* destroy */
 };
 
 
@@ -90,40 +94,66 @@ static struct semaphore *create_semaphore( struct object *root, const struct uni
         if (get_error() != STATUS_OBJECT_NAME_EXISTS)
         {
             /* initialize it if it didn't already exist */
-            sem->count = initial;
-            sem->max   = max;
+            sem->max = max;
+            /* counts that don't fit in the shared state can only be handled by the server */
+            if (max <= FAST_SYNC_STATE_MASK) sem->sync = alloc_fast_sync_entry( &sem->sync_index );
+            else if ((sem->sync = mem_alloc( sizeof(*sem->sync) ))) sem->sync_index = 0;
+            if (!sem->sync)
+            {
+                release_object( sem );
+                return NULL;
+            }
+            sem->sync->state   = initial;
+            sem->sync->waiters = 0;
+            sem->sync->data    = max;
         }
     }
     return sem;
 }
 
+static inline unsigned int semaphore_count( struct semaphore *sem )
+{
+    if (!sem->sync_index) return sem->sync->state;
+    return sem->sync->state & FAST_SYNC_STATE_MASK;
+}
+
 static int release_semaphore( struct semaphore *sem, unsigned int count,
                               unsigned int *prev )
 {
-    if (prev) *prev = sem->count;
-    if (sem->count + count < sem->count || sem->count + count > sem->max)
-    {
-        set_error( STATUS_SEMAPHORE_LIMIT_EXCEEDED );
-        return 0;
-    }
-    else if (sem->count)
+    unsigned int old, cur;
+
+    do
     {
-        /* there cannot be any thread to wake up if the count is != 0 */
-        sem->count += count;
-    }
-    else
+        old = sem->sync->state;
+        cur = sem->sync_index ? old & FAST_SYNC_STATE_MASK : old;
+        if (prev) *prev = cur;
+        if (cur + count < cur || cur + count > sem->max)
+        {
+            set_error( STATUS_SEMAPHORE_LIMIT_EXCEEDED );
+            return 0;
+        }
+    } while (interlocked_cmpxchg( &sem->sync->state, old + count, old ) != old);
+
+    /* there cannot be any thread to wake up if the count was != 0 */
+    if (!cur)
     {
-        sem->count = count;
+        fast_sync_wake( sem->sync );
         wake_up( &sem->obj, count );
     }
     return 1;
 }
 
+unsigned int get_semaphore_fast_sync_index( struct object *obj )
+{
+    if (obj->ops != &semaphore_ops) return 0;
+    return ((struct semaphore *)obj)->sync_index;
+}
+
 static void semaphore_dump( struct object *obj, int verbose )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    fprintf( stderr, "Semaphore count=%d max=%d\n", sem->count, sem->max );
+    fprintf( stderr, "Semaphore count=%d max=%d\n", semaphore_count( sem ), sem->max );
 }
 
 static struct object_type *semaphore_get_type( struct object *obj )
@@ -133,19 +163,36 @@ static struct object_type *semaphore_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    if (!sem->sync_index) return add_queue( obj, entry );
+    return fast_sync_add_queue( obj, entry, sem->sync );
+}
+
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    if (!sem->sync_index) remove_queue( obj, entry );
+    else fast_sync_remove_queue( obj, entry, sem->sync );
+}
+
 static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    return (sem->count > 0);
+    return (semaphore_count( sem ) > 0);
 }
 
 static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    assert( sem->count );
-    sem->count--;
+    assert( semaphore_count( sem ));
+    /* clients leave the state alone while there are server-side waiters */
+    interlocked_xchg_add( &sem->sync->state, -1 );
 }
 
 static unsigned int semaphore_map_access( struct object *obj, unsigned int access )
@@ -170,6 +217,14 @@ static int semaphore_signal( struct object *obj, unsigned int access )
     return release_semaphore( sem, 1, NULL );
 }
 
+static void semaphore_destroy( struct object *obj )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+
+    if (sem->sync) free_fast_sync_entry( sem->sync, sem->sync_index );
+}
+
 /* create a semaphore */
 DECL_HANDLER(create_semaphore)
 {
@@ -224,7 +279,7 @@ DECL_HANDLER(query_semaphore)
     if ((sem = (struct semaphore *)get_handle_obj( current->process, req->handle,
                                                    SEMAPHORE_QUERY_STATE, &semaphore_ops )))
     {
-        reply->current = sem->count;
+        reply->current = semaphore_count( sem );
         reply->max = sem->max;
         release_object( sem );
     }
@@ -96,10 +96,8 @@ struct sock
 {
     struct object       obj;         /* object header */
     struct fd          *fd;          /* socket file descriptor */
-    unsigned int        state;       /* status bits */
-    unsigned int        mask;        /* event mask */
-    unsigned int        hmask;       /* held (blocked) events */
-    unsigned int        pmask;       /* pending events */
+    struct socket_shared *shared;    /* status bits and event masks, possibly in the shared area */
+    unsigned int        shared_index; /* index in the shared area, 0 if allocated privately */
     unsigned int        flags;       /* socket flags */
     int                 polling;     /* is socket being polled? */
     unsigned short      proto;       /* socket protocol */
@@ -261,7 +259,7 @@ static int sock_reselect( struct sock *sock )
     if (!sock->polling)  /* FIXME: should find a better way to do this */
     {
         /* previously unconnected socket, is this reselect supposed to connect it? */
-        if (!(sock->state & ~FD_WINE_NONBLOCKING)) return 0;
+        if (!(sock->shared->state & ~FD_WINE_NONBLOCKING)) return 0;
         /* ok, it is, attach it to the wineserver's main poll loop */
         sock->polling = 1;
         allow_fd_caching( sock->fd );
@@ -274,7 +272,7 @@ static int sock_reselect( struct sock *sock )
 /* wake anybody waiting on the socket event or send the associated message */
 static void sock_wake_up( struct sock *sock )
 {
-    unsigned int events = sock->pmask & sock->mask;
+    unsigned int events = sock->shared->pmask & sock->shared->mask;
     int i;
 
     if ( !events ) return;
@@ -290,13 +288,13 @@ static void sock_wake_up( struct sock *sock )
         for (i = 0; i < FD_MAX_EVENTS; i++)
         {
             int event = event_bitorder[i];
-            if (sock->pmask & (1 << event))
+            if (sock->shared->pmask & (1 << event))
             {
                 lparam_t lparam = (1 << event) | (sock->errors[event] << 16);
                 post_message( sock->window, sock->message, sock->wparam, lparam );
             }
         }
-        sock->pmask = 0;
+        sock->shared->pmask = 0;
         sock_reselect( sock );
     }
 }
@@ -330,9 +328,9 @@ static int sock_dispatch_asyncs( struct sock *sock, int event, int error )
         {
             int status = sock_get_ntstatus( error );
 
-            if ( !(sock->state & FD_READ) )
+            if ( !(sock->shared->state & FD_READ) )
                 async_wake_up( &sock->read_q, status );
-            if ( !(sock->state & FD_WRITE) )
+            if ( !(sock->shared->state & FD_WRITE) )
                 async_wake_up( &sock->write_q, status );
         }
     }
@@ -343,44 +341,44 @@ static void sock_dispatch_events( struct sock *sock, int prevstate, int event, i
 {
     if (prevstate & FD_CONNECT)
     {
-        sock->pmask |= FD_CONNECT;
-        sock->hmask |= FD_CONNECT;
+        sock->shared->pmask |= FD_CONNECT;
+        sock->shared->hmask |= FD_CONNECT;
         sock->errors[FD_CONNECT_BIT] = sock_get_error( error );
         goto end;
     }
     if (prevstate & FD_WINE_LISTENING)
     {
-        sock->pmask |= FD_ACCEPT;
-        sock->hmask |= FD_ACCEPT;
+        sock->shared->pmask |= FD_ACCEPT;
+        sock->shared->hmask |= FD_ACCEPT;
         sock->errors[FD_ACCEPT_BIT] = sock_get_error( error );
         goto end;
     }
 
     if (event & POLLIN)
     {
-        sock->pmask |= FD_READ;
-        sock->hmask |= FD_READ;
+        sock->shared->pmask |= FD_READ;
+        sock->shared->hmask |= FD_READ;
         sock->errors[FD_READ_BIT] = 0;
     }
 
     if (event & POLLOUT)
     {
-        sock->pmask |= FD_WRITE;
-        sock->hmask |= FD_WRITE;
+        sock->shared->pmask |= FD_WRITE;
+        sock->shared->hmask |= FD_WRITE;
         sock->errors[FD_WRITE_BIT] = 0;
     }
 
     if (event & POLLPRI)
     {
-        sock->pmask |= FD_OOB;
-        sock->hmask |= FD_OOB;
+        sock->shared->pmask |= FD_OOB;
+        sock->shared->hmask |= FD_OOB;
         sock->errors[FD_OOB_BIT] = 0;
     }
 
     if (event & (POLLERR|POLLHUP))
     {
-        sock->pmask |= FD_CLOSE;
-        sock->hmask |= FD_CLOSE;
+        sock->shared->pmask |= FD_CLOSE;
+        sock->shared->hmask |= FD_CLOSE;
         sock->errors[FD_CLOSE_BIT] = sock_get_error( error );
     }
 end:
@@ -391,7 +389,7 @@ static void sock_poll_event( struct fd *fd, int event )
 {
     struct sock *sock = get_fd_user( fd );
     int hangup_seen = 0;
-    int prevstate = sock->state;
+    int prevstate = sock->shared->state;
     int error = 0;
 
     assert( sock->obj.ops == &sock_ops );
@@ -401,24 +399,24 @@ static void sock_poll_event( struct fd *fd, int event )
     /* we may change event later, remove from loop here */
     if (event & (POLLERR|POLLHUP)) set_fd_events( sock->fd, -1 );
 
-    if (sock->state & FD_CONNECT)
+    if (sock->shared->state & FD_CONNECT)
     {
         if (event & (POLLERR|POLLHUP))
         {
             /* we didn't get connected? */
-            sock->state &= ~FD_CONNECT;
+            sock->shared->state &= ~FD_CONNECT;
             event &= ~POLLOUT;
             error = sock_error( fd );
         }
         else if (event & POLLOUT)
         {
             /* we got connected */
-            sock->state |= FD_WINE_CONNECTED|FD_READ|FD_WRITE;
-            sock->state &= ~FD_CONNECT;
+            sock->shared->state |= FD_WINE_CONNECTED|FD_READ|FD_WRITE;
+            sock->shared->state &= ~FD_CONNECT;
             sock->connect_time = current_time;
         }
     }
-    else if (sock->state & FD_WINE_LISTENING)
+    else if (sock->shared->state & FD_WINE_LISTENING)
     {
         /* listening */
         if (event & (POLLERR|POLLHUP))
@@ -455,12 +453,12 @@ static void sock_poll_event( struct fd *fd, int event )
             }
         }
 
-        if ( (hangup_seen || event & (POLLHUP|POLLERR)) && (sock->state & (FD_READ|FD_WRITE)) )
+        if ( (hangup_seen || event & (POLLHUP|POLLERR)) && (sock->shared->state & (FD_READ|FD_WRITE)) )
         {
             error = error ? error : sock_error( fd );
             if ( (event & POLLERR) || ( sock_shutdown_type == SOCK_SHUTDOWN_EOF && (event & POLLHUP) ))
-                sock->state &= ~FD_WRITE;
-            sock->state &= ~FD_READ;
+                sock->shared->state &= ~FD_WRITE;
+            sock->shared->state &= ~FD_READ;
 
             if (debug_level)
                 fprintf(stderr, "socket %p aborted by error %d, event: %x\n", sock, error, event);
@@ -485,8 +483,8 @@ static void sock_dump( struct object *obj, int verbose )
     struct sock *sock = (struct sock *)obj;
     assert( obj->ops == &sock_ops );
     fprintf( stderr, "Socket fd=%p, state=%x, mask=%x, pending=%x, held=%x\n",
-            sock->fd, sock->state,
-            sock->mask, sock->pmask, sock->hmask );
+            sock->fd, sock->shared->state,
+            sock->shared->mask, sock->shared->pmask, sock->shared->hmask );
 }
 
 static int sock_signaled( struct object *obj, struct wait_queue_entry *entry )
@@ -500,13 +498,13 @@ static int sock_signaled( struct object *obj, struct wait_queue_entry *entry )
 static int sock_get_poll_events( struct fd *fd )
 {
     struct sock *sock = get_fd_user( fd );
-    unsigned int mask = sock->mask & ~sock->hmask;
-    unsigned int smask = sock->state & mask;
+    unsigned int mask = sock->shared->mask & ~sock->shared->hmask;
+    unsigned int smask = sock->shared->state & mask;
     int ev = 0;
 
     assert( sock->obj.ops == &sock_ops );
 
-    if (sock->state & FD_CONNECT)
+    if (sock->shared->state & FD_CONNECT)
         /* connecting, wait for writable */
         return POLLOUT;
 
@@ -514,11 +512,11 @@ static int sock_get_poll_events( struct fd *fd )
     {
         if (async_waiting( &sock->read_q )) ev |= POLLIN | POLLPRI;
     }
-    else if (smask & FD_READ || (sock->state & FD_WINE_LISTENING && mask & FD_ACCEPT))
+    else if (smask & FD_READ || (sock->shared->state & FD_WINE_LISTENING && mask & FD_ACCEPT))
         ev |= POLLIN | POLLPRI;
     /* We use POLLIN with 0 bytes recv() as FD_CLOSE indication for stream sockets. */
-    else if ( sock->type == SOCK_STREAM && sock->state & FD_READ && mask & FD_CLOSE &&
-              !(sock->hmask & FD_READ) )
+    else if ( sock->type == SOCK_STREAM && sock->shared->state & FD_READ && mask & FD_CLOSE &&
+              !(sock->shared->hmask & FD_READ) )
         ev |= POLLIN;
 
     if (async_queued( &sock->write_q ))
@@ -545,7 +543,7 @@ static int sock_ioctl( struct fd *fd, ioctl_code_t code, struct async *async )
     switch(code)
     {
     case WS_SIO_ADDRESS_LIST_CHANGE:
-        if ((sock->state & FD_WINE_NONBLOCKING) && async_is_blocking( async ))
+        if ((sock->shared->state & FD_WINE_NONBLOCKING) && async_is_blocking( async ))
         {
             set_win32_error( WSAEWOULDBLOCK );
             return 0;
@@ -580,8 +578,8 @@ static void sock_queue_async( struct fd *fd, struct async *async, int type, int
         return;
     }
 
-    if ( ( !( sock->state & (FD_READ|FD_CONNECT|FD_WINE_LISTENING) ) && type == ASYNC_TYPE_READ  ) ||
-         ( !( sock->state & (FD_WRITE|FD_CONNECT) ) && type == ASYNC_TYPE_WRITE ) )
+    if ( ( !( sock->shared->state & (FD_READ|FD_CONNECT|FD_WINE_LISTENING) ) && type == ASYNC_TYPE_READ  ) ||
+         ( !( sock->shared->state & (FD_WRITE|FD_CONNECT) ) && type == ASYNC_TYPE_WRITE ) )
     {
         set_error( STATUS_PIPE_DISCONNECTED );
         return;
@@ -607,6 +605,80 @@ static struct fd *sock_get_fd( struct object *obj )
     return (struct fd *)grab_object( sock->fd );
 }
 
+/*
+ * When WINESHAREDSOCKETS is set, the status bits and event masks of the
+ * sockets are stored in a memory area that is mapped in all client
+ * processes, so that clients can check the
+ * blocking mode and whether re-enabling an event would change anything
+ * without a server round-trip. Only the server writes to it. Each entry holds
+ * the serial number of its socket, so that clients can detect that an entry
+ * has been reused. Clients find the entry of a socket through the handle
+ * they got it from, so a handle closed without their knowledge and reused for
+ * another socket can still show them the state of the old one; that's why the
+ * area is opt-in. When the area is disabled, cannot be created or is full,
+ * the state is allocated privately and clients always ask the server.
+ */
+
+static struct socket_shared *socket_shared_area;  /* shared area, NULL if not created */
+static int socket_shared_fd = -1;                 /* fd of the shared area */
+static int socket_shared_failed;                  /* the area is disabled or its creation failed */
+static unsigned int socket_shared_used = 1;       /* entries used so far, entry 0 is never used */
+static unsigned int socket_shared_nb_free;        /* number of freed entries */
+static unsigned int socket_shared_free[SOCKET_SHARED_ENTRIES];  /* freed entries */
+static unsigned int socket_serial;                /* last serial number allocated */
+
+/* allocate the shared state of a socket; index is 0 for private entries */
+static struct socket_shared *alloc_socket_shared( unsigned int *index )
+{
+    struct socket_shared *shared;
+    void *ptr;
+
+    if (!socket_shared_area && !socket_shared_failed)
+    {
+        const char *env = getenv( "WINESHAREDSOCKETS" );
+
+        if (env && atoi( env ) &&
+            (socket_shared_fd = create_shared_memory( SOCKET_SHARED_ENTRIES * sizeof(*shared), &ptr )) != -1)
+            socket_shared_area = ptr;
+        else
+        {
+            socket_shared_failed = 1;
+            clear_error();
+        }
+    }
+
+    *index = 0;
+    if (socket_shared_area)
+    {
+        if (socket_shared_nb_free) *index = socket_shared_free[--socket_shared_nb_free];
+        else if (socket_shared_used < SOCKET_SHARED_ENTRIES) *index = socket_shared_used++;
+    }
+
+    if (*index) shared = &socket_shared_area[*index];
+    else if (!(shared = mem_alloc( sizeof(*shared) ))) return NULL;
+
+    shared->state = 0;
+    shared->mask  = 0;
+    shared->hmask = 0;
+    shared->pmask = 0;
+    shared->type  = 0;
+    if (!++socket_serial) socket_serial++;
+    shared->serial = socket_serial;
+    return shared;
+}
+
+/* free the shared state of a socket */
+static void free_socket_shared( struct socket_shared *shared, unsigned int index )
+{
+    if (!index)
+    {
+        free( shared );
+        return;
+    }
+    shared->serial = 0;
+    socket_shared_free[socket_shared_nb_free++] = index;
+}
+
 static void sock_destroy( struct object *obj )
 {
     struct sock *sock = (struct sock *)obj;
@@ -629,14 +701,12 @@ static void sock_destroy( struct object *obj )
         shutdown( get_unix_fd(sock->fd), SHUT_RDWR );
         release_object( sock->fd );
     }
+    if (sock->shared) free_socket_shared( sock->shared, sock->shared_index );
 }
 
-static void init_sock(struct sock *sock)
+static int init_sock(struct sock *sock)
 {
-    sock->state = 0;
-    sock->mask    = 0;
-    sock->hmask   = 0;
-    sock->pmask   = 0;
+    sock->fd      = NULL;
     sock->polling = 0;
     sock->flags   = 0;
     sock->type    = 0;
@@ -652,6 +722,7 @@ static void init_sock(struct sock *sock)
     init_async_queue( &sock->write_q );
     init_async_queue( &sock->ifchange_q );
     memset( sock->errors, 0, sizeof(sock->errors) );
+    return (sock->shared = alloc_socket_shared( &sock->shared_index )) != NULL;
 }
 
 /* create a new and unconnected socket */
@@ -673,11 +744,17 @@ static struct object *create_socket( int family, int type, int protocol, unsigne
         close( sockfd );
         return NULL;
     }
-    init_sock( sock );
-    sock->state  = (type != SOCK_STREAM) ? (FD_READ|FD_WRITE) : 0;
+    if (!init_sock( sock ))
+    {
+        close( sockfd );
+        release_object( sock );
+        return NULL;
+    }
+    sock->shared->state  = (type != SOCK_STREAM) ? (FD_READ|FD_WRITE) : 0;
     sock->flags  = flags;
     sock->proto  = protocol;
     sock->type   = type;
+    sock->shared->type = type;
     sock->family = family;
 
     if (!(sock->fd = create_anonymous_fd( &sock_fd_ops, sockfd, &sock->obj,
@@ -739,14 +816,21 @@ static struct sock *accept_socket( obj_handle_t handle )
             return NULL;
         }
 
-        init_sock( acceptsock );
+        if (!init_sock( acceptsock ))
+        {
+            close( acceptfd );
+            release_object( acceptsock );
+            release_object( sock );
+            return NULL;
+        }
         /* newly created socket gets the same properties of the listening socket */
-        acceptsock->state  = FD_WINE_CONNECTED|FD_READ|FD_WRITE;
-        if (sock->state & FD_WINE_NONBLOCKING)
-            acceptsock->state |= FD_WINE_NONBLOCKING;
-        acceptsock->mask    = sock->mask;
+        acceptsock->shared->state  = FD_WINE_CONNECTED|FD_READ|FD_WRITE;
+        if (sock->shared->state & FD_WINE_NONBLOCKING)
+            acceptsock->shared->state |= FD_WINE_NONBLOCKING;
+        acceptsock->shared->mask    = sock->shared->mask;
         acceptsock->proto   = sock->proto;
         acceptsock->type    = sock->type;
+        acceptsock->shared->type = sock->type;
         acceptsock->family  = sock->family;
         acceptsock->window  = sock->window;
         acceptsock->message = sock->message;
@@ -762,8 +846,8 @@ static struct sock *accept_socket( obj_handle_t handle )
         }
     }
     clear_error();
-    sock->pmask &= ~FD_ACCEPT;
-    sock->hmask &= ~FD_ACCEPT;
+    sock->shared->pmask &= ~FD_ACCEPT;
+    sock->shared->hmask &= ~FD_ACCEPT;
     sock_reselect( sock );
     release_object( sock );
     return acceptsock;
@@ -795,12 +879,13 @@ static int accept_into_socket( struct sock *sock, struct sock *acceptsock )
             return FALSE;
     }
 
-    acceptsock->state  |= FD_WINE_CONNECTED|FD_READ|FD_WRITE;
-    acceptsock->hmask   = 0;
-    acceptsock->pmask   = 0;
+    acceptsock->shared->state  |= FD_WINE_CONNECTED|FD_READ|FD_WRITE;
+    acceptsock->shared->hmask   = 0;
+    acceptsock->shared->pmask   = 0;
     acceptsock->polling = 0;
     acceptsock->proto   = sock->proto;
     acceptsock->type    = sock->type;
+    acceptsock->shared->type = sock->type;
     acceptsock->family  = sock->family;
     acceptsock->wparam  = 0;
     acceptsock->deferred = NULL;
@@ -810,8 +895,8 @@ static int accept_into_socket( struct sock *sock, struct sock *acceptsock )
     acceptsock->fd = newfd;
 
     clear_error();
-    sock->pmask &= ~FD_ACCEPT;
-    sock->hmask &= ~FD_ACCEPT;
+    sock->shared->pmask &= ~FD_ACCEPT;
+    sock->shared->hmask &= ~FD_ACCEPT;
     sock_reselect( sock );
 
     return TRUE;
@@ -1172,7 +1257,11 @@ DECL_HANDLER(create_socket)
     reply->handle = 0;
     if ((obj = create_socket( req->family, req->type, req->protocol, req->flags )) != NULL)
     {
+        struct sock *sock = (struct sock *)obj;
+
         reply->handle = alloc_handle( current->process, obj, req->access, req->attributes );
+        reply->shared_index  = sock->shared_index;
+        reply->shared_serial = sock->shared->serial;
         release_object( obj );
     }
 }
@@ -1187,11 +1276,37 @@ DECL_HANDLER(accept_socket)
     {
         reply->handle = alloc_handle( current->process, &sock->obj, req->access, req->attributes );
         sock->wparam = reply->handle;  /* wparam for message is the socket handle */
+        reply->shared_index  = sock->shared_index;
+        reply->shared_serial = sock->shared->serial;
         sock_reselect( sock );
         release_object( &sock->obj );
     }
 }
 
+/* retrieve the shared area of socket states */
+DECL_HANDLER(get_socket_shared_area)
+{
+    struct file *file;
+    int fd;
+
+    if (!socket_shared_area)
+    {
+        set_error( STATUS_NOT_IMPLEMENTED );
+        return;
+    }
+    if ((fd = dup( socket_shared_fd )) == -1)
+    {
+        file_set_error();
+        return;
+    }
+    if ((file = create_file_for_fd( fd, FILE_READ_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE )))
+    {
+        reply->handle = alloc_handle( current->process, file, FILE_READ_DATA, 0 );
+        reply->size   = SOCKET_SHARED_ENTRIES * sizeof(*socket_shared_area);
+        release_object( file );
+    }
+}
+
 /* accept a socket into an initialized socket */
 DECL_HANDLER(accept_into_socket)
 {
@@ -1227,8 +1342,8 @@ DECL_HANDLER(set_socket_event)
     if (!(sock = (struct sock *)get_handle_obj( current->process, req->handle,
                                                 FILE_WRITE_ATTRIBUTES, &sock_ops))) return;
     old_event = sock->event;
-    sock->mask    = req->mask;
-    sock->hmask   &= ~req->mask; /* re-enable held events */
+    sock->shared->mask    = req->mask;
+    sock->shared->hmask   &= ~req->mask; /* re-enable held events */
     sock->event   = NULL;
     sock->window  = req->window;
     sock->message = req->msg;
@@ -1239,7 +1354,7 @@ DECL_HANDLER(set_socket_event)
 
     sock_reselect( sock );
 
-    sock->state |= FD_WINE_NONBLOCKING;
+    sock->shared->state |= FD_WINE_NONBLOCKING;
 
     /* if a network event is pending, signal the event object
        it is possible that FD_CONNECT or FD_ACCEPT network events has happened
@@ -1258,9 +1373,9 @@ DECL_HANDLER(get_socket_event)
 
     if (!(sock = (struct sock *)get_handle_obj( current->process, req->handle,
                                                 FILE_READ_ATTRIBUTES, &sock_ops ))) return;
-    reply->mask  = sock->mask;
-    reply->pmask = sock->pmask;
-    reply->state = sock->state;
+    reply->mask  = sock->shared->mask;
+    reply->pmask = sock->shared->pmask;
+    reply->state = sock->shared->state;
     set_reply_data( sock->errors, min( get_reply_max_size(), sizeof(sock->errors) ));
 
     if (req->service)
@@ -1275,7 +1390,7 @@ DECL_HANDLER(get_socket_event)
                 release_object( cevent );
             }
         }
-        sock->pmask = 0;
+        sock->shared->pmask = 0;
         sock_reselect( sock );
     }
     release_object( &sock->obj );
@@ -1291,12 +1406,12 @@ DECL_HANDLER(enable_socket_event)
         return;
 
     /* for event-based notification, windows erases stale events */
-    sock->pmask &= ~req->mask;
+    sock->shared->pmask &= ~req->mask;
 
-    sock->hmask &= ~req->mask;
-    sock->state |= req->sstate;
-    sock->state &= ~req->cstate;
-    if ( sock->type != SOCK_STREAM ) sock->state &= ~STREAM_FLAG_MASK;
+    sock->shared->hmask &= ~req->mask;
+    sock->shared->state |= req->sstate;
+    sock->shared->state &= ~req->cstate;
+    if ( sock->type != SOCK_STREAM ) sock->shared->state &= ~STREAM_FLAG_MASK;
 
     sock_reselect( sock );
 
@@ -30,6 +30,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include <unistd.h>
 #include <time.h>
 #ifdef HAVE_POLL_H
@@ -195,6 +198,7 @@ static inline void init_thread_structure( struct thread *thread )
     thread->request_fd      = NULL;
     thread->reply_fd        = NULL;
     thread->wait_fd         = NULL;
+    thread->request_shm     = NULL;
     thread->state           = RUNNING;
     thread->exit_code       = 0;
     thread->priority        = 0;
@@ -325,6 +329,7 @@ static void cleanup_thread( struct thread *thread )
     if (thread->request_fd) release_object( thread->request_fd );
     if (thread->reply_fd) release_object( thread->reply_fd );
     if (thread->wait_fd) release_object( thread->wait_fd );
+    if (thread->request_shm) munmap( thread->request_shm, REQUEST_SHM_SIZE );
     free( thread->suspend_context );
     cleanup_clipboard_thread(thread);
     destroy_thread_windows( thread );
@@ -344,6 +349,7 @@ static void cleanup_thread( struct thread *thread )
     thread->request_fd = NULL;
     thread->reply_fd = NULL;
     thread->wait_fd = NULL;
+    thread->request_shm = NULL;
     thread->context = NULL;
     thread->suspend_context = NULL;
     thread->desktop = 0;
@@ -1403,6 +1409,28 @@ DECL_HANDLER(init_thread)
     reply->server_start = server_start_time;
     reply->all_cpus     = supported_cpus & get_prefix_cpu_mask();
     reply->suspend      = (current->suspend || process->suspend);
+
+#ifdef __linux__
+    if (req->request_shm && !current->request_shm)
+    {
+        void *ptr;
+        int fd;
+
+        /* failing to setup the shared area is not fatal, the client keeps using the pipes */
+        if ((fd = create_shared_memory( REQUEST_SHM_SIZE, &ptr )) != -1)
+        {
+            if (!send_client_fd( process, fd, 0 ))
+            {
+                /* only used once the reply to this request has been sent */
+                current->request_shm = ptr;
+                reply->request_shm = 1;
+            }
+            else munmap( ptr, REQUEST_SHM_SIZE );
+            close( fd );
+        }
+        clear_error();
+    }
+#endif
     return;
 
  error:
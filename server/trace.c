@@ -1334,6 +1334,7 @@ static void dump_init_thread_request( const struct init_thread_request *req )
     fprintf( stderr, ", reply_fd=%d", req->reply_fd );
     fprintf( stderr, ", wait_fd=%d", req->wait_fd );
     dump_client_cpu( ", cpu=", &req->cpu );
+    fprintf( stderr, ", request_shm=%d", req->request_shm );
 }
 
 static void dump_init_thread_reply( const struct init_thread_reply *req )
@@ -1345,6 +1346,7 @@ static void dump_init_thread_reply( const struct init_thread_reply *req )
     fprintf( stderr, ", version=%d", req->version );
     fprintf( stderr, ", all_cpus=%08x", req->all_cpus );
     fprintf( stderr, ", suspend=%d", req->suspend );
+    fprintf( stderr, ", request_shm=%d", req->request_shm );
 }
 
 static void dump_terminate_process_request( const struct terminate_process_request *req )
@@ -1559,6 +1561,17 @@ static void dump_dup_handle_reply( const struct dup_handle_reply *req )
     fprintf( stderr, ", closed=%d", req->closed );
 }
 
+static void dump_get_handle_cache_request( const struct get_handle_cache_request *req )
+{
+}
+
+static void dump_get_handle_cache_reply( const struct get_handle_cache_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+    fprintf( stderr, ", process_type=%08x", req->process_type );
+    fprintf( stderr, ", thread_type=%08x", req->thread_type );
+}
+
 static void dump_open_process_request( const struct open_process_request *req )
 {
     fprintf( stderr, " pid=%04x", req->pid );
@@ -1718,6 +1731,27 @@ static void dump_query_mutex_reply( const struct query_mutex_reply *req )
     fprintf( stderr, ", abandoned=%d", req->abandoned );
 }
 
+static void dump_get_fast_sync_area_request( const struct get_fast_sync_area_request *req )
+{
+}
+
+static void dump_get_fast_sync_area_reply( const struct get_fast_sync_area_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+}
+
+static void dump_get_fast_sync_obj_request( const struct get_fast_sync_obj_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
+static void dump_get_fast_sync_obj_reply( const struct get_fast_sync_obj_reply *req )
+{
+    fprintf( stderr, " index=%08x", req->index );
+    fprintf( stderr, ", type=%d", req->type );
+    fprintf( stderr, ", access=%08x", req->access );
+}
+
 static void dump_create_semaphore_request( const struct create_semaphore_request *req )
 {
     fprintf( stderr, " access=%08x", req->access );
@@ -1911,6 +1945,8 @@ static void dump_create_socket_request( const struct create_socket_request *req
 static void dump_create_socket_reply( const struct create_socket_reply *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
+    fprintf( stderr, ", shared_index=%08x", req->shared_index );
+    fprintf( stderr, ", shared_serial=%08x", req->shared_serial );
 }
 
 static void dump_accept_socket_request( const struct accept_socket_request *req )
@@ -1923,6 +1959,18 @@ static void dump_accept_socket_request( const struct accept_socket_request *req
 static void dump_accept_socket_reply( const struct accept_socket_reply *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
+    fprintf( stderr, ", shared_index=%08x", req->shared_index );
+    fprintf( stderr, ", shared_serial=%08x", req->shared_serial );
+}
+
+static void dump_get_socket_shared_area_request( const struct get_socket_shared_area_request *req )
+{
+}
+
+static void dump_get_socket_shared_area_reply( const struct get_socket_shared_area_reply *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+    fprintf( stderr, ", size=%u", req->size );
 }
 
 static void dump_accept_into_socket_request( const struct accept_into_socket_request *req )
@@ -2784,6 +2832,17 @@ static void dump_get_msg_queue_request( const struct get_msg_queue_request *req
 static void dump_get_msg_queue_reply( const struct get_msg_queue_reply *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
+    fprintf( stderr, ", shared_index=%08x", req->shared_index );
+}
+
+static void dump_get_queue_shared_area_request( const struct get_queue_shared_area_request *req )
+{
+}
+
+static void dump_get_queue_shared_area_reply( const struct get_queue_shared_area_reply *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+    fprintf( stderr, ", size=%u", req->size );
 }
 
 static void dump_set_queue_fd_request( const struct set_queue_fd_request *req )
@@ -2815,6 +2874,16 @@ static void dump_get_queue_status_reply( const struct get_queue_status_reply *re
     fprintf( stderr, ", changed_bits=%08x", req->changed_bits );
 }
 
+static void dump_get_desktop_shared_request( const struct get_desktop_shared_request *req )
+{
+}
+
+static void dump_get_desktop_shared_reply( const struct get_desktop_shared_reply *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+    fprintf( stderr, ", size=%u", req->size );
+}
+
 static void dump_get_process_idle_event_request( const struct get_process_idle_event_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -4242,6 +4311,7 @@ static void dump_get_object_type_request( const struct get_object_type_request *
 static void dump_get_object_type_reply( const struct get_object_type_reply *req )
 {
     fprintf( stderr, " total=%u", req->total );
+    fprintf( stderr, ", index=%08x", req->index );
     dump_varargs_unicode_str( ", type=", cur_size );
 }
 
@@ -4412,6 +4482,11 @@ static void dump_add_completion_request( const struct add_completion_request *re
     fprintf( stderr, ", status=%08x", req->status );
 }
 
+static void dump_wake_completion_request( const struct wake_completion_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
 static void dump_remove_completion_request( const struct remove_completion_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -4639,6 +4714,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_close_handle_request,
     (dump_func)dump_set_handle_info_request,
     (dump_func)dump_dup_handle_request,
+    (dump_func)dump_get_handle_cache_request,
     (dump_func)dump_open_process_request,
     (dump_func)dump_open_thread_request,
     (dump_func)dump_select_request,
@@ -4652,6 +4728,8 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_release_mutex_request,
     (dump_func)dump_open_mutex_request,
     (dump_func)dump_query_mutex_request,
+    (dump_func)dump_get_fast_sync_area_request,
+    (dump_func)dump_get_fast_sync_obj_request,
     (dump_func)dump_create_semaphore_request,
     (dump_func)dump_release_semaphore_request,
     (dump_func)dump_query_semaphore_request,
@@ -4669,6 +4747,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_unlock_file_request,
     (dump_func)dump_create_socket_request,
     (dump_func)dump_accept_socket_request,
+    (dump_func)dump_get_socket_shared_area_request,
     (dump_func)dump_accept_into_socket_request,
     (dump_func)dump_set_socket_event_request,
     (dump_func)dump_get_socket_event_request,
@@ -4747,9 +4826,11 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_empty_atom_table_request,
     (dump_func)dump_init_atom_table_request,
     (dump_func)dump_get_msg_queue_request,
+    (dump_func)dump_get_queue_shared_area_request,
     (dump_func)dump_set_queue_fd_request,
     (dump_func)dump_set_queue_mask_request,
     (dump_func)dump_get_queue_status_request,
+    (dump_func)dump_get_desktop_shared_request,
     (dump_func)dump_get_process_idle_event_request,
     (dump_func)dump_send_message_request,
     (dump_func)dump_post_quit_message_request,
@@ -4887,6 +4968,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_completion_request,
     (dump_func)dump_open_completion_request,
     (dump_func)dump_add_completion_request,
+    (dump_func)dump_wake_completion_request,
     (dump_func)dump_remove_completion_request,
     (dump_func)dump_query_completion_request,
     (dump_func)dump_set_completion_info_request,
@@ -4939,6 +5021,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     NULL,
     (dump_func)dump_set_handle_info_reply,
     (dump_func)dump_dup_handle_reply,
+    (dump_func)dump_get_handle_cache_reply,
     (dump_func)dump_open_process_reply,
     (dump_func)dump_open_thread_reply,
     (dump_func)dump_select_reply,
@@ -4952,6 +5035,8 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_release_mutex_reply,
     (dump_func)dump_open_mutex_reply,
     (dump_func)dump_query_mutex_reply,
+    (dump_func)dump_get_fast_sync_area_reply,
+    (dump_func)dump_get_fast_sync_obj_reply,
     (dump_func)dump_create_semaphore_reply,
     (dump_func)dump_release_semaphore_reply,
     (dump_func)dump_query_semaphore_reply,
@@ -4969,6 +5054,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     NULL,
     (dump_func)dump_create_socket_reply,
     (dump_func)dump_accept_socket_reply,
+    (dump_func)dump_get_socket_shared_area_reply,
     NULL,
     NULL,
     (dump_func)dump_get_socket_event_reply,
@@ -5047,9 +5133,11 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     NULL,
     (dump_func)dump_init_atom_table_reply,
     (dump_func)dump_get_msg_queue_reply,
+    (dump_func)dump_get_queue_shared_area_reply,
     NULL,
     (dump_func)dump_set_queue_mask_reply,
     (dump_func)dump_get_queue_status_reply,
+    (dump_func)dump_get_desktop_shared_reply,
     (dump_func)dump_get_process_idle_event_reply,
     NULL,
     NULL,
@@ -5187,6 +5275,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_completion_reply,
     (dump_func)dump_open_completion_reply,
     NULL,
+    NULL,
     (dump_func)dump_remove_completion_reply,
     (dump_func)dump_query_completion_reply,
     NULL,
@@ -5239,6 +5328,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "close_handle",
     "set_handle_info",
     "dup_handle",
+    "get_handle_cache",
     "open_process",
     "open_thread",
     "select",
@@ -5252,6 +5342,8 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "release_mutex",
     "open_mutex",
     "query_mutex",
+    "get_fast_sync_area",
+    "get_fast_sync_obj",
     "create_semaphore",
     "release_semaphore",
     "query_semaphore",
@@ -5269,6 +5361,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "unlock_file",
     "create_socket",
     "accept_socket",
+    "get_socket_shared_area",
     "accept_into_socket",
     "set_socket_event",
     "get_socket_event",
@@ -5347,9 +5440,11 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "empty_atom_table",
     "init_atom_table",
     "get_msg_queue",
+    "get_queue_shared_area",
     "set_queue_fd",
     "set_queue_mask",
     "get_queue_status",
+    "get_desktop_shared",
     "get_process_idle_event",
     "send_message",
     "post_quit_message",
@@ -5487,6 +5582,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "create_completion",
     "open_completion",
     "add_completion",
+    "wake_completion",
     "remove_completion",
     "query_completion",
     "set_completion_info",
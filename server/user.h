@@ -77,6 +77,8 @@ struct desktop
     unsigned int         users;            /* processes and threads using this desktop */
     struct global_cursor cursor;           /* global cursor information */
     unsigned char        keystate[256];    /* asynchronous key state */
+    struct desktop_shared *shared;         /* state shared with the clients, NULL if not created yet */
+    int                  shared_fd;        /* fd of the shared state */
 };
 
 /* user handles functions */
@@ -120,6 +122,7 @@ extern void post_win_event( struct thread *thread, unsigned int event,
                             const WCHAR *module, data_size_t module_size,
                             user_handle_t handle );
 extern void free_hotkeys( struct desktop *desktop, user_handle_t window );
+extern void free_desktop_shared( struct desktop *desktop );
 
 /* region functions */
 